@@ -0,0 +1,39 @@
+#ifndef CACHE_PROXY_ADMIN_H
+#define CACHE_PROXY_ADMIN_H
+
+#include <stdio.h>
+
+/**
+ * @brief Сервер администрирования
+ * @details Отдельный поток принимает соединения на своем порту и по запросу GET /metrics
+ *          отвечает метриками в текстовом формате Prometheus. Соединения обслуживаются
+ *          по одному и закрываются после ответа: сервер рассчитан на редкие опросы,
+ *          а не на нагрузку.
+ */
+struct admin_server_t;
+typedef struct admin_server_t admin_server_t;
+
+/**
+ * @brief Функция, дописывающая в ответ метрики владельца сервера
+ * @details Вызывается в потоке сервера после вывода metrics_write.
+ * @param out Поток вывода
+ * @param arg Произвольный указатель, переданный в admin_server_create
+ */
+typedef void (*admin_collect_t)(FILE *out, void *arg);
+
+/**
+ * @brief Создает слушающий сокет и запускает поток сервера администрирования
+ * @param port    Порт для прослушивания
+ * @param collect Функция, дописывающая метрики владельца (может быть NULL)
+ * @param arg     Аргумент для collect
+ * @return Указатель на сервер или NULL при ошибке
+ */
+admin_server_t *admin_server_create(int port, admin_collect_t collect, void *arg);
+
+/**
+ * @brief Останавливает поток сервера администрирования и освобождает его ресурсы
+ * @param server Сервер
+ */
+void admin_server_destroy(admin_server_t *server);
+
+#endif // CACHE_PROXY_ADMIN_H
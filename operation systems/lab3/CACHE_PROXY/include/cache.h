@@ -10,17 +10,61 @@
 #define ERROR       (-1)
 #define NOT_FOUND   (-2)
 
+#define CACHE_REVALIDATING 2 // Значение created: элемент создан, ответ загружает проверка устаревшего элемента
+
+/**
+ * @brief Подписчик на изменения элемента кэша
+ * @details Используется обработчиками, которые не могут блокироваться на ready_cond
+ *          (например, событийным циклом epoll). Память под подписчика принадлежит
+ *          вызывающей стороне и должна жить до cache_entry_unsubscribe.
+ * @var notify Функция, вызываемая под entry->mutex при появлении новых данных
+ * @var arg    Аргумент для notify
+ * @var next   Следующий подписчик в списке
+ */
+struct cache_entry_subscriber_t {
+    void (*notify)(void *arg);
+    void *arg;
+    struct cache_entry_subscriber_t *next;
+};
+typedef struct cache_entry_subscriber_t cache_entry_subscriber_t;
+
 /**
  * @brief Элемент кэша, хранящий информацию об HTTP-запросе и ответе
+ * @details Время жизни элемента определяется счетчиком ссылок: кэш держит одну ссылку,
+ *          каждый обработчик, получивший элемент, - еще одну. Элемент уничтожается
+ *          при освобождении последней ссылки, поэтому удаление из кэша не мешает
+ *          клиентам, которые еще отдают его данные.
+ *          Кэш ищет элементы не по тексту запроса, а по нормализованному ключу
+ *          (метод и абсолютный URL, см. http_build_cache_key). Если ответ содержит Vary,
+ *          элемент основного ключа запоминает его, и запросы с другими значениями
+ *          перечисленных заголовков попадают в отдельный элемент-вариант.
+ *          Срок свежести задает сервер (Cache-Control, Expires); устаревший элемент
+ *          проверяется условным запросом по ETag и Last-Modified.
  */
 struct cache_entry_t {
     char *request; // текст HTTP-запроса
     size_t request_len; // длина запроса в байтах
+    char *key; // нормализованный ключ кэша (NULL у элементов, не добавленных в кэш)
+    size_t key_len; // длина ключа
+    char *vary; // значение заголовка Vary ответа (NULL если ответ не зависит от заголовков запроса, под mutex)
+    char *vary_key; // ключ варианта, которому соответствует ответ этого элемента (под mutex)
+    size_t vary_key_len; // длина ключа варианта
     message_t *response; // структура с HTTP-ответом
     atomic_int finished; // атомарный флаг, указывающий, что ответ полностью получен
     pthread_mutex_t mutex; // мьютекс
     pthread_cond_t ready_cond; // условная переменная
     atomic_int deleted; // атомарный флаг, указывающий, что элемент удален из кэша
+    atomic_int failed; // атомарный флаг, указывающий, что загрузка ответа прервана
+    int delimited; // конец ответа обозначен Content-Length или chunked, а не закрытием соединения (записывается до finished)
+    atomic_int refcount; // счетчик ссылок на элемент
+    cache_entry_subscriber_t *subscribers; // подписчики на новые данные (под mutex)
+    char *etag; // значение ETag ответа (NULL если нет, под mutex)
+    char *last_modified; // значение Last-Modified ответа (NULL если нет, под mutex)
+    long long lifetime_ms; // срок свежести из заголовков ответа (HTTP_FRESHNESS_UNKNOWN - не задан, под mutex)
+    long long stale_while_revalidate_ms; // сколько после устаревания ответ отдается с проверкой в фоне (под mutex)
+    atomic_llong fresh_until_ms; // до какого момента монотонных часов ответ свежий (LLONG_MAX - срок не задан)
+    atomic_llong stale_until_ms; // до какого момента устаревший ответ еще можно отдавать, проверяя его в фоне
+    atomic_int revalidating; // атомарный флаг, указывающий, что элемент проверяется у сервера в фоне
 };
 typedef struct cache_entry_t cache_entry_t;
 
@@ -39,24 +83,97 @@ cache_entry_t *cache_entry_create(const char *request, size_t request_len, const
  */
 void cache_entry_destroy(cache_entry_t *entry);
 
+/**
+ * @brief Захватывает дополнительную ссылку на элемент кэша
+ * @param entry Элемент кэша
+ * @return Тот же элемент (для удобства)
+ */
+cache_entry_t *cache_entry_acquire(cache_entry_t *entry);
+
+/**
+ * @brief Освобождает ссылку на элемент кэша
+ * @details При освобождении последней ссылки элемент уничтожается
+ * @param entry Элемент кэша
+ */
+void cache_entry_release(cache_entry_t *entry);
+
+/**
+ * @brief Подписывает обработчик на появление новых данных в элементе
+ * @param entry      Элемент кэша
+ * @param subscriber Подписчик (память принадлежит вызывающей стороне)
+ */
+void cache_entry_subscribe(cache_entry_t *entry, cache_entry_subscriber_t *subscriber);
+
+/**
+ * @brief Отписывает обработчик от элемента
+ * @details После возврата notify подписчика гарантированно больше не вызывается
+ * @param entry      Элемент кэша
+ * @param subscriber Подписчик
+ */
+void cache_entry_unsubscribe(cache_entry_t *entry, cache_entry_subscriber_t *subscriber);
+
+/**
+ * @brief Оповещает ожидающие потоки и подписчиков об изменении элемента
+ * @details Будит потоки на ready_cond и вызывает notify каждого подписчика
+ * @param entry Элемент кэша
+ */
+void cache_entry_notify(cache_entry_t *entry);
+
 /**
  * @brief Структура, представляющая кэш в целом
- * @details Реализация скрыта в .c файле для инкапсуляции
+ * @details Реализация скрыта в .c файле для инкапсуляции.
+ *          Кэш разбит на независимые сегменты со своими блокировками,
+ *          LRU-списками и учетом размера; сегмент выбирается по хэшу запроса.
+ *          Объем ограничен бюджетом в байтах; при его превышении вытесняются элементы
+ *          согласно выбранной политике (см. cache_policy_t).
  */
 struct cache_t;
 typedef struct cache_t cache_t;
 
+/**
+ * @brief Политика вытеснения элементов кэша
+ * @details При обеих политиках попадание не захватывает мьютекс сегмента и не переставляет
+ *          узлы: оно атомарно сдвигает срок жизни узла и увеличивает его счетчик обращений.
+ *          GDSF точнее учитывает размер элементов; приоритет узла и его место в куче
+ *          пересчитываются по накопленному счетчику отложенно, при выборе жертвы вытеснения.
+ *          S3-FIFO ограничивает счетчик S3FIFO_MAX_FREQUENCY и однократные запросы вытесняет
+ *          из малой очереди, не затрагивая часто используемые элементы.
+ */
+typedef enum {
+    CACHE_POLICY_GDSF,      // Greedy-Dual-Size-Frequency: большие и редко запрашиваемые вытесняются первыми
+    CACHE_POLICY_S3FIFO     // S3-FIFO: малая и основная FIFO-очереди со счетчиками обращений
+} cache_policy_t;
+
+/**
+ * @brief Функция, запускающая проверку устаревшего элемента у сервера
+ * @details Проверка выполняется асинхронно условным запросом. Если pending == NULL,
+ *          элемент еще отдается клиентам (stale-while-revalidate), и при изменении ответа
+ *          проверка заменяет его новым (cache_replace_entry). Иначе устаревший элемент
+ *          уже заменен в кэше элементом pending, которого ждут клиенты, и проверка
+ *          заполняет его: при 304 - копией сохраненного ответа (cache_refresh), иначе - новым ответом.
+ *          Функция захватывает собственные ссылки на stale и pending.
+ * @param arg     Аргумент, переданный в cache_set_revalidator
+ * @param stale   Устаревший элемент
+ * @param pending Элемент, заменивший устаревший в кэше (NULL - не заменен)
+ * @return SUCCESS если проверка запущена, ERROR при ошибке
+ */
+typedef int (*cache_revalidate_t)(void *arg, cache_entry_t *stale, cache_entry_t *pending);
+
 /**
  * @brief Создает новый кэш с указанными параметрами
- * @param capacity              Максимальное количество элементов
+ * @param max_size              Бюджет памяти кэша в байтах (ответы и служебные данные элементов)
+ * @param shard_count           Количество сегментов
+ * @param policy                Политика вытеснения
  * @param cache_expired_time_ms Время жизни элемента в миллисекундах
  * @return Указатель на созданный кэш или NULL при ошибке
  */
-cache_t *cache_create(int capacity, time_t cache_expired_time_ms);
+cache_t *cache_create(size_t max_size, int shard_count, cache_policy_t policy, time_t cache_expired_time_ms);
 
 /**
  * @brief Ищет элемент кэша по запросу
- * @details Если элемент найден но еще загружается, блокирует поток до готовности
+ * @details Запрос сводится к нормализованному ключу, с учетом Vary найденного элемента.
+ *          Возвращенный элемент захвачен (cache_entry_acquire), вызывающая сторона
+ *          должна освободить его через cache_entry_release
  * @param cache        Кэш для поиска
  * @param request      Текст запроса для поиска
  * @param request_len  Длина запроса
@@ -64,16 +181,111 @@ cache_t *cache_create(int capacity, time_t cache_expired_time_ms);
  */
 cache_entry_t *cache_get(cache_t *cache, const char *request, size_t request_len);
 
+/**
+ * @brief Ищет элемент кэша по запросу, а если его нет - атомарно добавляет новый
+ * @details Поиск и вставка выполняются под блокировкой одного сегмента, поэтому
+ *          для каждого ключа новый элемент создает ровно один вызывающий.
+ *          Если найденный элемент запомнил Vary и значения этих заголовков в запросе
+ *          отличаются, поиск повторяется по ключу варианта.
+ *          Созданный элемент не содержит ответа и получает request во владение;
+ *          если элемент найден, request остается у вызывающей стороны.
+ *          Возвращенный элемент захвачен, его нужно освободить через cache_entry_release
+ *          Свежий элемент и элемент в пределах stale-while-revalidate считаются найденными
+ *          (для второго в фоне запускается проверка у сервера). Элемент, устаревший сильнее,
+ *          заменяется новым: если проверку удалось запустить, created равен CACHE_REVALIDATING,
+ *          и ответ загрузит она; иначе created равен 1, как при промахе.
+ * @param cache        Кэш
+ * @param request      Текст запроса (выделенный через malloc)
+ * @param request_len  Длина запроса
+ * @param created      Указатель для сохранения признака создания (1 - создан, CACHE_REVALIDATING -
+ *                     создан и загружается проверкой, 0 - найден)
+ * @return Указатель на элемент или NULL при ошибке
+ */
+cache_entry_t *cache_get_or_add(cache_t *cache, char *request, size_t request_len, int *created);
+
 /**
  * @brief Добавляет новый элемент в кэш
+ * @details Кэш захватывает собственную ссылку на элемент
  * @param cache Кэш для добавления
  * @param entry Элемент для добавления
  * @return SUCCESS при успешном добавлении, ERROR при ошибке
  */
 int cache_add(cache_t *cache, cache_entry_t *entry);
 
+/**
+ * @brief Учитывает данные, дописанные в ответ элемента кэша
+ * @details Вызывается загрузчиком после каждой порции ответа. Размер элемента
+ *          добавляется к размеру кэша; если бюджет превышен, элементы вытесняются.
+ *          Для элементов, которых нет в кэше, ничего не делает.
+ * @param cache Кэш
+ * @param entry Элемент
+ * @param bytes Количество дописанных байт
+ */
+void cache_account(cache_t *cache, cache_entry_t *entry, size_t bytes);
+
+/**
+ * @brief Запоминает заголовок Vary ответа в элементе кэша
+ * @details Вызывается загрузчиком после получения заголовков ответа. Следующие запросы
+ *          с другими значениями заголовков из Vary получат отдельный элемент.
+ *          Ответ с "Vary: *" удаляется из кэша (его нельзя отдавать другим клиентам).
+ * @param cache        Кэш
+ * @param entry        Элемент, для которого получен ответ
+ * @param response     Заголовки ответа
+ * @param response_len Длина заголовков
+ * @return SUCCESS при успехе, ERROR при ошибке
+ */
+int cache_set_vary(cache_t *cache, cache_entry_t *entry, const char *response, size_t response_len);
+
+/**
+ * @brief Запоминает свежесть и валидаторы ответа в элементе кэша
+ * @details Вызывается загрузчиком после получения заголовков ответа, рядом с cache_set_vary.
+ *          Ответ с Cache-Control: no-store или private удаляется из кэша.
+ * @param cache        Кэш
+ * @param entry        Элемент, для которого получен ответ
+ * @param response     Заголовки ответа
+ * @param response_len Длина заголовков
+ * @return SUCCESS при успехе, ERROR при ошибке
+ */
+int cache_set_freshness(cache_t *cache, cache_entry_t *entry, const char *response, size_t response_len);
+
+/**
+ * @brief Продлевает свежесть элемента по ответу 304 Not Modified
+ * @details Срок и валидаторы берутся из ответа 304, а если он их не содержит - остаются прежними.
+ *          Если устаревший элемент уже заменен в кэше элементом pending, тот получает копию
+ *          сохраненного ответа; завершенным pending помечает вызывающая сторона.
+ * @param cache        Кэш
+ * @param stale        Проверенный элемент
+ * @param pending      Элемент, заменивший его в кэше (NULL - не заменен)
+ * @param response     Заголовки ответа 304
+ * @param response_len Длина заголовков
+ * @return SUCCESS при успехе, ERROR при ошибке
+ */
+int cache_refresh(cache_t *cache, cache_entry_t *stale, cache_entry_t *pending, const char *response, size_t response_len);
+
+/**
+ * @brief Заменяет в кэше устаревший элемент новым
+ * @details Кэш захватывает собственную ссылку на новый элемент. Если по ключу уже лежит
+ *          другой элемент (устаревший успели заменить), ничего не меняется.
+ * @param cache Кэш
+ * @param stale Устаревший элемент
+ * @param entry Новый элемент с тем же ключом
+ * @return SUCCESS при успехе, ERROR при ошибке
+ */
+int cache_replace_entry(cache_t *cache, cache_entry_t *stale, cache_entry_t *entry);
+
+/**
+ * @brief Задает функцию, проверяющую устаревшие элементы у сервера
+ * @details Вызывается до начала обслуживания запросов. Пока функция не задана,
+ *          устаревший элемент заменяется новым и загружается заново.
+ * @param cache      Кэш
+ * @param revalidate Функция проверки (NULL - не проверять)
+ * @param arg        Аргумент для функции
+ */
+void cache_set_revalidator(cache_t *cache, cache_revalidate_t revalidate, void *arg);
+
 /**
  * @brief Удаляет элемент из кэша по запросу
+ * @details Удаляется элемент основного ключа запроса, варианты вытесняются сами
  * @param cache        Кэш для удаления
  * @param request      Текст запроса для удаления
  * @param request_len  Длина запроса
@@ -81,6 +293,15 @@ int cache_add(cache_t *cache, cache_entry_t *entry);
  */
 int cache_delete(cache_t *cache, const char *request, size_t request_len);
 
+/**
+ * @brief Удаляет из кэша именно указанный элемент
+ * @details Если по тому же запросу в кэше уже лежит другой элемент, он не удаляется
+ * @param cache Кэш
+ * @param entry Элемент для удаления
+ * @return SUCCESS при успешном удалении, ERROR или NOT_FOUND при ошибке
+ */
+int cache_remove_entry(cache_t *cache, cache_entry_t *entry);
+
 /**
  * @brief Полностью уничтожает кэш, освобождая все ресурсы
  * @param cache Кэш для уничтожения
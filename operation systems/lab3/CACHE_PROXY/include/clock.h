@@ -0,0 +1,46 @@
+#ifndef CACHE_PROXY_CLOCK_H
+#define CACHE_PROXY_CLOCK_H
+
+#include <stdatomic.h>
+
+/**
+ * @brief Грубые монотонные часы процесса
+ * @details Поток часов раз в CLOCK_TICK_MS переписывает текущее время монотонных часов
+ *          в общую переменную, и читатели получают его одной атомарной загрузкой, без
+ *          обращения к часам ядра. Время отсчитывается от произвольного момента и не меняется
+ *          при переводе системных часов (NTP), поэтому годится для сроков жизни и таймаутов,
+ *          но не для вывода даты. Точность - CLOCK_TICK_MS; задержки в микросекундах
+ *          измеряются по-прежнему через metrics_now_us и trace_now_us.
+ */
+
+/**
+ * @brief Текущее время часов в миллисекундах (-1 - поток часов не работает)
+ * @note Читайте через proxy_clock_now_ms
+ */
+extern atomic_llong proxy_clock_ms;
+
+/**
+ * @brief Запускает поток часов
+ * @details Вызывается в начале main. Пока поток не запущен (или если он не запустился),
+ *          proxy_clock_now_ms читает часы ядра при каждом вызове.
+ *          Поток останавливается при выходе из процесса.
+ */
+void proxy_clock_start(void);
+
+/**
+ * @brief Читает монотонные часы ядра
+ * @return Время в миллисекундах
+ * @note Используйте proxy_clock_now_ms
+ */
+long long proxy_clock_read_ms(void);
+
+/**
+ * @brief Возвращает текущее время часов в миллисекундах
+ * @return Время в миллисекундах (точность - CLOCK_TICK_MS)
+ */
+static inline long long proxy_clock_now_ms(void) {
+    long long now = atomic_load_explicit(&proxy_clock_ms, memory_order_relaxed);
+    return now >= 0 ? now : proxy_clock_read_ms();
+}
+
+#endif // CACHE_PROXY_CLOCK_H
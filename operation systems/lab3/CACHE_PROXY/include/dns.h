@@ -0,0 +1,126 @@
+#ifndef CACHE_PROXY_DNS_H
+#define CACHE_PROXY_DNS_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <time.h>
+
+#define SUCCESS     0
+#define ERROR       (-1)
+#define DNS_PENDING 1
+
+/**
+ * @brief Асинхронный кэширующий резолвер имен хостов
+ * @details Разрешает имена в IPv4-адреса, отправляя запросы типа A по UDP серверу имен
+ *          (первый nameserver из /etc/resolv.conf или заданный явно). Ответы кэшируются
+ *          на время их TTL, отказы (NXDOMAIN, ошибки сервера, отсутствие ответа) - на время
+ *          отрицательного кэширования. Одновременные запросы одного имени ждут один и тот же
+ *          DNS-запрос. Имена из /etc/hosts и IP-адреса разрешаются без обращения к серверу.
+ *          Прием ответов и повторные отправки выполняет отдельный поток.
+ */
+struct dns_resolver_t;
+typedef struct dns_resolver_t dns_resolver_t;
+
+struct dns_query_t;
+typedef struct dns_query_t dns_query_t;
+
+/**
+ * @brief Функция, которую поток резолвера вызывает после разрешения имени
+ * @details Вызывается под мьютексом резолвера, поэтому не должна вызывать функции резолвера
+ *          и должна быстро возвращать управление (например, передать результат циклу событий).
+ */
+typedef void (*dns_callback_t)(dns_query_t *query);
+
+/**
+ * @brief Запрос на разрешение имени
+ * @details Память запроса принадлежит вызывающему и должна оставаться действительной,
+ *          пока не вызвана функция callback или dns_cancel.
+ * @var callback Функция, вызываемая после разрешения (может быть NULL)
+ * @var arg      Произвольный указатель для callback
+ * @var status   SUCCESS или ERROR
+ * @var addr     Адрес хоста (при status == SUCCESS)
+ * @var done     Разрешение завершено, status и addr заполнены
+ * @var name     Имя, которое ждет запрос (заполняет резолвер)
+ * @var next     Следующий запрос, ждущий то же имя (заполняет резолвер)
+ */
+struct dns_query_t {
+    dns_callback_t callback;
+    void *arg;
+    int status;
+    struct in_addr addr;
+    int done;
+    struct dns_name_t *name;
+    struct dns_query_t *next;
+};
+
+/**
+ * @brief Счетчики резолвера
+ * @var hits      Сколько запросов получили ответ из кэша (в том числе отрицательный)
+ * @var misses    Сколько DNS-запросов было отправлено серверу
+ * @var coalesced Сколько запросов присоединились к уже отправленному DNS-запросу
+ * @var failures  Сколько DNS-запросов завершились отказом
+ */
+struct dns_stats_t {
+    size_t hits;
+    size_t misses;
+    size_t coalesced;
+    size_t failures;
+};
+typedef struct dns_stats_t dns_stats_t;
+
+/**
+ * @brief Создает резолвер и запускает его поток
+ * @param server          Адрес сервера имен "ip[:port]" или NULL, чтобы взять его из /etc/resolv.conf
+ * @param negative_ttl_ms Сколько миллисекунд хранится отказ, для которого сервер не сообщил время
+ *                        отрицательного кэширования
+ * @return Указатель на резолвер или NULL при ошибке
+ * @note Если сервер имен не найден, резолвер разрешает только IP-адреса и имена из /etc/hosts
+ */
+dns_resolver_t *dns_resolver_create(const char *server, time_t negative_ttl_ms);
+
+/**
+ * @brief Начинает разрешение имени, не блокируя вызывающий поток
+ * @details Если ответ есть в кэше, он возвращается сразу и callback не вызывается.
+ *          Иначе запрос встает в очередь ожидания имени (DNS-запрос отправляется,
+ *          только если его еще никто не отправил), и callback вызовет поток резолвера.
+ * @param resolver Резолвер
+ * @param host     Имя хоста или IPv4-адрес
+ * @param query    Запрос (заполнены callback и arg)
+ * @return SUCCESS (адрес в query->addr), DNS_PENDING (результат придет в callback)
+ *         или ERROR (имя не разрешается)
+ */
+int dns_resolve(dns_resolver_t *resolver, const char *host, dns_query_t *query);
+
+/**
+ * @brief Отменяет ожидание запроса
+ * @details После возврата callback запроса не вызывается и не выполняется.
+ *          DNS-запрос не прерывается: его ответ попадет в кэш для других клиентов.
+ * @param resolver Резолвер
+ * @param query    Запрос, для которого dns_resolve вернула DNS_PENDING
+ */
+void dns_cancel(dns_resolver_t *resolver, dns_query_t *query);
+
+/**
+ * @brief Разрешает имя, блокируя вызывающий поток до получения ответа
+ * @param resolver Резолвер
+ * @param host     Имя хоста или IPv4-адрес
+ * @param addr     Указатель для сохранения адреса
+ * @return SUCCESS или ERROR
+ */
+int dns_resolve_wait(dns_resolver_t *resolver, const char *host, struct in_addr *addr);
+
+/**
+ * @brief Возвращает счетчики резолвера
+ * @param resolver Резолвер
+ * @param stats    Указатель для сохранения счетчиков
+ */
+void dns_get_stats(dns_resolver_t *resolver, dns_stats_t *stats);
+
+/**
+ * @brief Останавливает поток резолвера и освобождает его ресурсы
+ * @details Незавершенные запросы завершаются с ошибкой.
+ * @param resolver Резолвер
+ */
+void dns_resolver_destroy(dns_resolver_t *resolver);
+
+#endif // CACHE_PROXY_DNS_H
@@ -1,8 +1,11 @@
 #ifndef CACHE_PROXY_ENV_H
 #define CACHE_PROXY_ENV_H
 
+#include <stddef.h>
 #include <time.h>
 
+#include "proxy.h"
+
 /**
  * @brief Получает количество обработчиков клиентов из переменных окружения
  * @details Читает значение из переменной окружения CLIENT_HANDLER_COUNT
@@ -10,6 +13,13 @@
  */
 int env_get_client_handler_count();
 
+/**
+ * @brief Получает количество потоков-загрузчиков ответов из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_FETCHER_POOL_SIZE
+ * @return Количество потоков-загрузчиков (по умолчанию 4)
+ */
+int env_get_fetcher_count();
+
 /**
  * @brief Получает время жизни кэша из переменных окружения
  * @details Читает значение из переменной окружения CACHE_EXPIRED_TIME_MS
@@ -17,4 +27,110 @@ int env_get_client_handler_count();
  */
 time_t env_get_cache_expired_time_ms();
 
+/**
+ * @brief Получает количество сегментов кэша из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_CACHE_SHARDS
+ * @return Количество сегментов кэша (по умолчанию 16)
+ */
+int env_get_cache_shards();
+
+/**
+ * @brief Получает бюджет памяти кэша из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_CACHE_SIZE (в байтах)
+ * @return Бюджет памяти кэша в байтах (по умолчанию 256 МБ)
+ */
+size_t env_get_cache_size();
+
+/**
+ * @brief Получает количество простаивающих соединений с одним сервером из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_UPSTREAM_IDLE_PER_HOST
+ * @return Предел простаивающих соединений одного сервера (по умолчанию 8)
+ */
+int env_get_upstream_idle_per_host();
+
+/**
+ * @brief Получает время простоя соединения с сервером из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_UPSTREAM_IDLE_TIMEOUT_MS
+ * @return Время простоя в миллисекундах, после которого соединение закрывается (по умолчанию 30000)
+ */
+time_t env_get_upstream_idle_timeout_ms();
+
+/**
+ * @brief Получает время ожидания следующего запроса клиента из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_CLIENT_IDLE_TIMEOUT_MS
+ * @return Время простоя постоянного клиентского соединения в миллисекундах (по умолчанию 5000, 0 - не ждать)
+ */
+time_t env_get_client_idle_timeout_ms();
+
+/**
+ * @brief Получает адрес сервера имен из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_DNS_SERVER ("ip[:port]")
+ * @return Адрес сервера имен или NULL (по умолчанию берется из /etc/resolv.conf)
+ */
+const char *env_get_dns_server();
+
+/**
+ * @brief Получает время отрицательного кэширования DNS из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_DNS_NEGATIVE_TTL_MS
+ * @return Сколько миллисекунд хранится отказ в разрешении имени, если сервер имен
+ *         не сообщил это время сам (по умолчанию 5000)
+ */
+time_t env_get_dns_negative_ttl_ms();
+
+/**
+ * @brief Получает количество потоков, принимающих соединения, из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_ACCEPTORS
+ * @return Количество потоков приема соединений (по умолчанию 1)
+ */
+int env_get_acceptor_count();
+
+/**
+ * @brief Получает длину очереди подключений слушающего сокета из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_LISTEN_BACKLOG
+ * @return Длина очереди подключений (по умолчанию SOMAXCONN)
+ */
+int env_get_listen_backlog();
+
+/**
+ * @brief Получает порт администрирования из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_ADMIN_PORT
+ * @return Порт, на котором отдаются метрики (по умолчанию 0 - метрики не отдаются)
+ */
+int env_get_admin_port();
+
+/**
+ * @brief Получает частоту трассировки запросов из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_TRACE_SAMPLE
+ * @return Сколько запросов потока приходится на один трассируемый (по умолчанию 0 - трассировка выключена)
+ */
+int env_get_trace_sample();
+
+/**
+ * @brief Получает путь к файлу трассировки из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_TRACE_FILE
+ * @return Путь к файлу трасс (по умолчанию cache_proxy_trace.json)
+ */
+const char *env_get_trace_file();
+
+/**
+ * @brief Получает политику вытеснения кэша из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_CACHE_POLICY ("gdsf" или "s3fifo")
+ * @return Политика вытеснения (по умолчанию CACHE_POLICY_GDSF)
+ */
+cache_policy_t env_get_cache_policy();
+
+/**
+ * @brief Получает режим обработки соединений из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_IO_MODE ("threads", "epoll" или "io_uring")
+ * @return Режим обработки соединений (по умолчанию PROXY_IO_THREADS)
+ */
+proxy_io_mode_t env_get_io_mode();
+
+/**
+ * @brief Получает уровень логирования из переменных окружения
+ * @details Читает значение из переменной окружения CACHE_PROXY_LOG_LEVEL ("error", "info" или "debug")
+ * @return Уровень LOG_LEVEL_* (по умолчанию LOG_LEVEL_INFO)
+ */
+int env_get_log_level();
+
 #endif // CACHE_PROXY_ENV_H
@@ -0,0 +1,66 @@
+#ifndef CACHE_PROXY_EPOCH_H
+#define CACHE_PROXY_EPOCH_H
+
+#define SUCCESS     0
+#define ERROR       (-1)
+
+/**
+ * @brief Освобождение памяти по эпохам (epoch-based reclamation)
+ * @details Читатели обходят общие структуры без блокировок внутри epoch_enter/epoch_exit.
+ *          Писатель, исключивший объект из структуры, не освобождает его сразу, а передает
+ *          в epoch_retire. Глобальная эпоха продвигается, только когда все потоки внутри
+ *          epoch_enter/epoch_exit уже видели текущую эпоху, поэтому объект, отложенный
+ *          в эпоху e, освобождается не раньше эпохи e + 3: к этому моменту ни один читатель
+ *          не может хранить на него указатель. Участки чтения должны быть короткими -
+ *          пока поток внутри участка, освобождение памяти всеми потоками откладывается.
+ */
+
+/**
+ * @brief Заголовок объекта, ожидающего освобождения
+ * @details Встраивается в освобождаемую структуру, поэтому epoch_retire не выделяет память.
+ * @var next    Следующий объект в списке ожидающих
+ * @var reclaim Функция, освобождающая объект (получает указатель на заголовок)
+ */
+typedef struct epoch_entry_t {
+    struct epoch_entry_t *next;
+    void (*reclaim)(struct epoch_entry_t *entry);
+} epoch_entry_t;
+
+/**
+ * @brief Начинает участок чтения
+ * @return SUCCESS или ERROR, если не удалось зарегистрировать поток
+ *         (тогда участок не начат и epoch_exit вызывать не нужно)
+ * @details Участки могут быть вложенными. При первом вызове в потоке регистрирует
+ *          запись потока (записи завершившихся потоков используются повторно).
+ */
+int epoch_enter(void);
+
+/**
+ * @brief Завершает участок чтения
+ */
+void epoch_exit(void);
+
+/**
+ * @brief Откладывает освобождение объекта до выхода из участков чтения всех потоков,
+ *        которые могли его видеть
+ * @param entry   Заголовок объекта (объект уже должен быть исключен из общих структур)
+ * @param reclaim Функция освобождения объекта
+ * @details Попутно пытается продвинуть эпоху и освобождает объекты, срок которых прошел.
+ */
+void epoch_retire(epoch_entry_t *entry, void (*reclaim)(epoch_entry_t *entry));
+
+/**
+ * @brief Пытается продвинуть эпоху и освобождает объекты, срок которых прошел
+ * @details Вызывается периодически (сборщиком мусора кэша), чтобы отложенные объекты
+ *          освобождались и тогда, когда новых удалений нет.
+ */
+void epoch_collect(void);
+
+/**
+ * @brief Дожидается освобождения всех отложенных объектов
+ * @details Вызывается при уничтожении структуры, когда новых читателей у нее уже нет.
+ * @note Нельзя вызывать внутри участка чтения: эпоха не продвинется.
+ */
+void epoch_barrier(void);
+
+#endif // CACHE_PROXY_EPOCH_H
@@ -0,0 +1,21 @@
+#ifndef CACHE_PROXY_HASH_H
+#define CACHE_PROXY_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Вычисляет 64-битный хэш последовательности байтов
+ * @details Реализация по схеме wyhash: байты читаются словами по 8,
+ *          перемешиваются 128-битным умножением. Хорошо распределяет
+ *          близкие и переставленные строки (URL, заголовки) по всем 64 битам,
+ *          поэтому младшие биты можно использовать как индекс корзины,
+ *          а старшие - для выбора сегмента.
+ * @param data Данные
+ * @param len  Длина данных в байтах
+ * @param seed Начальное значение (разные seed дают независимые хэши)
+ * @return Хэш данных
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+
+#endif // CACHE_PROXY_HASH_H
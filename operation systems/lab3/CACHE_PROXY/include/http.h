@@ -0,0 +1,377 @@
+#ifndef CACHE_PROXY_HTTP_H
+#define CACHE_PROXY_HTTP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SUCCESS     0
+#define ERROR       (-1)
+#define PARTIAL     (-2)
+
+/**
+ * @brief Значение длины тела ответа, когда заголовок Content-Length отсутствует
+ * @details В этом случае тело ответа читается до закрытия соединения сервером.
+ */
+#define HTTP_CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+
+/**
+ * @brief Значение срока свежести, когда сервер его не указал
+ * @details Ни Cache-Control: max-age/s-maxage, ни Expires в ответе нет.
+ */
+#define HTTP_FRESHNESS_UNKNOWN (-1LL)
+
+/**
+ * @brief Ответ клиенту, запрос которого нельзя разобрать однозначно
+ * @details Отправляется перед закрытием соединения, когда http_request_length вернул ERROR.
+ */
+#define HTTP_BAD_REQUEST_RESPONSE "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+/**
+ * @brief Свежесть ответа для общего (разделяемого клиентами) кэша
+ * @var lifetime_ms               Сколько ответ остается свежим с момента получения, с учетом
+ *                                его возраста (Age, Date); HTTP_FRESHNESS_UNKNOWN - срок не указан
+ * @var stale_while_revalidate_ms Сколько после устаревания ответ можно отдавать, проверяя его
+ *                                у сервера в фоне (Cache-Control: stale-while-revalidate)
+ * @var no_store                  1 если ответ нельзя хранить в общем кэше (no-store, private)
+ */
+struct http_freshness_t {
+    long long lifetime_ms;
+    long long stale_while_revalidate_ms;
+    int no_store;
+};
+typedef struct http_freshness_t http_freshness_t;
+
+/**
+ * @brief Выбирает реализацию разборщика HTTP под текущий процессор
+ * @details Если сборка содержит вариант PicoHTTPParser с SSE4.2 и процессор его поддерживает
+ *          (проверяется через CPUID), разбор идет векторным путем, иначе - скалярным.
+ *          Вызывается один раз при запуске, до создания потоков.
+ */
+void http_init(void);
+
+/**
+ * @brief Парсит HTTP-запрос и извлекает метод и заголовок Host
+ * @param request     Строка с HTTP-запросом
+ * @param request_len Длина строки запроса
+ * @param method      Указатель для сохранения указателя на метод в request
+ * @param method_len  Указатель для сохранения длины метода
+ * @param host        Указатель для сохранения указателя на значение Host в request
+ * @param host_len    Указатель для сохранения длины значения Host
+ * @return SUCCESS при успехе, ERROR при ошибке
+ */
+int http_parse_request(const char *request, size_t request_len, const char **method, size_t *method_len, const char **host, size_t *host_len);
+
+/**
+ * @brief Парсит HTTP-ответ и извлекает статус и длину контента
+ * @param response              Строка с HTTP-ответом
+ * @param response_len          Длина строки ответа
+ * @param status                Указатель для сохранения HTTP статус-кода
+ * @param content_len           Указатель для сохранения длины тела, уже находящегося в response
+ * @param content_length_header Указатель для сохранения значения заголовка Content-Length
+ *                              (HTTP_CONTENT_LENGTH_UNKNOWN, если заголовка нет)
+ * @return SUCCESS при успехе, PARTIAL если заголовки получены не полностью, ERROR при ошибке
+ */
+int http_parse_response(const char *response, size_t response_len, int *status, size_t *content_len, size_t *content_length_header);
+
+/**
+ * @brief Определяет полную длину HTTP-запроса вместе с телом
+ * @details Используется неблокирующими обработчиками, которые накапливают
+ *          запрос по частям и должны понять, что он получен целиком.
+ * @param request     Буфер с началом HTTP-запроса
+ * @param request_len Количество байт в буфере
+ * @return Длина запроса (заголовки + тело по Content-Length или chunked), PARTIAL
+ *         если данных недостаточно, ERROR если запрос некорректен или его границы
+ *         неоднозначны (Transfer-Encoding вместе с Content-Length, разные значения
+ *         Content-Length, переполнение); в ответ клиенту отправляется
+ *         HTTP_BAD_REQUEST_RESPONSE
+ */
+ssize_t http_request_length(const char *request, size_t request_len);
+
+/**
+ * @brief Состояние разбора тела в кодировке chunked
+ */
+typedef enum {
+    HTTP_CHUNK_SIZE = 0,        // шестнадцатеричный размер куска
+    HTTP_CHUNK_EXT,             // расширения куска до конца строки размера
+    HTTP_CHUNK_DATA,            // данные куска
+    HTTP_CHUNK_DATA_END,        // CRLF после данных куска
+    HTTP_CHUNK_TRAILER,         // начало строки трейлера (пустая строка завершает тело)
+    HTTP_CHUNK_TRAILER_END,     // CR пустой строки трейлера
+    HTTP_CHUNK_TRAILER_LINE,    // остаток непустой строки трейлера
+    HTTP_CHUNK_DONE             // тело получено полностью
+} http_chunk_state_t;
+
+/**
+ * @brief Разборщик границ тела в кодировке chunked
+ * @details Нулевая структура соответствует началу тела. Данные не декодируются:
+ *          разборщик только находит конец тела, а сами байты пересылаются клиенту как есть.
+ * @var state     Текущее состояние
+ * @var remaining Сколько байт осталось в текущем куске (или накопленный размер куска)
+ * @var digits    Количество прочитанных цифр размера
+ */
+struct http_chunked_t {
+    http_chunk_state_t state;
+    size_t remaining;
+    int digits;
+};
+typedef struct http_chunked_t http_chunked_t;
+
+/**
+ * @brief Продвигает разбор тела в кодировке chunked
+ * @param chunked Состояние разбора
+ * @param data    Очередная порция тела
+ * @param len     Длина порции
+ * @return Количество байт порции до конца тела включительно, если тело завершилось,
+ *         PARTIAL если нужна следующая порция, ERROR если тело некорректно
+ */
+ssize_t http_chunked_parse(http_chunked_t *chunked, const char *data, size_t len);
+
+/**
+ * @brief Определяет, как сервер обозначает конец ответа и можно ли переиспользовать соединение
+ * @param response     Заголовки HTTP-ответа
+ * @param response_len Длина заголовков
+ * @param chunked      Указатель для сохранения признака Transfer-Encoding: chunked
+ * @param keep_alive   Указатель для сохранения признака постоянного соединения
+ *                     (HTTP/1.1 без Connection: close или HTTP/1.0 с Connection: keep-alive)
+ * @return SUCCESS при успехе, ERROR если ответ некорректен
+ */
+int http_get_framing(const char *response, size_t response_len, int *chunked, int *keep_alive);
+
+/**
+ * @brief Определяет, есть ли у ответа тело
+ * @details Ответы на HEAD и ответы со статусом 1xx, 204 и 304 тела не имеют,
+ *          даже если их заголовки описывают его длину.
+ * @param method     Метод запроса
+ * @param method_len Длина метода
+ * @param status     HTTP статус-код ответа
+ * @return 1 если тело есть, 0 если нет
+ */
+int http_response_has_body(const char *method, size_t method_len, int status);
+
+/**
+ * @brief Разборщик границ ответа сервера, принимаемого порциями
+ * @details Нулевая структура соответствует началу ответа. Конец ответа определяется так же,
+ *          как при загрузке в пуле загрузчиков: ответ без тела (HEAD, 1xx, 204, 304) завершается
+ *          заголовками, тело chunked - куском нулевого размера и трейлером, остальные - по
+ *          Content-Length или закрытием соединения. Данные не изменяются и не копируются,
+ *          кроме начала ответа до конца заголовков.
+ * @var header         Начало ответа до конца заголовков (после разбора остается до
+ *                     http_response_framing_free, чтобы по нему можно было прочитать заголовки)
+ * @var header_len     Количество байт в header
+ * @var header_parsed  Заголовки разобраны
+ * @var status         HTTP статус-код ответа
+ * @var chunked        Тело в кодировке chunked
+ * @var content_length Длина тела или HTTP_CONTENT_LENGTH_UNKNOWN (тело до закрытия соединения или chunked)
+ * @var body_received  Количество принятых байт тела
+ * @var chunks         Поиск конца тела в кодировке chunked
+ */
+struct http_response_framing_t {
+    char *header;
+    size_t header_len;
+    int header_parsed;
+    int status;
+    int chunked;
+    size_t content_length;
+    size_t body_received;
+    http_chunked_t chunks;
+};
+typedef struct http_response_framing_t http_response_framing_t;
+
+/**
+ * @brief Продвигает разбор границ ответа сервера
+ * @details Вызывающая сторона узнает о разборе заголовков по смене header_parsed
+ *          и может прочитать их из header.
+ * @param framing    Состояние разбора
+ * @param method     Метод запроса, на который получен ответ
+ * @param method_len Длина метода
+ * @param data       Очередная порция ответа
+ * @param len        Длина порции
+ * @return 1 если ответ получен полностью, 0 если нужна следующая порция, ERROR если ответ некорректен
+ */
+int http_response_framing_parse(http_response_framing_t *framing, const char *method, size_t method_len,
+                                const char *data, size_t len);
+
+/**
+ * @brief Проверяет, завершает ли закрытие соединения сервером принятый ответ
+ * @param framing Состояние разбора
+ * @return 1 если ответ полон (тело без длины читается до закрытия), 0 если ответ оборван
+ */
+int http_response_framing_eof(const http_response_framing_t *framing);
+
+/**
+ * @brief Освобождает накопленное начало ответа
+ * @details Разбор можно продолжать: после разбора заголовков буфер больше не нужен.
+ * @param framing Состояние разбора
+ */
+void http_response_framing_free(http_response_framing_t *framing);
+
+/**
+ * @brief Строит запрос к серверу
+ * @details Версия HTTP клиента сохраняется (HTTP/1.0 или HTTP/1.1), заголовки Connection, Proxy-Connection
+ *          и Keep-Alive клиента заменяются на "Connection: keep-alive" или "Connection: close",
+ *          тело копируется как есть.
+ * @param request      Текст HTTP-запроса клиента
+ * @param request_len  Длина запроса
+ * @param keep_alive   1 для постоянного соединения, 0 если сервер должен закрыть соединение после ответа
+ * @param upstream_len Указатель для сохранения длины нового запроса
+ * @return Запрос (выделен через malloc, освобождает вызывающая сторона) или NULL при ошибке
+ */
+char *http_build_upstream_request(const char *request, size_t request_len, int keep_alive, size_t *upstream_len);
+
+/**
+ * @brief Строит условный запрос к серверу для проверки сохраненного ответа
+ * @details Как http_build_upstream_request с постоянным соединением, но условные заголовки
+ *          клиента (If-None-Match, If-Modified-Since, If-Match, If-Unmodified-Since, If-Range)
+ *          заменяются на If-None-Match и If-Modified-Since по валидаторам сохраненного ответа.
+ *          Если сохраненный ответ не изменился, сервер отвечает 304 без тела.
+ * @param request           Текст HTTP-запроса клиента
+ * @param request_len       Длина запроса
+ * @param etag              Значение ETag сохраненного ответа (NULL если нет)
+ * @param last_modified     Значение Last-Modified сохраненного ответа (NULL если нет)
+ * @param upstream_len      Указатель для сохранения длины нового запроса
+ * @return Запрос (выделен через malloc, освобождает вызывающая сторона) или NULL при ошибке
+ */
+char *http_build_conditional_request(const char *request, size_t request_len, const char *etag, const char *last_modified,
+                                     size_t *upstream_len);
+
+/**
+ * @brief Определяет, хочет ли клиент отправить следующий запрос по тому же соединению
+ * @details Соединение постоянное для HTTP/1.1 без "Connection: close"
+ *          и для HTTP/1.0 с "Connection: keep-alive".
+ * @param request     Текст HTTP-запроса
+ * @param request_len Длина запроса
+ * @return 1 если соединение постоянное, 0 если нет (или запрос некорректен)
+ */
+int http_request_keep_alive(const char *request, size_t request_len);
+
+/**
+ * @brief Части URI
+ * @details Все указатели ссылаются на разобранную строку, завершающих нулей нет.
+ * @var scheme        Схема ("http"), NULL если URI без схемы
+ * @var scheme_len    Длина схемы
+ * @var authority     Хост с портом в том виде, в каком они записаны (без "user@"), NULL для origin-form
+ * @var authority_len Длина authority
+ * @var host          Имя хоста или IP-адрес (без квадратных скобок для IPv6)
+ * @var host_len      Длина хоста
+ * @var port          Порт (если не указан - 443 для https, иначе 80)
+ * @var path          Путь вместе со строкой запроса, без фрагмента ("#...")
+ * @var path_len      Длина пути (0 если путь пустой)
+ */
+struct http_uri_t {
+    const char *scheme;
+    size_t scheme_len;
+    const char *authority;
+    size_t authority_len;
+    const char *host;
+    size_t host_len;
+    int port;
+    const char *path;
+    size_t path_len;
+};
+typedef struct http_uri_t http_uri_t;
+
+/**
+ * @brief Разбирает URI без копирования и выделения памяти
+ * @details Понимает absolute-form ("http://host:port/path?query"), значение заголовка Host
+ *          или authority-form ("host:port") и origin-form ("/path?query").
+ * @param uri     Строка URI (завершающий ноль не нужен)
+ * @param uri_len Длина строки
+ * @param parsed  Указатель для сохранения частей URI
+ * @return SUCCESS при успехе, ERROR если URI некорректен
+ */
+int http_parse_uri(const char *uri, size_t uri_len, http_uri_t *parsed);
+
+/**
+ * @brief Извлекает хост и порт из строки URL или адреса сервера
+ * @param host_port     Входная строка (URL или "host:port", завершающий ноль не нужен)
+ * @param host_port_len Длина строки
+ * @param host          Буфер для сохранения имени хоста (с завершающим нулем)
+ * @param host_size     Размер буфера host
+ * @param port          Указатель на переменную для сохранения номера порта
+ * @return SUCCESS при успехе, ERROR при ошибке парсинга
+ */
+int http_get_host_port(const char *host_port, size_t host_port_len, char *host, size_t host_size, int *port);
+
+/**
+ * @brief Строит нормализованный ключ кэша для HTTP-запроса
+ * @details Ключ имеет вид "METHOD scheme://host[:port]/path?query" (с " HTTP/1.0" в конце для
+ *          запросов HTTP/1.0, которым нельзя отдавать ответ chunked): схема и хост
+ *          приводятся к нижнему регистру, порт по умолчанию и фрагмент отбрасываются,
+ *          для запроса в origin-form хост берется из заголовка Host.
+ *          Остальные заголовки в ключ не входят (см. http_build_variant_key).
+ * @param request     Текст HTTP-запроса
+ * @param request_len Длина запроса
+ * @param key_len     Указатель для сохранения длины ключа
+ * @return Ключ (выделен через malloc, освобождает вызывающая сторона) или NULL при ошибке
+ */
+char *http_build_cache_key(const char *request, size_t request_len, size_t *key_len);
+
+/**
+ * @brief Извлекает значение заголовка Vary из HTTP-ответа
+ * @param response     Заголовки HTTP-ответа
+ * @param response_len Длина заголовков
+ * @param vary         Указатель для сохранения указателя на значение в response (NULL если заголовка нет)
+ * @param vary_len     Указатель для сохранения длины значения
+ * @return SUCCESS при успехе, ERROR если ответ некорректен
+ */
+int http_get_vary(const char *response, size_t response_len, const char **vary, size_t *vary_len);
+
+/**
+ * @brief Вычисляет свежесть ответа по Cache-Control, Expires, Date и Age
+ * @details Срок берется из s-maxage, затем из max-age, затем как разность Expires и Date;
+ *          из него вычитается возраст ответа (наибольшее из Age и задержки относительно Date).
+ *          no-cache дает нулевой срок (ответ проверяется при каждом обращении),
+ *          must-revalidate и proxy-revalidate запрещают отдавать устаревший ответ.
+ * @param response     Заголовки HTTP-ответа
+ * @param response_len Длина заголовков
+ * @param freshness    Указатель для сохранения свежести
+ * @return SUCCESS при успехе, ERROR если ответ некорректен
+ */
+int http_get_freshness(const char *response, size_t response_len, http_freshness_t *freshness);
+
+/**
+ * @brief Извлекает валидаторы ответа для условных запросов
+ * @param response          Заголовки HTTP-ответа
+ * @param response_len      Длина заголовков
+ * @param etag              Указатель для сохранения указателя на значение ETag в response (NULL если нет)
+ * @param etag_len          Указатель для сохранения длины ETag
+ * @param last_modified     Указатель для сохранения указателя на значение Last-Modified (NULL если нет)
+ * @param last_modified_len Указатель для сохранения длины Last-Modified
+ * @return SUCCESS при успехе, ERROR если ответ некорректен
+ */
+int http_get_validators(const char *response, size_t response_len, const char **etag, size_t *etag_len,
+                        const char **last_modified, size_t *last_modified_len);
+
+/**
+ * @brief Строит ключ варианта ответа по заголовкам, перечисленным в Vary
+ * @details К основному ключу дописываются пары "имя:значение" для каждого заголовка
+ *          из vary в порядке перечисления (имя в нижнем регистре, пробелы по краям значения
+ *          отброшены, отсутствующий заголовок дает пустое значение).
+ * @param key         Основной ключ (см. http_build_cache_key)
+ * @param key_len     Длина основного ключа
+ * @param vary        Значение заголовка Vary (имена через запятую)
+ * @param vary_len    Длина значения Vary
+ * @param request     Текст HTTP-запроса
+ * @param request_len Длина запроса
+ * @param variant_len Указатель для сохранения длины ключа варианта
+ * @return Ключ варианта (выделен через malloc) или NULL при ошибке
+ */
+char *http_build_variant_key(const char *key, size_t key_len, const char *vary, size_t vary_len,
+                             const char *request, size_t request_len, size_t *variant_len);
+
+/**
+ * @brief Проверяет, является ли HTTP-запрос кэшируемым
+ * @param method     Указатель на строку с HTTP-методом
+ * @param method_len Длина строки метода
+ * @return 1 если метод кэшируемый, 0 если нет
+ */
+int http_check_request(const char *method, size_t method_len);
+
+/**
+ * @brief Проверяет, является ли HTTP-ответ кэшируемым на основе статус-кода
+ * @param status HTTP статус-код ответа
+ * @return 1 если ответ можно кэшировать, 0 если нет
+ */
+int http_check_response(int status);
+
+#endif // CACHE_PROXY_HTTP_H
@@ -1,12 +1,62 @@
 #ifndef CACHE_PROXY_LOG_H
 #define CACHE_PROXY_LOG_H
 
+#define LOG_LEVEL_ERROR 0 // Ошибки
+#define LOG_LEVEL_INFO  1 // Ход работы прокси (запросы, попадания в кэш, запуск и остановка)
+#define LOG_LEVEL_DEBUG 2 // Подробности на каждую операцию (отправки, задачи пула)
+
 /**
- * @brief Выводит лог-сообщение с форматированием в стандартный поток ошибок (stderr)
- *      с добавлением временной метки и префикса.
+ * @brief Наибольший уровень, сообщения которого попадают в сборку
+ * @details Вызовы с более подробным уровнем удаляются компилятором вместе с вычислением аргументов.
+ *          Задается при сборке (cmake -DCACHE_PROXY_LOG_LEVEL=0).
+ */
+#ifndef CACHE_PROXY_LOG_LEVEL
+#define CACHE_PROXY_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * @brief Наибольший уровень, сообщения которого выводятся (задается при запуске)
+ * @note Читается без синхронизации: меняется только через proxy_log_set_level до создания потоков
+ */
+extern int proxy_log_level;
+
+/**
+ * @brief Выводит сообщение с уровнем level, если уровень включен при сборке и при запуске
+ * @details Выключенный вызов стоит одного сравнения, аргументы при этом не вычисляются.
+ */
+#define proxy_log_at(level, ...) \
+    do { \
+        if ((level) <= CACHE_PROXY_LOG_LEVEL && (level) <= proxy_log_level) proxy_log_write(__VA_ARGS__); \
+    } while (0)
+
+#define proxy_log_error(...) proxy_log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define proxy_log(...)       proxy_log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define proxy_log_debug(...) proxy_log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/**
+ * @brief Форматирует лог-сообщение и передает его потоку записи логов
+ * @details Строка с временной меткой и именем потока формируется в вызывающем потоке
+ *          и кладется в его собственный кольцевой буфер без блокировок. Поток записи
+ *          выводит накопленные строки всех потоков в stdout пачками через writev.
+ *          Порядок строк одного потока сохраняется, строки разных потоков могут
+ *          перемешиваться в пределах интервала сброса.
  * @param format Строка формата в стиле printf
  * @param ... Аргументы для подстановки в строку формата
+ * @note Используйте макросы proxy_log_error, proxy_log и proxy_log_debug
+ */
+void proxy_log_write(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Устанавливает наибольший выводимый уровень сообщений
+ * @param level LOG_LEVEL_ERROR, LOG_LEVEL_INFO или LOG_LEVEL_DEBUG
+ */
+void proxy_log_set_level(int level);
+
+/**
+ * @brief Устанавливает имя текущего потока, которое выводится в логах
+ * @details Скрывает различия сигнатур pthread_setname_np между macOS и Linux.
+ * @param name Имя потока (не длиннее 15 символов)
  */
-void proxy_log(const char* format, ...);
+void proxy_set_thread_name(const char *name);
 
 #endif // CACHE_PROXY_LOG_H
@@ -1,38 +1,124 @@
 #ifndef CACHE_PROXY_MESSAGE_H
 #define CACHE_PROXY_MESSAGE_H
 
+#include <stdatomic.h>
 #include <stddef.h>
 
 #define SUCCESS 0
 #define ERROR   (-1)
 
 /**
- * @brief Элемент связанного списка, представляющий часть HTTP-сообщения
- * @details Используется для хранения фрагментов HTTP-ответов, которые
- *          могут приходить частями при потоковой передаче.
- * @var part      Указатель на данные части сообщения
- * @var part_len  Длина части в байтах
- * @var next      Указатель на следующую часть сообщения (NULL если это последняя часть)
+ * @brief Кусок буфера HTTP-сообщения
+ * @details Куски связаны в список и заполняются по порядку: все куски,
+ *          кроме последнего, заполнены целиком. Записанные данные не перемещаются,
+ *          поэтому читатели могут отправлять их прямо из куска.
+ * @var next     Указатель на следующий кусок (NULL если это последний)
+ * @var capacity Размер области данных в байтах
+ * @var data     Данные
+ */
+struct message_chunk_t {
+    struct message_chunk_t *next;
+    size_t capacity;
+    char data[];
+};
+typedef struct message_chunk_t message_chunk_t;
+
+/**
+ * @brief Буфер HTTP-сообщения, дописываемый одним писателем и читаемый многими читателями
+ * @details Используется для хранения HTTP-ответов, которые приходят частями
+ *          при потоковой передаче. Данные копируются в большие куски (размер растет
+ *          от MESSAGE_CHUNK_MIN до MESSAGE_CHUNK_MAX), добавление идет сразу в хвост.
+ *          Писатель публикует новый размер через length, поэтому читатели узнают
+ *          о новых данных без блокировки и без прохода по списку с головы.
+ * @var head     Первый кусок
+ * @var tail     Последний кусок (только для писателя)
+ * @var tail_len Количество заполненных байт последнего куска (только для писателя)
+ * @var length   Опубликованный размер сообщения в байтах
  */
 struct message_t {
-    char *part;
-    size_t part_len;
-    struct message_t *next;
+    message_chunk_t *head;
+    message_chunk_t *tail;
+    size_t tail_len;
+    atomic_size_t length;
 };
 typedef struct message_t message_t;
 
 /**
- * @brief Добавляет новую часть в конец связанного списка сообщений и добавляет его в конец
- * @param message Указатель на указатель на начало списка сообщений
- * @param part    Данные для добавления (копируются внутрь структуры)
+ * @brief Позиция читателя в сообщении
+ * @details Нулевая структура указывает на начало сообщения.
+ * @var chunk       Текущий кусок (NULL пока чтение не началось)
+ * @var chunk_start Смещение текущего куска от начала сообщения
+ * @var offset      Смещение внутри текущего куска
+ */
+struct message_reader_t {
+    message_chunk_t *chunk;
+    size_t chunk_start;
+    size_t offset;
+};
+typedef struct message_reader_t message_reader_t;
+
+/**
+ * @brief Дописывает данные в конец сообщения
+ * @details Если *message == NULL, создает сообщение. Данные копируются внутрь,
+ *          новый размер публикуется после копирования. Добавление выполняется
+ *          за время, пропорциональное длине данных, независимо от размера сообщения.
+ * @param message  Указатель на указатель на сообщение
+ * @param part     Данные для добавления (копируются внутрь структуры)
  * @param part_len Длина данных в байтах
  * @return SUCCESS при успешном добавлении, ERROR при ошибке выделения памяти
+ * @note Писатель у сообщения должен быть один
+ */
+int message_add_part(message_t **message, const char *part, size_t part_len);
+
+/**
+ * @brief Возвращает свободное место в конце сообщения для записи без промежуточного буфера
+ * @details Если *message == NULL, создает сообщение; если последний кусок заполнен,
+ *          выделяет следующий. Данные, записанные в это место, становятся видны
+ *          читателям только после message_commit. Позволяет принимать данные из сокета
+ *          прямо в буфер сообщения.
+ * @param message Указатель на указатель на сообщение
+ * @param hint    Сколько байт писатель собирается записать (влияет на размер нового куска)
+ * @param len     Указатель для сохранения размера свободного места
+ * @return Указатель на свободное место или NULL при ошибке выделения памяти
+ * @note Писатель у сообщения должен быть один
+ */
+char *message_reserve(message_t **message, size_t hint, size_t *len);
+
+/**
+ * @brief Публикует данные, записанные в место, полученное от message_reserve
+ * @param message Сообщение
+ * @param len     Количество записанных байт (не больше размера свободного места)
+ */
+void message_commit(message_t *message, size_t len);
+
+/**
+ * @brief Возвращает опубликованный размер сообщения
+ * @param message Сообщение (может быть NULL)
+ * @return Количество байт, доступных читателям
+ */
+size_t message_length(const message_t *message);
+
+/**
+ * @brief Возвращает непрерывный участок данных, доступных читателю
+ * @details Позиция читателя не сдвигается, для этого вызывается message_consume.
+ *          Указатель остается действительным, пока существует сообщение.
+ * @param message Сообщение (может быть NULL)
+ * @param reader  Позиция читателя
+ * @param len     Указатель для сохранения длины участка (0 если новых данных нет)
+ * @return Указатель на данные или NULL если новых данных нет
+ */
+const char *message_peek(const message_t *message, message_reader_t *reader, size_t *len);
+
+/**
+ * @brief Сдвигает позицию читателя
+ * @param reader Позиция читателя
+ * @param len    Количество прочитанных байт (не больше длины, полученной от message_peek)
  */
-int message_add_part(message_t **message, char *part, size_t part_len);
+void message_consume(message_reader_t *reader, size_t len);
 
 /**
- * @brief Полностью уничтожает связанный список сообщений
- * @param message Указатель на указатель на начало списка сообщений.
+ * @brief Полностью уничтожает сообщение
+ * @param message Указатель на указатель на сообщение.
  *                После вызова *message будет установлен в NULL
  */
 void message_destroy(message_t **message);
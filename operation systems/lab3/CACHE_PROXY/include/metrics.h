@@ -0,0 +1,135 @@
+#ifndef CACHE_PROXY_METRICS_H
+#define CACHE_PROXY_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Счетчики прокси
+ * @details Каждый поток увеличивает собственную копию счетчиков (в своих строках кэша,
+ *          без атомарных read-modify-write), копии суммируются только при выводе метрик.
+ */
+typedef enum {
+    METRIC_REQUESTS,            // запросы клиентов
+    METRIC_CACHE_HITS,          // ответ уже был в кэше целиком
+    METRIC_CACHE_MISSES,        // запрос запустил загрузку с сервера
+    METRIC_CACHE_COALESCED,     // запрос присоединился к уже идущей загрузке
+    METRIC_CACHE_BYPASS,        // некэшируемый запрос
+    METRIC_BYTES_FROM_CACHE,    // байты, отданные клиентам из кэша (hit и coalesced)
+    METRIC_BYTES_FROM_ORIGIN,   // байты, отданные клиентам, запустившим загрузку
+    METRIC_CACHE_EVICTIONS,     // элементы, вытесненные по бюджету памяти
+    METRIC_CACHE_EXPIRATIONS,   // элементы, удаленные сборщиком мусора по времени жизни
+    METRIC_CACHE_REFRESHED,     // проверки устаревших элементов, продлившие их свежесть (304)
+    METRIC_CACHE_REPLACED,      // проверки устаревших элементов, получившие новый ответ
+    METRIC_POOL_TASKS,          // задачи, выполненные пулами потоков
+    METRIC_COUNTER_COUNT
+} metrics_counter_t;
+
+/**
+ * @brief Гистограммы задержек (значения в микросекундах)
+ */
+typedef enum {
+    METRIC_TIME_TO_FIRST_BYTE,  // от получения запроса до отправки первого байта ответа
+    METRIC_REQUEST_DURATION,    // от получения запроса до отправки всего ответа
+    METRIC_POOL_TASK_WAIT,      // время задачи в очереди пула потоков
+    METRIC_HISTOGRAM_COUNT
+} metrics_histogram_t;
+
+/**
+ * @brief Результат поиска запроса в кэше
+ */
+typedef enum {
+    METRICS_LOOKUP_HIT,
+    METRICS_LOOKUP_MISS,
+    METRICS_LOOKUP_COALESCED,
+    METRICS_LOOKUP_BYPASS
+} metrics_lookup_t;
+
+/**
+ * @brief Состояние измерения одного запроса
+ * @var start_us   Время получения запроса (мкс, монотонные часы)
+ * @var first_byte Первый байт ответа уже отправлен
+ * @var from_cache Ответ отдается из кэша (hit или coalesced)
+ */
+struct metrics_request_t {
+    uint64_t start_us;
+    int first_byte;
+    int from_cache;
+};
+typedef struct metrics_request_t metrics_request_t;
+
+/**
+ * @brief Возвращает текущее время монотонных часов в микросекундах
+ * @return Время в микросекундах
+ */
+uint64_t metrics_now_us(void);
+
+/**
+ * @brief Увеличивает счетчик текущего потока
+ * @param counter Счетчик
+ * @param value   Приращение
+ */
+void metrics_add(metrics_counter_t counter, uint64_t value);
+
+/**
+ * @brief Добавляет значение в гистограмму текущего потока
+ * @param histogram Гистограмма
+ * @param value_us  Значение в микросекундах
+ */
+void metrics_record(metrics_histogram_t histogram, uint64_t value_us);
+
+/**
+ * @brief Начинает измерение запроса и учитывает его в METRIC_REQUESTS
+ * @param request Состояние измерения
+ */
+void metrics_request_start(metrics_request_t *request);
+
+/**
+ * @brief Учитывает результат поиска запроса в кэше
+ * @param request Состояние измерения
+ * @param lookup  Результат поиска
+ */
+void metrics_request_lookup(metrics_request_t *request, metrics_lookup_t lookup);
+
+/**
+ * @brief Учитывает отправленные клиенту байты ответа
+ * @details При первом вызове записывает время до первого байта.
+ * @param request Состояние измерения
+ * @param bytes   Количество отправленных байт
+ */
+void metrics_request_sent(metrics_request_t *request, size_t bytes);
+
+/**
+ * @brief Завершает измерение запроса, записывая его длительность
+ * @param request Состояние измерения
+ */
+void metrics_request_finish(metrics_request_t *request);
+
+/**
+ * @brief Выводит счетчики и гистограммы в текстовом формате Prometheus
+ * @details Для гистограмм выводятся корзины по степеням двойки (от 64 мкс до 64 с)
+ *          и квантили 0.5, 0.9, 0.99 и 0.999 отдельным семейством *_quantile_seconds.
+ * @param out Поток вывода
+ */
+void metrics_write(FILE *out);
+
+/**
+ * @brief Выводит строки HELP и TYPE семейства метрик
+ * @param out  Поток вывода
+ * @param name Имя семейства
+ * @param type Тип ("counter" или "gauge")
+ * @param help Описание
+ */
+void metrics_write_header(FILE *out, const char *name, const char *type, const char *help);
+
+/**
+ * @brief Выводит одно значение метрики
+ * @param out    Поток вывода
+ * @param name   Имя семейства
+ * @param labels Метки без фигурных скобок (например, "pool=\"fetchers\"") или NULL
+ * @param value  Значение
+ */
+void metrics_write_sample(FILE *out, const char *name, const char *labels, double value);
+
+#endif // CACHE_PROXY_METRICS_H
@@ -3,27 +3,76 @@
 
 #include <time.h>
 
+#include "cache.h"
+
 /**
  * @brief Структура, представляющая HTTP-прокси с кэшированием
  */
 struct proxy_t;
 typedef struct proxy_t proxy_t;
 
+/**
+ * @brief Режим обработки клиентских соединений
+ */
+typedef enum {
+    PROXY_IO_THREADS,   // каждое соединение целиком обрабатывается потоком из пула
+    PROXY_IO_EPOLL,     // неблокирующие соединения в событийных циклах epoll (только Linux)
+    PROXY_IO_URING      // асинхронные операции через кольца io_uring (только Linux)
+} proxy_io_mode_t;
+
+/**
+ * @brief Параметры прокси
+ * @var handler_count            Количество потоков-обработчиков (или циклов epoll/io_uring)
+ * @var fetcher_count            Количество потоков-загрузчиков ответов (в режимах epoll и io_uring - только проверки устаревших элементов)
+ * @var cache_expired_time_ms    Время жизни элементов кэша в миллисекундах
+ * @var cache_shards             Количество независимых сегментов кэша
+ * @var cache_size               Бюджет памяти кэша в байтах
+ * @var cache_policy             Политика вытеснения элементов кэша
+ * @var upstream_idle_per_host   Сколько простаивающих соединений с одним сервером хранит пул загрузчиков
+ * @var upstream_idle_timeout_ms Через сколько миллисекунд простоя соединение с сервером закрывается
+ * @var client_idle_timeout_ms   Сколько миллисекунд постоянное клиентское соединение ждет следующего запроса (режим PROXY_IO_THREADS)
+ * @var dns_server               Адрес сервера имен "ip[:port]" (NULL - из /etc/resolv.conf)
+ * @var dns_negative_ttl_ms      Сколько миллисекунд хранится отказ в разрешении имени
+ * @var acceptor_count           Количество потоков, принимающих соединения, каждый со своим сокетом SO_REUSEPORT
+ *                               (режимы PROXY_IO_THREADS и PROXY_IO_EPOLL)
+ * @var listen_backlog           Длина очереди подключений слушающего сокета
+ * @var admin_port               Порт, на котором отдаются метрики в формате Prometheus (0 - выключен)
+ * @var io_mode                  Режим обработки соединений
+ */
+struct proxy_config_t {
+    int handler_count;
+    int fetcher_count;
+    time_t cache_expired_time_ms;
+    int cache_shards;
+    size_t cache_size;
+    cache_policy_t cache_policy;
+    int upstream_idle_per_host;
+    time_t upstream_idle_timeout_ms;
+    time_t client_idle_timeout_ms;
+    const char *dns_server;
+    time_t dns_negative_ttl_ms;
+    int acceptor_count;
+    int listen_backlog;
+    int admin_port;
+    proxy_io_mode_t io_mode;
+};
+typedef struct proxy_config_t proxy_config_t;
+
 /**
  * @brief Создает новый экземпляр HTTP-прокси с кэшированием
  * @details Выделяет память под структуру прокси, инициализирует кэш
- *          с заданным временем жизни и создает пул потоков-обработчиков.
- * @param handler_count Количество потоков-обработчиков в пуле
- * @param cache_expired_time_ms Время жизни элементов кэша в миллисекундах
+ *          с заданным временем жизни и создает обработчики соединений
+ *          (пул потоков или событийные циклы, в зависимости от io_mode).
+ * @param config Параметры прокси
  * @return Указатель на созданный прокси или NULL при ошибке
  */
-proxy_t *proxy_create(int handler_count, time_t cache_expired_time_ms);
+proxy_t *proxy_create(const proxy_config_t *config);
 
 /**
  * @brief Запускает работу прокси на указанном порту
  * @details Создает слушающий сокет, настраивает обработку сигналов
  *          и начинает принимать входящие подключения. Каждое подключение
- *          обрабатывается в отдельном потоке из пула обработчиков.
+ *          обрабатывается потоком из пула или передается событийному циклу.
  *          Функция работает в бесконечном цикле до получения сигнала остановки.
  * @param proxy Указатель на инициализированный прокси
  * @param port  Порт для прослушивания входящих подключений
@@ -0,0 +1,43 @@
+#ifndef CACHE_PROXY_REACTOR_H
+#define CACHE_PROXY_REACTOR_H
+
+#include "cache.h"
+#include "dns.h"
+
+/**
+ * @brief Событийный обработчик соединений на основе epoll (edge-triggered)
+ * @details Состоит из нескольких потоков-циклов, у каждого свой epoll и eventfd.
+ *          Каждое соединение - неблокирующий конечный автомат:
+ *          чтение запроса -> поиск в кэше -> разрешение имени -> подключение к серверу -> отдача данных.
+ *          Благодаря этому несколько потоков обслуживают десятки тысяч соединений,
+ *          а медленный клиент не занимает поток целиком.
+ */
+struct reactor_t;
+typedef struct reactor_t reactor_t;
+
+/**
+ * @brief Создает событийный обработчик и запускает его циклы
+ * @param loop_count Количество потоков-циклов (если <= 0, используется 1)
+ * @param cache      Кэш HTTP-ответов, общий для всех циклов
+ * @param resolver   Резолвер имен серверов, общий для всех циклов
+ * @return Указатель на созданный обработчик или NULL при ошибке
+ */
+reactor_t *reactor_create(int loop_count, cache_t *cache, dns_resolver_t *resolver);
+
+/**
+ * @brief Передает принятое клиентское соединение одному из циклов
+ * @details Циклы выбираются по кругу. Сокет должен быть неблокирующим,
+ *          после вызова им владеет обработчик.
+ * @param reactor       Событийный обработчик
+ * @param client_socket Дескриптор клиентского сокета
+ */
+void reactor_submit(reactor_t *reactor, int client_socket);
+
+/**
+ * @brief Останавливает циклы, закрывает все соединения и освобождает ресурсы
+ * @param reactor Событийный обработчик
+ * @note Функция блокирует вызывающий поток до завершения всех циклов
+ */
+void reactor_destroy(reactor_t *reactor);
+
+#endif // CACHE_PROXY_REACTOR_H
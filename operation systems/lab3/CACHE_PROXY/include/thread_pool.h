@@ -3,6 +3,9 @@
 
 /**
  * @brief Структура, представляющая пул потоков
+ * @details Пул с кражей задач: у каждого исполнителя свой дек Чейза-Леви, задачи от сторонних
+ *          потоков распределяются по входящим очередям исполнителей, простаивающий исполнитель
+ *          крадет работу у соседей и засыпает (на futex в Linux), только если задач нет нигде.
  */
 struct thread_pool_t;
 typedef struct thread_pool_t thread_pool_t;
@@ -15,34 +18,46 @@ typedef void (*routine_t)(void *arg);
 
 /**
  * @brief Создает новый пул потоков
- * @details Создает заданное количество потоков-исполнителей и инициализирует
- *          очередь задач с указанной емкостью.
- * @param executor_count Количество потоков-исполнителей в пуле
- * @param task_queue_capacity Максимальное количество задач в очереди
+ * @details Создает заданное количество потоков-исполнителей, у каждого из которых
+ *          свой дек задач указанной емкости (округляется до степени двойки).
+ *          Задачи, не поместившиеся в дек, ждут в общей очереди, поэтому
+ *          количество задач в пуле не ограничено.
+ * @param executor_count Количество потоков-исполнителей в пуле (больше 0)
+ * @param task_queue_capacity Емкость дека одного исполнителя
  * @return Указатель на созданный пул потоков или NULL при ошибке
- * @note Если executor_count <= 0, используется значение по умолчанию
- * @note Если task_queue_capacity <= 0, используется неограниченная очередь
+ * @note Если task_queue_capacity <= 0, используется емкость по умолчанию
  */
 thread_pool_t *thread_pool_create(int executor_count, int task_queue_capacity);
 
 /**
  * @brief Добавляет новую задачу в пул потоков для выполнения
- * @details Помещает задачу в очередь. Если есть свободные потоки,
- *          задача будет немедленно взята на выполнение.
+ * @details Не блокируется. Задача, поставленная исполнителем этого же пула,
+ *          попадает в его дек, остальные - во входящие очереди исполнителей по кругу.
+ *          Если есть спящие потоки, один из них будится.
  * @param pool Пул потоков для выполнения задачи
  * @param routine Функция для выполнения
  * @param arg Аргумент для передачи в функцию routine
+ * @return 0 если задача поставлена в очередь, -1 если пул уже остановлен или не хватило памяти
+ *         (тогда освободить arg должна вызывающая сторона)
  */
-void thread_pool_execute(thread_pool_t *pool, routine_t routine, void *arg);
+int thread_pool_execute(thread_pool_t *pool, routine_t routine, void *arg);
+
+/**
+ * @brief Возвращает количество задач, ожидающих свободного потока
+ * @details Позволяет долгой задаче уступить поток, если его ждут другие.
+ * @param pool Пул потоков
+ * @return Длина очереди задач
+ */
+int thread_pool_pending(thread_pool_t *pool);
 
 /**
  * @brief Останавливает пул потоков
- * @details Завершает прием новых задач, дожидается завершения всех
- *          текущих задач в очереди, затем останавливает потоки-исполнители
- *          и освобождает все ресурсы.
+ * @details Завершает прием новых задач, дожидается завершения выполняемых
+ *          задач, затем останавливает потоки-исполнители и освобождает все ресурсы.
+ *          Задачи, которые не успели начаться, не выполняются.
  * @param pool Пул потоков для остановки
  * @note Функция блокирует вызывающий поток до полной остановки пула
- * @note Последующие вызовы thread_pool_execute будут игнорироваться
+ * @note Последующие вызовы thread_pool_execute будут возвращать -1
  */
 void thread_pool_shutdown(thread_pool_t *pool);
 
@@ -0,0 +1,97 @@
+#ifndef CACHE_PROXY_TRACE_H
+#define CACHE_PROXY_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * @brief Трассировка этапов обработки запросов
+ * @details Каждый N-й запрос потока (N задается при запуске) получает идентификатор,
+ *          и пока он обрабатывается, этапы (прием, разбор, поиск в кэше, разрешение имени,
+ *          подключение, ожидание данных, отправка) записываются в заранее выделенный буфер
+ *          потока. При остановке прокси буферы всех потоков выводятся в файл в формате
+ *          Chrome trace event (открывается в chrome://tracing или Perfetto).
+ *          Запрос, который отдается из загрузки другого потока, передает ей свой
+ *          идентификатор, и этапы загрузки попадают в ту же трассу.
+ */
+
+/**
+ * @brief Сколько запросов приходится на один трассируемый (0 - трассировка выключена)
+ * @note Читается без синхронизации: меняется только через trace_init до создания потоков
+ */
+extern int trace_sample_rate;
+
+/**
+ * @brief Идентификатор запроса, который сейчас трассирует поток (0 - не трассируется)
+ */
+extern _Thread_local uint64_t trace_current;
+
+/**
+ * @brief Решает, трассировать ли запрос, который начинает обрабатывать поток
+ * @details Выключенная трассировка стоит одного сравнения.
+ */
+#define trace_request_begin() \
+    do { \
+        if (trace_sample_rate > 0) trace_sample_request(); \
+    } while (0)
+
+/**
+ * @brief Продолжает в текущем потоке трассировку запроса id (0 - не трассировать)
+ */
+#define trace_request_resume(id) (trace_current = (id))
+
+/**
+ * @brief Завершает трассировку запроса в текущем потоке
+ */
+#define trace_request_end() (trace_current = 0)
+
+/**
+ * @brief Начинает этап трассируемого запроса
+ * @return Время начала этапа или 0, если запрос не трассируется
+ */
+#define trace_span_begin() (trace_current != 0 ? trace_now_us() : 0)
+
+/**
+ * @brief Записывает этап name, начатый в момент start (см. trace_span_begin)
+ * @details name должен быть строковым литералом: сохраняется только указатель.
+ */
+#define trace_span_end(name, start) \
+    do { \
+        if ((start) != 0) trace_record((name), (start)); \
+    } while (0)
+
+/**
+ * @brief Включает трассировку
+ * @param sample_rate Трассировать каждый sample_rate-й запрос потока (0 - выключить)
+ * @param path        Файл, в который trace_dump выведет трассы
+ */
+void trace_init(int sample_rate, const char *path);
+
+/**
+ * @brief Выбирает, трассировать ли очередной запрос потока, и заполняет trace_current
+ * @note Используйте макрос trace_request_begin
+ */
+void trace_sample_request(void);
+
+/**
+ * @brief Возвращает текущее время монотонных часов в микросекундах
+ * @return Время в микросекундах
+ */
+uint64_t trace_now_us(void);
+
+/**
+ * @brief Записывает этап запроса trace_current в буфер текущего потока
+ * @details Если буфер заполнен, этап отбрасывается и учитывается в счетчике потерь.
+ * @param name  Имя этапа (строковый литерал)
+ * @param start Время начала этапа (trace_now_us)
+ * @note Используйте макрос trace_span_end
+ */
+void trace_record(const char *name, uint64_t start);
+
+/**
+ * @brief Выводит записанные трассы в файл, заданный в trace_init, и освобождает буферы
+ * @details Вызывается после остановки всех потоков, которые пишут трассы.
+ *          Ничего не делает, если трассировка выключена.
+ */
+void trace_dump(void);
+
+#endif // CACHE_PROXY_TRACE_H
@@ -0,0 +1,74 @@
+#ifndef CACHE_PROXY_UPSTREAM_H
+#define CACHE_PROXY_UPSTREAM_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define SUCCESS 0
+#define ERROR   (-1)
+
+/**
+ * @brief Пул простаивающих постоянных соединений с серверами
+ * @details Соединения группируются по паре (хост, порт). Загрузчик, закончивший
+ *          чтение ответа, возвращает соединение в пул, следующий промах кэша к тому же
+ *          серверу забирает его вместо нового подключения. Соединения, простаивающие
+ *          дольше заданного времени, закрывает фоновый поток.
+ */
+struct upstream_pool_t;
+typedef struct upstream_pool_t upstream_pool_t;
+
+/**
+ * @brief Счетчики пула соединений
+ * @var hits   Сколько раз запрос получил соединение из пула
+ * @var misses Сколько раз подходящего соединения не нашлось
+ * @var idle   Сколько соединений простаивает в пуле сейчас
+ */
+struct upstream_stats_t {
+    size_t hits;
+    size_t misses;
+    size_t idle;
+};
+typedef struct upstream_stats_t upstream_stats_t;
+
+/**
+ * @brief Создает пул соединений и запускает поток, закрывающий простаивающие соединения
+ * @param max_idle_per_host Сколько простаивающих соединений хранится для одного сервера
+ * @param idle_timeout_ms   Через сколько миллисекунд простоя соединение закрывается
+ * @return Указатель на пул или NULL при ошибке
+ */
+upstream_pool_t *upstream_pool_create(int max_idle_per_host, time_t idle_timeout_ms);
+
+/**
+ * @brief Забирает из пула живое соединение с сервером
+ * @details Соединения, закрытые сервером за время простоя, отбрасываются.
+ * @param pool Пул соединений
+ * @param host Имя хоста сервера
+ * @param port Порт сервера
+ * @return Дескриптор сокета или ERROR, если подходящего соединения нет
+ */
+int upstream_take(upstream_pool_t *pool, const char *host, int port);
+
+/**
+ * @brief Возвращает соединение в пул после полностью прочитанного ответа
+ * @details Если для сервера уже хранится max_idle_per_host соединений, сокет закрывается.
+ * @param pool   Пул соединений
+ * @param host   Имя хоста сервера
+ * @param port   Порт сервера
+ * @param socket Дескриптор сокета (после вызова им владеет пул)
+ */
+void upstream_put(upstream_pool_t *pool, const char *host, int port, int socket);
+
+/**
+ * @brief Возвращает счетчики пула
+ * @param pool  Пул соединений
+ * @param stats Указатель для сохранения счетчиков
+ */
+void upstream_get_stats(upstream_pool_t *pool, upstream_stats_t *stats);
+
+/**
+ * @brief Останавливает фоновый поток, закрывает все соединения и уничтожает пул
+ * @param pool Пул соединений
+ */
+void upstream_pool_destroy(upstream_pool_t *pool);
+
+#endif // CACHE_PROXY_UPSTREAM_H
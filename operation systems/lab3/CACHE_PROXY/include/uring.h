@@ -0,0 +1,45 @@
+#ifndef CACHE_PROXY_URING_H
+#define CACHE_PROXY_URING_H
+
+#include "cache.h"
+#include "dns.h"
+
+/**
+ * @brief Обработчик соединений на основе io_uring
+ * @details Состоит из нескольких потоков-циклов, у каждого свое кольцо io_uring.
+ *          В отличие от epoll, где цикл узнает о готовности сокета и сам делает
+ *          recv/send, здесь операции (accept, recv, send, connect) ставятся в очередь
+ *          отправки пачками, а цикл обрабатывает только их завершения.
+ *          Прием соединений и чтение выполняются многоразовыми (multishot) операциями
+ *          в буферы, заранее зарегистрированные в ядре, поэтому число системных
+ *          вызовов на мегабайт данных не зависит от размера порции.
+ */
+struct uring_t;
+typedef struct uring_t uring_t;
+
+/**
+ * @brief Создает обработчик и запускает его циклы
+ * @param loop_count Количество потоков-циклов (если <= 0, используется 1)
+ * @param cache      Кэш HTTP-ответов, общий для всех циклов
+ * @param resolver   Резолвер имен серверов, общий для всех циклов
+ * @return Указатель на созданный обработчик или NULL, если io_uring недоступен
+ */
+uring_t *uring_create(int loop_count, cache_t *cache, dns_resolver_t *resolver);
+
+/**
+ * @brief Начинает прием соединений на слушающем сокете
+ * @details Каждый цикл ставит на сокет собственный multishot accept,
+ *          ядро распределяет новые соединения между циклами.
+ * @param uring         Обработчик
+ * @param server_socket Слушающий сокет (остается во владении вызывающей стороны)
+ */
+void uring_listen(uring_t *uring, int server_socket);
+
+/**
+ * @brief Останавливает циклы, закрывает все соединения и освобождает ресурсы
+ * @param uring Обработчик
+ * @note Функция блокирует вызывающий поток до завершения всех циклов
+ */
+void uring_destroy(uring_t *uring);
+
+#endif // CACHE_PROXY_URING_H
@@ -0,0 +1,237 @@
+#include "admin.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+
+#define ADMIN_REQUEST_SIZE      4096
+#define ADMIN_IO_TIMEOUT_MS     1000
+#define ADMIN_BACKLOG           16
+
+#define SUCCESS     0
+#define ERROR       (-1)
+
+/**
+ * @brief Сервер администрирования
+ * @var socket  Слушающий сокет
+ * @var wake    Канал для пробуждения потока сервера при остановке
+ * @var collect Функция, дописывающая метрики владельца
+ * @var arg     Аргумент для collect
+ * @var running Атомарный флаг работы потока
+ * @var thread  Поток сервера
+ */
+struct admin_server_t {
+    int socket;
+    int wake[2];
+    admin_collect_t collect;
+    void *arg;
+    atomic_int running;
+    pthread_t thread;
+};
+
+/**
+ * @brief Основная функция потока сервера администрирования
+ * @param arg Сервер
+ * @return NULL
+ */
+static void *admin_routine(void *arg);
+
+/**
+ * @brief Читает запрос, отвечает на него и закрывает соединение
+ * @param server Сервер
+ * @param client Сокет клиента
+ */
+static void serve_admin_client(admin_server_t *server, int client);
+
+/**
+ * @brief Отправляет данные целиком, ожидая готовности сокета не дольше ADMIN_IO_TIMEOUT_MS
+ * @param client Сокет клиента
+ * @param data   Данные
+ * @param len    Длина данных
+ * @return SUCCESS или ERROR
+ */
+static int send_all(int client, const char *data, size_t len);
+
+/**
+ * @brief Создает слушающий сокет и запускает поток сервера администрирования
+ * @param port    Порт для прослушивания
+ * @param collect Функция, дописывающая метрики владельца
+ * @param arg     Аргумент для collect
+ * @return Указатель на сервер или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Создает неблокирующий канал пробуждения
+ *          2. Создает TCP-сокет, привязывает его к порту на всех интерфейсах и начинает прослушивание
+ *          3. Запускает поток сервера
+ */
+admin_server_t *admin_server_create(int port, admin_collect_t collect, void *arg) {
+    errno = 0;
+    admin_server_t *server = calloc(1, sizeof(admin_server_t));
+    if (server == NULL) {
+        proxy_log_error("Admin server creation error: %s", strerror(errno));
+        return NULL;
+    }
+    server->collect = collect;
+    server->arg = arg;
+    if (pipe2(server->wake, O_NONBLOCK | O_CLOEXEC) == ERROR) { // Остановка не должна блокироваться на записи в канал
+        proxy_log_error("Admin server creation error: %s", strerror(errno));
+        free(server);
+        return NULL;
+    }
+    server->socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->socket == ERROR) {
+        proxy_log_error("Admin server creation error: %s", strerror(errno));
+        goto close_wake;
+    }
+    int true = 1;
+    setsockopt(server->socket, SOL_SOCKET, SO_REUSEADDR, &true, sizeof(int));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(server->socket, (struct sockaddr *) &addr, sizeof(addr)) == ERROR
+        || listen(server->socket, ADMIN_BACKLOG) == ERROR) {
+        proxy_log_error("Admin server creation error: %s", strerror(errno));
+        goto close_socket;
+    }
+    atomic_store(&server->running, 1);
+    if (pthread_create(&server->thread, NULL, admin_routine, server) != 0) {
+        proxy_log_error("Admin server creation error: failed to create admin thread");
+        goto close_socket;
+    }
+    proxy_log("Admin server listen on port %d", port);
+    return server;
+
+    close_socket:
+    close(server->socket);
+    close_wake:
+    close(server->wake[0]);
+    close(server->wake[1]);
+    free(server);
+    return NULL;
+}
+
+/**
+ * @brief Останавливает поток сервера администрирования и освобождает его ресурсы
+ * @param server Сервер
+ */
+void admin_server_destroy(admin_server_t *server) {
+    if (server == NULL) return;
+    if (atomic_exchange(&server->running, 0)) {
+        char byte = 0;
+        ssize_t ret = write(server->wake[1], &byte, 1);
+        (void) ret; // EAGAIN: в канале уже есть пробуждение
+        pthread_join(server->thread, NULL);
+    }
+    close(server->socket);
+    close(server->wake[0]);
+    close(server->wake[1]);
+    free(server);
+}
+
+/**
+ * @brief Основная функция потока сервера администрирования
+ * @param arg Сервер
+ * @return NULL
+ * @details Алгоритм работы:
+ *          1. Ждет нового соединения или пробуждения через канал
+ *          2. Принимает соединение и обслуживает его до конца
+ *          3. Повторяет, пока сервер не остановлен
+ */
+static void *admin_routine(void *arg) {
+    proxy_set_thread_name("admin");
+    admin_server_t *server = (admin_server_t *) arg;
+    while (atomic_load(&server->running)) {
+        struct pollfd fds[2] = {{.fd = server->wake[0], .events = POLLIN}, {.fd = server->socket, .events = POLLIN}};
+        int ready = poll(fds, 2, -1);
+        if (ready == ERROR && errno != EINTR) {
+            proxy_log_error("Admin server error: %s", strerror(errno));
+            break;
+        }
+        if (ready <= 0 || !(fds[1].revents & POLLIN)) continue;
+        int client = accept(server->socket, NULL, NULL);
+        if (client == ERROR) continue;
+        serve_admin_client(server, client);
+        close(client);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Читает запрос, отвечает на него и закрывает соединение
+ * @param server Сервер
+ * @param client Сокет клиента
+ * @details Алгоритм работы:
+ *          1. Читает заголовок запроса (до пустой строки), ожидая данных не дольше ADMIN_IO_TIMEOUT_MS
+ *          2. На GET /metrics собирает тело в памяти: metrics_write и функция владельца
+ *          3. На остальные запросы отвечает 404
+ *          4. Отправляет ответ HTTP/1.0 с Content-Length и Connection: close
+ */
+static void serve_admin_client(admin_server_t *server, int client) {
+    char request[ADMIN_REQUEST_SIZE];
+    size_t request_len = 0;
+    while (request_len < sizeof(request) - 1) {
+        struct pollfd fd = {.fd = client, .events = POLLIN};
+        if (poll(&fd, 1, ADMIN_IO_TIMEOUT_MS) <= 0) return;
+        ssize_t received = recv(client, request + request_len, sizeof(request) - 1 - request_len, 0);
+        if (received <= 0) return;
+        request_len += (size_t) received;
+        request[request_len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
+    }
+    char *body = NULL;
+    size_t body_len = 0;
+    const char *status = "404 Not Found";
+    const char *content_type = "text/plain";
+    if (strncmp(request, "GET ", 4) == 0 && strcspn(request + 4, " ?\r\n") == strlen("/metrics")
+        && strncmp(request + 4, "/metrics", strlen("/metrics")) == 0) {
+        FILE *out = open_memstream(&body, &body_len);
+        if (out == NULL) {
+            proxy_log_error("Admin server error: %s", strerror(errno));
+            return;
+        }
+        metrics_write(out);
+        if (server->collect != NULL) server->collect(out, server->arg);
+        fclose(out);
+        status = "200 OK";
+        content_type = "text/plain; version=0.0.4; charset=utf-8";
+    }
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                              status, content_type, body_len);
+    if (send_all(client, header, (size_t) header_len) == SUCCESS && body_len > 0) send_all(client, body, body_len);
+    free(body);
+}
+
+/**
+ * @brief Отправляет данные целиком, ожидая готовности сокета не дольше ADMIN_IO_TIMEOUT_MS
+ * @param client Сокет клиента
+ * @param data   Данные
+ * @param len    Длина данных
+ * @return SUCCESS или ERROR
+ */
+static int send_all(int client, const char *data, size_t len) {
+    while (len > 0) {
+        struct pollfd fd = {.fd = client, .events = POLLOUT};
+        if (poll(&fd, 1, ADMIN_IO_TIMEOUT_MS) <= 0) return ERROR;
+        ssize_t sent = send(client, data, len, 0);
+        if (sent == ERROR) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return ERROR;
+        }
+        data += sent;
+        len -= (size_t) sent;
+    }
+    return SUCCESS;
+}
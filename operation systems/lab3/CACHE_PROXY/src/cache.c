@@ -1,89 +1,344 @@
 #include "cache.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
 #include <unistd.h>
 
+#include "../include/clock.h"
+#include "../include/epoch.h"
+#include "../include/hash.h"
+#include "../include/http.h"
 #include "../include/log.h"
+#include "../include/metrics.h"
 
 #define MIN(x, y) (x < y) ? x : y
 
+#define BUCKET_COUNT_INITIAL    16  // Начальное количество корзин в сегменте (степень двойки)
+#define REHASH_STEPS            4   // Сколько корзин старой таблицы переносится за одну операцию
+#define HEAP_CAPACITY_INITIAL   16  // Начальная вместимость кучи приоритетов сегмента
+#define S3FIFO_MAX_FREQUENCY    3   // Предел счетчика обращений узла в S3-FIFO
+#define S3FIFO_SMALL_RATIO      10  // Малая очередь S3-FIFO занимает 1/10 объема сегмента
+#define GHOST_CAPACITY          256 // Сколько хэшей вытесненных из малой очереди помнит сегмент
+#define WHEEL_BITS              6   // Колесо таймеров: 2^6 ячеек на уровень
+#define WHEEL_SLOTS             (1 << WHEEL_BITS)
+#define WHEEL_MASK              (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS            4   // 2^24 тактов (при такте 1 с - около 194 дней), дальше - список far
+#define ENTRY_FRESH             0   // Ответ свежий (или еще загружается)
+#define ENTRY_STALE             1   // Ответ устарел, но его можно отдавать, проверяя в фоне
+#define ENTRY_EXPIRED           2   // Ответ нужно проверить у сервера до выдачи клиенту
+
 /**
  * @brief Узел хэш-таблицы кэша
  * @details Связывает элемент кэша с дополнительной информацией:
- *          временем последнего изменения и блокировкой для чтения/записи.
+ *          сроком жизни, хэшем ключа и данными для вытеснения.
+ *          Поля узла меняются под мьютексом сегмента, которому он принадлежит.
+ *          Поиск читает entry, hash и next без мьютекса, а обращение меняет
+ *          expires_ms и frequency атомарно (см. key_get_or_add). Исключенный узел
+ *          освобождается через epoch_retire, когда его уже не видит ни один поиск.
  * @var entry                Указатель на основной элемент кэша (cache_entry_t)
- * @var last_modified_time   Время последнего доступа/изменения элемента
- * @var rwlock               Читательско-писательская блокировка для узла
+ * @var expires_ms           Момент устаревания по монотонным часам (мс): время последнего доступа + entry_expired_time_ms
+ * @var hash                 Хэш ключа (по нему выбирается корзина, он же сравнивается до memcmp)
+ * @var size                 Учтенный в бюджете кэша размер элемента в байтах
+ * @var frequency            Количество обращений к элементу (в S3-FIFO - от 0 до S3FIFO_MAX_FREQUENCY,
+ *                           меняется без перестановки узла в очередях)
+ * @var heap_frequency       Значение frequency, по которому вычислен priority (GDSF)
+ * @var priority             Приоритет GDSF: чем меньше, тем раньше элемент будет вытеснен
+ * @var heap_index           Позиция узла в куче приоритетов сегмента
+ * @var small                1 если узел в малой очереди S3-FIFO
  * @var next                 Указатель на следующий узел в цепочке коллизий
- * @var lru_prev             Указатель на предыдущий узел в LRU-списке
- * @var lru_next             Указатель на следующий узел в LRU-списке
+ * @var lru_prev             Указатель на предыдущий узел в LRU-списке (очереди S3-FIFO)
+ * @var lru_next             Указатель на следующий узел в LRU-списке (очереди S3-FIFO)
+ * @var timer_next           Следующий узел в ячейке колеса таймеров
+ * @var timer_pprev          Поле, указывающее на узел в ячейке колеса (NULL - узел не в колесе)
+ * @var retire               Заголовок для отложенного освобождения узла
  */
 typedef struct cache_node_t {
     cache_entry_t *entry;
-    struct timeval last_modified_time;
-    pthread_rwlock_t rwlock;
-    struct cache_node_t *next;
+    atomic_llong expires_ms;
+    uint64_t hash;
+    size_t size;
+    atomic_uint frequency;
+    unsigned int heap_frequency;
+    double priority;
+    size_t heap_index;
+    int small;
+    _Atomic(struct cache_node_t *) next;
     struct cache_node_t *lru_prev;
     struct cache_node_t *lru_next;
+    struct cache_node_t *timer_next;
+    struct cache_node_t **timer_pprev;
+    epoch_entry_t retire;
 } cache_node_t;
 
+/**
+ * @brief Таблица корзин сегмента
+ * @details Число корзин и сами корзины лежат в одном блоке, поэтому поиск без мьютекса
+ *          всегда видит согласованную пару. Замененная таблица освобождается через epoch_retire.
+ * @var retire  Заголовок для отложенного освобождения таблицы
+ * @var mask    Количество корзин минус 1
+ * @var buckets Головы цепочек коллизий
+ */
+typedef struct {
+    epoch_entry_t retire;
+    size_t mask;
+    _Atomic(cache_node_t *) buckets[];
+} cache_table_t;
+
+/**
+ * @brief Сегмент кэша
+ * @details Независимая часть кэша со своей блокировкой, хэш-таблицей, LRU-списком
+ *          и учетом размера. Запросы к разным сегментам не конкурируют между собой.
+ *          Хэш-таблица состоит из 2^k корзин и удваивается, когда элементов становится
+ *          больше, чем корзин. Перенос узлов в новую таблицу выполняется постепенно:
+ *          каждая операция с сегментом переносит REHASH_STEPS корзин старой таблицы,
+ *          поэтому ни один запрос не платит за перестройку всей таблицы целиком.
+ *          Поиск элемента не захватывает мьютекс: он обходит цепочки внутри участка
+ *          чтения epoch_enter/epoch_exit, а исключенные узлы и замененные таблицы
+ *          освобождаются только после выхода всех таких поисков.
+ *          Для вытеснения узлы сегмента лежат в min-куче по приоритету GDSF
+ *          (Greedy-Dual-Size-Frequency): H = L + frequency / size, где L - приоритет
+ *          последнего вытесненного элемента сегмента. Маленькие часто запрашиваемые
+ *          элементы получают высокий приоритет, большие и редкие вытесняются первыми,
+ *          а рост L со временем вытесняет и когда-то популярные, но забытые элементы.
+ *          LRU-список при GDSF только хранит все узлы сегмента (порядок не используется).
+ *          При политике S3-FIFO куча не используется: новые узлы попадают в малую очередь
+ *          (small_head/small_tail), LRU-список служит основной очередью, а обращение
+ *          только увеличивает счетчик узла. При вытеснении узел из хвоста малой очереди
+ *          со счетчиком > 0 переходит в основную, иначе вытесняется и запоминается
+ *          в ghost; узел из хвоста основной очереди со счетчиком > 0 возвращается
+ *          в ее голову с уменьшенным счетчиком. Ключи из ghost сразу попадают в основную
+ *          очередь. Так однократные запросы (обход сайта роботом) вытесняются
+ *          из малой очереди, не трогая часто запрашиваемые элементы.
+ *          Для устаревания узлы лежат в иерархическом колесе таймеров: уровень l
+ *          содержит 2^WHEEL_BITS ячеек по 2^(WHEEL_BITS * l) тактов. Узел кладется в ячейку
+ *          по своему сроку и спускается на нижние уровни, когда колесо до нее доходит.
+ *          Обращение к узлу только сдвигает срок; узел перекладывается, когда срабатывает
+ *          его ячейка, поэтому работа сборщика мусора пропорциональна числу устаревших
+ *          элементов, а не размеру кэша.
+ * @var mutex           Мьютекс, защищающий все поля сегмента и его узлы от изменения
+ * @var table           Текущая таблица корзин
+ * @var old_table       Старая таблица, из которой еще переносятся узлы (NULL если перенос не идет)
+ * @var rehash_index    Первая еще не перенесенная корзина старой таблицы
+ * @var size            Текущее количество элементов в сегменте
+ * @var bytes           Суммарный учтенный размер элементов сегмента
+ * @var heap            Куча узлов по возрастанию приоритета
+ * @var heap_capacity   Вместимость массива кучи
+ * @var inflation       Значение L (приоритет последнего вытесненного узла)
+ * @var lru_head        head для LRU list
+ * @var lru_tail        tail для LRU list
+ * @var small_head      head малой очереди S3-FIFO
+ * @var small_tail      tail малой очереди S3-FIFO
+ * @var small_bytes     Суммарный размер узлов малой очереди
+ * @var ghost           Кольцевой буфер хэшей узлов, вытесненных из малой очереди (только S3-FIFO)
+ * @var ghost_index     Позиция следующей записи в ghost
+ * @var wheel           Ячейки колеса таймеров по уровням
+ * @var wheel_far       Узлы со сроком дальше, чем охватывает колесо
+ * @var wheel_tick      Следующий необработанный такт колеса
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    _Atomic(cache_table_t *) table;
+    _Atomic(cache_table_t *) old_table;
+    size_t rehash_index;
+    int size;
+    size_t bytes;
+    cache_node_t **heap;
+    size_t heap_capacity;
+    double inflation;
+    cache_node_t lru_head;
+    cache_node_t lru_tail;
+    cache_node_t small_head;
+    cache_node_t small_tail;
+    size_t small_bytes;
+    uint64_t *ghost;
+    size_t ghost_index;
+    cache_node_t *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+    cache_node_t *wheel_far;
+    uint64_t wheel_tick;
+} cache_shard_t;
+
 /**
  * @brief Основная структура кэша
- * @details Реализует кэш как хэш-таблицу с garbage collector'ом
- * @var capacity                      Вместимость хэш-таблицы (число слотов)
- * @var array                         Массив указателей на цепочки узлов (хэш-таблица)
+ * @details Реализует кэш как набор сегментов с garbage collector'ом.
+ *          Сегмент выбирается по хэшу запроса, глобальной блокировки нет.
+ *          Объем кэша ограничен бюджетом в байтах, общим для всех сегментов.
+ * @var shards                        Массив сегментов
+ * @var shard_count                   Количество сегментов
+ * @var max_size                      Бюджет памяти кэша в байтах
+ * @var policy                        Политика вытеснения
+ * @var size                          Суммарный учтенный размер элементов в кэше
  * @var garbage_collector_running     Атомарный флаг работы сборщика мусора
  * @var entry_expired_time_ms         Время жизни элемента кэша в миллисекундах
+ * @var tick_ms                       Длина такта колеса таймеров (период сборщика мусора) в миллисекундах
  * @var garbage_collector             Дескриптор потока сборщика мусора
- * @var current_size                  Текущее количество элементов в кэше (атомарный)
- * @var lru_mutex                     Мьютекс для синхронизации LRU-операций
- * @var lru_head                      head для LRU list
- * @var lru_tail                      tail для LRU list
+ * @var revalidate                    Функция проверки устаревших элементов у сервера (NULL - не задана)
+ * @var revalidate_arg                Аргумент функции проверки
  */
 struct cache_t {
-    int capacity;
-    cache_node_t **array;
+    cache_shard_t *shards;
+    int shard_count;
+    size_t max_size;
+    cache_policy_t policy;
+    atomic_size_t size;
     atomic_int garbage_collector_running;
     time_t entry_expired_time_ms;
+    time_t tick_ms;
     pthread_t garbage_collector;
-    atomic_int current_size;
-    pthread_mutex_t lru_mutex;
-    cache_node_t *lru_head;
-    cache_node_t *lru_tail;
+    cache_revalidate_t revalidate;
+    void *revalidate_arg;
 };
 
 /**
- * @brief Вычисляет хэш для HTTP-запроса
- * @param request      Текст HTTP-запроса
- * @param request_len  Длина запроса в байтах
- * @param size         Размер хэш-таблицы (для получения индекса в массиве)
- * @return Индекс в хэш-таблице (от 0 до size-1)
- * @details Использует простую хэш-функцию: сумма байтов по модулю size
+ * @brief Находит сегмент, в котором хранится ключ
+ * @param cache Кэш
+ * @param h     Хэш ключа
+ * @return Сегмент кэша
+ */
+static cache_shard_t *get_shard(cache_t *cache, uint64_t h);
+
+/**
+ * @brief Создает пустую таблицу корзин
+ * @param bucket_count Количество корзин (степень двойки)
+ * @return Таблица или NULL при ошибке
+ */
+static cache_table_t *table_create(size_t bucket_count);
+
+/**
+ * @brief Освобождает замененную таблицу корзин (вызывается через epoch_retire)
+ * @param retire Заголовок таблицы
+ */
+static void table_reclaim(epoch_entry_t *retire);
+
+/**
+ * @brief Возвращает корзину сегмента, в которой должен лежать узел с данным хэшем
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param h     Хэш ключа
+ * @return Указатель на голову цепочки корзины
+ */
+static _Atomic(cache_node_t *) *shard_bucket(cache_shard_t *shard, uint64_t h);
+
+/**
+ * @brief Переносит несколько корзин старой таблицы в новую
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param steps Максимальное количество переносимых корзин
+ */
+static void shard_rehash(cache_shard_t *shard, int steps);
+
+/**
+ * @brief Начинает удвоение таблицы корзин сегмента
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ */
+static void shard_grow(cache_shard_t *shard);
+
+/**
+ * @brief Ищет узел ключа в сегменте
+ * @param shard   Сегмент (мьютекс должен быть захвачен)
+ * @param h       Хэш ключа
+ * @param key     Ключ
+ * @param key_len Длина ключа
+ * @return Узел или NULL если не найден
+ */
+static cache_node_t *shard_find(cache_shard_t *shard, uint64_t h, const char *key, size_t key_len);
+
+/**
+ * @brief Ищет узел ключа в сегменте без мьютекса
+ * @param shard     Сегмент (вызывающий поток должен быть внутри epoch_enter/epoch_exit)
+ * @param h         Хэш ключа
+ * @param key       Ключ
+ * @param key_len   Длина ключа
+ * @param rehashing Указатель для сохранения признака идущего переноса корзин
+ * @return Узел или NULL если не найден
+ */
+static cache_node_t *shard_lookup(cache_shard_t *shard, uint64_t h, const char *key, size_t key_len, int *rehashing);
+
+/**
+ * @brief Ищет элемент по ключу и, если задан запрос, добавляет новый при промахе
+ * @param cache       Кэш
+ * @param key         Ключ (при создании элемента передается ему во владение)
+ * @param key_len     Длина ключа
+ * @param request     Текст запроса для нового элемента (NULL - только поиск)
+ * @param request_len Длина запроса
+ * @param created     Указатель для сохранения признака создания
+ * @return Захваченный элемент или NULL
+ */
+static cache_entry_t *key_get_or_add(cache_t *cache, char *key, size_t key_len, char *request, size_t request_len, int *created);
+
+/**
+ * @brief Определяет, можно ли отдать ответ элемента без проверки у сервера
+ * @param entry Элемент
+ * @param now   Текущее время монотонных часов (мс)
+ * @return ENTRY_FRESH, ENTRY_STALE или ENTRY_EXPIRED
+ */
+static int entry_staleness(cache_entry_t *entry, long long now);
+
+/**
+ * @brief Запускает проверку устаревшего элемента в фоне, если ее еще никто не запустил
+ * @param cache Кэш
+ * @param entry Устаревший элемент, который продолжает отдаваться клиентам
+ */
+static void entry_revalidate(cache_t *cache, cache_entry_t *entry);
+
+/**
+ * @brief Записывает срок свежести элемента, отсчитывая его от текущего момента
+ * @param entry       Элемент (мьютекс элемента должен быть захвачен)
+ * @param lifetime_ms Срок свежести (HTTP_FRESHNESS_UNKNOWN - не ограничен)
+ * @param stale_ms    Сколько после устаревания ответ можно отдавать с проверкой в фоне
+ */
+static void entry_set_lifetime(cache_entry_t *entry, long long lifetime_ms, long long stale_ms);
+
+/**
+ * @brief Копирует валидаторы ответа
+ * @param response      Заголовки ответа
+ * @param response_len  Длина заголовков
+ * @param etag          Указатель для сохранения копии ETag (NULL если нет)
+ * @param last_modified Указатель для сохранения копии Last-Modified (NULL если нет)
+ * @return SUCCESS при успехе, ERROR при ошибке
+ */
+static int copy_validators(const char *response, size_t response_len, char **etag, char **last_modified);
+
+/**
+ * @brief Строит ключ варианта, если запрос не совпадает с вариантом найденного элемента
+ * @param entry       Найденный элемент основного ключа
+ * @param request     Текст запроса
+ * @param request_len Длина запроса
+ * @param variant_len Указатель для сохранения длины ключа варианта
+ * @return Ключ варианта (malloc) или NULL, если подходит сам элемент
  */
-static int hash(const char *request, size_t request_len, int size);
+static char *entry_variant_key(cache_entry_t *entry, const char *request, size_t request_len, size_t *variant_len);
 
 /**
  * @brief Создает новый узел хэш-таблицы
  * @param entry Указатель на элемент кэша для хранения в узле
+ * @param h     Хэш ключа элемента
  * @return Указатель на созданный узел или NULL при ошибке
- * @details Инициализирует время последнего изменения текущим временем
- *          и создает rwlock для узла.
+ * @details Срок узла задает shard_insert.
  */
-static cache_node_t *cache_node_create(cache_entry_t *entry);
+static cache_node_t *cache_node_create(cache_entry_t *entry, uint64_t h);
 
 /**
  * @brief Уничтожает узел хэш-таблицы
  * @param node Узел для уничтожения
- * @details Освобождает блокировку rwlock, но НЕ освобождает cache_entry_t.
- *          Ответственность за освобождение cache_entry_t лежит на вызывающей стороне.
+ * @details Освобождает ссылку кэша на cache_entry_t.
+ *          Сам элемент уничтожается, когда его освободят все обработчики.
  */
 static void cache_node_destroy(cache_node_t *node);
 
+/**
+ * @brief Уничтожает исключенный узел (вызывается через epoch_retire)
+ * @param retire Заголовок узла
+ */
+static void node_reclaim(epoch_entry_t *retire);
+
+/**
+ * @brief Откладывает уничтожение исключенного из сегмента узла
+ * @param node Узел
+ */
+static void node_retire(cache_node_t *node);
+
 /**
  * @brief Удаляет узел из LRU-списка
  * @param node Узел для удаления из списка
@@ -92,79 +347,351 @@ static void _lru_remove(cache_node_t *node);
 
 /**
  * @brief Перемещает узел в начало LRU-списка (most recently used)
- * @param cache Кэш
+ * @param shard Сегмент
  * @param node Узел для перемещения
  */
-static void move_to_head(cache_t *cache, cache_node_t *node);
+static void move_to_head(cache_shard_t *shard, cache_node_t *node);
+
+/**
+ * @brief Вставляет узел в начало списка
+ * @param head Головной узел списка
+ * @param node Узел (не должен состоять в списке)
+ */
+static void list_push(cache_node_t *head, cache_node_t *node);
+
+/**
+ * @brief Вычисляет приоритет GDSF узла
+ * @param shard Сегмент узла
+ * @param node  Узел
+ * @return L + heap_frequency / size
+ */
+static double node_priority(const cache_shard_t *shard, const cache_node_t *node);
+
+/**
+ * @brief Поднимает узел кучи к корню, пока его приоритет меньше родительского
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param index Позиция узла в куче
+ */
+static void heap_sift_up(cache_shard_t *shard, size_t index);
+
+/**
+ * @brief Опускает узел кучи, пока его приоритет больше приоритета потомков
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param index Позиция узла в куче
+ */
+static void heap_sift_down(cache_shard_t *shard, size_t index);
+
+/**
+ * @brief Пересчитывает приоритет узла и восстанавливает порядок кучи
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param node  Узел
+ */
+static void heap_update(cache_shard_t *shard, cache_node_t *node);
+
+/**
+ * @brief Учитывает обращение к узлу согласно политике вытеснения
+ * @param cache Кэш
+ * @param node  Узел (мьютекс сегмента может быть не захвачен)
+ */
+static void node_touch(cache_t *cache, cache_node_t *node);
+
+/**
+ * @brief Возвращает узел GDSF для вытеснения
+ * @param shard Сегмент (мьютекс должен быть захвачен, сегмент не пуст)
+ * @return Узел с наименьшим приоритетом (еще не исключенный из сегмента)
+ */
+static cache_node_t *gdsf_victim(cache_shard_t *shard);
+
+/**
+ * @brief Проверяет, был ли хэш недавно вытеснен из малой очереди S3-FIFO
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param h     Хэш ключа
+ * @return 1 если хэш найден в ghost (запись при этом стирается), иначе 0
+ */
+static int ghost_take(cache_shard_t *shard, uint64_t h);
+
+/**
+ * @brief Выбирает узел для вытеснения по S3-FIFO
+ * @param shard Сегмент (мьютекс должен быть захвачен, сегмент не пуст)
+ * @return Узел для вытеснения (еще не исключенный из сегмента)
+ */
+static cache_node_t *s3fifo_victim(cache_shard_t *shard);
+
+/**
+ * @brief Кладет узел в ячейку колеса таймеров по его сроку
+ * @param cache Кэш
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param node  Узел (не должен быть в колесе)
+ */
+static void timer_schedule(cache_t *cache, cache_shard_t *shard, cache_node_t *node);
+
+/**
+ * @brief Убирает узел из колеса таймеров
+ * @param node Узел
+ */
+static void timer_cancel(cache_node_t *node);
+
+/**
+ * @brief Проворачивает колесо таймеров сегмента до текущего времени
+ * @param cache   Кэш
+ * @param shard   Сегмент (мьютекс должен быть захвачен)
+ * @param now     Текущее время (мс)
+ * @param expired Список исключенных узлов (связанных через timer_next), дополняется
+ */
+static void wheel_advance(cache_t *cache, cache_shard_t *shard, long long now, cache_node_t **expired);
+
+/**
+ * @brief Добавляет узел в сегмент
+ * @param cache Кэш
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param node  Узел для добавления
+ * @return SUCCESS или ERROR, если не удалось расширить кучу
+ */
+static int shard_insert(cache_t *cache, cache_shard_t *shard, cache_node_t *node);
+
+/**
+ * @brief Исключает узел из цепочки, LRU-списка, кучи и колеса таймеров сегмента
+ * @param cache Кэш
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param node  Узел для исключения
+ */
+static void shard_unlink(cache_t *cache, cache_shard_t *shard, cache_node_t *node);
 
 /**
- * @brief Удаляет и вытесняет наименее недавно использованный элемент (tail)
+ * @brief Вытесняет элементы, пока кэш превышает бюджет
  * @param cache Кэш
+ * @param start Сегмент, с которого начинается вытеснение (мьютекс не должен быть захвачен)
+ */
+static void cache_evict(cache_t *cache, cache_shard_t *start);
+
+/**
+ * @brief Откладывает уничтожение списка исключенных узлов (связанных через timer_next)
+ * @param nodes Первый узел списка
  */
-static void remove_tail(cache_t *cache);
+static void retire_nodes(cache_node_t *nodes);
 
 /**
  * @brief Функция потока garbage collector'а
  * @param arg Указатель на структуру cache_t
- * @details Бесконечный цикл, который периодически проверяет все элементы кэша
- *          и удаляет те, которые не использовались дольше entry_expired_time_ms.
+ * @details Раз в такт колеса таймеров проворачивает колесо каждого сегмента
+ *          и удаляет элементы, которые не использовались дольше entry_expired_time_ms.
+ *          Мьютекс удерживается только на время обработки одного сегмента;
+ *          исключенные узлы передаются в node_retire вне мьютекса.
  *          Работает в фоновом режиме, пока garbage_collector_running == 1.
  */
 static void *garbage_collector_routine(void *arg);
 
 /**
- * @brief Вычисляет хэш для HTTP-запроса
- * @param request      Текст HTTP-запроса
- * @param request_len  Длина запроса в байтах
- * @param size         Размер хэш-таблицы (для получения индекса в массиве)
- * @return Индекс в хэш-таблице (от 0 до size-1)
- * @details Использует простую хэш-функцию: сумма байтов по модулю size
+ * @brief Находит сегмент, в котором хранится ключ
+ * @param cache Кэш
+ * @param h     Хэш ключа
+ * @return Сегмент кэша
+ * @details Сегмент выбирается по старшим 32 битам хэша, корзина внутри сегмента -
+ *          по младшим, поэтому элементы одного сегмента равномерно распределены по корзинам.
+ */
+static cache_shard_t *get_shard(cache_t *cache, uint64_t h) {
+    return &cache->shards[(h >> 32) % (uint64_t) cache->shard_count];
+}
+
+/**
+ * @brief Создает пустую таблицу корзин
+ * @param bucket_count Количество корзин (степень двойки)
+ * @return Таблица или NULL при ошибке
+ */
+static cache_table_t *table_create(size_t bucket_count) {
+    errno = 0;
+    cache_table_t *table = calloc(1, sizeof(cache_table_t) + bucket_count * sizeof(_Atomic(cache_node_t *)));
+    if (table == NULL) return NULL;
+    table->mask = bucket_count - 1;
+    return table;
+}
+
+/**
+ * @brief Освобождает замененную таблицу корзин (вызывается через epoch_retire)
+ * @param retire Заголовок таблицы
+ */
+static void table_reclaim(epoch_entry_t *retire) {
+    free((cache_table_t *) ((char *) retire - offsetof(cache_table_t, retire)));
+}
+
+/**
+ * @brief Возвращает корзину сегмента, в которой должен лежать узел с данным хэшем
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param h     Хэш ключа
+ * @return Указатель на голову цепочки корзины
+ * @details Пока идет перенос, корзины старой таблицы с индексом >= rehash_index
+ *          еще не перенесены, и узлы из них ищутся в старой таблице.
+ */
+static _Atomic(cache_node_t *) *shard_bucket(cache_shard_t *shard, uint64_t h) {
+    cache_table_t *old_table = shard->old_table;
+    if (old_table != NULL && (h & old_table->mask) >= shard->rehash_index) return &old_table->buckets[h & old_table->mask];
+    cache_table_t *table = shard->table;
+    return &table->buckets[h & table->mask];
+}
+
+/**
+ * @brief Переносит несколько корзин старой таблицы в новую
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param steps Максимальное количество переносимых корзин
+ * @details Узлы перекладываются по сохраненному хэшу без повторного хэширования запроса.
+ *          Поиск без мьютекса, шедший по переложенному узлу, уходит в цепочку новой
+ *          таблицы и может не найти ключ - такой промах перепроверяется под мьютексом
+ *          (см. key_get_or_add). После переноса последней корзины старая таблица
+ *          освобождается через epoch_retire.
+ */
+static void shard_rehash(cache_shard_t *shard, int steps) {
+    cache_table_t *old_table = shard->old_table;
+    cache_table_t *table = shard->table;
+    while (old_table != NULL && steps-- > 0) {
+        cache_node_t *curr = old_table->buckets[shard->rehash_index];
+        while (curr != NULL) {
+            cache_node_t *next = curr->next;
+            _Atomic(cache_node_t *) *bucket = &table->buckets[curr->hash & table->mask];
+            curr->next = *bucket;
+            *bucket = curr;
+            curr = next;
+        }
+        old_table->buckets[shard->rehash_index] = NULL;
+        if (++shard->rehash_index > old_table->mask) { // Перенос завершен
+            shard->old_table = NULL;
+            shard->rehash_index = 0;
+            epoch_retire(&old_table->retire, table_reclaim);
+            old_table = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Начинает удвоение таблицы корзин сегмента
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @details Текущая таблица становится старой, узлы из нее переносятся постепенно
+ *          (см. shard_rehash). Если памяти не хватило, таблица остается прежней -
+ *          цепочки станут длиннее, но кэш продолжит работать.
+ */
+static void shard_grow(cache_shard_t *shard) {
+    if (shard->old_table != NULL) return; // Предыдущий перенос еще не закончен
+    cache_table_t *table = table_create((shard->table->mask + 1) * 2);
+    if (table == NULL) {
+        proxy_log_error("Cache table growing error: %s", strerror(errno));
+        return;
+    }
+    shard->rehash_index = 0;
+    shard->old_table = shard->table; // Сначала старая: поиск, увидевший новую таблицу, найдет и старую
+    shard->table = table;
+}
+
+/**
+ * @brief Ищет узел ключа в сегменте
+ * @param shard   Сегмент (мьютекс должен быть захвачен)
+ * @param h       Хэш ключа
+ * @param key     Ключ
+ * @param key_len Длина ключа
+ * @return Узел или NULL если не найден
+ * @details Попутно продвигает перенос корзин. Ключи сравниваются побайтово
+ *          только при совпадении хэша и длины.
+ */
+static cache_node_t *shard_find(cache_shard_t *shard, uint64_t h, const char *key, size_t key_len) {
+    shard_rehash(shard, REHASH_STEPS);
+    for (cache_node_t *curr = *shard_bucket(shard, h); curr != NULL; curr = curr->next) {
+        if (curr->hash == h && curr->entry->key_len == key_len && memcmp(curr->entry->key, key, key_len) == 0) return curr;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Ищет узел ключа в сегменте без мьютекса
+ * @param shard     Сегмент (вызывающий поток должен быть внутри epoch_enter/epoch_exit)
+ * @param h         Хэш ключа
+ * @param key       Ключ
+ * @param key_len   Длина ключа
+ * @param rehashing Указатель для сохранения признака переноса корзин во время поиска
+ * @return Узел или NULL если не найден
+ * @details Просматривает цепочку текущей таблицы, а если идет перенос - и цепочку старой.
+ *          Найденный узел мог быть только что исключен из сегмента, но до выхода
+ *          из участка чтения он не будет освобожден. Если во время поиска шел перенос,
+ *          промах может быть ложным (узел переложили во время обхода).
  */
-static int hash(const char *request, size_t request_len, int size) {
-    int sum = 0;
-    for (size_t i = 0; i < request_len; i++) sum += request[i];
-    return sum % size;
+static cache_node_t *shard_lookup(cache_shard_t *shard, uint64_t h, const char *key, size_t key_len, int *rehashing) {
+    *rehashing = 0;
+    cache_table_t *tables[2];
+    tables[0] = atomic_load_explicit(&shard->table, memory_order_acquire);
+    tables[1] = atomic_load_explicit(&shard->old_table, memory_order_acquire);
+    for (int i = 0; i < 2 && tables[i] != NULL; i++) {
+        cache_node_t *curr = atomic_load_explicit(&tables[i]->buckets[h & tables[i]->mask], memory_order_acquire);
+        for (; curr != NULL; curr = atomic_load_explicit(&curr->next, memory_order_acquire)) {
+            if (curr->hash == h && curr->entry->key_len == key_len && memcmp(curr->entry->key, key, key_len) == 0) return curr;
+        }
+    }
+    // Узлы перекладываются, только пока есть старая таблица; завершенный перенос меняет текущую
+    *rehashing = tables[1] != NULL || atomic_load(&shard->old_table) != NULL || atomic_load(&shard->table) != tables[0];
+    return NULL;
 }
 
 /**
  * @brief Создает новый узел хэш-таблицы
  * @param entry Указатель на элемент кэша для хранения в узле
+ * @param h     Хэш ключа элемента
  * @return Указатель на созданный узел или NULL при ошибке
- * @details Инициализирует время последнего изменения текущим временем
- *          и создает rwlock для узла.
+ * @details Срок узла задает shard_insert.
  */
-static cache_node_t *cache_node_create(cache_entry_t *entry) {
+static cache_node_t *cache_node_create(cache_entry_t *entry, uint64_t h) {
     errno = 0;
     cache_node_t *node = malloc(sizeof(cache_node_t));
     if (node == NULL) {
-        proxy_log("Cache node creation error: %s", strerror(errno));
+        proxy_log_error("Cache node creation error: %s", strerror(errno));
         return NULL;
     }
     node->entry = entry;
-    gettimeofday(&node->last_modified_time, 0);
-    pthread_rwlock_init(&node->rwlock, NULL);
+    node->expires_ms = 0;
+    node->hash = h;
+    node->size = sizeof(cache_node_t) + sizeof(cache_entry_t) + entry->key_len + entry->request_len; // Служебные данные элемента
+    node->size += message_length(entry->response);
+    node->frequency = 1;
+    node->heap_frequency = 1;
+    node->priority = 0;
+    node->heap_index = 0;
+    node->small = 0;
     node->next = NULL;
     node->lru_prev = NULL;
     node->lru_next = NULL;
+    node->timer_next = NULL;
+    node->timer_pprev = NULL;
     return node;
 }
 
 /**
  * @brief Уничтожает узел хэш-таблицы
  * @param node Узел для уничтожения
- * @details Освобождает блокировку rwlock, но НЕ освобождает cache_entry_t.
- *          Ответственность за освобождение cache_entry_t лежит на вызывающей стороне.
+ * @details Освобождает ссылку кэша на cache_entry_t.
+ *          Сам элемент уничтожается, когда его освободят все обработчики.
  */
 static void cache_node_destroy(cache_node_t *node) {
     if (node == NULL) {
-        proxy_log("Cache node destroying error: node is NULL");
+        proxy_log_error("Cache node destroying error: node is NULL");
         return;
     }
-    cache_entry_destroy(node->entry);
-    pthread_rwlock_destroy(&node->rwlock);
+    cache_entry_release(node->entry);
     free(node);
 }
 
+/**
+ * @brief Уничтожает исключенный узел (вызывается через epoch_retire)
+ * @param retire Заголовок узла
+ */
+static void node_reclaim(epoch_entry_t *retire) {
+    cache_node_destroy((cache_node_t *) ((char *) retire - offsetof(cache_node_t, retire)));
+}
+
+/**
+ * @brief Откладывает уничтожение исключенного из сегмента узла
+ * @param node Узел
+ * @details Поиск без мьютекса мог найти узел до исключения, поэтому узел
+ *          (и ссылка кэша на элемент) живет, пока такие поиски не завершатся.
+ */
+static void node_retire(cache_node_t *node) {
+    epoch_retire(&node->retire, node_reclaim);
+}
+
 /**
  * @brief Удаляет узел из LRU-списка
  * @param node Узел для удаления из списка
@@ -179,108 +706,650 @@ static void _lru_remove(cache_node_t *node) {
 
 /**
  * @brief Перемещает узел в начало LRU-списка (most recently used)
- * @param cache Кэш
+ * @param shard Сегмент
  * @param node Узел для перемещения
  */
-static void move_to_head(cache_t *cache, cache_node_t *node) {
-    pthread_mutex_lock(&cache->lru_mutex);
-    _lru_remove(node);
-    node->lru_next = cache->lru_head->lru_next;
+static void move_to_head(cache_shard_t *shard, cache_node_t *node) {
+    if (node->lru_prev != NULL) _lru_remove(node);
+    list_push(&shard->lru_head, node);
+}
+
+/**
+ * @brief Вставляет узел в начало списка
+ * @param head Головной узел списка
+ * @param node Узел (не должен состоять в списке)
+ */
+static void list_push(cache_node_t *head, cache_node_t *node) {
+    node->lru_next = head->lru_next;
     node->lru_next->lru_prev = node;
-    cache->lru_head->lru_next = node;
-    node->lru_prev = cache->lru_head;
-    pthread_mutex_unlock(&cache->lru_mutex);
+    head->lru_next = node;
+    node->lru_prev = head;
+}
+
+/**
+ * @brief Вычисляет приоритет GDSF узла
+ * @param shard Сегмент узла
+ * @param node  Узел
+ * @return L + heap_frequency / size
+ * @details Стоимость промаха считается одинаковой для всех элементов (1),
+ *          поэтому политика максимизирует долю попаданий на байт памяти.
+ */
+static double node_priority(const cache_shard_t *shard, const cache_node_t *node) {
+    return shard->inflation + (double) node->heap_frequency / (double) (node->size > 0 ? node->size : 1);
 }
 
 /**
- * @brief Удаляет и вытесняет наименее недавно использованный элемент (tail)
+ * @brief Поднимает узел кучи к корню, пока его приоритет меньше родительского
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param index Позиция узла в куче
+ */
+static void heap_sift_up(cache_shard_t *shard, size_t index) {
+    cache_node_t *node = shard->heap[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (shard->heap[parent]->priority <= node->priority) break;
+        shard->heap[index] = shard->heap[parent];
+        shard->heap[index]->heap_index = index;
+        index = parent;
+    }
+    shard->heap[index] = node;
+    node->heap_index = index;
+}
+
+/**
+ * @brief Опускает узел кучи, пока его приоритет больше приоритета потомков
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param index Позиция узла в куче
+ */
+static void heap_sift_down(cache_shard_t *shard, size_t index) {
+    size_t count = (size_t) shard->size;
+    cache_node_t *node = shard->heap[index];
+    while (1) {
+        size_t child = index * 2 + 1;
+        if (child >= count) break;
+        if (child + 1 < count && shard->heap[child + 1]->priority < shard->heap[child]->priority) child++;
+        if (node->priority <= shard->heap[child]->priority) break;
+        shard->heap[index] = shard->heap[child];
+        shard->heap[index]->heap_index = index;
+        index = child;
+    }
+    shard->heap[index] = node;
+    node->heap_index = index;
+}
+
+/**
+ * @brief Пересчитывает приоритет узла и восстанавливает порядок кучи
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param node  Узел
+ */
+static void heap_update(cache_shard_t *shard, cache_node_t *node) {
+    node->heap_frequency = atomic_load_explicit(&node->frequency, memory_order_relaxed);
+    node->priority = node_priority(shard, node);
+    heap_sift_up(shard, node->heap_index);
+    heap_sift_down(shard, node->heap_index);
+}
+
+/**
+ * @brief Учитывает обращение к узлу согласно политике вытеснения
  * @param cache Кэш
+ * @param node  Узел (мьютекс сегмента может быть не захвачен)
+ * @details Меняются только атомарные поля узла, поэтому обращение не требует мьютекса.
+ *          Срок узла сдвигается, но в колесе таймеров узел остается на месте:
+ *          его переложит сборщик мусора, когда сработает ячейка.
+ *          При GDSF увеличивается счетчик, а приоритет и место в куче пересчитываются
+ *          при вытеснении (см. gdsf_victim).
+ *          При S3-FIFO счетчик увеличивается до S3FIFO_MAX_FREQUENCY:
+ *          списки и другие узлы не меняются, потеря инкремента при гонке допустима.
  */
-static void remove_tail(cache_t *cache) {
-    pthread_mutex_lock(&cache->lru_mutex);
-    cache_node_t *tail = cache->lru_tail->lru_prev;
-    if (tail == cache->lru_head) {
-        // Список пуст
-        pthread_mutex_unlock(&cache->lru_mutex);
+static void node_touch(cache_t *cache, cache_node_t *node) {
+    atomic_store_explicit(&node->expires_ms, proxy_clock_now_ms() + cache->entry_expired_time_ms, memory_order_relaxed);
+    if (cache->policy == CACHE_POLICY_S3FIFO) {
+        unsigned int frequency = atomic_load_explicit(&node->frequency, memory_order_relaxed);
+        if (frequency < S3FIFO_MAX_FREQUENCY) atomic_store_explicit(&node->frequency, frequency + 1, memory_order_relaxed);
         return;
     }
-    _lru_remove(tail);
-    pthread_mutex_unlock(&cache->lru_mutex);
-    // Удаляем элемент из кэша
-    cache_delete(cache, tail->entry->request, tail->entry->request_len);
+    atomic_fetch_add_explicit(&node->frequency, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Возвращает узел GDSF для вытеснения
+ * @param shard Сегмент (мьютекс должен быть захвачен, сегмент не пуст)
+ * @return Узел с наименьшим приоритетом (еще не исключенный из сегмента)
+ * @details Обращения не перестраивают кучу, поэтому приоритет узла в корне может
+ *          отставать от его счетчика. Такой узел получает приоритет по текущему L
+ *          и опускается в куче, пока в корне не окажется узел с актуальным приоритетом.
+ *          Пересчет по L на момент вытеснения, а не обращения, чуть завышает приоритет
+ *          недавно использованных узлов, что соответствует смыслу GDSF. Число пересчетов
+ *          ограничено размером сегмента, поэтому поток обращений не задержит вытеснение.
+ */
+static cache_node_t *gdsf_victim(cache_shard_t *shard) {
+    cache_node_t *node = shard->heap[0];
+    for (int i = 0; i < shard->size && atomic_load_explicit(&node->frequency, memory_order_relaxed) != node->heap_frequency; i++) {
+        heap_update(shard, node);
+        node = shard->heap[0];
+    }
+    return node;
+}
+
+/**
+ * @brief Проверяет, был ли хэш недавно вытеснен из малой очереди S3-FIFO
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param h     Хэш ключа
+ * @return 1 если хэш найден в ghost (запись при этом стирается), иначе 0
+ */
+static int ghost_take(cache_shard_t *shard, uint64_t h) {
+    for (size_t i = 0; i < GHOST_CAPACITY; i++) {
+        if (shard->ghost[i] == h) {
+            shard->ghost[i] = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Выбирает узел для вытеснения по S3-FIFO
+ * @param shard Сегмент (мьютекс должен быть захвачен, сегмент не пуст)
+ * @return Узел для вытеснения (еще не исключенный из сегмента)
+ * @details Алгоритм работы:
+ *          1. Если малая очередь занимает больше 1/S3FIFO_SMALL_RATIO сегмента (или основная пуста),
+ *             берет узел из ее хвоста: использованный узел переводит в основную очередь,
+ *             неиспользованный возвращает как жертву и запоминает его хэш в ghost
+ *          2. Иначе берет узел из хвоста основной очереди: использованный возвращает
+ *             в голову с уменьшенным счетчиком, неиспользованный возвращает как жертву
+ *          3. Повторяет, пока не найдена жертва; счетчики ограничены, поэтому цикл конечен
+ */
+static cache_node_t *s3fifo_victim(cache_shard_t *shard) {
+    while (1) {
+        int small_empty = shard->small_tail.lru_prev == &shard->small_head;
+        int main_empty = shard->lru_tail.lru_prev == &shard->lru_head;
+        if (!small_empty && (main_empty || shard->small_bytes > shard->bytes / S3FIFO_SMALL_RATIO)) {
+            cache_node_t *node = shard->small_tail.lru_prev;
+            if (atomic_load_explicit(&node->frequency, memory_order_relaxed) == 0) {
+                shard->ghost[shard->ghost_index] = node->hash;
+                shard->ghost_index = (shard->ghost_index + 1) % GHOST_CAPACITY;
+                return node;
+            }
+            _lru_remove(node); // Узел использовали, пока он был в малой очереди - переводим в основную
+            shard->small_bytes -= node->size;
+            node->small = 0;
+            atomic_store_explicit(&node->frequency, 0, memory_order_relaxed);
+            list_push(&shard->lru_head, node);
+        } else {
+            cache_node_t *node = shard->lru_tail.lru_prev;
+            unsigned int frequency = atomic_load_explicit(&node->frequency, memory_order_relaxed);
+            if (frequency == 0) return node;
+            atomic_store_explicit(&node->frequency, frequency - 1, memory_order_relaxed);
+            move_to_head(shard, node); // Даем узлу еще один круг
+        }
+    }
+}
+
+/**
+ * @brief Добавляет узел в сегмент
+ * @param cache Кэш
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param node  Узел для добавления
+ * @return SUCCESS или ERROR, если не удалось расширить кучу
+ * @details Если элементов стало больше, чем корзин, начинает удвоение таблицы.
+ *          Узел получает срок жизни и попадает в колесо таймеров.
+ *          В цепочку корзины узел попадает последним, уже полностью заполненным.
+ *          Размер узла добавляется к размеру кэша; вытеснение при превышении бюджета
+ *          выполняет вызывающая сторона после освобождения мьютекса (см. cache_evict).
+ */
+static int shard_insert(cache_t *cache, cache_shard_t *shard, cache_node_t *node) {
+    if (cache->policy == CACHE_POLICY_GDSF && (size_t) shard->size == shard->heap_capacity) { // Сначала место в куче, чтобы при ошибке ничего не менять
+        size_t heap_capacity = shard->heap_capacity * 2;
+        errno = 0;
+        cache_node_t **heap = realloc(shard->heap, heap_capacity * sizeof(cache_node_t *));
+        if (heap == NULL) {
+            proxy_log_error("Cache heap growing error: %s", strerror(errno));
+            return ERROR;
+        }
+        shard->heap = heap;
+        shard->heap_capacity = heap_capacity;
+    }
+    shard_rehash(shard, REHASH_STEPS);
+    if (cache->policy == CACHE_POLICY_S3FIFO) {
+        atomic_store_explicit(&node->frequency, 0, memory_order_relaxed);
+        node->small = !ghost_take(shard, node->hash); // Недавно вытесненный ключ сразу идет в основную очередь
+        list_push(node->small ? &shard->small_head : &shard->lru_head, node);
+        if (node->small) shard->small_bytes += node->size;
+        shard->size++;
+    } else {
+        move_to_head(shard, node);
+        node->heap_index = (size_t) shard->size;
+        shard->heap[node->heap_index] = node;
+        shard->size++;
+        node->priority = node_priority(shard, node);
+        heap_sift_up(shard, node->heap_index);
+    }
+    shard->bytes += node->size;
+    atomic_fetch_add(&cache->size, node->size);
+    node->expires_ms = proxy_clock_now_ms() + cache->entry_expired_time_ms;
+    timer_schedule(cache, shard, node);
+    _Atomic(cache_node_t *) *bucket = shard_bucket(shard, node->hash);
+    node->next = *bucket;
+    *bucket = node; // Публикуем узел для поиска без мьютекса последним, когда все поля заполнены
+    if ((size_t) shard->size > shard->table->mask + 1) shard_grow(shard);
+    return SUCCESS;
+}
+
+/**
+ * @brief Исключает узел из цепочки, LRU-списка, кучи и колеса таймеров сегмента
+ * @param cache Кэш
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param node Узел для исключения
+ * @details Помечает элемент удаленным и будит ожидающие его потоки.
+ *          Поле next узла не сбрасывается: поиск без мьютекса, стоящий на узле,
+ *          продолжит обход цепочки. Узел не уничтожается: после освобождения
+ *          мьютекса он передается в node_retire.
+ */
+static void shard_unlink(cache_t *cache, cache_shard_t *shard, cache_node_t *node) {
+    _Atomic(cache_node_t *) *curr = shard_bucket(shard, node->hash);
+    while (*curr != NULL && *curr != node) curr = &(*curr)->next;
+    if (*curr != NULL) *curr = node->next;
+    _lru_remove(node);
+    timer_cancel(node);
+    shard->size--;
+    shard->bytes -= node->size;
+    if (node->small) shard->small_bytes -= node->size;
+    if (cache->policy == CACHE_POLICY_GDSF && node->heap_index != (size_t) shard->size) { // На место узла ставим последний элемент кучи
+        cache_node_t *last = shard->heap[shard->size];
+        shard->heap[node->heap_index] = last;
+        last->heap_index = node->heap_index;
+        heap_sift_up(shard, last->heap_index);
+        heap_sift_down(shard, last->heap_index);
+    }
+    atomic_fetch_sub(&cache->size, node->size);
+    node->entry->deleted = 1;
+    pthread_cond_broadcast(&node->entry->ready_cond);
+}
+
+/**
+ * @brief Вытесняет элементы, пока кэш превышает бюджет
+ * @param cache Кэш
+ * @param start Сегмент, с которого начинается вытеснение (мьютекс не должен быть захвачен)
+ * @details Алгоритм работы:
+ *          1. Обходит сегменты по кругу, начиная с сегмента, в котором вырос размер
+ *          2. В каждом сегменте вытесняет один узел: при GDSF - с наименьшим приоритетом
+ *             (выбранный gdsf_victim()), поднимая L сегмента до его приоритета; при S3-FIFO -
+ *             выбранный s3fifo_victim()
+ *          3. Останавливается, когда размер кэша уложился в бюджет
+ *             или за полный круг не нашлось ни одного узла
+ * @note Одновременно захвачен мьютекс только одного сегмента. Глобальный минимум
+ *       приоритета не ищется: каждый сегмент теряет свой наименее ценный элемент.
+ */
+static void cache_evict(cache_t *cache, cache_shard_t *start) {
+    int index = (int) (start - cache->shards);
+    int idle = 0; // Количество подряд пустых сегментов
+    while (atomic_load(&cache->size) > cache->max_size && idle < cache->shard_count) {
+        cache_shard_t *shard = &cache->shards[index];
+        cache_node_t *victim = NULL;
+        pthread_mutex_lock(&shard->mutex);
+        if (shard->size > 0 && atomic_load(&cache->size) > cache->max_size) {
+            if (cache->policy == CACHE_POLICY_S3FIFO) {
+                victim = s3fifo_victim(shard);
+            } else {
+                victim = gdsf_victim(shard);
+                shard->inflation = victim->priority;
+            }
+            shard_unlink(cache, shard, victim);
+        }
+        pthread_mutex_unlock(&shard->mutex);
+        if (victim != NULL) {
+            node_retire(victim);
+            metrics_add(METRIC_CACHE_EVICTIONS, 1);
+            idle = 0;
+        } else {
+            idle++;
+        }
+        index = (index + 1) % cache->shard_count;
+    }
+}
+
+/**
+ * @brief Откладывает уничтожение списка исключенных узлов (связанных через timer_next)
+ * @param nodes Первый узел списка
+ * @details Список строится через timer_next, а не next: по next исключенного узла
+ *          еще может идти поиск без мьютекса.
+ */
+static void retire_nodes(cache_node_t *nodes) {
+    while (nodes != NULL) {
+        cache_node_t *next = nodes->timer_next;
+        node_retire(nodes);
+        nodes = next;
+    }
 }
 
 /**
  * @brief Создает новый кэш с указанными параметрами
- * @param capacity              Максимальное количество элементов
+ * @param max_size              Бюджет памяти кэша в байтах
+ * @param shard_count           Количество независимых сегментов
+ * @param policy                Политика вытеснения
  * @param cache_expired_time_ms Время жизни элемента в миллисекундах
  * @return Указатель на созданный кэш или NULL при ошибке
+ * @details Бюджет общий для всех сегментов, вытеснение выполняется выбранной политикой.
+ *          Таблица корзин и куча каждого сегмента начинаются с небольшого размера
+ *          и растут вместе с числом элементов.
  */
-cache_t *cache_create(int capacity, time_t cache_expired_time_ms) {
+cache_t *cache_create(size_t max_size, int shard_count, cache_policy_t policy, time_t cache_expired_time_ms) {
+    if (shard_count <= 0) shard_count = 1;
     errno = 0;
     cache_t *cache = malloc(sizeof(cache_t));
     if (cache == NULL) {
-        proxy_log("Cache creation error: %s", strerror(errno));
+        proxy_log_error("Cache creation error: %s", strerror(errno));
         return NULL;
     }
-    cache->capacity = capacity;
-    cache->array = calloc(capacity, sizeof(cache_node_t *));
-    if (cache->array == NULL) {
-        proxy_log("Cache creation error: %s", strerror(errno));
+    cache->shard_count = shard_count;
+    cache->max_size = max_size;
+    cache->policy = policy;
+    atomic_init(&cache->size, 0);
+    cache->shards = calloc(shard_count, sizeof(cache_shard_t));
+    if (cache->shards == NULL) {
+        proxy_log_error("Cache creation error: %s", strerror(errno));
         free(cache);
         return NULL;
     }
+    for (int i = 0; i < shard_count; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        shard->table = table_create(BUCKET_COUNT_INITIAL);
+        shard->old_table = NULL;
+        shard->heap = malloc(HEAP_CAPACITY_INITIAL * sizeof(cache_node_t *));
+        shard->heap_capacity = HEAP_CAPACITY_INITIAL;
+        shard->inflation = 0;
+        if (policy == CACHE_POLICY_S3FIFO) shard->ghost = calloc(GHOST_CAPACITY, sizeof(uint64_t));
+        if (shard->table == NULL || shard->heap == NULL || (policy == CACHE_POLICY_S3FIFO && shard->ghost == NULL)) {
+            proxy_log_error("Cache creation error: %s", strerror(errno));
+            for (int j = 0; j <= i; j++) {
+                free(cache->shards[j].table);
+                free(cache->shards[j].heap);
+                free(cache->shards[j].ghost);
+            }
+            free(cache->shards);
+            free(cache);
+            return NULL;
+        }
+        pthread_mutex_init(&shard->mutex, NULL);
+        // Инициализация LRU
+        shard->lru_head.lru_next = &shard->lru_tail;
+        shard->lru_tail.lru_prev = &shard->lru_head;
+        shard->small_head.lru_next = &shard->small_tail;
+        shard->small_tail.lru_prev = &shard->small_head;
+    }
     atomic_store(&cache->garbage_collector_running, 1);
     cache->entry_expired_time_ms = cache_expired_time_ms;
-    atomic_store(&cache->current_size, 0);
-    // Инициализация LRU
-    pthread_mutex_init(&cache->lru_mutex, NULL);
-    cache->lru_head = cache_node_create(NULL);
-    cache->lru_tail = cache_node_create(NULL);
-    if (cache->lru_head == NULL || cache->lru_tail == NULL) {
-        proxy_log("Cache creation error: failed to create dummy LRU nodes");
-        free(cache->array);
-        free(cache);
-        return NULL;
-    }
-    cache->lru_head->lru_next = cache->lru_tail;
-    cache->lru_tail->lru_prev = cache->lru_head;
+    cache->revalidate = NULL;
+    cache->revalidate_arg = NULL;
+    cache->tick_ms = MIN(cache_expired_time_ms / 2, 1000); // Проверяем элементы в 2 раза чаще чем время их жизни
+    if (cache->tick_ms < 1) cache->tick_ms = 1;
+    uint64_t tick = (uint64_t) (proxy_clock_now_ms() / cache->tick_ms);
+    for (int i = 0; i < shard_count; i++) cache->shards[i].wheel_tick = tick;
     // Запуск GC
     if (pthread_create(&cache->garbage_collector, NULL, garbage_collector_routine, cache) != 0) {
-        proxy_log("Cache creation error: failed to create garbage collector thread");
-        free(cache->array);
+        proxy_log_error("Cache creation error: failed to create garbage collector thread");
+        for (int i = 0; i < shard_count; i++) {
+            pthread_mutex_destroy(&cache->shards[i].mutex);
+            free(cache->shards[i].table);
+            free(cache->shards[i].heap);
+            free(cache->shards[i].ghost);
+        }
+        free(cache->shards);
         free(cache);
         return NULL;
     }
     return cache;
 }
 
+/**
+ * @brief Ищет элемент по ключу и, если задан запрос, добавляет новый при промахе
+ * @param cache       Кэш
+ * @param key         Ключ (при создании элемента передается ему во владение)
+ * @param key_len     Длина ключа
+ * @param request     Текст запроса для нового элемента (NULL - только поиск)
+ * @param request_len Длина запроса
+ * @param created     Указатель для сохранения признака создания
+ * @return Захваченный элемент или NULL
+ * @details Алгоритм работы:
+ *          1. Ищет узел без мьютекса внутри участка чтения epoch_enter/epoch_exit:
+ *             ссылка кэша на элемент найденного узла жива, пока узел не освобожден,
+ *             поэтому элемент можно захватить. Элемент, уже исключенный из кэша,
+ *             не возвращается
+ *          2. Свежий элемент возвращается сразу; для устаревшего в пределах
+ *             stale-while-revalidate еще и запускается проверка в фоне
+ *          3. Если узел не найден (или элемент нужно проверить до выдачи), а запроса нет
+ *             и перенос корзин не шел, это промах
+ *          4. Иначе повторяет поиск под мьютексом сегмента и при промахе добавляет элемент,
+ *             поэтому для одного ключа элемент создает (и загружает ответ) ровно один обработчик.
+ *             Элемент, который нужно проверить до выдачи, исключается и заменяется новым,
+ *             после освобождения мьютекса для них запускается проверка
+ */
+static cache_entry_t *key_get_or_add(cache_t *cache, char *key, size_t key_len, char *request, size_t request_len, int *created) {
+    *created = 0;
+    uint64_t h = hash_bytes(key, key_len, 0);
+    cache_shard_t *shard = get_shard(cache, h);
+    cache_entry_t *entry = NULL;
+    int rehashing = 1;
+    int staleness = ENTRY_FRESH;
+    if (epoch_enter() == SUCCESS) {
+        cache_node_t *node = shard_lookup(shard, h, key, key_len, &rehashing);
+        if (node != NULL && !node->entry->deleted) {
+            staleness = entry_staleness(node->entry, proxy_clock_now_ms());
+            if (staleness != ENTRY_EXPIRED) {
+                node_touch(cache, node);
+                entry = cache_entry_acquire(node->entry); // Ссылка для вызывающей стороны
+            }
+        }
+        epoch_exit();
+        if (entry != NULL && staleness == ENTRY_STALE) entry_revalidate(cache, entry);
+        if (entry != NULL || (request == NULL && ((node == NULL && !rehashing) || staleness == ENTRY_EXPIRED))) return entry;
+    }
+    cache_node_t *expired = NULL; // Исключенный узел элемента, который нужно проверить до выдачи
+    cache_entry_t *stale = NULL;
+    staleness = ENTRY_FRESH;
+    pthread_mutex_lock(&shard->mutex);
+    cache_node_t *node = shard_find(shard, h, key, key_len);
+    if (node != NULL) {
+        staleness = entry_staleness(node->entry, proxy_clock_now_ms());
+        if (staleness != ENTRY_EXPIRED) {
+            node_touch(cache, node);
+            entry = cache_entry_acquire(node->entry); // Ссылка для вызывающей стороны
+        } else if (request != NULL) {
+            stale = cache_entry_acquire(node->entry); // Ссылка для проверки
+            shard_unlink(cache, shard, node);
+            expired = node;
+            node = NULL;
+        }
+    }
+    if (node == NULL && entry == NULL && request != NULL) {
+        entry = cache_entry_create(request, request_len, NULL); // Ссылка для вызывающей стороны
+        if (entry != NULL) {
+            entry->key = key;
+            entry->key_len = key_len;
+            node = cache_node_create(entry, h);
+        }
+        if (node == NULL || shard_insert(cache, shard, node) == ERROR) {
+            free(node);
+            if (entry != NULL) {
+                entry->request = NULL; // Буфер запроса и ключ остаются у вызывающей стороны
+                entry->key = NULL;
+                cache_entry_release(entry);
+                entry = NULL;
+            }
+        } else {
+            cache_entry_acquire(entry); // Собственная ссылка кэша
+            *created = 1;
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    if (expired != NULL) node_retire(expired);
+    if (stale != NULL) {
+        // Ответ загрузит проверка: при 304 новый элемент получит копию сохраненного ответа
+        if (*created && cache->revalidate != NULL && cache->revalidate(cache->revalidate_arg, stale, entry) == SUCCESS) {
+            *created = CACHE_REVALIDATING;
+        }
+        cache_entry_release(stale);
+    }
+    if (entry != NULL && staleness == ENTRY_STALE) entry_revalidate(cache, entry);
+    if (*created) cache_evict(cache, shard);
+    return entry;
+}
+
+/**
+ * @brief Определяет, можно ли отдать ответ элемента без проверки у сервера
+ * @param entry Элемент
+ * @param now   Текущее время монотонных часов (мс)
+ * @return ENTRY_FRESH, ENTRY_STALE или ENTRY_EXPIRED
+ * @details Пока ответ загружается, элемент считается свежим: запрос присоединяется к загрузке.
+ *          Срок записывается до флага finished, поэтому после его чтения срок уже виден.
+ */
+static int entry_staleness(cache_entry_t *entry, long long now) {
+    if (!entry->finished) return ENTRY_FRESH;
+    if (now < atomic_load_explicit(&entry->fresh_until_ms, memory_order_relaxed)) return ENTRY_FRESH;
+    return now < atomic_load_explicit(&entry->stale_until_ms, memory_order_relaxed) ? ENTRY_STALE : ENTRY_EXPIRED;
+}
+
+/**
+ * @brief Запускает проверку устаревшего элемента в фоне, если ее еще никто не запустил
+ * @param cache Кэш
+ * @param entry Устаревший элемент, который продолжает отдаваться клиентам
+ * @details Флаг revalidating снимает проверка по завершении, поэтому сколько бы запросов
+ *          ни получили устаревший элемент, проверка у сервера идет одна.
+ */
+static void entry_revalidate(cache_t *cache, cache_entry_t *entry) {
+    if (cache->revalidate == NULL) return;
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&entry->revalidating, &expected, 1)) return; // Проверка уже идет
+    if (cache->revalidate(cache->revalidate_arg, entry, NULL) == ERROR) atomic_store(&entry->revalidating, 0);
+}
+
+/**
+ * @brief Записывает срок свежести элемента, отсчитывая его от текущего момента
+ * @param entry       Элемент (мьютекс элемента должен быть захвачен)
+ * @param lifetime_ms Срок свежести (HTTP_FRESHNESS_UNKNOWN - не ограничен)
+ * @param stale_ms    Сколько после устаревания ответ можно отдавать с проверкой в фоне
+ * @details Без срока от сервера элемент живет, пока его не вытеснят или не удалит
+ *          сборщик мусора после entry_expired_time_ms без обращений.
+ */
+static void entry_set_lifetime(cache_entry_t *entry, long long lifetime_ms, long long stale_ms) {
+    entry->lifetime_ms = lifetime_ms;
+    entry->stale_while_revalidate_ms = stale_ms;
+    long long fresh_until = LLONG_MAX, stale_until = LLONG_MAX;
+    if (lifetime_ms != HTTP_FRESHNESS_UNKNOWN) {
+        fresh_until = proxy_clock_now_ms() + lifetime_ms;
+        stale_until = fresh_until + stale_ms;
+    }
+    atomic_store(&entry->fresh_until_ms, fresh_until);
+    atomic_store(&entry->stale_until_ms, stale_until);
+}
+
+/**
+ * @brief Копирует валидаторы ответа
+ * @param response      Заголовки ответа
+ * @param response_len  Длина заголовков
+ * @param etag          Указатель для сохранения копии ETag (NULL если нет)
+ * @param last_modified Указатель для сохранения копии Last-Modified (NULL если нет)
+ * @return SUCCESS при успехе, ERROR при ошибке
+ */
+static int copy_validators(const char *response, size_t response_len, char **etag, char **last_modified) {
+    const char *etag_value, *last_modified_value;
+    size_t etag_len, last_modified_len;
+    *etag = NULL;
+    *last_modified = NULL;
+    if (http_get_validators(response, response_len, &etag_value, &etag_len, &last_modified_value, &last_modified_len) == ERROR) return ERROR;
+    errno = 0;
+    if (etag_value != NULL) *etag = strndup(etag_value, etag_len);
+    if (last_modified_value != NULL) *last_modified = strndup(last_modified_value, last_modified_len);
+    if ((etag_value != NULL && *etag == NULL) || (last_modified_value != NULL && *last_modified == NULL)) {
+        proxy_log_error("Cache validators copying error: %s", strerror(errno));
+        free(*etag);
+        free(*last_modified);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Строит ключ варианта, если запрос не совпадает с вариантом найденного элемента
+ * @param entry       Найденный элемент основного ключа
+ * @param request     Текст запроса
+ * @param request_len Длина запроса
+ * @param variant_len Указатель для сохранения длины ключа варианта
+ * @return Ключ варианта (malloc) или NULL, если подходит сам элемент
+ * @details Пока заголовки ответа не получены, Vary элемента неизвестен, и запрос
+ *          присоединяется к уже идущей загрузке.
+ */
+static char *entry_variant_key(cache_entry_t *entry, const char *request, size_t request_len, size_t *variant_len) {
+    pthread_mutex_lock(&entry->mutex);
+    char *variant = NULL;
+    if (entry->vary != NULL) {
+        variant = http_build_variant_key(entry->key, entry->key_len, entry->vary, strlen(entry->vary), request, request_len, variant_len);
+        if (variant != NULL && *variant_len == entry->vary_key_len && memcmp(variant, entry->vary_key, *variant_len) == 0) { // Тот же вариант
+            free(variant);
+            variant = NULL;
+        }
+    }
+    pthread_mutex_unlock(&entry->mutex);
+    return variant;
+}
+
 /**
  * @brief Ищет элемент кэша по запросу
- * @details Если элемент найден но еще загружается, блокирует поток до готовности
  * @param cache        Кэш для поиска
  * @param request      Текст запроса для поиска
  * @param request_len  Длина запроса
- * @return Указатель на найденный элемент или NULL если не найден
+ * @return Указатель на найденный элемент (захваченный) или NULL если не найден
  */
 cache_entry_t *cache_get(cache_t *cache, const char *request, size_t request_len) {
     if (cache == NULL || request == NULL) return NULL;
-    int index = hash(request, request_len, cache->capacity);
-    cache_node_t *curr = cache->array[index];
-    while (curr != NULL) {
-        pthread_rwlock_rdlock(&curr->rwlock);
-        if (curr->entry->request_len == request_len && strncmp(curr->entry->request, request, request_len) == 0 && !curr->entry->deleted) {
-            gettimeofday(&curr->last_modified_time, 0);
-            // Обновляем LRU: перемещаем в голову
-            move_to_head(cache, curr);
-            cache_entry_t *entry = curr->entry;
-            pthread_rwlock_unlock(&curr->rwlock);
-            return entry;
-        }
-        pthread_rwlock_unlock(&curr->rwlock);
-        curr = curr->next;
+    size_t key_len;
+    char *key = http_build_cache_key(request, request_len, &key_len);
+    if (key == NULL) return NULL;
+    int created;
+    cache_entry_t *entry = key_get_or_add(cache, key, key_len, NULL, 0, &created);
+    free(key);
+    if (entry == NULL) return NULL;
+    size_t variant_len;
+    char *variant = entry_variant_key(entry, request, request_len, &variant_len);
+    if (variant != NULL) { // Ответ зависит от заголовков запроса - ищем вариант
+        cache_entry_release(entry);
+        entry = key_get_or_add(cache, variant, variant_len, NULL, 0, &created);
+        free(variant);
     }
-    return NULL;
+    return entry;
+}
+
+/**
+ * @brief Ищет элемент кэша по запросу, а если его нет - добавляет новый
+ * @param cache        Кэш
+ * @param request      Текст запроса (при создании элемента передается ему во владение)
+ * @param request_len  Длина запроса
+ * @param created      Указатель для сохранения признака: 1 - элемент создан, CACHE_REVALIDATING - создан
+ *                     вместо устаревшего и загружается его проверкой, 0 - найден
+ * @return Указатель на элемент (захваченный) или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Строит нормализованный ключ запроса
+ *          2. Атомарно ищет или создает элемент этого ключа (устаревший элемент заменяется новым)
+ *          3. Если элемент найден и его ответ зависит от заголовков запроса (Vary),
+ *             а значения этих заголовков отличаются, повторяет шаг 2 для ключа варианта
+ */
+cache_entry_t *cache_get_or_add(cache_t *cache, char *request, size_t request_len, int *created) {
+    if (cache == NULL || request == NULL || created == NULL) return NULL;
+    *created = 0;
+    size_t key_len;
+    char *key = http_build_cache_key(request, request_len, &key_len);
+    if (key == NULL) return NULL;
+    cache_entry_t *entry = key_get_or_add(cache, key, key_len, request, request_len, created);
+    if (!*created) free(key);
+    if (entry == NULL || *created) return entry;
+    size_t variant_len;
+    char *variant = entry_variant_key(entry, request, request_len, &variant_len);
+    if (variant != NULL) { // Ответ зависит от заголовков запроса - ищем или создаем вариант
+        cache_entry_release(entry);
+        entry = key_get_or_add(cache, variant, variant_len, request, request_len, created);
+        if (!*created) free(variant);
+    }
+    return entry;
 }
 
 /**
@@ -288,68 +1357,330 @@ cache_entry_t *cache_get(cache_t *cache, const char *request, size_t request_len
  * @param cache Кэш для добавления
  * @param entry Элемент для добавления
  * @return SUCCESS при успешном добавлении, ERROR при ошибке
+ * @details Если у элемента еще нет ключа, он строится по тексту запроса.
  */
 int cache_add(cache_t *cache, cache_entry_t *entry) {
     if (cache == NULL || entry == NULL) return ERROR;
-    cache_node_t *node = cache_node_create(entry);
+    if (entry->key == NULL) {
+        entry->key = http_build_cache_key(entry->request, entry->request_len, &entry->key_len);
+        if (entry->key == NULL) return ERROR;
+    }
+    uint64_t h = hash_bytes(entry->key, entry->key_len, 0);
+    cache_node_t *node = cache_node_create(entry, h);
     if (node == NULL) return ERROR;
-    int index = hash(entry->request, entry->request_len, cache->capacity);
-    pthread_rwlock_wrlock(&node->rwlock); // Блокировка нового узла
-    node->next = cache->array[index];
-    cache->array[index] = node;
-    pthread_rwlock_unlock(&node->rwlock);
-    // Добавляем в голову LRU
-    pthread_mutex_lock(&cache->lru_mutex);
-    node->lru_next = cache->lru_head->lru_next;
-    node->lru_next->lru_prev = node;
-    cache->lru_head->lru_next = node;
-    node->lru_prev = cache->lru_head;
-    atomic_fetch_add(&cache->current_size, 1);
-    pthread_mutex_unlock(&cache->lru_mutex);
-    // Проверяем переполнение и вытесняем если нужно
-    while (atomic_load(&cache->current_size) > cache->capacity) {
-        remove_tail(cache);
+    cache_shard_t *shard = get_shard(cache, h);
+    pthread_mutex_lock(&shard->mutex);
+    int ret = shard_insert(cache, shard, node); // Добавляем в голову LRU и в кучу
+    if (ret == SUCCESS) cache_entry_acquire(entry); // Собственная ссылка кэша
+    pthread_mutex_unlock(&shard->mutex);
+    if (ret == ERROR) {
+        free(node);
+        return ERROR;
+    }
+    cache_evict(cache, shard); // Вытесняем, если превышен бюджет
+    return SUCCESS;
+}
+
+/**
+ * @brief Учитывает данные, дописанные в ответ элемента
+ * @param cache Кэш
+ * @param entry Элемент
+ * @param bytes Количество дописанных байт
+ * @details Алгоритм работы:
+ *          1. Находит узел элемента в его сегменте (если элемента уже нет в кэше - ничего не делает)
+ *          2. Увеличивает размер узла и кэша, пересчитывает приоритет узла
+ *          3. После освобождения мьютекса вытесняет элементы, если превышен бюджет
+ * @note Элемент, который сам больше бюджета, по мере загрузки становится наименее
+ *       ценным в своем сегменте и вытесняется; клиенты, уже читающие его, дочитывают ответ.
+ */
+void cache_account(cache_t *cache, cache_entry_t *entry, size_t bytes) {
+    if (cache == NULL || entry == NULL || entry->key == NULL || entry->deleted) return;
+    uint64_t h = hash_bytes(entry->key, entry->key_len, 0);
+    cache_shard_t *shard = get_shard(cache, h);
+    pthread_mutex_lock(&shard->mutex);
+    cache_node_t *node = shard_find(shard, h, entry->key, entry->key_len);
+    if (node != NULL && node->entry == entry) {
+        node->size += bytes;
+        shard->bytes += bytes;
+        if (node->small) shard->small_bytes += bytes;
+        atomic_fetch_add(&cache->size, bytes);
+        if (cache->policy == CACHE_POLICY_GDSF) heap_update(shard, node);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    cache_evict(cache, shard);
+}
+
+/**
+ * @brief Запоминает заголовок Vary ответа в элементе кэша
+ * @param cache        Кэш
+ * @param entry        Элемент, для которого получен ответ
+ * @param response     Заголовки ответа
+ * @param response_len Длина заголовков
+ * @return SUCCESS при успехе, ERROR при ошибке
+ * @details Алгоритм работы:
+ *          1. Ищет в ответе заголовок Vary, если его нет - ничего не делает
+ *          2. "Vary: *" означает, что ответ нельзя отдавать другим запросам - элемент удаляется из кэша
+ *          3. Иначе строит ключ варианта по запросу, для которого загружен ответ,
+ *             и сохраняет его вместе со значением Vary в элементе
+ */
+int cache_set_vary(cache_t *cache, cache_entry_t *entry, const char *response, size_t response_len) {
+    if (cache == NULL || entry == NULL || entry->key == NULL || entry->request == NULL) return ERROR;
+    const char *vary;
+    size_t vary_len;
+    if (http_get_vary(response, response_len, &vary, &vary_len) == ERROR) return ERROR;
+    if (vary == NULL || vary_len == 0) return SUCCESS;
+    if (vary_len == 1 && vary[0] == '*') {
+        proxy_log("Response varies on *, not cacheable");
+        cache_remove_entry(cache, entry);
+        return SUCCESS;
     }
+    size_t vary_key_len;
+    char *vary_key = http_build_variant_key(entry->key, entry->key_len, vary, vary_len, entry->request, entry->request_len, &vary_key_len);
+    char *vary_copy = strndup(vary, vary_len);
+    if (vary_key == NULL || vary_copy == NULL) {
+        proxy_log_error("Cache vary setting error: %s", strerror(errno));
+        free(vary_key);
+        free(vary_copy);
+        return ERROR;
+    }
+    pthread_mutex_lock(&entry->mutex);
+    free(entry->vary);
+    free(entry->vary_key);
+    entry->vary = vary_copy;
+    entry->vary_key = vary_key;
+    entry->vary_key_len = vary_key_len;
+    pthread_mutex_unlock(&entry->mutex);
     return SUCCESS;
 }
 
+/**
+ * @brief Запоминает свежесть и валидаторы ответа в элементе кэша
+ * @param cache        Кэш
+ * @param entry        Элемент, для которого получен ответ
+ * @param response     Заголовки ответа
+ * @param response_len Длина заголовков
+ * @return SUCCESS при успехе, ERROR при ошибке
+ * @details Алгоритм работы:
+ *          1. Вычисляет срок свежести ответа (http_get_freshness)
+ *          2. Ответ, который нельзя хранить в общем кэше (no-store, private), удаляется из кэша
+ *          3. Иначе сохраняет ETag и Last-Modified для условных запросов и срок свежести,
+ *             отсчитанный от текущего момента
+ */
+int cache_set_freshness(cache_t *cache, cache_entry_t *entry, const char *response, size_t response_len) {
+    if (cache == NULL || entry == NULL) return ERROR;
+    http_freshness_t freshness;
+    if (http_get_freshness(response, response_len, &freshness) == ERROR) return ERROR;
+    if (freshness.no_store) {
+        proxy_log("Response is not storable in a shared cache");
+        cache_remove_entry(cache, entry);
+        return SUCCESS;
+    }
+    char *etag, *last_modified;
+    if (copy_validators(response, response_len, &etag, &last_modified) == ERROR) return ERROR;
+    pthread_mutex_lock(&entry->mutex);
+    free(entry->etag);
+    free(entry->last_modified);
+    entry->etag = etag;
+    entry->last_modified = last_modified;
+    entry_set_lifetime(entry, freshness.lifetime_ms, freshness.stale_while_revalidate_ms);
+    pthread_mutex_unlock(&entry->mutex);
+    return SUCCESS;
+}
+
+/**
+ * @brief Продлевает свежесть элемента по ответу 304 Not Modified
+ * @param cache        Кэш
+ * @param stale        Проверенный элемент
+ * @param pending      Элемент, заменивший его в кэше (NULL - не заменен)
+ * @param response     Заголовки ответа 304
+ * @param response_len Длина заголовков
+ * @return SUCCESS при успехе, ERROR при ошибке
+ * @details Алгоритм работы:
+ *          1. Если ответ 304 задает срок свежести, он заменяет прежний (вместе со stale-while-revalidate),
+ *             иначе прежний срок отсчитывается заново; валидаторы из ответа 304 заменяют прежние
+ *          2. Если pending не задан, больше ничего не нужно: элемент остается в кэше свежим
+ *          3. Иначе копирует сохраненный ответ, Vary и валидаторы в pending и учитывает
+ *             его размер в бюджете кэша. Мьютексы двух элементов не захватываются одновременно
+ */
+int cache_refresh(cache_t *cache, cache_entry_t *stale, cache_entry_t *pending, const char *response, size_t response_len) {
+    if (cache == NULL || stale == NULL) return ERROR;
+    http_freshness_t freshness;
+    if (http_get_freshness(response, response_len, &freshness) == ERROR) return ERROR;
+    char *etag, *last_modified;
+    if (copy_validators(response, response_len, &etag, &last_modified) == ERROR) return ERROR;
+    pthread_mutex_lock(&stale->mutex);
+    if (etag != NULL) {
+        free(stale->etag);
+        stale->etag = etag;
+    }
+    if (last_modified != NULL) {
+        free(stale->last_modified);
+        stale->last_modified = last_modified;
+    }
+    if (freshness.lifetime_ms != HTTP_FRESHNESS_UNKNOWN) {
+        entry_set_lifetime(stale, freshness.lifetime_ms, freshness.stale_while_revalidate_ms);
+    } else {
+        entry_set_lifetime(stale, stale->lifetime_ms, stale->stale_while_revalidate_ms);
+    }
+    if (pending == NULL) {
+        pthread_mutex_unlock(&stale->mutex);
+        return SUCCESS;
+    }
+    long long lifetime_ms = stale->lifetime_ms, stale_ms = stale->stale_while_revalidate_ms;
+    int ret = SUCCESS;
+    errno = 0;
+    etag = stale->etag != NULL ? strdup(stale->etag) : NULL;
+    last_modified = stale->last_modified != NULL ? strdup(stale->last_modified) : NULL;
+    char *vary = stale->vary != NULL ? strdup(stale->vary) : NULL;
+    char *vary_key = NULL;
+    size_t vary_key_len = stale->vary_key_len;
+    if (stale->vary_key != NULL) {
+        vary_key = malloc(vary_key_len);
+        if (vary_key != NULL) memcpy(vary_key, stale->vary_key, vary_key_len);
+    }
+    if ((stale->etag != NULL && etag == NULL) || (stale->last_modified != NULL && last_modified == NULL) ||
+        (stale->vary != NULL && vary == NULL) || (stale->vary_key != NULL && vary_key == NULL)) {
+        ret = ERROR;
+    }
+    int delimited = stale->delimited;
+    pthread_mutex_unlock(&stale->mutex);
+    message_t *copy = NULL; // Ответ устаревшего элемента полностью загружен и больше не меняется
+    message_reader_t reader = {0};
+    const char *part;
+    size_t part_len;
+    while (ret == SUCCESS && (part = message_peek(stale->response, &reader, &part_len)) != NULL) {
+        ret = message_add_part(&copy, part, part_len);
+        message_consume(&reader, part_len);
+    }
+    if (ret == ERROR) {
+        proxy_log_error("Cache entry refreshing error: failed to copy stored response");
+        free(etag);
+        free(last_modified);
+        free(vary);
+        free(vary_key);
+        if (copy != NULL) message_destroy(&copy);
+        return ERROR;
+    }
+    pthread_mutex_lock(&pending->mutex);
+    free(pending->etag);
+    free(pending->last_modified);
+    free(pending->vary);
+    free(pending->vary_key);
+    if (pending->response != NULL) message_destroy(&pending->response);
+    pending->etag = etag;
+    pending->last_modified = last_modified;
+    pending->vary = vary;
+    pending->vary_key = vary_key;
+    pending->vary_key_len = vary_key_len;
+    pending->response = copy;
+    pending->delimited = delimited;
+    entry_set_lifetime(pending, lifetime_ms, stale_ms);
+    pthread_mutex_unlock(&pending->mutex);
+    cache_account(cache, pending, message_length(copy));
+    return SUCCESS;
+}
+
+/**
+ * @brief Заменяет в кэше устаревший элемент новым
+ * @param cache Кэш
+ * @param stale Устаревший элемент
+ * @param entry Новый элемент (без ключа - получает копию ключа stale)
+ * @return SUCCESS при успехе, ERROR при ошибке
+ * @details Устаревший элемент исключается, если он еще в кэше; если его успели удалить
+ *          или вытеснить, новый элемент просто добавляется. Если по ключу уже лежит
+ *          другой элемент, новый не добавляется: тот не старше проверенного.
+ */
+int cache_replace_entry(cache_t *cache, cache_entry_t *stale, cache_entry_t *entry) {
+    if (cache == NULL || stale == NULL || entry == NULL || stale->key == NULL) return ERROR;
+    if (entry->key == NULL) {
+        errno = 0;
+        entry->key = malloc(stale->key_len);
+        if (entry->key == NULL) {
+            proxy_log_error("Cache entry replacing error: %s", strerror(errno));
+            return ERROR;
+        }
+        memcpy(entry->key, stale->key, stale->key_len);
+        entry->key_len = stale->key_len;
+    }
+    uint64_t h = hash_bytes(entry->key, entry->key_len, 0);
+    cache_node_t *node = cache_node_create(entry, h);
+    if (node == NULL) return ERROR;
+    cache_shard_t *shard = get_shard(cache, h);
+    pthread_mutex_lock(&shard->mutex);
+    cache_node_t *old = shard_find(shard, h, entry->key, entry->key_len);
+    int ret = old == NULL || old->entry == stale ? SUCCESS : ERROR;
+    if (ret == ERROR) old = NULL; // Чужой узел остается в кэше
+    if (old != NULL) shard_unlink(cache, shard, old);
+    if (ret == SUCCESS) ret = shard_insert(cache, shard, node);
+    if (ret == SUCCESS) cache_entry_acquire(entry); // Собственная ссылка кэша
+    pthread_mutex_unlock(&shard->mutex);
+    if (old != NULL) node_retire(old);
+    if (ret == ERROR) {
+        free(node);
+        return ERROR;
+    }
+    cache_evict(cache, shard);
+    return SUCCESS;
+}
+
+/**
+ * @brief Задает функцию, проверяющую устаревшие элементы у сервера
+ * @param cache      Кэш
+ * @param revalidate Функция проверки (NULL - не проверять)
+ * @param arg        Аргумент для функции
+ */
+void cache_set_revalidator(cache_t *cache, cache_revalidate_t revalidate, void *arg) {
+    if (cache == NULL) return;
+    cache->revalidate = revalidate;
+    cache->revalidate_arg = arg;
+}
+
 /**
  * @brief Удаляет элемент из кэша по запросу
  * @param cache        Кэш для удаления
  * @param request      Текст запроса для удаления
  * @param request_len  Длина запроса
  * @return SUCCESS при успешном удалении, ERROR или NOT_FOUND при ошибке
+ * @details Удаляется элемент основного ключа запроса.
  */
 int cache_delete(cache_t *cache, const char *request, size_t request_len) {
     if (cache == NULL || request == NULL) return ERROR;
-    int index = hash(request, request_len, cache->capacity);
-    cache_node_t *curr = cache->array[index];
-    cache_node_t *prev = NULL;
-    while (curr != NULL) {
-        pthread_rwlock_rdlock(&curr->rwlock);
-        if (curr->entry->request_len == request_len && strncmp(curr->entry->request, request, request_len) == 0) {
-            // Удаляем из LRU сначала
-            pthread_mutex_lock(&cache->lru_mutex);
-            _lru_remove(curr);
-            atomic_fetch_sub(&cache->current_size, 1);
-            pthread_mutex_unlock(&cache->lru_mutex);
-            // Удаляем из цепочки хэш-таблицы
-            if (prev == NULL) {
-                cache->array[index] = curr->next;
-            } else {
-                prev->next = curr->next;
-            }
-            pthread_rwlock_unlock(&curr->rwlock);
-            curr->entry->deleted = 1;
-            pthread_cond_broadcast(&curr->entry->ready_cond);
-            cache_node_destroy(curr);
-            return SUCCESS;
-        }
-        pthread_rwlock_unlock(&curr->rwlock);
-        prev = curr;
-        curr = curr->next;
-    }
-    return NOT_FOUND;
+    size_t key_len;
+    char *key = http_build_cache_key(request, request_len, &key_len);
+    if (key == NULL) return ERROR;
+    uint64_t h = hash_bytes(key, key_len, 0);
+    cache_shard_t *shard = get_shard(cache, h);
+    pthread_mutex_lock(&shard->mutex);
+    cache_node_t *node = shard_find(shard, h, key, key_len);
+    if (node != NULL) shard_unlink(cache, shard, node);
+    pthread_mutex_unlock(&shard->mutex);
+    free(key);
+    if (node == NULL) return NOT_FOUND;
+    node_retire(node);
+    return SUCCESS;
+}
+
+/**
+ * @brief Удаляет из кэша именно этот элемент
+ * @param cache Кэш
+ * @param entry Элемент для удаления
+ * @return SUCCESS при успешном удалении, ERROR или NOT_FOUND если элемент уже не в кэше
+ * @details В отличие от cache_delete не трогает другой элемент с тем же ключом,
+ *          добавленный после того, как этот был вытеснен.
+ */
+int cache_remove_entry(cache_t *cache, cache_entry_t *entry) {
+    if (cache == NULL || entry == NULL) return ERROR;
+    if (entry->deleted || entry->key == NULL) return NOT_FOUND;
+    uint64_t h = hash_bytes(entry->key, entry->key_len, 0);
+    cache_shard_t *shard = get_shard(cache, h);
+    pthread_mutex_lock(&shard->mutex);
+    cache_node_t *node = shard_find(shard, h, entry->key, entry->key_len);
+    if (node != NULL && node->entry != entry) node = NULL;
+    if (node != NULL) shard_unlink(cache, shard, node);
+    pthread_mutex_unlock(&shard->mutex);
+    if (node == NULL) return NOT_FOUND;
+    node_retire(node);
+    return SUCCESS;
 }
 
 /**
@@ -360,61 +1691,147 @@ void cache_destroy(cache_t *cache) {
     if (cache == NULL) return;
     atomic_store(&cache->garbage_collector_running, 0);
     pthread_join(cache->garbage_collector, NULL);
-    for (int i = 0; i < cache->capacity; i++) {
-        cache_node_t *curr = cache->array[i];
-        while (curr != NULL) {
-            cache_node_t *next = curr->next;
-            // Удаляем из LRU (хотя список уже пустеет)
-            _lru_remove(curr);
+    epoch_barrier(); // Исключенные узлы и замененные таблицы
+    for (int i = 0; i < cache->shard_count; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        cache_node_t *curr = shard->small_head.lru_next; // Все узлы сегмента есть в одном из списков
+        while (curr != &shard->small_tail) {
+            cache_node_t *next = curr->lru_next;
             cache_node_destroy(curr);
             curr = next;
         }
+        curr = shard->lru_head.lru_next;
+        while (curr != &shard->lru_tail) {
+            cache_node_t *next = curr->lru_next;
+            cache_node_destroy(curr);
+            curr = next;
+        }
+        pthread_mutex_destroy(&shard->mutex);
+        free(shard->table);
+        free(shard->old_table);
+        free(shard->heap);
+        free(shard->ghost);
     }
-    // Уничтожаем dummy nodes
-    free(cache->lru_head);
-    free(cache->lru_tail);
-    pthread_mutex_destroy(&cache->lru_mutex);
-    free(cache->array);
+    free(cache->shards);
     free(cache);
 }
 
 /**
  * @brief Функция потока garbage collector'а
  * @param arg Указатель на структуру cache_t
- * @details Бесконечный цикл, который периодически проверяет все элементы кэша
- *          и удаляет те, которые не использовались дольше entry_expired_time_ms.
+ * @details Раз в такт колеса таймеров проворачивает колесо каждого сегмента
+ *          и удаляет элементы, которые не использовались дольше entry_expired_time_ms.
+ *          Мьютекс удерживается только на время обработки одного сегмента;
+ *          исключенные узлы передаются в node_retire вне мьютекса.
  *          Работает в фоновом режиме, пока garbage_collector_running == 1.
  */
 static void *garbage_collector_routine(void *arg) {
-    pthread_setname_np("garbage-collector");
+    proxy_set_thread_name("garbage-collector");
     if (arg == NULL) {
-        proxy_log("Cache garbage collector error: cache is NULL");
+        proxy_log_error("Cache garbage collector error: cache is NULL");
         pthread_exit(NULL);
     }
     cache_t *cache = (cache_t *) arg;
     proxy_log("Cache garbage collector start");
-    struct timeval curr_time;
     while (atomic_load(&cache->garbage_collector_running)) {
-        usleep(MIN(1000 * cache->entry_expired_time_ms / 2, 1000000)); // Проверяем элементы в 2 раза чаще чем время их жизни
-        proxy_log("Garbage collector running");
-        gettimeofday(&curr_time, 0);
-        for (int i = 0; i < cache->capacity; i++) { // Проход по всем индексам
-            cache_node_t *curr = cache->array[i]; // Первый элемент в цепочке
-            if (curr == NULL) continue;
-            cache_node_t *next = NULL; // Указатель на следующий узел
-            while (curr != NULL) {
-                pthread_rwlock_rdlock(&curr->rwlock);
-                time_t diff = (curr_time.tv_sec - curr->last_modified_time.tv_sec) * 1000 +
-                              (curr_time.tv_usec - curr->last_modified_time.tv_usec) / 1000; // Вычисление времени, прошедшего с последнего доступа
-                next = curr->next; // Получение следующего элемента
-                pthread_rwlock_unlock(&curr->rwlock);
-                if (diff >= cache->entry_expired_time_ms) { // Проверка истекло ли время жизни элемента
-                    cache_delete(cache, curr->entry->request, curr->entry->request_len); // Удаление элемента
-                }
-                curr = next;
-            }
+        usleep(cache->tick_ms * 1000);
+        proxy_log_debug("Garbage collector running");
+        long long now = proxy_clock_now_ms();
+        for (int i = 0; i < cache->shard_count; i++) { // Проход по всем сегментам
+            cache_shard_t *shard = &cache->shards[i];
+            cache_node_t *expired = NULL; // Исключенные узлы, уничтожаются после освобождения мьютекса
+            pthread_mutex_lock(&shard->mutex);
+            wheel_advance(cache, shard, now, &expired);
+            pthread_mutex_unlock(&shard->mutex);
+            retire_nodes(expired);
         }
+        epoch_collect(); // Освобождает отложенное и тогда, когда удалений нет
     }
     proxy_log("Cache garbage collector destroy");
     pthread_exit(NULL);
 }
+
+/**
+ * @brief Кладет узел в ячейку колеса таймеров по его сроку
+ * @param cache Кэш
+ * @param shard Сегмент (мьютекс должен быть захвачен)
+ * @param node  Узел (не должен быть в колесе)
+ * @details Такт срока округляется вверх, поэтому ячейка срабатывает не раньше срока.
+ *          Уровень выбирается по старшей группе из WHEEL_BITS бит, в которой такт срока
+ *          отличается от текущего: цифра срока в этой группе больше текущей, и колесо
+ *          дойдет до ячейки ровно тогда, когда узел пора спустить на нижний уровень.
+ */
+static void timer_schedule(cache_t *cache, cache_shard_t *shard, cache_node_t *node) {
+    long long expires_ms = atomic_load_explicit(&node->expires_ms, memory_order_relaxed);
+    uint64_t deadline = (uint64_t) ((expires_ms + cache->tick_ms - 1) / cache->tick_ms);
+    if (deadline < shard->wheel_tick) deadline = shard->wheel_tick;
+    uint64_t diff = deadline ^ shard->wheel_tick;
+    int level = 0;
+    while (level < WHEEL_LEVELS && (diff >> (WHEEL_BITS * (level + 1))) != 0) level++;
+    cache_node_t **slot = level == WHEEL_LEVELS ? &shard->wheel_far
+                                                : &shard->wheel[level][(deadline >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    node->timer_next = *slot;
+    if (*slot != NULL) (*slot)->timer_pprev = &node->timer_next;
+    *slot = node;
+    node->timer_pprev = slot;
+}
+
+/**
+ * @brief Убирает узел из колеса таймеров
+ * @param node Узел
+ */
+static void timer_cancel(cache_node_t *node) {
+    if (node->timer_pprev == NULL) return;
+    *node->timer_pprev = node->timer_next;
+    if (node->timer_next != NULL) node->timer_next->timer_pprev = node->timer_pprev;
+    node->timer_next = NULL;
+    node->timer_pprev = NULL;
+}
+
+/**
+ * @brief Проворачивает колесо таймеров сегмента до текущего времени
+ * @param cache   Кэш
+ * @param shard   Сегмент (мьютекс должен быть захвачен)
+ * @param now     Текущее время (мс)
+ * @param expired Список исключенных узлов (связанных через timer_next), дополняется
+ * @details Алгоритм работы для каждого такта до текущего включительно:
+ *          1. Если такт начинает оборот уровня l (младшие WHEEL_BITS * l бит нулевые),
+ *             перекладывает узлы текущей ячейки уровня l (для последнего оборота - список far)
+ *             на нижние уровни
+ *          2. Забирает ячейку такта нижнего уровня: устаревшие узлы исключает из сегмента,
+ *             а узлы, к которым обращались после постановки в колесо, кладет по новому сроку
+ */
+static void wheel_advance(cache_t *cache, cache_shard_t *shard, long long now, cache_node_t **expired) {
+    uint64_t now_tick = (uint64_t) (now / cache->tick_ms);
+    while (shard->wheel_tick <= now_tick) {
+        uint64_t tick = shard->wheel_tick;
+        for (int level = 1; level <= WHEEL_LEVELS && (tick & ((1ULL << (WHEEL_BITS * level)) - 1)) == 0; level++) {
+            cache_node_t **slot = level == WHEEL_LEVELS ? &shard->wheel_far
+                                                        : &shard->wheel[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+            cache_node_t *node = *slot;
+            *slot = NULL;
+            while (node != NULL) {
+                cache_node_t *next = node->timer_next;
+                node->timer_pprev = NULL;
+                timer_schedule(cache, shard, node);
+                node = next;
+            }
+        }
+        cache_node_t *node = shard->wheel[0][tick & WHEEL_MASK];
+        shard->wheel[0][tick & WHEEL_MASK] = NULL;
+        shard->wheel_tick = tick + 1; // Узлы с новым сроком не должны вернуться в забранную ячейку
+        while (node != NULL) {
+            cache_node_t *next = node->timer_next;
+            node->timer_pprev = NULL;
+            if (atomic_load_explicit(&node->expires_ms, memory_order_relaxed) <= now) {
+                shard_unlink(cache, shard, node);
+                node->timer_next = *expired;
+                *expired = node;
+                metrics_add(METRIC_CACHE_EXPIRATIONS, 1);
+            } else {
+                timer_schedule(cache, shard, node);
+            }
+            node = next;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#include "clock.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define CLOCK_TICK_MS   10  // Период обновления часов: сроки жизни и таймауты задаются с точностью не выше этой
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define CLOCK_SOURCE    CLOCK_MONOTONIC_COARSE // Читается без системного вызова и без синхронизации счетчиков ядер
+#else
+#define CLOCK_SOURCE    CLOCK_MONOTONIC
+#endif
+
+atomic_llong proxy_clock_ms = -1;
+
+static pthread_t ticker;                // Поток часов
+static atomic_int ticker_running = 0;   // Флаг работы потока часов
+
+/**
+ * @brief Функция потока часов
+ * @param arg Не используется
+ * @return NULL
+ */
+static void *clock_ticker(void *arg);
+
+/**
+ * @brief Останавливает поток часов (вызывается при выходе из процесса)
+ * @details После остановки proxy_clock_now_ms снова читает часы ядра.
+ */
+static void clock_stop(void);
+
+/**
+ * @brief Запускает поток часов
+ * @details Время записывается до запуска потока, поэтому первое же чтение
+ *          после proxy_clock_start получает актуальное значение.
+ */
+void proxy_clock_start(void) {
+    if (atomic_exchange(&ticker_running, 1)) return;
+    atomic_store(&proxy_clock_ms, proxy_clock_read_ms());
+    if (pthread_create(&ticker, NULL, clock_ticker, NULL) != 0) {
+        proxy_log_error("Clock starting error: failed to create ticker thread, reading kernel clock instead");
+        atomic_store(&ticker_running, 0);
+        atomic_store(&proxy_clock_ms, -1);
+        return;
+    }
+    atexit(clock_stop);
+}
+
+/**
+ * @brief Читает монотонные часы ядра
+ * @return Время в миллисекундах
+ */
+long long proxy_clock_read_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_SOURCE, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Функция потока часов
+ * @param arg Не используется
+ * @return NULL
+ * @details Раз в CLOCK_TICK_MS записывает время часов ядра; читатели видят его
+ *          с задержкой не больше одного периода.
+ */
+static void *clock_ticker(__attribute__((unused)) void *arg) {
+    proxy_set_thread_name("clock");
+    while (atomic_load_explicit(&ticker_running, memory_order_relaxed)) {
+        usleep(CLOCK_TICK_MS * 1000);
+        atomic_store_explicit(&proxy_clock_ms, proxy_clock_read_ms(), memory_order_relaxed);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Останавливает поток часов (вызывается при выходе из процесса)
+ * @details После остановки proxy_clock_now_ms снова читает часы ядра.
+ */
+static void clock_stop(void) {
+    atomic_store(&ticker_running, 0);
+    pthread_join(ticker, NULL);
+    atomic_store(&proxy_clock_ms, -1);
+}
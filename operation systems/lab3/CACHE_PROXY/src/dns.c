@@ -0,0 +1,929 @@
+#include "dns.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "hash.h"
+#include "log.h"
+
+#define DNS_BUCKET_COUNT    256             // Количество корзин таблицы имен (степень двойки)
+#define DNS_MAX_NAMES       4096            // Предел количества имен в кэше
+#define DNS_MAX_NAME_LEN    253             // Предельная длина имени без завершающей точки
+#define DNS_MAX_LABEL_LEN   63
+#define DNS_MAX_JUMPS       16              // Предел переходов по ссылкам сжатия в одном имени
+#define DNS_PACKET_SIZE     512             // Размер запроса и ответа без EDNS
+#define DNS_PORT            53
+#define DNS_RETRY_MS        500             // Таймаут первой попытки, каждая следующая ждет вдвое дольше
+#define DNS_ATTEMPTS        3
+#define DNS_MAX_TTL_S       3600            // Предел времени хранения ответа
+#define DNS_SWEEP_MS        1000            // Период удаления устаревших имен
+#define DNS_PERMANENT       LLONG_MAX       // Время устаревания имен из /etc/hosts
+#define RESOLV_CONF_PATH    "/etc/resolv.conf"
+#define HOSTS_PATH          "/etc/hosts"
+
+#define DNS_TYPE_A          1
+#define DNS_TYPE_CNAME      5
+#define DNS_TYPE_SOA        6
+#define DNS_CLASS_IN        1
+#define DNS_FLAG_QR         0x8000
+#define DNS_FLAG_TC         0x0200
+#define DNS_FLAG_RD         0x0100
+#define DNS_RCODE_MASK      0x000F
+#define DNS_RCODE_NOERROR   0
+#define DNS_RCODE_NXDOMAIN  3
+
+/**
+ * @brief Состояние имени в кэше резолвера
+ */
+typedef enum {
+    DNS_NAME_PENDING,   // DNS-запрос отправлен, ответа еще нет
+    DNS_NAME_RESOLVED,  // адрес известен
+    DNS_NAME_FAILED     // имя не разрешается (отрицательное кэширование)
+} dns_name_state_t;
+
+/**
+ * @brief Имя хоста в кэше резолвера
+ * @var host         Имя в нижнем регистре без завершающей точки
+ * @var hash         Хэш имени
+ * @var state        Состояние
+ * @var addr         Адрес (в состоянии DNS_NAME_RESOLVED)
+ * @var expires      Когда ответ устаревает (мс, монотонные часы)
+ * @var id           Идентификатор отправленного DNS-запроса
+ * @var attempts     Сколько раз запрос был отправлен
+ * @var retry_at     Когда запрос отправляется повторно (мс, монотонные часы)
+ * @var waiters      Запросы, ждущие ответа
+ * @var next         Следующее имя в цепочке коллизий
+ * @var pending_next Следующее имя в списке ожидающих ответа
+ */
+typedef struct dns_name_t {
+    char *host;
+    uint64_t hash;
+    dns_name_state_t state;
+    struct in_addr addr;
+    long long expires;
+    uint16_t id;
+    int attempts;
+    long long retry_at;
+    dns_query_t *waiters;
+    struct dns_name_t *next;
+    struct dns_name_t *pending_next;
+} dns_name_t;
+
+/**
+ * @brief Резолвер
+ * @var mutex           Мьютекс, защищающий таблицу имен и очереди ожидания
+ * @var done_cond       Условная переменная, по которой оповещаются блокирующие запросы
+ * @var buckets         Корзины таблицы имен
+ * @var name_count      Количество имен в таблице
+ * @var pending         Список имен, ждущих ответа сервера
+ * @var socket          UDP-сокет, подключенный к серверу имен (ERROR, если сервера нет)
+ * @var wake            Канал для пробуждения потока резолвера
+ * @var negative_ttl_ms Время отрицательного кэширования по умолчанию
+ * @var id_seed         Случайное начальное значение идентификаторов запросов
+ * @var id_counter      Счетчик для генерации идентификаторов
+ * @var hits            Счетчик ответов из кэша
+ * @var misses          Счетчик отправленных DNS-запросов
+ * @var coalesced       Счетчик запросов, присоединившихся к отправленному
+ * @var failures        Счетчик отказов
+ * @var running         Атомарный флаг работы потока
+ * @var thread          Поток резолвера
+ */
+struct dns_resolver_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    dns_name_t *buckets[DNS_BUCKET_COUNT];
+    size_t name_count;
+    dns_name_t *pending;
+    int socket;
+    int wake[2];
+    time_t negative_ttl_ms;
+    uint64_t id_seed;
+    uint64_t id_counter;
+    atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_size_t coalesced;
+    atomic_size_t failures;
+    atomic_int running;
+    pthread_t thread;
+};
+
+/**
+ * @brief Приводит имя хоста к виду, в котором оно хранится в кэше
+ * @param host Имя хоста
+ * @param out  Буфер размера DNS_MAX_NAME_LEN + 1
+ * @return Длина имени или ERROR, если имя некорректно
+ */
+static int normalize_host(const char *host, char *out);
+
+/**
+ * @brief Разбирает адрес сервера имен "ip[:port]"
+ * @param server Строка с адресом
+ * @param addr   Указатель для сохранения адреса
+ * @return SUCCESS или ERROR
+ */
+static int parse_server(const char *server, struct sockaddr_in *addr);
+
+/**
+ * @brief Находит первый IPv4-адрес nameserver в /etc/resolv.conf
+ * @param addr Указатель для сохранения адреса
+ * @return SUCCESS или ERROR, если сервер не найден
+ */
+static int read_resolv_conf(struct sockaddr_in *addr);
+
+/**
+ * @brief Добавляет в кэш имена из /etc/hosts
+ * @param resolver Резолвер
+ */
+static void load_hosts(dns_resolver_t *resolver);
+
+/**
+ * @brief Находит имя в таблице
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param host     Нормализованное имя
+ * @param hash     Хэш имени
+ * @return Имя или NULL, если его нет
+ */
+static dns_name_t *find_name(dns_resolver_t *resolver, const char *host, uint64_t hash);
+
+/**
+ * @brief Добавляет имя в таблицу, при необходимости освобождая место
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param host     Нормализованное имя
+ * @param hash     Хэш имени
+ * @param now      Текущее время (мс)
+ * @return Имя или NULL при ошибке
+ */
+static dns_name_t *add_name(dns_resolver_t *resolver, const char *host, uint64_t hash, long long now);
+
+/**
+ * @brief Удаляет имя из таблицы и освобождает его
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param name     Имя без ожидающих запросов
+ */
+static void remove_name(dns_resolver_t *resolver, dns_name_t *name);
+
+/**
+ * @brief Удаляет устаревшие имена
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param now      Текущее время (мс)
+ */
+static void sweep_names(dns_resolver_t *resolver, long long now);
+
+/**
+ * @brief Отправляет серверу DNS-запрос типа A для имени
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param name     Имя в состоянии DNS_NAME_PENDING
+ * @param now      Текущее время (мс)
+ */
+static void send_query(dns_resolver_t *resolver, dns_name_t *name, long long now);
+
+/**
+ * @brief Завершает ожидание имени и оповещает ждущие запросы
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param name     Имя в состоянии DNS_NAME_PENDING
+ * @param status   SUCCESS или ERROR
+ * @param addr     Адрес (при status == SUCCESS)
+ * @param ttl_ms   Сколько миллисекунд хранить результат
+ */
+static void complete_name(dns_resolver_t *resolver, dns_name_t *name, int status, struct in_addr addr, long long ttl_ms);
+
+/**
+ * @brief Читает имя из DNS-сообщения, следуя ссылкам сжатия
+ * @param packet Сообщение
+ * @param len    Длина сообщения
+ * @param off    Смещение имени; после вызова - смещение следующего за именем поля
+ * @param out    Буфер размера DNS_MAX_NAME_LEN + 1 или NULL, если имя нужно пропустить
+ * @return SUCCESS или ERROR, если имя некорректно
+ */
+static int read_name(const uint8_t *packet, size_t len, size_t *off, char *out);
+
+/**
+ * @brief Обрабатывает ответ сервера имен
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param packet   Ответ
+ * @param len      Длина ответа
+ */
+static void handle_response(dns_resolver_t *resolver, const uint8_t *packet, size_t len);
+
+/**
+ * @brief Функция потока резолвера
+ * @param arg Указатель на dns_resolver_t
+ * @return NULL
+ */
+static void *resolver_routine(void *arg);
+
+/**
+ * @brief Создает резолвер и запускает его поток
+ * @param server Адрес сервера имен "ip[:port]" или NULL
+ * @param negative_ttl_ms Время отрицательного кэширования по умолчанию
+ * @return Указатель на резолвер или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Выделяет память и создает неблокирующий канал пробуждения потока
+ *          2. Загружает имена из /etc/hosts (они не устаревают)
+ *          3. Определяет сервер имен (server или /etc/resolv.conf) и подключает к нему UDP-сокет
+ *          4. Запускает поток резолвера
+ */
+dns_resolver_t *dns_resolver_create(const char *server, time_t negative_ttl_ms) {
+    errno = 0;
+    dns_resolver_t *resolver = calloc(1, sizeof(dns_resolver_t));
+    if (resolver == NULL) {
+        proxy_log_error("DNS resolver creation error: %s", strerror(errno));
+        return NULL;
+    }
+    if (pipe2(resolver->wake, O_NONBLOCK | O_CLOEXEC) == ERROR) { // Запись в заполненный канал не должна блокировать поток клиента
+        proxy_log_error("DNS resolver creation error: %s", strerror(errno));
+        free(resolver);
+        return NULL;
+    }
+    pthread_mutex_init(&resolver->mutex, NULL);
+    pthread_cond_init(&resolver->done_cond, NULL);
+    resolver->socket = ERROR;
+    resolver->negative_ttl_ms = negative_ttl_ms;
+    long long seed = proxy_clock_now_ms() ^ ((long long) getpid() << 32);
+    resolver->id_seed = hash_bytes(&seed, sizeof(seed), (uint64_t) (uintptr_t) resolver);
+    atomic_init(&resolver->hits, 0);
+    atomic_init(&resolver->misses, 0);
+    atomic_init(&resolver->coalesced, 0);
+    atomic_init(&resolver->failures, 0);
+    load_hosts(resolver);
+    struct sockaddr_in addr;
+    int found = ERROR;
+    if (server != NULL) {
+        found = parse_server(server, &addr);
+        if (found == ERROR) proxy_log_error("DNS resolver creation error: invalid name server address %s", server);
+    }
+    if (found == ERROR) found = read_resolv_conf(&addr);
+    if (found == SUCCESS) {
+        resolver->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (resolver->socket == ERROR || connect(resolver->socket, (struct sockaddr *) &addr, sizeof(addr)) == ERROR) {
+            proxy_log_error("DNS resolver creation error: %s", strerror(errno));
+            if (resolver->socket != ERROR) close(resolver->socket);
+            resolver->socket = ERROR;
+        } else {
+            char addr_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr.sin_addr, addr_str, sizeof(addr_str));
+            proxy_log("DNS resolver uses name server %s:%d", addr_str, ntohs(addr.sin_port));
+        }
+    }
+    if (resolver->socket == ERROR) proxy_log_error("DNS resolver error: no name server, only IP addresses and names from %s are resolved", HOSTS_PATH);
+    atomic_store(&resolver->running, 1);
+    if (pthread_create(&resolver->thread, NULL, resolver_routine, resolver) != 0) {
+        proxy_log_error("DNS resolver creation error: failed to create resolver thread");
+        atomic_store(&resolver->running, 0);
+        dns_resolver_destroy(resolver);
+        return NULL;
+    }
+    return resolver;
+}
+
+/**
+ * @brief Начинает разрешение имени, не блокируя вызывающий поток
+ * @param resolver Резолвер
+ * @param host Имя хоста или IPv4-адрес
+ * @param query Запрос
+ * @return SUCCESS, DNS_PENDING или ERROR
+ * @details Алгоритм работы:
+ *          1. IPv4-адрес возвращается без обращения к кэшу
+ *          2. Под мьютексом ищет имя в кэше; устаревший результат удаляет
+ *          3. Известный адрес или отказ возвращает сразу
+ *          4. Если DNS-запрос для имени уже отправлен, ставит запрос в его очередь ожидания
+ *          5. Иначе добавляет имя, отправляет DNS-запрос и будит поток резолвера,
+ *             чтобы тот учел таймаут повторной отправки
+ */
+int dns_resolve(dns_resolver_t *resolver, const char *host, dns_query_t *query) {
+    query->done = 0;
+    query->name = NULL;
+    query->next = NULL;
+    if (inet_pton(AF_INET, host, &query->addr) == 1) {
+        query->status = SUCCESS;
+        query->done = 1;
+        return SUCCESS;
+    }
+    char normalized[DNS_MAX_NAME_LEN + 1];
+    int host_len = normalize_host(host, normalized);
+    if (host_len == ERROR) {
+        proxy_log_error("DNS resolving error: invalid host name %s", host);
+        return ERROR;
+    }
+    uint64_t hash = hash_bytes(normalized, host_len, 0);
+    long long now = proxy_clock_now_ms();
+    pthread_mutex_lock(&resolver->mutex);
+    dns_name_t *name = find_name(resolver, normalized, hash);
+    if (name != NULL && name->state != DNS_NAME_PENDING && name->expires <= now) { // Результат устарел
+        remove_name(resolver, name);
+        name = NULL;
+    }
+    if (name != NULL && name->state != DNS_NAME_PENDING) {
+        int status = name->state == DNS_NAME_RESOLVED ? SUCCESS : ERROR;
+        query->addr = name->addr;
+        pthread_mutex_unlock(&resolver->mutex);
+        atomic_fetch_add(&resolver->hits, 1);
+        query->status = status;
+        query->done = 1;
+        return status;
+    }
+    if (name != NULL) { // DNS-запрос уже отправлен - ждем его ответа
+        query->name = name;
+        query->next = name->waiters;
+        name->waiters = query;
+        pthread_mutex_unlock(&resolver->mutex);
+        atomic_fetch_add(&resolver->coalesced, 1);
+        return DNS_PENDING;
+    }
+    if (resolver->socket == ERROR) {
+        pthread_mutex_unlock(&resolver->mutex);
+        proxy_log_error("DNS resolving error: %s: no name server", normalized);
+        return ERROR;
+    }
+    name = add_name(resolver, normalized, hash, now);
+    if (name == NULL) {
+        pthread_mutex_unlock(&resolver->mutex);
+        return ERROR;
+    }
+    name->state = DNS_NAME_PENDING;
+    name->waiters = query;
+    name->pending_next = resolver->pending;
+    resolver->pending = name;
+    query->name = name;
+    send_query(resolver, name, now);
+    pthread_mutex_unlock(&resolver->mutex);
+    atomic_fetch_add(&resolver->misses, 1);
+    char byte = 0;
+    if (write(resolver->wake[1], &byte, 1) == ERROR && errno != EAGAIN) { // Заполненный канал означает, что поток и так будет разбужен
+        proxy_log_error("DNS resolver wake error: %s", strerror(errno));
+    }
+    return DNS_PENDING;
+}
+
+/**
+ * @brief Отменяет ожидание запроса
+ * @param resolver Резолвер
+ * @param query Запрос
+ * @details Поток резолвера вызывает callback под мьютексом, поэтому после его захвата
+ *          запрос либо уже оповещен, либо еще стоит в очереди ожидания и удаляется из нее.
+ */
+void dns_cancel(dns_resolver_t *resolver, dns_query_t *query) {
+    pthread_mutex_lock(&resolver->mutex);
+    if (!query->done && query->name != NULL) {
+        dns_query_t **link = &query->name->waiters;
+        while (*link != NULL && *link != query) link = &(*link)->next;
+        if (*link != NULL) *link = query->next;
+        query->name = NULL;
+        query->next = NULL;
+    }
+    pthread_mutex_unlock(&resolver->mutex);
+}
+
+/**
+ * @brief Разрешает имя, блокируя вызывающий поток до получения ответа
+ * @param resolver Резолвер
+ * @param host Имя хоста или IPv4-адрес
+ * @param addr Указатель для сохранения адреса
+ * @return SUCCESS или ERROR
+ * @details Запрос без callback ставится в очередь ожидания имени, поток ждет
+ *          на done_cond, пока резолвер не отметит запрос завершенным. Ответ
+ *          приходит не позже, чем истекут все попытки отправки DNS-запроса.
+ */
+int dns_resolve_wait(dns_resolver_t *resolver, const char *host, struct in_addr *addr) {
+    dns_query_t query;
+    query.callback = NULL;
+    query.arg = NULL;
+    int ret = dns_resolve(resolver, host, &query);
+    if (ret == DNS_PENDING) {
+        pthread_mutex_lock(&resolver->mutex);
+        while (!query.done) pthread_cond_wait(&resolver->done_cond, &resolver->mutex);
+        pthread_mutex_unlock(&resolver->mutex);
+        ret = query.status;
+    }
+    if (ret == SUCCESS) *addr = query.addr;
+    return ret;
+}
+
+/**
+ * @brief Возвращает счетчики резолвера
+ * @param resolver Резолвер
+ * @param stats Указатель для сохранения счетчиков
+ */
+void dns_get_stats(dns_resolver_t *resolver, dns_stats_t *stats) {
+    stats->hits = atomic_load(&resolver->hits);
+    stats->misses = atomic_load(&resolver->misses);
+    stats->coalesced = atomic_load(&resolver->coalesced);
+    stats->failures = atomic_load(&resolver->failures);
+}
+
+/**
+ * @brief Останавливает поток резолвера и освобождает его ресурсы
+ * @param resolver Резолвер
+ * @details Поток перед выходом завершает с ошибкой все ожидающие запросы,
+ *          после этого таблица имен освобождается без блокировок.
+ */
+void dns_resolver_destroy(dns_resolver_t *resolver) {
+    if (resolver == NULL) return;
+    if (atomic_exchange(&resolver->running, 0)) {
+        char byte = 0;
+        ssize_t ret = write(resolver->wake[1], &byte, 1);
+        (void) ret; // EAGAIN: в канале уже есть пробуждение
+        pthread_join(resolver->thread, NULL);
+    }
+    for (int i = 0; i < DNS_BUCKET_COUNT; i++) {
+        dns_name_t *name = resolver->buckets[i];
+        while (name != NULL) {
+            dns_name_t *next = name->next;
+            free(name->host);
+            free(name);
+            name = next;
+        }
+    }
+    if (resolver->socket != ERROR) close(resolver->socket);
+    close(resolver->wake[0]);
+    close(resolver->wake[1]);
+    pthread_cond_destroy(&resolver->done_cond);
+    pthread_mutex_destroy(&resolver->mutex);
+    free(resolver);
+}
+
+/**
+ * @brief Приводит имя хоста к виду, в котором оно хранится в кэше
+ * @param host Имя хоста
+ * @param out Буфер размера DNS_MAX_NAME_LEN + 1
+ * @return Длина имени или ERROR, если имя некорректно
+ * @details Имена в DNS не зависят от регистра, поэтому имя переводится в нижний регистр.
+ *          Завершающая точка (полное имя) отбрасывается. Проверяется длина имени
+ *          и каждой метки, пустые метки не допускаются.
+ */
+static int normalize_host(const char *host, char *out) {
+    size_t len = strlen(host);
+    if (len > 0 && host[len - 1] == '.') len--;
+    if (len == 0 || len > DNS_MAX_NAME_LEN) return ERROR;
+    size_t label_len = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (host[i] == '.') {
+            if (label_len == 0) return ERROR;
+            label_len = 0;
+        } else if (++label_len > DNS_MAX_LABEL_LEN) {
+            return ERROR;
+        }
+        out[i] = (char) tolower((unsigned char) host[i]);
+    }
+    if (label_len == 0) return ERROR;
+    out[len] = '\0';
+    return (int) len;
+}
+
+/**
+ * @brief Разбирает адрес сервера имен "ip[:port]"
+ * @param server Строка с адресом
+ * @param addr Указатель для сохранения адреса
+ * @return SUCCESS или ERROR
+ */
+static int parse_server(const char *server, struct sockaddr_in *addr) {
+    char ip[INET_ADDRSTRLEN];
+    const char *colon = strchr(server, ':');
+    size_t ip_len = colon != NULL ? (size_t) (colon - server) : strlen(server);
+    if (ip_len >= sizeof(ip)) return ERROR;
+    memcpy(ip, server, ip_len);
+    ip[ip_len] = '\0';
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(DNS_PORT);
+    if (inet_pton(AF_INET, ip, &addr->sin_addr) != 1) return ERROR;
+    if (colon != NULL) {
+        char *end;
+        errno = 0;
+        long port = strtol(colon + 1, &end, 10);
+        if (errno != 0 || end == colon + 1 || *end != '\0' || port <= 0 || port > 65535) return ERROR;
+        addr->sin_port = htons((uint16_t) port);
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Находит первый IPv4-адрес nameserver в /etc/resolv.conf
+ * @param addr Указатель для сохранения адреса
+ * @return SUCCESS или ERROR, если сервер не найден
+ * @note Директивы search, options и IPv6-серверы не поддерживаются
+ */
+static int read_resolv_conf(struct sockaddr_in *addr) {
+    FILE *file = fopen(RESOLV_CONF_PATH, "r");
+    if (file == NULL) return ERROR;
+    char line[256];
+    int ret = ERROR;
+    while (ret == ERROR && fgets(line, sizeof(line), file) != NULL) {
+        char keyword[16], value[INET6_ADDRSTRLEN];
+        if (sscanf(line, "%15s %45s", keyword, value) != 2 || strcmp(keyword, "nameserver") != 0) continue;
+        ret = parse_server(value, addr); // IPv6-адреса не разбираются и пропускаются
+    }
+    fclose(file);
+    return ret;
+}
+
+/**
+ * @brief Добавляет в кэш имена из /etc/hosts
+ * @param resolver Резолвер
+ * @details Каждая строка - адрес и список имен, после '#' идет комментарий.
+ *          Строки с IPv6-адресами пропускаются. Если имя встречается несколько раз,
+ *          используется первый адрес. Такие имена не устаревают и не вытесняются.
+ */
+static void load_hosts(dns_resolver_t *resolver) {
+    FILE *file = fopen(HOSTS_PATH, "r");
+    if (file == NULL) return;
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        char *save;
+        char *token = strtok_r(line, " \t\r\n", &save);
+        struct in_addr addr;
+        if (token == NULL || inet_pton(AF_INET, token, &addr) != 1) continue;
+        while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            char normalized[DNS_MAX_NAME_LEN + 1];
+            int host_len = normalize_host(token, normalized);
+            if (host_len == ERROR) continue;
+            uint64_t hash = hash_bytes(normalized, host_len, 0);
+            if (find_name(resolver, normalized, hash) != NULL) continue;
+            dns_name_t *name = add_name(resolver, normalized, hash, 0);
+            if (name == NULL) break;
+            name->state = DNS_NAME_RESOLVED;
+            name->addr = addr;
+            name->expires = DNS_PERMANENT;
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Находит имя в таблице
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param host Нормализованное имя
+ * @param hash Хэш имени
+ * @return Имя или NULL, если его нет
+ */
+static dns_name_t *find_name(dns_resolver_t *resolver, const char *host, uint64_t hash) {
+    for (dns_name_t *name = resolver->buckets[hash & (DNS_BUCKET_COUNT - 1)]; name != NULL; name = name->next) {
+        if (name->hash == hash && strcmp(name->host, host) == 0) return name;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Добавляет имя в таблицу, при необходимости освобождая место
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param host Нормализованное имя
+ * @param hash Хэш имени
+ * @param now Текущее время (мс)
+ * @return Имя или NULL при ошибке
+ * @details Если таблица заполнена, сначала удаляются устаревшие имена, а если их нет -
+ *          имя, которое устареет раньше всех (ожидающие ответа и имена из /etc/hosts
+ *          не вытесняются).
+ */
+static dns_name_t *add_name(dns_resolver_t *resolver, const char *host, uint64_t hash, long long now) {
+    if (resolver->name_count >= DNS_MAX_NAMES) sweep_names(resolver, now);
+    if (resolver->name_count >= DNS_MAX_NAMES) {
+        dns_name_t *victim = NULL;
+        for (int i = 0; i < DNS_BUCKET_COUNT; i++) {
+            for (dns_name_t *name = resolver->buckets[i]; name != NULL; name = name->next) {
+                if (name->state == DNS_NAME_PENDING || name->expires == DNS_PERMANENT) continue;
+                if (victim == NULL || name->expires < victim->expires) victim = name;
+            }
+        }
+        if (victim == NULL) {
+            proxy_log_error("DNS resolving error: too many names in flight");
+            return NULL;
+        }
+        remove_name(resolver, victim);
+    }
+    errno = 0;
+    dns_name_t *name = calloc(1, sizeof(dns_name_t));
+    char *host_copy = strdup(host);
+    if (name == NULL || host_copy == NULL) {
+        proxy_log_error("DNS resolving error: %s", strerror(errno));
+        free(name);
+        free(host_copy);
+        return NULL;
+    }
+    dns_name_t **bucket = &resolver->buckets[hash & (DNS_BUCKET_COUNT - 1)];
+    name->host = host_copy;
+    name->hash = hash;
+    name->next = *bucket;
+    *bucket = name;
+    resolver->name_count++;
+    return name;
+}
+
+/**
+ * @brief Удаляет имя из таблицы и освобождает его
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param name Имя без ожидающих запросов
+ */
+static void remove_name(dns_resolver_t *resolver, dns_name_t *name) {
+    dns_name_t **link = &resolver->buckets[name->hash & (DNS_BUCKET_COUNT - 1)];
+    while (*link != name) link = &(*link)->next;
+    *link = name->next;
+    resolver->name_count--;
+    free(name->host);
+    free(name);
+}
+
+/**
+ * @brief Удаляет устаревшие имена
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param now Текущее время (мс)
+ */
+static void sweep_names(dns_resolver_t *resolver, long long now) {
+    for (int i = 0; i < DNS_BUCKET_COUNT; i++) {
+        dns_name_t **link = &resolver->buckets[i];
+        while (*link != NULL) {
+            dns_name_t *name = *link;
+            if (name->state == DNS_NAME_PENDING || name->expires > now) {
+                link = &name->next;
+                continue;
+            }
+            *link = name->next;
+            resolver->name_count--;
+            free(name->host);
+            free(name);
+        }
+    }
+}
+
+/**
+ * @brief Отправляет серверу DNS-запрос типа A для имени
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param name Имя в состоянии DNS_NAME_PENDING
+ * @param now Текущее время (мс)
+ * @details Каждая попытка получает новый случайный идентификатор, поэтому
+ *          запоздавший ответ на предыдущую попытку не принимается. Время
+ *          повторной отправки удваивается с каждой попыткой. Ошибка отправки
+ *          не прерывает ожидание: запрос уйдет повторно по таймауту.
+ */
+static void send_query(dns_resolver_t *resolver, dns_name_t *name, long long now) {
+    uint64_t counter = resolver->id_counter++;
+    name->id = (uint16_t) hash_bytes(&counter, sizeof(counter), resolver->id_seed);
+    name->retry_at = now + ((long long) DNS_RETRY_MS << name->attempts);
+    name->attempts++;
+    uint8_t packet[DNS_PACKET_SIZE];
+    memset(packet, 0, 12);
+    packet[0] = (uint8_t) (name->id >> 8);
+    packet[1] = (uint8_t) name->id;
+    packet[2] = DNS_FLAG_RD >> 8; // Серверу разрешена рекурсия
+    packet[5] = 1; // Один вопрос
+    size_t len = 12;
+    const char *label = name->host;
+    while (1) { // Имя записывается метками: длина, затем символы
+        const char *dot = strchr(label, '.');
+        size_t label_len = dot != NULL ? (size_t) (dot - label) : strlen(label);
+        packet[len++] = (uint8_t) label_len;
+        memcpy(packet + len, label, label_len);
+        len += label_len;
+        if (dot == NULL) break;
+        label = dot + 1;
+    }
+    packet[len++] = 0;
+    packet[len++] = 0;
+    packet[len++] = DNS_TYPE_A;
+    packet[len++] = 0;
+    packet[len++] = DNS_CLASS_IN;
+    if (send(resolver->socket, packet, len, 0) == ERROR) proxy_log_error("DNS query sending error: %s", strerror(errno));
+}
+
+/**
+ * @brief Завершает ожидание имени и оповещает ждущие запросы
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param name Имя в состоянии DNS_NAME_PENDING
+ * @param status SUCCESS или ERROR
+ * @param addr Адрес (при status == SUCCESS)
+ * @param ttl_ms Сколько миллисекунд хранить результат
+ * @details Имя убирается из списка ожидающих и получает время устаревания.
+ *          Каждый запрос из очереди ожидания отмечается завершенным до вызова
+ *          callback, блокирующие запросы будятся через done_cond.
+ */
+static void complete_name(dns_resolver_t *resolver, dns_name_t *name, int status, struct in_addr addr, long long ttl_ms) {
+    dns_name_t **link = &resolver->pending;
+    while (*link != name) link = &(*link)->pending_next;
+    *link = name->pending_next;
+    name->pending_next = NULL;
+    name->state = status == SUCCESS ? DNS_NAME_RESOLVED : DNS_NAME_FAILED;
+    name->addr = addr;
+    name->expires = proxy_clock_now_ms() + ttl_ms;
+    if (status == ERROR) atomic_fetch_add(&resolver->failures, 1);
+    dns_query_t *query = name->waiters;
+    name->waiters = NULL;
+    while (query != NULL) {
+        dns_query_t *next = query->next; // После оповещения запрос может быть освобожден
+        query->status = status;
+        query->addr = addr;
+        query->name = NULL;
+        query->next = NULL;
+        query->done = 1;
+        if (query->callback != NULL) query->callback(query);
+        query = next;
+    }
+    pthread_cond_broadcast(&resolver->done_cond);
+}
+
+/**
+ * @brief Читает имя из DNS-сообщения, следуя ссылкам сжатия
+ * @param packet Сообщение
+ * @param len Длина сообщения
+ * @param off Смещение имени; после вызова - смещение следующего за именем поля
+ * @param out Буфер размера DNS_MAX_NAME_LEN + 1 или NULL
+ * @return SUCCESS или ERROR, если имя некорректно
+ * @details Имя состоит из меток, заканчивается нулевой меткой или ссылкой на другое
+ *          место сообщения (два старших бита установлены). Количество переходов
+ *          ограничено, чтобы зацикленные ссылки не приводили к бесконечному циклу.
+ */
+static int read_name(const uint8_t *packet, size_t len, size_t *off, char *out) {
+    size_t pos = *off, out_len = 0;
+    int jumps = 0;
+    while (1) {
+        if (pos >= len) return ERROR;
+        uint8_t label_len = packet[pos];
+        if ((label_len & 0xC0) == 0xC0) { // Ссылка сжатия
+            if (pos + 1 >= len || ++jumps > DNS_MAX_JUMPS) return ERROR;
+            if (jumps == 1) *off = pos + 2;
+            pos = ((size_t) (label_len & 0x3F) << 8) | packet[pos + 1];
+            continue;
+        }
+        if (label_len & 0xC0) return ERROR;
+        pos++;
+        if (label_len == 0) break;
+        if (pos + label_len > len) return ERROR;
+        if (out != NULL) {
+            if (out_len + (out_len > 0) + label_len > DNS_MAX_NAME_LEN) return ERROR;
+            if (out_len > 0) out[out_len++] = '.';
+            memcpy(out + out_len, packet + pos, label_len);
+            out_len += label_len;
+        }
+        pos += label_len;
+    }
+    if (jumps == 0) *off = pos;
+    if (out != NULL) out[out_len] = '\0';
+    return SUCCESS;
+}
+
+/**
+ * @brief Обрабатывает ответ сервера имен
+ * @param resolver Резолвер (мьютекс должен быть захвачен)
+ * @param packet Ответ
+ * @param len Длина ответа
+ * @details Алгоритм работы:
+ *          1. Находит ожидающее имя по идентификатору и сверяет имя в вопросе:
+ *             ответы на устаревшие попытки и чужие ответы отбрасываются
+ *          2. При NOERROR берет первую A-запись раздела ответов; время хранения -
+ *             наименьший TTL записей A и CNAME (но не больше DNS_MAX_TTL_S)
+ *          3. При NXDOMAIN или пустом ответе время отрицательного кэширования берется
+ *             из SOA раздела полномочий (наименьшее из TTL записи и поля MINIMUM),
+ *             а без SOA - negative_ttl_ms
+ *          4. Прочие коды ответа (SERVFAIL, REFUSED) кэшируются на negative_ttl_ms
+ *          5. Усеченный ответ (TC) разбирается до последней целой записи; если A-записи
+ *             в нем нет, отказ кэшируется на negative_ttl_ms (повтор по TCP не выполняется)
+ *          6. Некорректный ответ игнорируется: имя дождется повторной отправки
+ */
+static void handle_response(dns_resolver_t *resolver, const uint8_t *packet, size_t len) {
+    if (len < 12) return;
+    uint16_t id = (uint16_t) (packet[0] << 8 | packet[1]);
+    uint16_t flags = (uint16_t) (packet[2] << 8 | packet[3]);
+    int question_count = packet[4] << 8 | packet[5];
+    int answer_count = packet[6] << 8 | packet[7];
+    int authority_count = packet[8] << 8 | packet[9];
+    if (!(flags & DNS_FLAG_QR) || question_count != 1) return;
+    dns_name_t *name = resolver->pending;
+    while (name != NULL && name->id != id) name = name->pending_next;
+    if (name == NULL) return;
+    char question[DNS_MAX_NAME_LEN + 1];
+    size_t off = 12;
+    if (read_name(packet, len, &off, question) == ERROR || strcasecmp(question, name->host) != 0) return;
+    off += 4; // Тип и класс вопроса
+    int rcode = flags & DNS_RCODE_MASK;
+    struct in_addr addr = {0};
+    if (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN) {
+        proxy_log_error("DNS resolving error: %s: name server returned code %d", name->host, rcode);
+        complete_name(resolver, name, ERROR, addr, resolver->negative_ttl_ms);
+        return;
+    }
+    int found = 0, truncated = (flags & DNS_FLAG_TC) != 0;
+    long long ttl_s = DNS_MAX_TTL_S, negative_ttl_ms = resolver->negative_ttl_ms;
+    for (int i = 0; i < answer_count + authority_count; i++) {
+        size_t record_off = off;
+        if (read_name(packet, len, &record_off, NULL) == ERROR || record_off + 10 > len ||
+            record_off + 10 + (size_t) (packet[record_off + 8] << 8 | packet[record_off + 9]) > len) {
+            if (truncated) break; // Записи за границей усеченного ответа не дошли
+            return;
+        }
+        off = record_off;
+        int type = packet[off] << 8 | packet[off + 1];
+        int class = packet[off + 2] << 8 | packet[off + 3];
+        long long ttl = (long long) packet[off + 4] << 24 | packet[off + 5] << 16 | packet[off + 6] << 8 | packet[off + 7];
+        size_t data_len = (size_t) (packet[off + 8] << 8 | packet[off + 9]);
+        off += 10;
+        if (class == DNS_CLASS_IN && i < answer_count && (type == DNS_TYPE_A || type == DNS_TYPE_CNAME)) {
+            if (ttl < ttl_s) ttl_s = ttl;
+            if (type == DNS_TYPE_A && data_len == 4 && !found) {
+                memcpy(&addr, packet + off, 4);
+                found = 1;
+            }
+        }
+        if (class == DNS_CLASS_IN && i >= answer_count && type == DNS_TYPE_SOA) {
+            size_t soa_off = off;
+            if (read_name(packet, len, &soa_off, NULL) == ERROR || read_name(packet, len, &soa_off, NULL) == ERROR) return;
+            if (soa_off + 20 > off + data_len) return;
+            const uint8_t *minimum = packet + soa_off + 16; // После SERIAL, REFRESH, RETRY, EXPIRE
+            long long minimum_s = (long long) minimum[0] << 24 | minimum[1] << 16 | minimum[2] << 8 | minimum[3];
+            if (ttl < minimum_s) minimum_s = ttl;
+            if (minimum_s > DNS_MAX_TTL_S) minimum_s = DNS_MAX_TTL_S;
+            negative_ttl_ms = minimum_s * 1000;
+        }
+        off += data_len;
+    }
+    if (rcode == DNS_RCODE_NOERROR && found) {
+        complete_name(resolver, name, SUCCESS, addr, ttl_s * 1000);
+        return;
+    }
+    if (truncated && rcode == DNS_RCODE_NOERROR) {
+        proxy_log_error("DNS resolving error: %s: truncated response", name->host);
+        complete_name(resolver, name, ERROR, addr, resolver->negative_ttl_ms);
+        return;
+    }
+    proxy_log_error("DNS resolving error: %s: %s", name->host, rcode == DNS_RCODE_NXDOMAIN ? "no such host" : "no address");
+    complete_name(resolver, name, ERROR, addr, negative_ttl_ms);
+}
+
+/**
+ * @brief Функция потока резолвера
+ * @param arg Указатель на dns_resolver_t
+ * @return NULL
+ * @details Алгоритм работы:
+ *          1. Под мьютексом повторно отправляет запросы, таймаут которых истек;
+ *             после DNS_ATTEMPTS попыток без ответа завершает имя отказом
+ *          2. Раз в DNS_SWEEP_MS удаляет устаревшие имена
+ *          3. Ждет ответа сервера или пробуждения через канал не дольше,
+ *             чем до ближайшей повторной отправки
+ *          4. Принимает все пришедшие ответы и обрабатывает их под мьютексом
+ *          5. При остановке завершает все ожидающие имена отказом
+ */
+static void *resolver_routine(void *arg) {
+    proxy_set_thread_name("dns-resolver");
+    dns_resolver_t *resolver = (dns_resolver_t *) arg;
+    long long last_sweep = proxy_clock_now_ms();
+    struct in_addr none = {0};
+    while (atomic_load(&resolver->running)) {
+        long long now = proxy_clock_now_ms();
+        long long timeout = DNS_SWEEP_MS;
+        pthread_mutex_lock(&resolver->mutex);
+        dns_name_t *name = resolver->pending;
+        while (name != NULL) {
+            dns_name_t *next = name->pending_next;
+            if (name->retry_at <= now && name->attempts >= DNS_ATTEMPTS) {
+                proxy_log_error("DNS resolving error: %s: no response from name server", name->host);
+                complete_name(resolver, name, ERROR, none, resolver->negative_ttl_ms);
+            } else {
+                if (name->retry_at <= now) send_query(resolver, name, now);
+                if (name->retry_at - now < timeout) timeout = name->retry_at - now;
+            }
+            name = next;
+        }
+        if (now - last_sweep >= DNS_SWEEP_MS) {
+            sweep_names(resolver, now);
+            last_sweep = now;
+        }
+        pthread_mutex_unlock(&resolver->mutex);
+        struct pollfd fds[2] = {{.fd = resolver->wake[0], .events = POLLIN}, {.fd = resolver->socket, .events = POLLIN}};
+        int ready = poll(fds, resolver->socket != ERROR ? 2 : 1, (int) timeout);
+        if (ready == ERROR && errno != EINTR) {
+            proxy_log_error("DNS resolver error: %s", strerror(errno));
+            break;
+        }
+        if (ready <= 0) continue;
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            ssize_t ret = read(resolver->wake[0], buf, sizeof(buf)); // Сброс пробуждений
+            (void) ret;
+        }
+        if (resolver->socket == ERROR || !(fds[1].revents & POLLIN)) continue;
+        uint8_t packet[DNS_PACKET_SIZE];
+        ssize_t received;
+        while ((received = recv(resolver->socket, packet, sizeof(packet), MSG_DONTWAIT)) >= 0) {
+            pthread_mutex_lock(&resolver->mutex);
+            handle_response(resolver, packet, (size_t) received);
+            pthread_mutex_unlock(&resolver->mutex);
+        }
+    }
+    pthread_mutex_lock(&resolver->mutex);
+    while (resolver->pending != NULL) complete_name(resolver, resolver->pending, ERROR, none, 0);
+    pthread_mutex_unlock(&resolver->mutex);
+    return NULL;
+}
@@ -1,9 +1,11 @@
 #include "cache.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "http.h"
 #include "log.h"
 
 /**
@@ -16,23 +18,41 @@
  *          1. Выделяет память под структуру cache_entry_t
  *          2. Копирует указатели на данные запроса и ответа
  *          3. Инициализирует мьютекс и условную переменную для синхронизации
- *          4. Устанавливает начальные значения флагов
+ *          4. Устанавливает начальные значения флагов; пока заголовки ответа не получены,
+ *             срок свежести не ограничен
+ *          5. Устанавливает счетчик ссылок в 1 (ссылка создателя)
  */
 cache_entry_t *cache_entry_create(const char *request, size_t request_len, const message_t *response) {
     errno = 0;
     cache_entry_t *entry = malloc(sizeof(cache_entry_t)); // Выделение памяти под элемент кэша
     if (entry == NULL) {
-        if (errno == ENOMEM) proxy_log("Cache entry creation error: %s", strerror(errno));
-        else proxy_log("Cache entry creation error: failed to reallocate memory");
+        if (errno == ENOMEM) proxy_log_error("Cache entry creation error: %s", strerror(errno));
+        else proxy_log_error("Cache entry creation error: failed to reallocate memory");
         return NULL;
     }
     entry->request = (char *) request;
     entry->request_len = request_len;
+    entry->key = NULL;
+    entry->key_len = 0;
+    entry->vary = NULL;
+    entry->vary_key = NULL;
+    entry->vary_key_len = 0;
     entry->response = (message_t *) response;
     pthread_mutex_init(&entry->mutex, NULL); // Инициализация мьютекса
     pthread_cond_init(&entry->ready_cond, NULL); // Инициализирует условную переменную для уведомления потоков
     entry->deleted = 0;
     entry->finished = 0;
+    entry->failed = 0;
+    entry->delimited = 0;
+    entry->refcount = 1;
+    entry->subscribers = NULL;
+    entry->etag = NULL;
+    entry->last_modified = NULL;
+    entry->lifetime_ms = HTTP_FRESHNESS_UNKNOWN;
+    entry->stale_while_revalidate_ms = 0;
+    entry->fresh_until_ms = LLONG_MAX;
+    entry->stale_until_ms = LLONG_MAX;
+    entry->revalidating = 0;
     return entry;
 }
 
@@ -40,19 +60,83 @@ cache_entry_t *cache_entry_create(const char *request, size_t request_len, const
  * @brief Уничтожает элемент кэша, освобождая все связанные ресурсы
  * @param entry Указатель на элемент кэша для уничтожения
  * @details Выполняет полное освобождение ресурсов элемента кэша:
- *          1. Освобождает память запроса (если не NULL)
+ *          1. Освобождает память запроса, ключа, Vary и валидаторов (если не NULL)
  *          2. Уничтожает структуру ответа (если не NULL)
  *          3. Уничтожает мьютекс и условную переменную
  *          4. Освобождает память самой структуры
  */
 void cache_entry_destroy(cache_entry_t *entry) {
     if (entry == NULL) {
-        proxy_log("Cache entry destroying error: entry is NULL");
+        proxy_log_error("Cache entry destroying error: entry is NULL");
         return;
     }
     if (entry->request != NULL) free(entry->request);
+    free(entry->key);
+    free(entry->vary);
+    free(entry->vary_key);
+    free(entry->etag);
+    free(entry->last_modified);
     if (entry->response != NULL) message_destroy(&entry->response);
     pthread_mutex_destroy(&entry->mutex);
     pthread_cond_destroy(&entry->ready_cond);
     free(entry);
 }
+
+/**
+ * @brief Захватывает дополнительную ссылку на элемент кэша
+ * @param entry Элемент кэша
+ * @return Тот же элемент
+ */
+cache_entry_t *cache_entry_acquire(cache_entry_t *entry) {
+    if (entry != NULL) atomic_fetch_add(&entry->refcount, 1);
+    return entry;
+}
+
+/**
+ * @brief Освобождает ссылку на элемент кэша
+ * @param entry Элемент кэша
+ * @details Уничтожает элемент, если освобождена последняя ссылка
+ */
+void cache_entry_release(cache_entry_t *entry) {
+    if (entry == NULL) return;
+    if (atomic_fetch_sub(&entry->refcount, 1) == 1) cache_entry_destroy(entry);
+}
+
+/**
+ * @brief Подписывает обработчик на появление новых данных в элементе
+ * @param entry Элемент кэша
+ * @param subscriber Подписчик (память принадлежит вызывающей стороне)
+ */
+void cache_entry_subscribe(cache_entry_t *entry, cache_entry_subscriber_t *subscriber) {
+    pthread_mutex_lock(&entry->mutex);
+    subscriber->next = entry->subscribers;
+    entry->subscribers = subscriber;
+    pthread_mutex_unlock(&entry->mutex);
+}
+
+/**
+ * @brief Отписывает обработчик от элемента
+ * @param entry Элемент кэша
+ * @param subscriber Подписчик
+ * @details notify вызывается только под entry->mutex, поэтому после выхода
+ *          из функции подписчик больше не будет оповещен
+ */
+void cache_entry_unsubscribe(cache_entry_t *entry, cache_entry_subscriber_t *subscriber) {
+    pthread_mutex_lock(&entry->mutex);
+    cache_entry_subscriber_t **curr = &entry->subscribers;
+    while (*curr != NULL && *curr != subscriber) curr = &(*curr)->next;
+    if (*curr != NULL) *curr = subscriber->next;
+    subscriber->next = NULL;
+    pthread_mutex_unlock(&entry->mutex);
+}
+
+/**
+ * @brief Оповещает ожидающие потоки и подписчиков об изменении элемента
+ * @param entry Элемент кэша
+ */
+void cache_entry_notify(cache_entry_t *entry) {
+    pthread_mutex_lock(&entry->mutex);
+    pthread_cond_broadcast(&entry->ready_cond);
+    for (cache_entry_subscriber_t *curr = entry->subscribers; curr != NULL; curr = curr->next) curr->notify(curr->arg);
+    pthread_mutex_unlock(&entry->mutex);
+}
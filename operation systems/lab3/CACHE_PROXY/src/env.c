@@ -1,8 +1,10 @@
 #include "env.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 
 #include "log.h"
 
@@ -12,12 +14,85 @@
  */
 #define HANDLER_COUNT_DEFAULT           1
 
+/**
+ * @brief Значение по умолчанию для количества потоков-загрузчиков ответов
+ * @details Используется если переменная окружения CACHE_PROXY_FETCHER_POOL_SIZE
+ */
+#define FETCHER_COUNT_DEFAULT           4
+
 /**
  * @brief Значение по умолчанию для времени жизни элемента кэша (в миллисекундах)
  * @details Используется если переменная окружения CACHE_PROXY_CACHE_EXPIRED_TIME_MS
  */
 #define CACHE_EXPIRED_TIME_MS_DEFAULT   (24 * 60 * 60 * 1000)
 
+/**
+ * @brief Значение по умолчанию для количества сегментов кэша
+ * @details Используется если переменная окружения CACHE_PROXY_CACHE_SHARDS
+ */
+#define CACHE_SHARDS_DEFAULT            16
+
+/**
+ * @brief Значение по умолчанию для бюджета памяти кэша (в байтах)
+ * @details Используется если переменная окружения CACHE_PROXY_CACHE_SIZE
+ */
+#define CACHE_SIZE_DEFAULT              ((size_t) 256 * 1024 * 1024)
+
+/**
+ * @brief Значение по умолчанию для количества простаивающих соединений с одним сервером
+ * @details Используется если переменная окружения CACHE_PROXY_UPSTREAM_IDLE_PER_HOST
+ */
+#define UPSTREAM_IDLE_PER_HOST_DEFAULT  8
+
+/**
+ * @brief Значение по умолчанию для времени простоя соединения с сервером (в миллисекундах)
+ * @details Используется если переменная окружения CACHE_PROXY_UPSTREAM_IDLE_TIMEOUT_MS
+ */
+#define UPSTREAM_IDLE_TIMEOUT_MS_DEFAULT 30000
+
+/**
+ * @brief Значение по умолчанию для времени ожидания следующего запроса клиента (в миллисекундах)
+ * @details Используется если переменная окружения CACHE_PROXY_CLIENT_IDLE_TIMEOUT_MS
+ */
+#define CLIENT_IDLE_TIMEOUT_MS_DEFAULT  5000
+
+/**
+ * @brief Значение по умолчанию для времени отрицательного кэширования DNS (в миллисекундах)
+ * @details Используется если переменная окружения CACHE_PROXY_DNS_NEGATIVE_TTL_MS
+ */
+#define DNS_NEGATIVE_TTL_MS_DEFAULT     5000
+
+/**
+ * @brief Значение по умолчанию для количества потоков, принимающих соединения
+ * @details Используется если переменная окружения CACHE_PROXY_ACCEPTORS
+ */
+#define ACCEPTOR_COUNT_DEFAULT          1
+
+/**
+ * @brief Значение по умолчанию для очереди подключений слушающего сокета
+ * @details Используется если переменная окружения CACHE_PROXY_LISTEN_BACKLOG.
+ *          Ядро в любом случае ограничивает очередь значением net.core.somaxconn
+ */
+#define LISTEN_BACKLOG_DEFAULT          SOMAXCONN
+
+/**
+ * @brief Значение по умолчанию для порта администрирования (0 - выключен)
+ * @details Используется если переменная окружения CACHE_PROXY_ADMIN_PORT
+ */
+#define ADMIN_PORT_DEFAULT              0
+
+/**
+ * @brief Значение по умолчанию для частоты трассировки запросов (0 - выключена)
+ * @details Используется если переменная окружения CACHE_PROXY_TRACE_SAMPLE
+ */
+#define TRACE_SAMPLE_DEFAULT            0
+
+/**
+ * @brief Значение по умолчанию для файла трассировки
+ * @details Используется если переменная окружения CACHE_PROXY_TRACE_FILE
+ */
+#define TRACE_FILE_DEFAULT              "cache_proxy_trace.json"
+
 /**
  * @brief Получает количество потоков-обработчиков из переменной окружения
  * @return Количество потоков-обработчиков для пула потоков прокси
@@ -31,23 +106,57 @@
 int env_get_client_handler_count() {
     char *handler_count_env = getenv("CACHE_PROXY_THREAD_POOL_SIZE");
     if (handler_count_env == NULL) {
-        proxy_log("CACHE_PROXY_THREAD_POOL_SIZE getting error: variable not set");
+        proxy_log_error("CACHE_PROXY_THREAD_POOL_SIZE getting error: variable not set");
         return HANDLER_COUNT_DEFAULT;
     }
     errno = 0;
     char *end;
     int handler_count = (int) strtol(handler_count_env, &end, 0); // Преобразование строки в целое число
     if (errno != 0) {
-        proxy_log("CACHE_PROXY_THREAD_POOL_SIZE getting error: %s", strerror(errno));
+        proxy_log_error("CACHE_PROXY_THREAD_POOL_SIZE getting error: %s", strerror(errno));
         return HANDLER_COUNT_DEFAULT;
     }
     if (end == handler_count_env) {
-        proxy_log("CACHE_PROXY_THREAD_POOL_SIZE getting error: no digits were found");
+        proxy_log_error("CACHE_PROXY_THREAD_POOL_SIZE getting error: no digits were found");
         return HANDLER_COUNT_DEFAULT;
     }
     return handler_count;
 }
 
+/**
+ * @brief Получает количество потоков-загрузчиков ответов из переменной окружения
+ * @return Количество потоков-загрузчиков для режима PROXY_IO_THREADS
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_FETCHER_POOL_SIZE
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (4)
+ *          3. Преобразует строковое значение в целое число
+ *          4. Проверяет корректность преобразования и что число положительное
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+int env_get_fetcher_count() {
+    char *fetcher_count_env = getenv("CACHE_PROXY_FETCHER_POOL_SIZE");
+    if (fetcher_count_env == NULL) {
+        proxy_log_error("CACHE_PROXY_FETCHER_POOL_SIZE getting error: variable not set");
+        return FETCHER_COUNT_DEFAULT;
+    }
+    errno = 0;
+    char *end;
+    int fetcher_count = (int) strtol(fetcher_count_env, &end, 0); // Преобразование строки в целое число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_FETCHER_POOL_SIZE getting error: %s", strerror(errno));
+        return FETCHER_COUNT_DEFAULT;
+    }
+    if (end == fetcher_count_env) {
+        proxy_log_error("CACHE_PROXY_FETCHER_POOL_SIZE getting error: no digits were found");
+        return FETCHER_COUNT_DEFAULT;
+    }
+    if (fetcher_count <= 0) {
+        proxy_log_error("CACHE_PROXY_FETCHER_POOL_SIZE getting error: value must be positive");
+        return FETCHER_COUNT_DEFAULT;
+    }
+    return fetcher_count;
+}
+
 /**
  * @brief Получает время жизни элементов кэша из переменной окружения
  * @return Время жизни элемента кэша в миллисекундах
@@ -61,7 +170,7 @@ int env_get_client_handler_count() {
 time_t env_get_cache_expired_time_ms() {
     char *cache_expired_time_ms_env = getenv("CACHE_PROXY_CACHE_EXPIRED_TIME_MS");
     if (cache_expired_time_ms_env == NULL) {
-        proxy_log("CACHE_PROXY_CACHE_EXPIRED_TIME_MS getting error: variable not set");
+        proxy_log_error("CACHE_PROXY_CACHE_EXPIRED_TIME_MS getting error: variable not set");
         return CACHE_EXPIRED_TIME_MS_DEFAULT;
     }
     // Convert string to time_t
@@ -69,12 +178,432 @@ time_t env_get_cache_expired_time_ms() {
     char *end;
     time_t cache_expired_time_ms = strtol(cache_expired_time_ms_env, &end, 0);
     if (errno != 0) {
-        proxy_log("CACHE_PROXY_CACHE_EXPIRED_TIME_MS getting error: %s", strerror(errno));
+        proxy_log_error("CACHE_PROXY_CACHE_EXPIRED_TIME_MS getting error: %s", strerror(errno));
         return CACHE_EXPIRED_TIME_MS_DEFAULT;
     }
     if (end == cache_expired_time_ms_env) {
-        proxy_log("CACHE_PROXY_CACHE_EXPIRED_TIME_MS getting error: no digits were found");
+        proxy_log_error("CACHE_PROXY_CACHE_EXPIRED_TIME_MS getting error: no digits were found");
         return CACHE_EXPIRED_TIME_MS_DEFAULT;
     }
     return cache_expired_time_ms;
 }
+
+/**
+ * @brief Получает количество сегментов кэша из переменной окружения
+ * @return Количество независимых сегментов кэша
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_CACHE_SHARDS
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (16)
+ *          3. Преобразует строковое значение в целое число
+ *          4. Проверяет корректность преобразования и что число положительное
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+int env_get_cache_shards() {
+    char *cache_shards_env = getenv("CACHE_PROXY_CACHE_SHARDS");
+    if (cache_shards_env == NULL) {
+        proxy_log_error("CACHE_PROXY_CACHE_SHARDS getting error: variable not set");
+        return CACHE_SHARDS_DEFAULT;
+    }
+    errno = 0;
+    char *end;
+    int cache_shards = (int) strtol(cache_shards_env, &end, 0); // Преобразование строки в целое число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_CACHE_SHARDS getting error: %s", strerror(errno));
+        return CACHE_SHARDS_DEFAULT;
+    }
+    if (end == cache_shards_env) {
+        proxy_log_error("CACHE_PROXY_CACHE_SHARDS getting error: no digits were found");
+        return CACHE_SHARDS_DEFAULT;
+    }
+    if (cache_shards <= 0) {
+        proxy_log_error("CACHE_PROXY_CACHE_SHARDS getting error: value must be positive");
+        return CACHE_SHARDS_DEFAULT;
+    }
+    return cache_shards;
+}
+
+/**
+ * @brief Получает бюджет памяти кэша из переменной окружения
+ * @return Бюджет памяти кэша в байтах
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_CACHE_SIZE
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (256 МБ)
+ *          3. Преобразует строковое значение в целое число
+ *          4. Проверяет корректность преобразования и что число положительное
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+size_t env_get_cache_size() {
+    char *cache_size_env = getenv("CACHE_PROXY_CACHE_SIZE");
+    if (cache_size_env == NULL) {
+        proxy_log_error("CACHE_PROXY_CACHE_SIZE getting error: variable not set");
+        return CACHE_SIZE_DEFAULT;
+    }
+    errno = 0;
+    char *end;
+    long long cache_size = strtoll(cache_size_env, &end, 0); // Преобразование строки в целое число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_CACHE_SIZE getting error: %s", strerror(errno));
+        return CACHE_SIZE_DEFAULT;
+    }
+    if (end == cache_size_env) {
+        proxy_log_error("CACHE_PROXY_CACHE_SIZE getting error: no digits were found");
+        return CACHE_SIZE_DEFAULT;
+    }
+    if (cache_size <= 0) {
+        proxy_log_error("CACHE_PROXY_CACHE_SIZE getting error: value must be positive");
+        return CACHE_SIZE_DEFAULT;
+    }
+    return (size_t) cache_size;
+}
+
+/**
+ * @brief Получает количество простаивающих соединений с одним сервером из переменной окружения
+ * @return Сколько постоянных соединений с одним сервером хранит пул
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_UPSTREAM_IDLE_PER_HOST
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (8)
+ *          3. Преобразует строковое значение в целое число
+ *          4. Проверяет корректность преобразования и что число положительное
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+int env_get_upstream_idle_per_host() {
+    char *idle_per_host_env = getenv("CACHE_PROXY_UPSTREAM_IDLE_PER_HOST");
+    if (idle_per_host_env == NULL) {
+        proxy_log_error("CACHE_PROXY_UPSTREAM_IDLE_PER_HOST getting error: variable not set");
+        return UPSTREAM_IDLE_PER_HOST_DEFAULT;
+    }
+    errno = 0;
+    char *end;
+    int idle_per_host = (int) strtol(idle_per_host_env, &end, 0); // Преобразование строки в целое число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_UPSTREAM_IDLE_PER_HOST getting error: %s", strerror(errno));
+        return UPSTREAM_IDLE_PER_HOST_DEFAULT;
+    }
+    if (end == idle_per_host_env) {
+        proxy_log_error("CACHE_PROXY_UPSTREAM_IDLE_PER_HOST getting error: no digits were found");
+        return UPSTREAM_IDLE_PER_HOST_DEFAULT;
+    }
+    if (idle_per_host <= 0) {
+        proxy_log_error("CACHE_PROXY_UPSTREAM_IDLE_PER_HOST getting error: value must be positive");
+        return UPSTREAM_IDLE_PER_HOST_DEFAULT;
+    }
+    return idle_per_host;
+}
+
+/**
+ * @brief Получает время простоя соединения с сервером из переменной окружения
+ * @return Через сколько миллисекунд простоя соединение с сервером закрывается
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_UPSTREAM_IDLE_TIMEOUT_MS
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (30 секунд)
+ *          3. Преобразует строковое значение в число типа time_t
+ *          4. Проверяет корректность преобразования и что число положительное
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+time_t env_get_upstream_idle_timeout_ms() {
+    char *idle_timeout_env = getenv("CACHE_PROXY_UPSTREAM_IDLE_TIMEOUT_MS");
+    if (idle_timeout_env == NULL) {
+        proxy_log_error("CACHE_PROXY_UPSTREAM_IDLE_TIMEOUT_MS getting error: variable not set");
+        return UPSTREAM_IDLE_TIMEOUT_MS_DEFAULT;
+    }
+    errno = 0;
+    char *end;
+    time_t idle_timeout = strtol(idle_timeout_env, &end, 0); // Преобразование строки в число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_UPSTREAM_IDLE_TIMEOUT_MS getting error: %s", strerror(errno));
+        return UPSTREAM_IDLE_TIMEOUT_MS_DEFAULT;
+    }
+    if (end == idle_timeout_env) {
+        proxy_log_error("CACHE_PROXY_UPSTREAM_IDLE_TIMEOUT_MS getting error: no digits were found");
+        return UPSTREAM_IDLE_TIMEOUT_MS_DEFAULT;
+    }
+    if (idle_timeout <= 0) {
+        proxy_log_error("CACHE_PROXY_UPSTREAM_IDLE_TIMEOUT_MS getting error: value must be positive");
+        return UPSTREAM_IDLE_TIMEOUT_MS_DEFAULT;
+    }
+    return idle_timeout;
+}
+
+/**
+ * @brief Получает время ожидания следующего запроса клиента из переменной окружения
+ * @return Сколько миллисекунд постоянное клиентское соединение может простаивать
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_CLIENT_IDLE_TIMEOUT_MS
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (5 секунд)
+ *          3. Преобразует строковое значение в число типа time_t
+ *          4. Проверяет корректность преобразования и что число неотрицательное
+ *             (0 отключает постоянные соединения)
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+time_t env_get_client_idle_timeout_ms() {
+    char *idle_timeout_env = getenv("CACHE_PROXY_CLIENT_IDLE_TIMEOUT_MS");
+    if (idle_timeout_env == NULL) {
+        proxy_log_error("CACHE_PROXY_CLIENT_IDLE_TIMEOUT_MS getting error: variable not set");
+        return CLIENT_IDLE_TIMEOUT_MS_DEFAULT;
+    }
+    errno = 0;
+    char *end;
+    time_t idle_timeout = strtol(idle_timeout_env, &end, 0); // Преобразование строки в число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_CLIENT_IDLE_TIMEOUT_MS getting error: %s", strerror(errno));
+        return CLIENT_IDLE_TIMEOUT_MS_DEFAULT;
+    }
+    if (end == idle_timeout_env) {
+        proxy_log_error("CACHE_PROXY_CLIENT_IDLE_TIMEOUT_MS getting error: no digits were found");
+        return CLIENT_IDLE_TIMEOUT_MS_DEFAULT;
+    }
+    if (idle_timeout < 0) {
+        proxy_log_error("CACHE_PROXY_CLIENT_IDLE_TIMEOUT_MS getting error: value must not be negative");
+        return CLIENT_IDLE_TIMEOUT_MS_DEFAULT;
+    }
+    return idle_timeout;
+}
+
+/**
+ * @brief Получает адрес сервера имен из переменной окружения
+ * @return Строка "ip[:port]" или NULL, если сервер берется из /etc/resolv.conf
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_DNS_SERVER
+ *          2. Если переменная не установлена или пуста, возвращает NULL
+ *          3. Корректность адреса проверяет резолвер при создании
+ */
+const char *env_get_dns_server() {
+    char *server_env = getenv("CACHE_PROXY_DNS_SERVER");
+    if (server_env == NULL || server_env[0] == '\0') {
+        proxy_log_error("CACHE_PROXY_DNS_SERVER getting error: variable not set");
+        return NULL;
+    }
+    return server_env;
+}
+
+/**
+ * @brief Получает время отрицательного кэширования DNS из переменной окружения
+ * @return Сколько миллисекунд хранится отказ в разрешении имени
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_DNS_NEGATIVE_TTL_MS
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (5 секунд)
+ *          3. Преобразует строковое значение в число типа time_t
+ *          4. Проверяет корректность преобразования и что число неотрицательное
+ *             (0 отключает отрицательное кэширование)
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+time_t env_get_dns_negative_ttl_ms() {
+    char *negative_ttl_env = getenv("CACHE_PROXY_DNS_NEGATIVE_TTL_MS");
+    if (negative_ttl_env == NULL) {
+        proxy_log_error("CACHE_PROXY_DNS_NEGATIVE_TTL_MS getting error: variable not set");
+        return DNS_NEGATIVE_TTL_MS_DEFAULT;
+    }
+    errno = 0;
+    char *end;
+    time_t negative_ttl = strtol(negative_ttl_env, &end, 0); // Преобразование строки в число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_DNS_NEGATIVE_TTL_MS getting error: %s", strerror(errno));
+        return DNS_NEGATIVE_TTL_MS_DEFAULT;
+    }
+    if (end == negative_ttl_env) {
+        proxy_log_error("CACHE_PROXY_DNS_NEGATIVE_TTL_MS getting error: no digits were found");
+        return DNS_NEGATIVE_TTL_MS_DEFAULT;
+    }
+    if (negative_ttl < 0) {
+        proxy_log_error("CACHE_PROXY_DNS_NEGATIVE_TTL_MS getting error: value must not be negative");
+        return DNS_NEGATIVE_TTL_MS_DEFAULT;
+    }
+    return negative_ttl;
+}
+
+/**
+ * @brief Получает количество потоков, принимающих соединения, из переменной окружения
+ * @return Количество потоков приема соединений
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_ACCEPTORS
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (1)
+ *          3. Преобразует строковое значение в целое число
+ *          4. Проверяет корректность преобразования и что число от 1 до 1024
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+int env_get_acceptor_count() {
+    char *acceptor_count_env = getenv("CACHE_PROXY_ACCEPTORS");
+    if (acceptor_count_env == NULL) return ACCEPTOR_COUNT_DEFAULT; // Одного потока хватает без шторма подключений, сообщать об этом незачем
+    errno = 0;
+    char *end;
+    long acceptor_count = strtol(acceptor_count_env, &end, 0); // Преобразование строки в целое число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_ACCEPTORS getting error: %s", strerror(errno));
+        return ACCEPTOR_COUNT_DEFAULT;
+    }
+    if (end == acceptor_count_env) {
+        proxy_log_error("CACHE_PROXY_ACCEPTORS getting error: no digits were found");
+        return ACCEPTOR_COUNT_DEFAULT;
+    }
+    if (acceptor_count < 1 || acceptor_count > 1024) {
+        proxy_log_error("CACHE_PROXY_ACCEPTORS getting error: value must be from 1 to 1024");
+        return ACCEPTOR_COUNT_DEFAULT;
+    }
+    return (int) acceptor_count;
+}
+
+/**
+ * @brief Получает длину очереди подключений слушающего сокета из переменной окружения
+ * @return Длина очереди подключений (backlog для listen)
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_LISTEN_BACKLOG
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (SOMAXCONN)
+ *          3. Преобразует строковое значение в целое число
+ *          4. Проверяет корректность преобразования и что число положительное
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+int env_get_listen_backlog() {
+    char *backlog_env = getenv("CACHE_PROXY_LISTEN_BACKLOG");
+    if (backlog_env == NULL) return LISTEN_BACKLOG_DEFAULT; // Значение по умолчанию подходит почти всегда, сообщать об этом незачем
+    errno = 0;
+    char *end;
+    long backlog = strtol(backlog_env, &end, 0); // Преобразование строки в целое число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_LISTEN_BACKLOG getting error: %s", strerror(errno));
+        return LISTEN_BACKLOG_DEFAULT;
+    }
+    if (end == backlog_env) {
+        proxy_log_error("CACHE_PROXY_LISTEN_BACKLOG getting error: no digits were found");
+        return LISTEN_BACKLOG_DEFAULT;
+    }
+    if (backlog < 1 || backlog > INT_MAX) {
+        proxy_log_error("CACHE_PROXY_LISTEN_BACKLOG getting error: value must be from 1 to %d", INT_MAX);
+        return LISTEN_BACKLOG_DEFAULT;
+    }
+    return (int) backlog;
+}
+
+/**
+ * @brief Получает порт администрирования из переменной окружения
+ * @return Порт, на котором отдаются метрики, или 0
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_ADMIN_PORT
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (0 - выключен)
+ *          3. Преобразует строковое значение в целое число
+ *          4. Проверяет корректность преобразования и что число от 0 до 65535
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+int env_get_admin_port() {
+    char *admin_port_env = getenv("CACHE_PROXY_ADMIN_PORT");
+    if (admin_port_env == NULL) return ADMIN_PORT_DEFAULT; // Порт необязателен, сообщать об этом незачем
+    errno = 0;
+    char *end;
+    long admin_port = strtol(admin_port_env, &end, 0); // Преобразование строки в целое число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_ADMIN_PORT getting error: %s", strerror(errno));
+        return ADMIN_PORT_DEFAULT;
+    }
+    if (end == admin_port_env) {
+        proxy_log_error("CACHE_PROXY_ADMIN_PORT getting error: no digits were found");
+        return ADMIN_PORT_DEFAULT;
+    }
+    if (admin_port < 0 || admin_port > 65535) {
+        proxy_log_error("CACHE_PROXY_ADMIN_PORT getting error: value must be from 0 to 65535");
+        return ADMIN_PORT_DEFAULT;
+    }
+    return (int) admin_port;
+}
+
+/**
+ * @brief Получает частоту трассировки запросов из переменной окружения
+ * @return Сколько запросов потока приходится на один трассируемый (0 - трассировка выключена)
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_TRACE_SAMPLE
+ *          2. Если переменная не установлена, возвращает значение по умолчанию (0)
+ *          3. Преобразует строковое значение в целое число
+ *          4. Проверяет корректность преобразования и что число неотрицательное
+ *          5. В случае ошибок возвращает значение по умолчанию с логированием
+ */
+int env_get_trace_sample() {
+    char *trace_sample_env = getenv("CACHE_PROXY_TRACE_SAMPLE");
+    if (trace_sample_env == NULL) return TRACE_SAMPLE_DEFAULT; // Трассировка необязательна, сообщать об этом незачем
+    errno = 0;
+    char *end;
+    long trace_sample = strtol(trace_sample_env, &end, 0); // Преобразование строки в целое число
+    if (errno != 0) {
+        proxy_log_error("CACHE_PROXY_TRACE_SAMPLE getting error: %s", strerror(errno));
+        return TRACE_SAMPLE_DEFAULT;
+    }
+    if (end == trace_sample_env) {
+        proxy_log_error("CACHE_PROXY_TRACE_SAMPLE getting error: no digits were found");
+        return TRACE_SAMPLE_DEFAULT;
+    }
+    if (trace_sample < 0 || trace_sample > INT_MAX) {
+        proxy_log_error("CACHE_PROXY_TRACE_SAMPLE getting error: value must be from 0 to %d", INT_MAX);
+        return TRACE_SAMPLE_DEFAULT;
+    }
+    return (int) trace_sample;
+}
+
+/**
+ * @brief Получает путь к файлу трассировки из переменной окружения
+ * @return Путь к файлу, в который выводятся трассы при остановке
+ * @details Если переменная CACHE_PROXY_TRACE_FILE не установлена, возвращает cache_proxy_trace.json
+ */
+const char *env_get_trace_file() {
+    char *trace_file_env = getenv("CACHE_PROXY_TRACE_FILE");
+    if (trace_file_env == NULL || trace_file_env[0] == '\0') return TRACE_FILE_DEFAULT;
+    return trace_file_env;
+}
+
+/**
+ * @brief Получает политику вытеснения кэша из переменной окружения
+ * @return Политика вытеснения
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_CACHE_POLICY
+ *          2. Если переменная не установлена, возвращает CACHE_POLICY_GDSF
+ *          3. Сравнивает значение с известными политиками ("gdsf", "s3fifo")
+ *          4. При неизвестном значении возвращает политику по умолчанию с логированием
+ */
+cache_policy_t env_get_cache_policy() {
+    char *policy_env = getenv("CACHE_PROXY_CACHE_POLICY");
+    if (policy_env == NULL) {
+        proxy_log_error("CACHE_PROXY_CACHE_POLICY getting error: variable not set");
+        return CACHE_POLICY_GDSF;
+    }
+    if (strcmp(policy_env, "gdsf") == 0) return CACHE_POLICY_GDSF;
+    if (strcmp(policy_env, "s3fifo") == 0) return CACHE_POLICY_S3FIFO;
+    proxy_log_error("CACHE_PROXY_CACHE_POLICY getting error: unknown policy %s", policy_env);
+    return CACHE_POLICY_GDSF;
+}
+
+/**
+ * @brief Получает режим обработки соединений из переменной окружения
+ * @return Режим обработки соединений
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_IO_MODE
+ *          2. Если переменная не установлена, возвращает PROXY_IO_THREADS
+ *          3. Сравнивает значение с известными режимами ("threads", "epoll", "io_uring")
+ *          4. При неизвестном значении возвращает режим по умолчанию с логированием
+ */
+proxy_io_mode_t env_get_io_mode() {
+    char *io_mode_env = getenv("CACHE_PROXY_IO_MODE");
+    if (io_mode_env == NULL) {
+        proxy_log_error("CACHE_PROXY_IO_MODE getting error: variable not set");
+        return PROXY_IO_THREADS;
+    }
+    if (strcmp(io_mode_env, "threads") == 0) return PROXY_IO_THREADS;
+    if (strcmp(io_mode_env, "epoll") == 0) return PROXY_IO_EPOLL;
+    if (strcmp(io_mode_env, "io_uring") == 0) return PROXY_IO_URING;
+    proxy_log_error("CACHE_PROXY_IO_MODE getting error: unknown mode %s", io_mode_env);
+    return PROXY_IO_THREADS;
+}
+
+/**
+ * @brief Получает уровень логирования из переменной окружения
+ * @return Наибольший выводимый уровень сообщений
+ * @details Алгоритм работы:
+ *          1. Пытается прочитать значение переменной CACHE_PROXY_LOG_LEVEL
+ *          2. Если переменная не установлена, возвращает LOG_LEVEL_INFO
+ *          3. Сравнивает значение с известными уровнями ("error", "info", "debug")
+ *          4. При неизвестном значении возвращает уровень по умолчанию с логированием
+ */
+int env_get_log_level() {
+    char *log_level_env = getenv("CACHE_PROXY_LOG_LEVEL");
+    if (log_level_env == NULL) return LOG_LEVEL_INFO; // Уровень по умолчанию, сообщать об этом незачем
+    if (strcmp(log_level_env, "error") == 0) return LOG_LEVEL_ERROR;
+    if (strcmp(log_level_env, "info") == 0) return LOG_LEVEL_INFO;
+    if (strcmp(log_level_env, "debug") == 0) return LOG_LEVEL_DEBUG;
+    proxy_log_error("CACHE_PROXY_LOG_LEVEL getting error: unknown level %s", log_level_env);
+    return LOG_LEVEL_INFO;
+}
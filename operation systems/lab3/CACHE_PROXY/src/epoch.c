@@ -0,0 +1,230 @@
+#include "epoch.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define EPOCH_LISTS     3   // Списки ожидающих объектов эпох e - 2, e - 1 и e
+#define EPOCH_ACTIVE    1UL // Младший бит состояния потока: поток внутри участка чтения
+
+/**
+ * @brief Запись потока, участвующего в чтении
+ * @details Записи только добавляются в общий список; запись завершившегося потока
+ *          помечается свободной и достается следующему новому потоку.
+ * @var state    Эпоха, которую видел поток при входе в участок, сдвинутая на 1 бит,
+ *               с флагом EPOCH_ACTIVE (0 - поток вне участка)
+ * @var orphaned Поток-владелец завершился, запись может занять новый поток
+ * @var depth    Глубина вложенности участков (меняет только владелец)
+ * @var next     Следующая запись в списке всех записей
+ */
+typedef struct epoch_record_t {
+    atomic_ulong state;
+    atomic_int orphaned;
+    int depth;
+    _Atomic(struct epoch_record_t *) next;
+} epoch_record_t;
+
+static atomic_ulong global_epoch = 1;                           // Текущая эпоха
+static _Atomic(epoch_record_t *) records = NULL;                // Записи всех потоков (только добавляются)
+static _Thread_local epoch_record_t *local_record = NULL;       // Запись текущего потока
+static pthread_key_t record_key;                                // Освобождает запись при завершении потока
+static int record_key_created = 0;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static epoch_entry_t *limbo[EPOCH_LISTS];                       // Ожидающие объекты по эпохам (epoch % EPOCH_LISTS)
+static pthread_mutex_t limbo_mutex = PTHREAD_MUTEX_INITIALIZER; // Защищает limbo и продвижение эпохи
+
+/**
+ * @brief Создает ключ записей потоков
+ */
+static void epoch_init(void);
+
+/**
+ * @brief Возвращает запись текущего потока, при первом вызове занимает или создает ее
+ * @return Запись или NULL, если не хватило памяти
+ */
+static epoch_record_t *epoch_get_record(void);
+
+/**
+ * @brief Освобождает запись завершившегося потока (деструктор ключа)
+ * @param arg Запись потока
+ */
+static void epoch_release_record(void *arg);
+
+/**
+ * @brief Продвигает эпоху, если все потоки в участках чтения видели текущую
+ * @param ready Указатель для сохранения списка объектов, которые можно освободить
+ * @return 1 если эпоха продвинута, иначе 0
+ */
+static int epoch_advance(epoch_entry_t **ready);
+
+/**
+ * @brief Освобождает список объектов
+ * @param entry Первый объект списка
+ */
+static void epoch_reclaim(epoch_entry_t *entry);
+
+/**
+ * @brief Начинает участок чтения
+ * @return SUCCESS или ERROR, если не удалось зарегистрировать поток
+ * @details Состояние записывается с полным барьером: эпоха не продвинется дальше
+ *          записанной, пока поток не выйдет из участка, а все чтения участка
+ *          выполняются после записи состояния.
+ */
+int epoch_enter(void) {
+    epoch_record_t *record = epoch_get_record();
+    if (record == NULL) return ERROR;
+    if (record->depth++ == 0) {
+        atomic_store(&record->state, (atomic_load(&global_epoch) << 1) | EPOCH_ACTIVE);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Завершает участок чтения
+ */
+void epoch_exit(void) {
+    epoch_record_t *record = local_record;
+    if (record == NULL || record->depth == 0) return;
+    if (--record->depth == 0) atomic_store_explicit(&record->state, 0, memory_order_release);
+}
+
+/**
+ * @brief Откладывает освобождение объекта до выхода из участков чтения всех потоков,
+ *        которые могли его видеть
+ * @param entry   Заголовок объекта (объект уже должен быть исключен из общих структур)
+ * @param reclaim Функция освобождения объекта
+ * @details Объект кладется в список текущей эпохи. Освобождение объектов, срок которых
+ *          прошел, выполняется после освобождения мьютекса.
+ */
+void epoch_retire(epoch_entry_t *entry, void (*reclaim)(epoch_entry_t *entry)) {
+    if (entry == NULL || reclaim == NULL) return;
+    entry->reclaim = reclaim;
+    epoch_entry_t *ready = NULL;
+    pthread_mutex_lock(&limbo_mutex);
+    epoch_entry_t **list = &limbo[atomic_load(&global_epoch) % EPOCH_LISTS];
+    entry->next = *list;
+    *list = entry;
+    epoch_advance(&ready);
+    pthread_mutex_unlock(&limbo_mutex);
+    epoch_reclaim(ready);
+}
+
+/**
+ * @brief Пытается продвинуть эпоху и освобождает объекты, срок которых прошел
+ */
+void epoch_collect(void) {
+    epoch_entry_t *ready = NULL;
+    pthread_mutex_lock(&limbo_mutex);
+    epoch_advance(&ready);
+    pthread_mutex_unlock(&limbo_mutex);
+    epoch_reclaim(ready);
+}
+
+/**
+ * @brief Дожидается освобождения всех отложенных объектов
+ * @details После EPOCH_LISTS продвижений эпохи освобождены все списки,
+ *          включая объекты, отложенные до вызова. Пока эпоху задерживает
+ *          поток в участке чтения, отдает процессор.
+ */
+void epoch_barrier(void) {
+    for (int advanced = 0; advanced < EPOCH_LISTS;) {
+        epoch_entry_t *ready = NULL;
+        pthread_mutex_lock(&limbo_mutex);
+        int ret = epoch_advance(&ready);
+        pthread_mutex_unlock(&limbo_mutex);
+        epoch_reclaim(ready);
+        if (ret) {
+            advanced++;
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * @brief Создает ключ записей потоков
+ * @details Если ключ не создан, записи завершившихся потоков не используются повторно.
+ */
+static void epoch_init(void) {
+    if (pthread_key_create(&record_key, epoch_release_record) == 0) record_key_created = 1;
+}
+
+/**
+ * @brief Возвращает запись текущего потока, при первом вызове занимает или создает ее
+ * @return Запись или NULL, если не хватило памяти
+ * @details Сначала ищет запись завершившегося потока, иначе добавляет новую
+ *          в конец списка без блокировок.
+ */
+static epoch_record_t *epoch_get_record(void) {
+    if (local_record != NULL) return local_record;
+    pthread_once(&epoch_once, epoch_init);
+    epoch_record_t *record = NULL;
+    for (epoch_record_t *r = atomic_load(&records); r != NULL; r = r->next) {
+        int expected = 1;
+        if (atomic_compare_exchange_strong(&r->orphaned, &expected, 0)) {
+            record = r;
+            break;
+        }
+    }
+    if (record == NULL) {
+        record = calloc(1, sizeof(epoch_record_t));
+        if (record == NULL) return NULL;
+        _Atomic(epoch_record_t *) *link = &records;
+        epoch_record_t *last = NULL;
+        while (!atomic_compare_exchange_strong(link, &last, record)) { // Добавляет в конец списка
+            link = &last->next;
+            last = NULL;
+        }
+    }
+    record->depth = 0;
+    if (record_key_created) pthread_setspecific(record_key, record);
+    local_record = record;
+    return record;
+}
+
+/**
+ * @brief Освобождает запись завершившегося потока (деструктор ключа)
+ * @param arg Запись потока
+ */
+static void epoch_release_record(void *arg) {
+    epoch_record_t *record = (epoch_record_t *) arg;
+    local_record = NULL;
+    atomic_store(&record->state, 0);
+    atomic_store(&record->orphaned, 1);
+}
+
+/**
+ * @brief Продвигает эпоху, если все потоки в участках чтения видели текущую
+ * @param ready Указатель для сохранения списка объектов, которые можно освободить
+ * @return 1 если эпоха продвинута, иначе 0
+ * @details Вызывается под limbo_mutex. При переходе в эпоху e + 1 освобождается список
+ *          объектов эпохи e - 2: все читатели вошли в участки уже в эпоху e, после того
+ *          как эти объекты были исключены из структур. Список освобождается, и в него
+ *          начинают попадать объекты новой эпохи.
+ */
+static int epoch_advance(epoch_entry_t **ready) {
+    unsigned long epoch = atomic_load(&global_epoch);
+    for (epoch_record_t *r = atomic_load(&records); r != NULL; r = r->next) {
+        unsigned long state = atomic_load(&r->state);
+        if ((state & EPOCH_ACTIVE) && (state >> 1) != epoch) return 0; // Поток еще в прошлой эпохе
+    }
+    epoch++;
+    *ready = limbo[epoch % EPOCH_LISTS];
+    limbo[epoch % EPOCH_LISTS] = NULL;
+    atomic_store(&global_epoch, epoch);
+    return 1;
+}
+
+/**
+ * @brief Освобождает список объектов
+ * @param entry Первый объект списка
+ */
+static void epoch_reclaim(epoch_entry_t *entry) {
+    while (entry != NULL) {
+        epoch_entry_t *next = entry->next;
+        entry->reclaim(entry);
+        entry = next;
+    }
+}
@@ -0,0 +1,156 @@
+#include "hash.h"
+
+#include <string.h>
+
+/**
+ * @brief Константы перемешивания wyhash
+ */
+static const uint64_t hash_secret[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+/**
+ * @brief Перемножает два 64-битных числа
+ * @param a Указатель на первый множитель, получает младшие 64 бита произведения
+ * @param b Указатель на второй множитель, получает старшие 64 бита произведения
+ */
+static inline void hash_mum(uint64_t *a, uint64_t *b);
+
+/**
+ * @brief Перемешивает два 64-битных числа
+ * @param a Первое число
+ * @param b Второе число
+ * @return XOR младшей и старшей половин 128-битного произведения
+ */
+static inline uint64_t hash_mix(uint64_t a, uint64_t b);
+
+/**
+ * @brief Читает 8 байт как 64-битное число
+ * @param p Указатель на данные (может быть невыровненным)
+ * @return Прочитанное значение
+ */
+static inline uint64_t hash_read8(const uint8_t *p);
+
+/**
+ * @brief Читает 4 байта как 32-битное число
+ * @param p Указатель на данные (может быть невыровненным)
+ * @return Прочитанное значение
+ */
+static inline uint64_t hash_read4(const uint8_t *p);
+
+/**
+ * @brief Собирает из 1-3 байтов одно число
+ * @param p Указатель на данные
+ * @param k Количество байтов (1..3)
+ * @return Первый, средний и последний байты, упакованные в число
+ */
+static inline uint64_t hash_read3(const uint8_t *p, size_t k);
+
+/**
+ * @brief Перемножает два 64-битных числа
+ * @param a Указатель на первый множитель, получает младшие 64 бита произведения
+ * @param b Указатель на второй множитель, получает старшие 64 бита произведения
+ */
+static inline void hash_mum(uint64_t *a, uint64_t *b) {
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+}
+
+/**
+ * @brief Перемешивает два 64-битных числа
+ * @param a Первое число
+ * @param b Второе число
+ * @return XOR младшей и старшей половин 128-битного произведения
+ */
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    hash_mum(&a, &b);
+    return a ^ b;
+}
+
+/**
+ * @brief Читает 8 байт как 64-битное число
+ * @param p Указатель на данные (может быть невыровненным)
+ * @return Прочитанное значение
+ */
+static inline uint64_t hash_read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Читает 4 байта как 32-битное число
+ * @param p Указатель на данные (может быть невыровненным)
+ * @return Прочитанное значение
+ */
+static inline uint64_t hash_read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Собирает из 1-3 байтов одно число
+ * @param p Указатель на данные
+ * @param k Количество байтов (1..3)
+ * @return Первый, средний и последний байты, упакованные в число
+ */
+static inline uint64_t hash_read3(const uint8_t *p, size_t k) {
+    return ((uint64_t) p[0] << 16) | ((uint64_t) p[k >> 1] << 8) | p[k - 1];
+}
+
+/**
+ * @brief Вычисляет 64-битный хэш последовательности байтов
+ * @param data Данные
+ * @param len  Длина данных в байтах
+ * @param seed Начальное значение
+ * @return Хэш данных
+ * @details Алгоритм работы (wyhash):
+ *          1. Перемешивает seed с константами
+ *          2. Данные до 16 байт упаковываются в два слова a и b целиком
+ *          3. Длинные данные обрабатываются блоками по 48 байт в трех независимых
+ *             цепочках (они выполняются процессором параллельно), затем по 16 байт
+ *          4. Последние 16 байт становятся словами a и b
+ *          5. a и b перемешиваются с seed и длиной
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t *) data;
+    seed ^= hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (hash_read4(p) << 32) | hash_read4(p + ((len >> 3) << 2));
+            b = (hash_read4(p + len - 4) << 32) | hash_read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = hash_read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = hash_mix(hash_read8(p) ^ hash_secret[1], hash_read8(p + 8) ^ seed);
+                see1 = hash_mix(hash_read8(p + 16) ^ hash_secret[2], hash_read8(p + 24) ^ see1);
+                see2 = hash_mix(hash_read8(p + 32) ^ hash_secret[3], hash_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_read8(p) ^ hash_secret[1], hash_read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = hash_read8(p + i - 16);
+        b = hash_read8(p + i - 8);
+    }
+    a ^= hash_secret[1];
+    b ^= seed;
+    hash_mum(&a, &b);
+    return hash_mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+}
@@ -0,0 +1,1300 @@
+#include "http.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "log.h"
+
+#include "../picohttpparser/picohttpparser.h"
+
+#define MAX_HEADERS_COUNT   100
+#define MAX_PORT            65535
+#define MAX_CHUNK_SIZE_DIGITS 15 // Размер куска помещается в size_t без переполнения
+#define MAX_DELTA_SECONDS   2147483648LL // Больший срок в секундах считается равным ему (RFC 9111, 1.2.2)
+#define MAX_DATE_LEN        63  // Длина самой длинной даты HTTP с запасом
+#define MAX_RESPONSE_HEADER_SIZE (64 * 1024) // Предел заголовков ответа в http_response_framing_parse
+
+/**
+ * @brief Функция разбора запроса PicoHTTPParser
+ */
+typedef int (*parse_request_t)(const char *buf, size_t len, const char **method, size_t *method_len, const char **path,
+                               size_t *path_len, int *minor_version, struct phr_header *headers, size_t *num_headers, size_t last_len);
+
+/**
+ * @brief Функция разбора ответа PicoHTTPParser
+ */
+typedef int (*parse_response_t)(const char *buf, size_t len, int *minor_version, int *status, const char **msg, size_t *msg_len,
+                                struct phr_header *headers, size_t *num_headers, size_t last_len);
+
+#ifdef CACHE_PROXY_HAVE_SSE42_PARSER
+// Вариант PicoHTTPParser, собранный с -msse4.2 (см. CMakeLists.txt)
+int phr_parse_request_sse42(const char *buf, size_t len, const char **method, size_t *method_len, const char **path,
+                            size_t *path_len, int *minor_version, struct phr_header *headers, size_t *num_headers, size_t last_len);
+int phr_parse_response_sse42(const char *buf, size_t len, int *minor_version, int *status, const char **msg, size_t *msg_len,
+                             struct phr_header *headers, size_t *num_headers, size_t last_len);
+#endif
+
+static parse_request_t parse_request = phr_parse_request;    // Выбирается в http_init
+static parse_response_t parse_response = phr_parse_response; // Выбирается в http_init
+
+/**
+ * @brief Сравнивает имя заголовка с образцом без учета регистра
+ * @param header   Разобранный заголовок
+ * @param name     Образец в нижнем регистре (буквы, цифры и '-')
+ * @param name_len Длина образца
+ * @return 1 если имена совпадают, 0 если нет
+ */
+static int header_name_is(const struct phr_header *header, const char *name, size_t name_len);
+
+/**
+ * @brief Проверяет, есть ли значение в списке заголовка, разделенном запятыми
+ * @param value     Значение заголовка
+ * @param value_len Длина значения
+ * @param token     Искомое значение (без учета регистра)
+ * @return 1 если значение найдено, 0 если нет
+ */
+static int header_has_token(const char *value, size_t value_len, const char *token);
+
+/**
+ * @brief Проверяет, совпадает ли последнее значение в списке заголовка с образцом
+ * @param value     Значение заголовка
+ * @param value_len Длина значения
+ * @param token     Образец (без учета регистра)
+ * @return 1 если совпадает, 0 если нет
+ */
+static int header_last_token_is(const char *value, size_t value_len, const char *token);
+
+/**
+ * @brief Ищет директиву в значении заголовка Cache-Control
+ * @param value     Значение заголовка
+ * @param value_len Длина значения
+ * @param name      Имя директивы в нижнем регистре
+ * @param arg       Указатель для сохранения аргумента без кавычек (NULL если аргумента нет)
+ * @param arg_len   Указатель для сохранения длины аргумента
+ * @return 1 если директива найдена, 0 если нет
+ */
+static int cache_control_find(const char *value, size_t value_len, const char *name, const char **arg, size_t *arg_len);
+
+/**
+ * @brief Разбирает число секунд (delta-seconds)
+ * @param value     Строка с числом
+ * @param value_len Длина строки
+ * @param seconds   Указатель для сохранения числа
+ * @return SUCCESS при успехе, ERROR если строка не является числом
+ */
+static int parse_delta_seconds(const char *value, size_t value_len, long long *seconds);
+
+/**
+ * @brief Разбирает дату HTTP (IMF-fixdate, RFC 850 или asctime)
+ * @param value     Строка с датой
+ * @param value_len Длина строки
+ * @param date      Указатель для сохранения времени в секундах от эпохи Unix
+ * @return SUCCESS при успехе, ERROR если дата некорректна
+ */
+static int parse_http_date(const char *value, size_t value_len, time_t *date);
+
+/**
+ * @brief Строит запрос к серверу с дополнительными заголовками
+ * @param request       Текст HTTP-запроса клиента
+ * @param request_len   Длина запроса
+ * @param keep_alive    1 для постоянного соединения, 0 если сервер должен закрыть соединение после ответа
+ * @param extra         Дополнительные заголовки, каждый с "\r\n" в конце (NULL если нет)
+ * @param conditional   1 если условные заголовки клиента нужно отбросить
+ * @param upstream_len  Указатель для сохранения длины нового запроса
+ * @return Запрос (выделен через malloc) или NULL при ошибке
+ */
+static char *build_upstream_request(const char *request, size_t request_len, int keep_alive, const char *extra,
+                                    int conditional, size_t *upstream_len);
+
+/**
+ * @brief Выбирает реализацию разборщика HTTP под текущий процессор
+ * @details Алгоритм работы:
+ *          1. По умолчанию используется скалярный вариант PicoHTTPParser
+ *          2. Если в сборку включен вариант SSE4.2 и CPUID сообщает о поддержке SSE4.2,
+ *             функции разбора переключаются на него
+ *          3. Выбранный вариант записывается в лог
+ */
+void http_init(void) {
+#ifdef CACHE_PROXY_HAVE_SSE42_PARSER
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        parse_request = phr_parse_request_sse42;
+        parse_response = phr_parse_response_sse42;
+        proxy_log("HTTP parser uses SSE4.2 code path");
+        return;
+    }
+#endif
+    proxy_log("HTTP parser uses scalar code path");
+}
+
+/**
+ * @brief Парсит HTTP-запрос и извлекает метод и заголовок Host
+ * @param request Строка с HTTP-запросом
+ * @param request_len Длина строки запроса
+ * @param method Указатель для сохранения указателя на метод в request
+ * @param method_len Указатель для сохранения длины метода
+ * @param host Указатель для сохранения указателя на значение Host в request
+ * @param host_len Указатель для сохранения длины значения Host
+ * @return SUCCESS (0) при успехе, ERROR (-1) при ошибке
+ * @details Алгоритм работы:
+ *          1. Использует библиотеку PicoHTTPParser для парсинга HTTP-запроса
+ *          2. Извлекает метод HTTP (GET, POST, CONNECT и т.д.)
+ *          3. Ищет заголовок Host среди разобранных заголовков
+ *          4. Сохраняет указатели на метод и Host в исходном буфере
+ */
+int http_parse_request(const char *request, size_t request_len, const char **method, size_t *method_len, const char **host, size_t *host_len) {
+    const char *path; // Указатель на путь
+    struct phr_header headers[MAX_HEADERS_COUNT]; // Массив заголовков
+    size_t path_len, num_headers = MAX_HEADERS_COUNT; // Длина пути и количество заголовков
+    int minor_version; // Минорная версия HTTP
+    // Разбирает HTTP-запрос и заполняет выходные параметры
+    int pret = parse_request(request, request_len, method, method_len, &path,
+                             &path_len, &minor_version, headers, &num_headers, 0);
+    if (pret == -2) { // Обработка неполного запроса
+        proxy_log_error("Request parsing error: request is partial");
+        return ERROR;
+    }
+    if (pret == -1) { // Если запрос некорректен
+        proxy_log_error("Request parsing error: failed");
+        return ERROR;
+    }
+    *host = NULL;
+    for (size_t i = 0; i < num_headers; ++i) { // Ищет заголовок Host среди разобранных заголовков и сохраняет его значение
+        if (header_name_is(&headers[i], "host", 4)) {
+            *host = headers[i].value;
+            *host_len = headers[i].value_len;
+            break;
+        }
+    }
+    if (*host == NULL) {
+        proxy_log_error("Request parsing error: host header not found");
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Парсит HTTP-ответ и извлекает статус, длину контента и значение заголовка Content-Length
+ * @param response Строка с HTTP-ответом
+ * @param response_len Длина строки ответа
+ * @param status Указатель для сохранения HTTP статус-кода (200, 404, 500 и т.д.)
+ * @param content_len Указатель для сохранения длины тела, уже находящегося в response
+ * @param content_length_header Указатель для сохранения значения заголовка Content-Length
+ * @return SUCCESS (0) при успехе, PARTIAL (-2) при неполных заголовках, ERROR (-1) при ошибке
+ * @details Алгоритм работы:
+ *          1. Использует PicoHTTPParser для парсинга HTTP-ответа
+ *          2. Извлекает HTTP статус-код
+ *          3. Ищет заголовок Content-Length и парсит его значение
+ *             (если заголовка нет - HTTP_CONTENT_LENGTH_UNKNOWN)
+ *          4. Вычисляет длину тела по количеству байт после заголовков
+ */
+int http_parse_response(const char *response, size_t response_len, int *status, size_t *content_len, size_t *content_length_header) {
+    const char *msg = NULL; // Сообщение cтатуса (например, "OK" для 200)
+    struct phr_header headers[MAX_HEADERS_COUNT]; // Массив заголовков
+    size_t msg_len = 0; // Длина сообщения
+    size_t num_headers = MAX_HEADERS_COUNT; // Количество заголовков
+    int minor_version = 0; // Минорная версия HTTP
+    // Парсинг HTTP-ответа
+    int pret = parse_response(response, response_len, &minor_version, status, &msg, &msg_len, headers,
+                              &num_headers, 0);
+    if (pret == -2) return PARTIAL; // Заголовки ответа получены не полностью
+    if (pret == -1) { // Обработка ошибки парсинга
+        proxy_log_error("Response parsing error: failed");
+        return ERROR;
+    }
+    *content_len = response_len - (size_t) pret; // Тело начинается сразу после "\r\n\r\n"
+    *content_length_header = HTTP_CONTENT_LENGTH_UNKNOWN;
+    // Поиск заголовка Content-Length
+    for (size_t i = 0; i < num_headers; ++i) {
+        if (!header_name_is(&headers[i], "content-length", 14)) continue;
+        char content_length_value[headers[i].value_len + 1]; // Временная нуль-терминированная строка для strtol
+        memcpy(content_length_value, headers[i].value, headers[i].value_len);
+        content_length_value[headers[i].value_len] = '\0';
+        errno = 0;
+        char *end = NULL;
+        long long value = strtoll(content_length_value, &end, 10); // Преобразует строку Content-Length в число
+        if (errno != 0) {
+            proxy_log_error("Response parsing error: %s", strerror(errno));
+            return ERROR;
+        }
+        if (end == content_length_value || value < 0) {
+            proxy_log_error("Response parsing error: no digits were found");
+            return ERROR;
+        }
+        *content_length_header = (size_t) value; // Сохранение значения Content-Length
+        break;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Определяет полную длину HTTP-запроса вместе с телом
+ * @param request Буфер с началом HTTP-запроса
+ * @param request_len Количество байт в буфере
+ * @return Длина запроса, PARTIAL (-2) если данных недостаточно, ERROR (-1) при ошибке
+ * @details Алгоритм работы:
+ *          1. Разбирает стартовую строку и заголовки через PicoHTTPParser
+ *          2. Проверяет заголовки Content-Length (тело есть, например, у POST): значение - непустая
+ *             строка цифр без переполнения, повторные заголовки должны совпадать
+ *          3. Transfer-Encoding допускается только в HTTP/1.1, без Content-Length и с chunked
+ *             последней кодировкой; тогда конец тела находит http_chunked_parse
+ *          4. Возвращает длину заголовков плюс длину тела
+ * @note Запрос, границы которого можно понять двумя способами, отвергается: иначе прокси
+ *       и сервер могли бы по-разному разделить поток на запросы (RFC 9112, раздел 6.3)
+ */
+ssize_t http_request_length(const char *request, size_t request_len) {
+    const char *method, *path;
+    size_t method_len, path_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_request(request, request_len, &method, &method_len, &path, &path_len,
+                             &minor_version, headers, &num_headers, 0);
+    if (pret == -2) return PARTIAL;
+    if (pret == -1) return ERROR;
+    size_t body_len = 0;
+    int has_length = 0, encoded = 0, chunked = 0;
+    for (size_t i = 0; i < num_headers; ++i) {
+        if (headers[i].name == NULL) { // Продолжение заголовка на новой строке (obs-fold) могло бы скрыть его значение
+            proxy_log_error("Request parsing error: obsolete line folding");
+            return ERROR;
+        }
+        if (header_name_is(&headers[i], "transfer-encoding", 17)) {
+            encoded = 1;
+            chunked = header_last_token_is(headers[i].value, headers[i].value_len, "chunked");
+            continue;
+        }
+        if (!header_name_is(&headers[i], "content-length", 14)) continue;
+        if (headers[i].value_len == 0) {
+            proxy_log_error("Request parsing error: empty Content-Length");
+            return ERROR;
+        }
+        size_t value = 0;
+        for (size_t j = 0; j < headers[i].value_len; ++j) { // Значение без ведущих пробелов, только цифры
+            if (headers[i].value[j] < '0' || headers[i].value[j] > '9') return ERROR;
+            size_t digit = (size_t) (headers[i].value[j] - '0');
+            if (value > (SIZE_MAX - digit) / 10) {
+                proxy_log_error("Request parsing error: Content-Length is too large");
+                return ERROR;
+            }
+            value = value * 10 + digit;
+        }
+        if (has_length && value != body_len) {
+            proxy_log_error("Request parsing error: conflicting Content-Length headers");
+            return ERROR;
+        }
+        body_len = value;
+        has_length = 1;
+    }
+    if (encoded) {
+        if (has_length || minor_version == 0 || !chunked) {
+            proxy_log_error("Request parsing error: unsupported Transfer-Encoding");
+            return ERROR;
+        }
+        http_chunked_t chunks = {0};
+        ssize_t parsed = http_chunked_parse(&chunks, request + pret, request_len - (size_t) pret);
+        if (parsed < 0) return parsed; // ERROR или PARTIAL
+        return (ssize_t) pret + parsed;
+    }
+    if (body_len > request_len - (size_t) pret) return PARTIAL;
+    return (ssize_t) ((size_t) pret + body_len);
+}
+
+/**
+ * @brief Определяет, хочет ли клиент отправить следующий запрос по тому же соединению
+ * @param request Текст HTTP-запроса
+ * @param request_len Длина запроса
+ * @return 1 (true) если соединение постоянное, 0 (false) если нет
+ * @details Алгоритм работы:
+ *          1. Разбирает запрос через PicoHTTPParser
+ *          2. По умолчанию соединение постоянное для HTTP/1.1 и закрывается для HTTP/1.0
+ *          3. Заголовок Connection (или Proxy-Connection от старых клиентов) со значением
+ *             close или keep-alive меняет это решение
+ */
+int http_request_keep_alive(const char *request, size_t request_len) {
+    const char *method, *path;
+    size_t method_len, path_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_request(request, request_len, &method, &method_len, &path, &path_len,
+                             &minor_version, headers, &num_headers, 0);
+    if (pret < 0) return 0;
+    int keep_alive = minor_version >= 1;
+    for (size_t i = 0; i < num_headers; ++i) {
+        if (!header_name_is(&headers[i], "connection", 10) &&
+            !header_name_is(&headers[i], "proxy-connection", 16)) continue;
+        if (header_has_token(headers[i].value, headers[i].value_len, "close")) keep_alive = 0;
+        else if (header_has_token(headers[i].value, headers[i].value_len, "keep-alive")) keep_alive = 1;
+    }
+    return keep_alive;
+}
+
+/**
+ * @brief Продвигает разбор тела в кодировке chunked
+ * @param chunked Состояние разбора
+ * @param data Очередная порция тела
+ * @param len Длина порции
+ * @return Количество байт до конца тела, PARTIAL (-2) если тело не завершено, ERROR (-1) при ошибке
+ * @details Алгоритм работы:
+ *          1. Накапливает шестнадцатеричный размер куска, пропускает расширения до конца строки
+ *          2. Пропускает данные куска и завершающий их CRLF
+ *          3. После куска нулевого размера пропускает строки трейлера до пустой строки
+ *          Состояние сохраняется между вызовами, поэтому границы порций могут быть любыми.
+ */
+ssize_t http_chunked_parse(http_chunked_t *chunked, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && chunked->state != HTTP_CHUNK_DONE) {
+        char c = data[i];
+        switch (chunked->state) {
+            case HTTP_CHUNK_SIZE:
+                if (isxdigit((unsigned char) c)) {
+                    if (chunked->digits == MAX_CHUNK_SIZE_DIGITS) {
+                        proxy_log_error("Chunked body parsing error: chunk is too large");
+                        return ERROR;
+                    }
+                    int digit = c <= '9' ? c - '0' : tolower((unsigned char) c) - 'a' + 10;
+                    chunked->remaining = chunked->remaining * 16 + (size_t) digit;
+                    chunked->digits++;
+                    i++;
+                    break;
+                }
+                if (chunked->digits == 0) {
+                    proxy_log_error("Chunked body parsing error: no digits were found");
+                    return ERROR;
+                }
+                chunked->state = HTTP_CHUNK_EXT; // Символ разбирается повторно как часть расширения
+                break;
+            case HTTP_CHUNK_EXT:
+                i++;
+                if (c != '\n') break;
+                chunked->digits = 0;
+                chunked->state = chunked->remaining == 0 ? HTTP_CHUNK_TRAILER : HTTP_CHUNK_DATA;
+                break;
+            case HTTP_CHUNK_DATA: {
+                size_t n = len - i < chunked->remaining ? len - i : chunked->remaining;
+                i += n;
+                chunked->remaining -= n;
+                if (chunked->remaining == 0) chunked->state = HTTP_CHUNK_DATA_END;
+                break;
+            }
+            case HTTP_CHUNK_DATA_END:
+                i++;
+                if (c == '\n') chunked->state = HTTP_CHUNK_SIZE;
+                break;
+            case HTTP_CHUNK_TRAILER:
+                i++;
+                if (c == '\n') chunked->state = HTTP_CHUNK_DONE;
+                else chunked->state = c == '\r' ? HTTP_CHUNK_TRAILER_END : HTTP_CHUNK_TRAILER_LINE;
+                break;
+            case HTTP_CHUNK_TRAILER_END:
+                i++;
+                chunked->state = c == '\n' ? HTTP_CHUNK_DONE : HTTP_CHUNK_TRAILER_LINE;
+                break;
+            case HTTP_CHUNK_TRAILER_LINE:
+                i++;
+                if (c == '\n') chunked->state = HTTP_CHUNK_TRAILER;
+                break;
+            case HTTP_CHUNK_DONE:
+                break;
+        }
+    }
+    return chunked->state == HTTP_CHUNK_DONE ? (ssize_t) i : PARTIAL;
+}
+
+/**
+ * @brief Определяет, как сервер обозначает конец ответа и можно ли переиспользовать соединение
+ * @param response Заголовки HTTP-ответа
+ * @param response_len Длина заголовков
+ * @param chunked Указатель для сохранения признака Transfer-Encoding: chunked
+ * @param keep_alive Указатель для сохранения признака постоянного соединения
+ * @return SUCCESS (0) при успехе, ERROR (-1) при ошибке
+ * @details Алгоритм работы:
+ *          1. Разбирает ответ через PicoHTTPParser
+ *          2. По умолчанию соединение постоянное для HTTP/1.1 и закрывается для HTTP/1.0
+ *          3. Заголовок Connection со значением close или keep-alive меняет это решение
+ *          4. Transfer-Encoding с chunked означает тело из кусков, любая другая кодировка -
+ *             тело до закрытия соединения, которое тогда нельзя переиспользовать
+ */
+int http_get_framing(const char *response, size_t response_len, int *chunked, int *keep_alive) {
+    const char *msg;
+    size_t msg_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version, status;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_response(response, response_len, &minor_version, &status, &msg, &msg_len, headers, &num_headers, 0);
+    if (pret < 0) return ERROR;
+    *chunked = 0;
+    *keep_alive = minor_version >= 1;
+    int encoded = 0;
+    for (size_t i = 0; i < num_headers; ++i) {
+        if (header_name_is(&headers[i], "connection", 10)) {
+            if (header_has_token(headers[i].value, headers[i].value_len, "close")) *keep_alive = 0;
+            else if (header_has_token(headers[i].value, headers[i].value_len, "keep-alive")) *keep_alive = 1;
+        } else if (header_name_is(&headers[i], "transfer-encoding", 17)) {
+            encoded = 1;
+            *chunked = header_has_token(headers[i].value, headers[i].value_len, "chunked");
+        }
+    }
+    if (encoded && !*chunked) *keep_alive = 0; // Конец тела определяется только закрытием соединения
+    return SUCCESS;
+}
+
+/**
+ * @brief Определяет, есть ли у ответа тело
+ * @param method Метод запроса
+ * @param method_len Длина метода
+ * @param status HTTP статус-код ответа
+ * @return 1 (true) если тело есть, 0 (false) если нет
+ */
+int http_response_has_body(const char *method, size_t method_len, int status) {
+    if (method_len == 4 && strncmp(method, "HEAD", 4) == 0) return 0;
+    return status / 100 != 1 && status != 204 && status != 304;
+}
+
+/**
+ * @brief Продвигает разбор границ ответа сервера
+ * @param framing Состояние разбора
+ * @param method Метод запроса, на который получен ответ
+ * @param method_len Длина метода
+ * @param data Очередная порция ответа
+ * @param len Длина порции
+ * @return 1 (true) если ответ получен полностью, 0 (false) если нужна следующая порция, ERROR (-1) при ошибке
+ * @details Алгоритм работы:
+ *          1. Пока заголовки не разобраны, копит начало ответа и разбирает его
+ *          2. После разбора определяет кодировку тела (http_get_framing); у ответа без тела
+ *             длина тела нулевая, при chunked Content-Length игнорируется
+ *          3. Часть порции после заголовков и следующие порции считает телом: ищет конец
+ *             тела chunked или сравнивает принятое с Content-Length
+ */
+int http_response_framing_parse(http_response_framing_t *framing, const char *method, size_t method_len,
+                                const char *data, size_t len) {
+    const char *body = data; // Часть порции, относящаяся к телу ответа
+    size_t body_len = len;
+    if (!framing->header_parsed) {
+        errno = 0;
+        char *temp = realloc(framing->header, framing->header_len + len);
+        if (temp == NULL) {
+            proxy_log_error("Response parsing error: %s", strerror(errno));
+            return ERROR;
+        }
+        framing->header = temp;
+        memcpy(framing->header + framing->header_len, data, len);
+        framing->header_len += len;
+        int ret = http_parse_response(framing->header, framing->header_len, &framing->status, &body_len, &framing->content_length);
+        if (ret == ERROR) return ERROR;
+        if (ret == PARTIAL) {
+            if (framing->header_len <= MAX_RESPONSE_HEADER_SIZE) return 0;
+            proxy_log_error("Response parsing error: headers are too large");
+            return ERROR;
+        }
+        int keep_alive;
+        if (http_get_framing(framing->header, framing->header_len, &framing->chunked, &keep_alive) == ERROR) return ERROR;
+        framing->header_parsed = 1;
+        if (!http_response_has_body(method, method_len, framing->status)) {
+            framing->chunked = 0; // Ответ без тела, даже если заголовки описывают его длину
+            framing->content_length = 0;
+        } else if (framing->chunked) {
+            framing->content_length = HTTP_CONTENT_LENGTH_UNKNOWN; // Content-Length игнорируется при chunked
+        }
+        body = data + len - body_len; // Начало тела пришло в этой же порции вслед за заголовками
+    }
+    if (framing->chunked) {
+        ssize_t parsed = http_chunked_parse(&framing->chunks, body, body_len);
+        if (parsed == ERROR) return ERROR;
+        framing->body_received += parsed == PARTIAL ? body_len : (size_t) parsed;
+        return parsed != PARTIAL;
+    }
+    framing->body_received += body_len;
+    return framing->content_length != HTTP_CONTENT_LENGTH_UNKNOWN && framing->body_received >= framing->content_length;
+}
+
+/**
+ * @brief Проверяет, завершает ли закрытие соединения сервером принятый ответ
+ * @param framing Состояние разбора
+ * @return 1 (true) если ответ полон, 0 (false) если соединение закрыто до конца ответа
+ */
+int http_response_framing_eof(const http_response_framing_t *framing) {
+    if (!framing->header_parsed || framing->chunked) return 0;
+    return framing->content_length == HTTP_CONTENT_LENGTH_UNKNOWN || framing->body_received >= framing->content_length;
+}
+
+/**
+ * @brief Освобождает накопленное начало ответа
+ * @param framing Состояние разбора
+ */
+void http_response_framing_free(http_response_framing_t *framing) {
+    free(framing->header);
+    framing->header = NULL;
+    framing->header_len = 0;
+}
+
+/**
+ * @brief Строит запрос к серверу
+ * @param request Текст HTTP-запроса клиента
+ * @param request_len Длина запроса
+ * @param keep_alive 1 для постоянного соединения, 0 если сервер должен закрыть соединение после ответа
+ * @param upstream_len Указатель для сохранения длины нового запроса
+ * @return Запрос (выделен через malloc) или NULL при ошибке
+ * @details Заголовки клиента переносятся как есть, кроме Connection, Proxy-Connection и Keep-Alive.
+ */
+char *http_build_upstream_request(const char *request, size_t request_len, int keep_alive, size_t *upstream_len) {
+    return build_upstream_request(request, request_len, keep_alive, NULL, 0, upstream_len);
+}
+
+/**
+ * @brief Строит условный запрос к серверу для проверки сохраненного ответа
+ * @param request       Текст HTTP-запроса клиента
+ * @param request_len   Длина запроса
+ * @param etag          Значение ETag сохраненного ответа (NULL если нет)
+ * @param last_modified Значение Last-Modified сохраненного ответа (NULL если нет)
+ * @param upstream_len  Указатель для сохранения длины нового запроса
+ * @return Запрос (выделен через malloc) или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Собирает строки If-None-Match и If-Modified-Since из валидаторов
+ *          2. Строит запрос с постоянным соединением, отбрасывая условные заголовки клиента:
+ *             ответ на проверку сохраняется для всех клиентов, а не только для этого
+ */
+char *http_build_conditional_request(const char *request, size_t request_len, const char *etag, const char *last_modified,
+                                     size_t *upstream_len) {
+    static const char if_none_match[] = "If-None-Match: ";
+    static const char if_modified_since[] = "If-Modified-Since: ";
+    size_t len = 1;
+    if (etag != NULL) len += sizeof(if_none_match) - 1 + strlen(etag) + 2;
+    if (last_modified != NULL) len += sizeof(if_modified_since) - 1 + strlen(last_modified) + 2;
+    errno = 0;
+    char *extra = malloc(len);
+    if (extra == NULL) {
+        proxy_log_error("Conditional request building error: %s", strerror(errno));
+        return NULL;
+    }
+    char *p = extra;
+    if (etag != NULL) p += sprintf(p, "%s%s\r\n", if_none_match, etag);
+    if (last_modified != NULL) p += sprintf(p, "%s%s\r\n", if_modified_since, last_modified);
+    *p = '\0';
+    char *upstream = build_upstream_request(request, request_len, 1, extra, 1, upstream_len);
+    free(extra);
+    return upstream;
+}
+
+/**
+ * @brief Строит запрос к серверу с дополнительными заголовками
+ * @param request       Текст HTTP-запроса клиента
+ * @param request_len   Длина запроса
+ * @param keep_alive    1 для постоянного соединения, 0 если сервер должен закрыть соединение после ответа
+ * @param extra         Дополнительные заголовки, каждый с "\r\n" в конце (NULL если нет)
+ * @param conditional   1 если условные заголовки клиента нужно отбросить
+ * @param upstream_len  Указатель для сохранения длины нового запроса
+ * @return Запрос (выделен через malloc) или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Разбирает стартовую строку и заголовки через PicoHTTPParser
+ *          2. Первый проход считает длину нового запроса, второй - заполняет его:
+ *             "METHOD target HTTP/1.x" с версией клиента, заголовки клиента кроме Connection, Proxy-Connection
+ *             и Keep-Alive (и условных при conditional), затем extra и "Connection: keep-alive"
+ *             или "Connection: close"
+ *          3. Дописывает тело запроса без изменений
+ * @note Версия клиента сохраняется: на запрос HTTP/1.0 сервер не ответит телом chunked,
+ *       которое клиент HTTP/1.0 не смог бы разобрать (RFC 9112, 6.1)
+ */
+static char *build_upstream_request(const char *request, size_t request_len, int keep_alive, const char *extra,
+                                    int conditional, size_t *upstream_len) {
+    const char *connection = keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    size_t connection_len = strlen(connection);
+    size_t extra_len = extra != NULL ? strlen(extra) : 0;
+    const char *method, *path;
+    size_t method_len, path_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_request(request, request_len, &method, &method_len, &path, &path_len,
+                             &minor_version, headers, &num_headers, 0);
+    if (pret < 0) {
+        proxy_log_error("Upstream request building error: failed to parse request");
+        return NULL;
+    }
+    char version[] = " HTTP/1.1\r\n";
+    version[sizeof(version) - 4] = minor_version == 0 ? '0' : '1';
+    size_t body_len = request_len - (size_t) pret;
+    char *upstream = NULL;
+    size_t len = 0;
+    for (int pass = 0; pass < 2; pass++) { // Первый проход считает длину, второй - заполняет запрос
+        if (pass == 1) {
+            errno = 0;
+            upstream = malloc(len);
+            if (upstream == NULL) {
+                proxy_log_error("Upstream request building error: %s", strerror(errno));
+                return NULL;
+            }
+        }
+        len = 0;
+        if (pass == 1) {
+            memcpy(upstream, method, method_len);
+            upstream[method_len] = ' ';
+            memcpy(upstream + method_len + 1, path, path_len);
+            memcpy(upstream + method_len + 1 + path_len, version, sizeof(version) - 1);
+        }
+        len += method_len + 1 + path_len + sizeof(version) - 1;
+        int hop_by_hop = 0;
+        for (size_t i = 0; i < num_headers; ++i) {
+            if (headers[i].name != NULL) { // NULL - продолжение предыдущего заголовка на новой строке
+                hop_by_hop = header_name_is(&headers[i], "connection", 10) ||
+                             header_name_is(&headers[i], "proxy-connection", 16) ||
+                             header_name_is(&headers[i], "keep-alive", 10) ||
+                             (conditional && headers[i].name_len > 3 && strncasecmp(headers[i].name, "if-", 3) == 0);
+            }
+            if (hop_by_hop) continue; // Эти заголовки относятся к соединению с клиентом или заменяются условными
+            if (pass == 1) {
+                if (headers[i].name != NULL) {
+                    memcpy(upstream + len, headers[i].name, headers[i].name_len);
+                    upstream[len + headers[i].name_len] = ':';
+                }
+                size_t value_start = len + (headers[i].name != NULL ? headers[i].name_len + 1 : 0);
+                upstream[value_start] = ' ';
+                memcpy(upstream + value_start + 1, headers[i].value, headers[i].value_len);
+                memcpy(upstream + value_start + 1 + headers[i].value_len, "\r\n", 2);
+            }
+            len += (headers[i].name != NULL ? headers[i].name_len + 1 : 0) + 1 + headers[i].value_len + 2;
+        }
+        if (pass == 1) {
+            if (extra_len > 0) memcpy(upstream + len, extra, extra_len);
+            memcpy(upstream + len + extra_len, connection, connection_len);
+            memcpy(upstream + len + extra_len + connection_len, request + pret, body_len);
+        }
+        len += extra_len + connection_len + body_len;
+    }
+    *upstream_len = len;
+    return upstream;
+}
+
+/**
+ * @brief Разбирает URI без копирования и выделения памяти
+ * @param uri Строка URI (завершающий ноль не нужен)
+ * @param uri_len Длина строки
+ * @param parsed Указатель для сохранения частей URI
+ * @return SUCCESS (0) при успехе, ERROR (-1) если URI некорректен
+ * @details Алгоритм работы:
+ *          1. Если строка начинается с "схема://", запоминает схему
+ *          2. Строка, начинающаяся с "/" без схемы, - origin-form: хоста нет, все остальное - путь
+ *          3. Иначе authority продолжается до "/", "?" или "#"; "user@" в ее начале отбрасывается
+ *          4. Хост - до ":" (или содержимое квадратных скобок для IPv6), затем необязательный порт
+ *          5. Путь - остаток строки до фрагмента
+ * @note Строка проходится один раз, все части указывают в исходный буфер
+ */
+int http_parse_uri(const char *uri, size_t uri_len, http_uri_t *parsed) {
+    const char *p = uri, *end = uri + uri_len;
+    memset(parsed, 0, sizeof(*parsed));
+    if (p < end && isalpha((unsigned char) *p)) { // scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." )
+        const char *s = p + 1;
+        while (s < end && (isalnum((unsigned char) *s) || *s == '+' || *s == '-' || *s == '.')) s++;
+        if (end - s >= 3 && memcmp(s, "://", 3) == 0) {
+            parsed->scheme = p;
+            parsed->scheme_len = (size_t) (s - p);
+            p = s + 3;
+        }
+    }
+    if (parsed->scheme == NULL && p < end && *p == '/') { // origin-form: только путь
+        parsed->port = 80;
+        parsed->path = p;
+    } else {
+        const char *authority = p;
+        while (p < end && *p != '/' && *p != '?' && *p != '#') {
+            if (*p == '@') authority = p + 1; // Данные пользователя серверу не нужны
+            p++;
+        }
+        const char *authority_end = p;
+        const char *host = authority, *host_end;
+        if (host < authority_end && *host == '[') { // IPv6-адрес в квадратных скобках
+            host_end = memchr(host, ']', (size_t) (authority_end - host));
+            if (host_end == NULL) {
+                proxy_log_error("URI parsing error: unterminated IPv6 address");
+                return ERROR;
+            }
+            host++;
+            p = host_end + 1;
+        } else {
+            host_end = host;
+            while (host_end < authority_end && *host_end != ':') host_end++;
+            p = host_end;
+        }
+        if (host_end == host) {
+            proxy_log_error("URI parsing error: no host");
+            return ERROR;
+        }
+        for (const char *c = host; c < host_end; c++) {
+            if ((unsigned char) *c <= ' ' || *c == 0x7f) {
+                proxy_log_error("URI parsing error: invalid character in host");
+                return ERROR;
+            }
+        }
+        int port = -1;
+        if (p < authority_end) {
+            if (*p != ':') {
+                proxy_log_error("URI parsing error: unexpected characters after host");
+                return ERROR;
+            }
+            for (p++; p < authority_end; p++) { // Пустой порт означает порт по умолчанию
+                if (*p < '0' || *p > '9') {
+                    proxy_log_error("URI parsing error: invalid port");
+                    return ERROR;
+                }
+                port = (port == -1 ? 0 : port * 10) + (*p - '0');
+                if (port > MAX_PORT) {
+                    proxy_log_error("URI parsing error: port is out of range");
+                    return ERROR;
+                }
+            }
+        }
+        if (port == -1) {
+            port = (parsed->scheme_len == 5 && strncasecmp(parsed->scheme, "https", 5) == 0) ? 443 : 80;
+        }
+        parsed->authority = authority;
+        parsed->authority_len = (size_t) (authority_end - authority);
+        parsed->host = host;
+        parsed->host_len = (size_t) (host_end - host);
+        parsed->port = port;
+        parsed->path = authority_end;
+    }
+    const char *fragment = memchr(parsed->path, '#', (size_t) (end - parsed->path));
+    parsed->path_len = (size_t) ((fragment != NULL ? fragment : end) - parsed->path); // Фрагмент не отправляется серверу
+    return SUCCESS;
+}
+
+/**
+ * @brief Извлекает хост и порт из строки URL или адреса сервера
+ * @param host_port Входная строка (URL или "host:port", завершающий ноль не нужен)
+ * @param host_port_len Длина строки
+ * @param host Буфер для сохранения имени хоста
+ * @param host_size Размер буфера host
+ * @param port Указатель на переменную для сохранения номера порта
+ * @return 0 при успехе, ERROR (-1) при ошибке парсинга
+ * @details Алгоритм работы:
+ *          1. Разбирает строку через http_parse_uri
+ *          2. Проверяет, что хост указан и помещается в буфер
+ *          3. Копирует хост в буфер, добавляя завершающий ноль
+ */
+int http_get_host_port(const char *host_port, size_t host_port_len, char *host, size_t host_size, int *port) {
+    http_uri_t uri;
+    if (http_parse_uri(host_port, host_port_len, &uri) == ERROR) return ERROR;
+    if (uri.host == NULL) {
+        proxy_log_error("Host and port getting error: no host or/and port");
+        return ERROR;
+    }
+    if (uri.host_len >= host_size) {
+        proxy_log_error("Host and port getting error: host is too long");
+        return ERROR;
+    }
+    memcpy(host, uri.host, uri.host_len);
+    host[uri.host_len] = '\0';
+    *port = uri.port;
+    return SUCCESS;
+}
+
+/**
+ * @brief Строит нормализованный ключ кэша для HTTP-запроса
+ * @param request Текст HTTP-запроса
+ * @param request_len Длина запроса
+ * @param key_len Указатель для сохранения длины ключа
+ * @return Ключ (выделен через malloc) или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Разбирает стартовую строку и заголовки через PicoHTTPParser, цель запроса - через http_parse_uri
+ *          2. Для absolute-form ("http://host/path") берет схему и хост из URL,
+ *             для origin-form ("/path") - схему http и хост из заголовка Host
+ *          3. Приводит схему и хост к нижнему регистру, отбрасывает порт по умолчанию
+ *          4. Фрагмент ("#...") отбрасывается, вместо пустого пути подставляется "/"
+ *          5. Собирает строку "METHOD scheme://host[:port]path", для запроса HTTP/1.0 дописывает " HTTP/1.0":
+ *             ответ сервера клиенту HTTP/1.1 может быть в кодировке chunked и не годится для HTTP/1.0
+ * @note Разные браузеры с разными User-Agent и порядком заголовков получают один ключ
+ */
+char *http_build_cache_key(const char *request, size_t request_len, size_t *key_len) {
+    const char *method, *path;
+    size_t method_len, path_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_request(request, request_len, &method, &method_len, &path, &path_len,
+                             &minor_version, headers, &num_headers, 0);
+    if (pret < 0) {
+        proxy_log_error("Cache key building error: failed to parse request");
+        return NULL;
+    }
+    const char *scheme = "http", *authority = NULL;
+    size_t scheme_len = 4, authority_len = 0;
+    http_uri_t uri;
+    if (http_parse_uri(path, path_len, &uri) == ERROR) {
+        proxy_log_error("Cache key building error: invalid request target");
+        return NULL;
+    }
+    if (uri.scheme != NULL || uri.authority == NULL) { // Цель в authority-form ("host:port", "*") остается как есть
+        path = uri.path;
+        path_len = uri.path_len;
+    }
+    if (uri.scheme != NULL) { // absolute-form: схема и хост в самом URL
+        scheme = uri.scheme;
+        scheme_len = uri.scheme_len;
+        authority = uri.authority;
+        authority_len = uri.authority_len;
+    } else { // origin-form: хост из заголовка Host
+        for (size_t i = 0; i < num_headers; ++i) {
+            if (header_name_is(&headers[i], "host", 4)) {
+                authority = headers[i].value;
+                authority_len = headers[i].value_len;
+                break;
+            }
+        }
+        if (authority == NULL) {
+            proxy_log_error("Cache key building error: host header not found");
+            return NULL;
+        }
+    }
+    // Порт по умолчанию для схемы не влияет на ресурс
+    if (scheme_len == 4 && strncasecmp(scheme, "http", 4) == 0 && authority_len > 3 && memcmp(authority + authority_len - 3, ":80", 3) == 0) authority_len -= 3;
+    if (scheme_len == 5 && strncasecmp(scheme, "https", 5) == 0 && authority_len > 4 && memcmp(authority + authority_len - 4, ":443", 4) == 0) authority_len -= 4;
+    static const char http10[] = " HTTP/1.0";
+    size_t version_len = minor_version == 0 ? sizeof(http10) - 1 : 0;
+    size_t len = method_len + 1 + scheme_len + 3 + authority_len + (path_len == 0 ? 1 : path_len) + version_len;
+    errno = 0;
+    char *key = malloc(len + 1);
+    if (key == NULL) {
+        proxy_log_error("Cache key building error: %s", strerror(errno));
+        return NULL;
+    }
+    char *p = key;
+    memcpy(p, method, method_len);
+    p += method_len;
+    *p++ = ' ';
+    for (size_t i = 0; i < scheme_len; i++) *p++ = (char) tolower((unsigned char) scheme[i]);
+    memcpy(p, "://", 3);
+    p += 3;
+    for (size_t i = 0; i < authority_len; i++) *p++ = (char) tolower((unsigned char) authority[i]);
+    if (path_len == 0) *p++ = '/';
+    else {
+        memcpy(p, path, path_len);
+        p += path_len;
+    }
+    memcpy(p, http10, version_len);
+    p += version_len;
+    *p = '\0';
+    *key_len = len;
+    return key;
+}
+
+/**
+ * @brief Извлекает значение заголовка Vary из HTTP-ответа
+ * @param response Заголовки HTTP-ответа
+ * @param response_len Длина заголовков
+ * @param vary Указатель для сохранения указателя на значение (NULL если заголовка нет)
+ * @param vary_len Указатель для сохранения длины значения
+ * @return SUCCESS (0) при успехе, ERROR (-1) при ошибке
+ */
+int http_get_vary(const char *response, size_t response_len, const char **vary, size_t *vary_len) {
+    const char *msg;
+    size_t msg_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version, status;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_response(response, response_len, &minor_version, &status, &msg, &msg_len, headers, &num_headers, 0);
+    if (pret < 0) return ERROR;
+    *vary = NULL;
+    *vary_len = 0;
+    for (size_t i = 0; i < num_headers; ++i) {
+        if (header_name_is(&headers[i], "vary", 4)) {
+            *vary = headers[i].value;
+            *vary_len = headers[i].value_len;
+            break;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Вычисляет свежесть ответа по Cache-Control, Expires, Date и Age
+ * @param response Заголовки HTTP-ответа
+ * @param response_len Длина заголовков
+ * @param freshness Указатель для сохранения свежести
+ * @return SUCCESS (0) при успехе, ERROR (-1) если ответ некорректен
+ * @details Алгоритм работы:
+ *          1. Проходит заголовки Cache-Control (их может быть несколько), Expires, Date и Age
+ *          2. no-store и private запрещают хранение, no-cache дает нулевой срок,
+ *             must-revalidate и proxy-revalidate отключают stale-while-revalidate
+ *          3. Срок свежести - s-maxage, иначе max-age, иначе Expires - Date
+ *             (без Date - Expires - текущее время); некорректный Expires означает "уже устарел"
+ *          4. Из срока вычитается возраст ответа: наибольшее из Age и текущего времени - Date
+ * @note Срок без явных указаний сервера не вычисляется эвристически: HTTP_FRESHNESS_UNKNOWN
+ */
+int http_get_freshness(const char *response, size_t response_len, http_freshness_t *freshness) {
+    const char *msg;
+    size_t msg_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version, status;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_response(response, response_len, &minor_version, &status, &msg, &msg_len, headers, &num_headers, 0);
+    if (pret < 0) return ERROR;
+    long long max_age = -1, s_maxage = -1, swr = 0, age = 0;
+    int no_cache = 0, must_revalidate = 0, has_expires = 0, has_date = 0, expires_valid = 0;
+    time_t expires = 0, date = 0;
+    freshness->no_store = 0;
+    for (size_t i = 0; i < num_headers; ++i) {
+        const char *value = headers[i].value;
+        size_t value_len = headers[i].value_len;
+        if (header_name_is(&headers[i], "cache-control", 13)) {
+            const char *arg;
+            size_t arg_len;
+            long long seconds;
+            if (cache_control_find(value, value_len, "no-store", &arg, &arg_len) ||
+                cache_control_find(value, value_len, "private", &arg, &arg_len)) {
+                freshness->no_store = 1;
+            }
+            if (cache_control_find(value, value_len, "no-cache", &arg, &arg_len)) no_cache = 1;
+            if (cache_control_find(value, value_len, "must-revalidate", &arg, &arg_len) ||
+                cache_control_find(value, value_len, "proxy-revalidate", &arg, &arg_len)) {
+                must_revalidate = 1;
+            }
+            if (cache_control_find(value, value_len, "s-maxage", &arg, &arg_len) &&
+                parse_delta_seconds(arg, arg_len, &seconds) == SUCCESS) {
+                s_maxage = seconds;
+            }
+            if (cache_control_find(value, value_len, "max-age", &arg, &arg_len) &&
+                parse_delta_seconds(arg, arg_len, &seconds) == SUCCESS) {
+                max_age = seconds;
+            }
+            if (cache_control_find(value, value_len, "stale-while-revalidate", &arg, &arg_len) &&
+                parse_delta_seconds(arg, arg_len, &seconds) == SUCCESS) {
+                swr = seconds;
+            }
+        } else if (header_name_is(&headers[i], "expires", 7)) {
+            has_expires = 1;
+            expires_valid = parse_http_date(value, value_len, &expires) == SUCCESS;
+        } else if (header_name_is(&headers[i], "date", 4)) {
+            has_date = parse_http_date(value, value_len, &date) == SUCCESS;
+        } else if (header_name_is(&headers[i], "age", 3)) {
+            long long seconds;
+            if (parse_delta_seconds(value, value_len, &seconds) == SUCCESS) age = seconds;
+        }
+    }
+    time_t now = time(NULL);
+    if (has_date && now - date > age) age = now - date;
+    long long lifetime = HTTP_FRESHNESS_UNKNOWN;
+    if (s_maxage >= 0) {
+        lifetime = s_maxage;
+    } else if (max_age >= 0) {
+        lifetime = max_age;
+    } else if (has_expires) {
+        lifetime = expires_valid ? (long long) expires - (long long) (has_date ? date : now) : 0;
+    }
+    if (no_cache) lifetime = 0;
+    if (lifetime != HTTP_FRESHNESS_UNKNOWN) {
+        lifetime -= age;
+        if (lifetime < 0) lifetime = 0;
+        lifetime *= 1000;
+    }
+    freshness->lifetime_ms = lifetime;
+    freshness->stale_while_revalidate_ms = no_cache || must_revalidate ? 0 : swr * 1000;
+    return SUCCESS;
+}
+
+/**
+ * @brief Извлекает валидаторы ответа для условных запросов
+ * @param response Заголовки HTTP-ответа
+ * @param response_len Длина заголовков
+ * @param etag Указатель для сохранения указателя на значение ETag (NULL если заголовка нет)
+ * @param etag_len Указатель для сохранения длины ETag
+ * @param last_modified Указатель для сохранения указателя на значение Last-Modified (NULL если заголовка нет)
+ * @param last_modified_len Указатель для сохранения длины Last-Modified
+ * @return SUCCESS (0) при успехе, ERROR (-1) при ошибке
+ */
+int http_get_validators(const char *response, size_t response_len, const char **etag, size_t *etag_len,
+                        const char **last_modified, size_t *last_modified_len) {
+    const char *msg;
+    size_t msg_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version, status;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_response(response, response_len, &minor_version, &status, &msg, &msg_len, headers, &num_headers, 0);
+    if (pret < 0) return ERROR;
+    *etag = NULL;
+    *etag_len = 0;
+    *last_modified = NULL;
+    *last_modified_len = 0;
+    for (size_t i = 0; i < num_headers; ++i) {
+        if (header_name_is(&headers[i], "etag", 4)) {
+            *etag = headers[i].value;
+            *etag_len = headers[i].value_len;
+        } else if (header_name_is(&headers[i], "last-modified", 13)) {
+            *last_modified = headers[i].value;
+            *last_modified_len = headers[i].value_len;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Строит ключ варианта ответа по заголовкам, перечисленным в Vary
+ * @param key Основной ключ
+ * @param key_len Длина основного ключа
+ * @param vary Значение заголовка Vary
+ * @param vary_len Длина значения Vary
+ * @param request Текст HTTP-запроса
+ * @param request_len Длина запроса
+ * @param variant_len Указатель для сохранения длины ключа варианта
+ * @return Ключ варианта (выделен через malloc) или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Разбирает заголовки запроса через PicoHTTPParser
+ *          2. Делит vary на имена по запятым, отбрасывая пробелы
+ *          3. Для каждого имени дописывает к ключу "\nимя:значение" (имя в нижнем регистре)
+ *          4. Если заголовок в запросе повторяется, значения объединяются через запятую
+ */
+char *http_build_variant_key(const char *key, size_t key_len, const char *vary, size_t vary_len,
+                             const char *request, size_t request_len, size_t *variant_len) {
+    const char *method, *path;
+    size_t method_len, path_len, num_headers = MAX_HEADERS_COUNT;
+    int minor_version;
+    struct phr_header headers[MAX_HEADERS_COUNT];
+    int pret = parse_request(request, request_len, &method, &method_len, &path, &path_len,
+                             &minor_version, headers, &num_headers, 0);
+    if (pret < 0) {
+        proxy_log_error("Variant key building error: failed to parse request");
+        return NULL;
+    }
+    char *variant = NULL;
+    size_t len = 0;
+    for (int pass = 0; pass < 2; pass++) { // Первый проход считает длину, второй - заполняет ключ
+        if (pass == 1) {
+            errno = 0;
+            variant = malloc(len + 1);
+            if (variant == NULL) {
+                proxy_log_error("Variant key building error: %s", strerror(errno));
+                return NULL;
+            }
+            memcpy(variant, key, key_len);
+        }
+        len = key_len;
+        const char *end = vary + vary_len;
+        const char *next = vary;
+        while (next < end) {
+            const char *name = next;
+            while (name < end && (*name == ' ' || *name == '\t' || *name == ',')) name++;
+            const char *name_end = name;
+            while (name_end < end && *name_end != ',') name_end++;
+            next = name_end;
+            while (name_end > name && (name_end[-1] == ' ' || name_end[-1] == '\t')) name_end--;
+            size_t name_len = (size_t) (name_end - name);
+            if (name_len == 0) continue;
+            if (pass == 1) {
+                variant[len] = '\n';
+                for (size_t i = 0; i < name_len; i++) variant[len + 1 + i] = (char) tolower((unsigned char) name[i]);
+                variant[len + 1 + name_len] = ':';
+            }
+            len += name_len + 2;
+            int first = 1;
+            for (size_t i = 0; i < num_headers; ++i) {
+                if (headers[i].name_len != name_len || strncasecmp(headers[i].name, name, name_len) != 0) continue;
+                if (!first && pass == 1) variant[len] = ',';
+                if (!first) len++;
+                if (pass == 1) memcpy(variant + len, headers[i].value, headers[i].value_len); // picohttpparser уже отбросил пробелы по краям
+                len += headers[i].value_len;
+                first = 0;
+            }
+        }
+    }
+    variant[len] = '\0';
+    *variant_len = len;
+    return variant;
+}
+
+/**
+ * @brief Проверяет, является ли HTTP-запрос кэшируемым
+ * @param method Указатель на строку с HTTP-методом
+ * @param method_len Длина строки метода
+ * @return 1 (true) если метод кэшируемый, 0 (false) если нет
+ * @details В текущей реализации кэшируются только GET-запросы.
+ */
+int http_check_request(const char *method, size_t method_len) {
+    return method_len == 3 && strncmp(method, "GET", method_len) == 0; // Сравнивает строку метода с константой "GET"
+}
+
+/**
+ * @brief Проверяет, является ли HTTP-ответ кэшируемым на основе статус-кода
+ * @param status HTTP статус-код ответа (200, 404, 500 и т.д.)
+ * @return 1 (true) если ответ можно кэшировать, 0 (false) если нет
+ * @details В текущей реализации кэшируются все ответы со статусом < 400.
+ * @note Кэшируются успешные ответы (2xx) и перенаправления (3xx)
+ * @note Не кэшируются клиентские (4xx) и серверные (5xx) ошибки
+ */
+int http_check_response(int status) {
+    return status < 400;
+}
+
+/**
+ * @brief Ищет директиву в значении заголовка Cache-Control
+ * @param value     Значение заголовка
+ * @param value_len Длина значения
+ * @param name      Имя директивы в нижнем регистре
+ * @param arg       Указатель для сохранения аргумента без кавычек (NULL если аргумента нет)
+ * @param arg_len   Указатель для сохранения длины аргумента
+ * @return 1 если директива найдена, 0 если нет
+ * @details Директивы разделяются запятыми, аргумент следует после '=' и может быть в кавычках.
+ *          Запятые внутри кавычек пропускаются.
+ */
+static int cache_control_find(const char *value, size_t value_len, const char *name, const char **arg, size_t *arg_len) {
+    size_t name_len = strlen(name);
+    const char *end = value + value_len;
+    const char *p = value;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *item = p;
+        while (p < end && *p != '=' && *p != ',' && *p != ' ' && *p != '\t') p++;
+        int match = (size_t) (p - item) == name_len && strncasecmp(item, name, name_len) == 0;
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        const char *value_start = NULL, *value_end = NULL;
+        if (p < end && *p == '=') {
+            p++;
+            while (p < end && (*p == ' ' || *p == '\t')) p++;
+            if (p < end && *p == '"') {
+                value_start = ++p;
+                while (p < end && *p != '"') p++;
+                value_end = p;
+                if (p < end) p++;
+            } else {
+                value_start = p;
+                while (p < end && *p != ',' && *p != ' ' && *p != '\t') p++;
+                value_end = p;
+            }
+        }
+        while (p < end && *p != ',') p++;
+        if (match) {
+            *arg = value_start;
+            *arg_len = value_start != NULL ? (size_t) (value_end - value_start) : 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Разбирает число секунд (delta-seconds)
+ * @param value     Строка с числом
+ * @param value_len Длина строки
+ * @param seconds   Указатель для сохранения числа
+ * @return SUCCESS при успехе, ERROR если строка не является числом
+ * @details Пробелы по краям отбрасываются; число больше MAX_DELTA_SECONDS заменяется на него.
+ */
+static int parse_delta_seconds(const char *value, size_t value_len, long long *seconds) {
+    if (value == NULL) return ERROR;
+    const char *end = value + value_len;
+    while (value < end && (*value == ' ' || *value == '\t')) value++;
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    if (value == end) return ERROR;
+    long long result = 0;
+    for (; value < end; value++) {
+        if (!isdigit((unsigned char) *value)) return ERROR;
+        if (result < MAX_DELTA_SECONDS) result = result * 10 + (*value - '0');
+    }
+    *seconds = result < MAX_DELTA_SECONDS ? result : MAX_DELTA_SECONDS;
+    return SUCCESS;
+}
+
+/**
+ * @brief Разбирает дату HTTP (IMF-fixdate, RFC 850 или asctime)
+ * @param value     Строка с датой
+ * @param value_len Длина строки
+ * @param date      Указатель для сохранения времени в секундах от эпохи Unix
+ * @return SUCCESS при успехе, ERROR если дата некорректна
+ * @details Строка копируется в буфер с завершающим нулем и разбирается strptime
+ *          по очереди в трех форматах из RFC 9110, 5.6.7. Названия дней и месяцев
+ *          английские: процесс не меняет локаль "C".
+ */
+static int parse_http_date(const char *value, size_t value_len, time_t *date) {
+    static const char *formats[] = {"%a, %d %b %Y %H:%M:%S GMT", "%A, %d-%b-%y %H:%M:%S GMT", "%a %b %e %H:%M:%S %Y"};
+    char buffer[MAX_DATE_LEN + 1];
+    while (value_len > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        value_len--;
+    }
+    if (value_len == 0 || value_len > MAX_DATE_LEN) return ERROR;
+    memcpy(buffer, value, value_len);
+    buffer[value_len] = '\0';
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *rest = strptime(buffer, formats[i], &tm);
+        if (rest == NULL) continue;
+        while (*rest == ' ' || *rest == '\t') rest++;
+        if (*rest != '\0') continue;
+        *date = timegm(&tm);
+        return *date == (time_t) -1 ? ERROR : SUCCESS;
+    }
+    return ERROR;
+}
+
+/**
+ * @brief Проверяет, есть ли значение в списке заголовка, разделенном запятыми
+ * @param value     Значение заголовка
+ * @param value_len Длина значения
+ * @param token     Искомое значение (без учета регистра)
+ * @return 1 если значение найдено, 0 если нет
+ * @details Элементы списка сравниваются после отбрасывания пробелов по краям.
+ */
+static int header_has_token(const char *value, size_t value_len, const char *token) {
+    size_t token_len = strlen(token);
+    const char *end = value + value_len;
+    const char *next = value;
+    while (next < end) {
+        const char *item = next;
+        while (item < end && (*item == ' ' || *item == '\t' || *item == ',')) item++;
+        const char *item_end = item;
+        while (item_end < end && *item_end != ',') item_end++;
+        next = item_end;
+        while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t')) item_end--;
+        if ((size_t) (item_end - item) == token_len && strncasecmp(item, token, token_len) == 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Проверяет, совпадает ли последнее значение в списке заголовка с образцом
+ * @param value     Значение заголовка
+ * @param value_len Длина значения
+ * @param token     Образец (без учета регистра)
+ * @return 1 если совпадает, 0 если нет
+ * @details Нужна для Transfer-Encoding: конец тела задает только последняя кодировка списка.
+ */
+static int header_last_token_is(const char *value, size_t value_len, const char *token) {
+    size_t token_len = strlen(token);
+    size_t end = value_len;
+    while (end > 0 && (value[end - 1] == ' ' || value[end - 1] == '\t')) end--;
+    size_t start = end;
+    while (start > 0 && value[start - 1] != ',') start--;
+    while (start < end && (value[start] == ' ' || value[start] == '\t')) start++;
+    return end - start == token_len && strncasecmp(value + start, token, token_len) == 0;
+}
+
+/**
+ * @brief Сравнивает имя заголовка с образцом без учета регистра
+ * @param header Разобранный заголовок
+ * @param name Образец в нижнем регистре (буквы, цифры и '-')
+ * @param name_len Длина образца
+ * @return 1 если имена совпадают, 0 если нет
+ * @details Алгоритм работы:
+ *          1. Отсеивает заголовки другой длины
+ *          2. Сравнивает имя словами по 8 байт: в каждом байте имени устанавливается бит 0x20,
+ *             что переводит буквы в нижний регистр, и слово сравнивается со словом образца
+ *          3. Хвост короче 8 байт дополняется нулями в обоих словах и сравнивается так же
+ * @note Установка бита 0x20 не смешивает символы, допустимые в имени заголовка (token),
+ *       с буквами, цифрами и '-', а PicoHTTPParser пропускает в имени только token
+ */
+static int header_name_is(const struct phr_header *header, const char *name, size_t name_len) {
+    if (header->name_len != name_len) return 0;
+    const uint64_t lower = 0x2020202020202020ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= name_len; i += sizeof(uint64_t)) {
+        uint64_t a, b;
+        memcpy(&a, header->name + i, sizeof(a));
+        memcpy(&b, name + i, sizeof(b));
+        if ((a | lower) != b) return 0;
+    }
+    if (i < name_len) {
+        uint64_t a = 0, b = 0;
+        memcpy(&a, header->name + i, name_len - i);
+        memcpy(&b, name + i, name_len - i);
+        if ((a | lower) != (b | lower)) return 0;
+    }
+    return 1;
+}
@@ -1,41 +1,421 @@
 #include "log.h"
 
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 #define MAX_LOG_MESSAGE_LENGTH  1024
+#define MAX_LOG_LINE_LENGTH     (MAX_LOG_MESSAGE_LENGTH + 64) // Сообщение с меткой времени и именем потока
+#define LOG_RING_SIZE           (64 * 1024) // Размер буфера потока (степень двойки)
+#define LOG_FLUSH_INTERVAL_MS   10
+#define LOG_BATCH_SIZE          64 // Сколько фрагментов выводит один вызов writev
+#define THREAD_NAME_SIZE        16
+#define PREFIX_SIZE             32
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/**
+ * @brief Кольцевой буфер строк лога одного потока
+ * @details Один писатель (поток-владелец) и один читатель (поток записи логов).
+ *          head и tail только растут, занятая часть буфера - [tail, head).
+ * @var data          Строки лога
+ * @var head          Конец записанных строк (меняет владелец)
+ * @var tail          Конец выведенных строк (меняет поток записи)
+ * @var orphaned      Поток-владелец завершился, буфер может занять новый поток
+ * @var thread_name   Имя потока-владельца для префикса строк
+ * @var prefix_second Секунда, для которой вычислен prefix
+ * @var prefix        Дата и время с точностью до секунды ("ГГГГ-ММ-ДД ЧЧ:ММ:СС")
+ * @var next          Следующий буфер в списке всех буферов (в порядке создания)
+ */
+struct log_ring_t {
+    char data[LOG_RING_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_int orphaned;
+    char thread_name[THREAD_NAME_SIZE];
+    time_t prefix_second;
+    char prefix[PREFIX_SIZE];
+    _Atomic(struct log_ring_t *) next;
+};
+typedef struct log_ring_t log_ring_t;
+
+int proxy_log_level = LOG_LEVEL_INFO;
+
+static _Atomic(log_ring_t *) rings = NULL;                  // Буферы всех потоков (только добавляются)
+static _Thread_local log_ring_t *local_ring = NULL;         // Буфер текущего потока
+static pthread_key_t ring_key;                              // Освобождает буфер при завершении потока
+static int ring_key_created = 0;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_t writer;                                    // Поток записи логов
+static atomic_int writer_running = 0;
+static int writer_stop = 0;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER; // Один читатель буферов в каждый момент
+
+/**
+ * @brief Создает ключ буферов потоков и запускает поток записи логов
+ * @details Если поток записи не запустился, каждая строка выводится вызвавшим потоком сразу.
+ */
+static void log_init(void);
+
+/**
+ * @brief Останавливает поток записи и выводит оставшиеся строки
+ * @details Регистрируется через atexit.
+ */
+static void log_shutdown(void);
+
+/**
+ * @brief Функция потока записи логов
+ * @param arg Не используется
+ * @return NULL
+ */
+static void *log_writer(void *arg);
+
+/**
+ * @brief Возвращает буфер текущего потока, создавая его при первом вызове
+ * @return Буфер или NULL, если выделить его не удалось
+ */
+static log_ring_t *log_get_ring(void);
+
+/**
+ * @brief Отмечает буфер завершившегося потока свободным
+ * @param arg Буфер
+ */
+static void log_release_ring(void *arg);
 
 /**
- * @brief Выводит форматированное лог-сообщение с метаданными
+ * @brief Записывает в line дату, время и имя потока
+ * @param ring Буфер текущего потока (кэширует дату и имя) или NULL
+ * @param line Буфер строки размера MAX_LOG_LINE_LENGTH
+ * @return Длина префикса
+ */
+static size_t log_format_prefix(log_ring_t *ring, char *line);
+
+/**
+ * @brief Кладет строку в буфер потока
+ * @param ring Буфер текущего потока
+ * @param line Строка
+ * @param len  Длина строки (не больше MAX_LOG_LINE_LENGTH)
+ */
+static void log_ring_push(log_ring_t *ring, const char *line, size_t len);
+
+/**
+ * @brief Выводит все накопленные строки под drain_mutex
+ * @return Количество выведенных байт
+ */
+static size_t log_flush(void);
+
+/**
+ * @brief Выводит фрагменты через writev, повторяя вызов при частичной записи
+ * @param iov   Фрагменты (изменяются)
+ * @param count Количество фрагментов
+ */
+static void log_writev_all(struct iovec *iov, int count);
+
+/**
+ * @brief Форматирует лог-сообщение и передает его потоку записи логов
  * @param format Строка формата (аналогично printf)
  * @param ... Аргументы для подстановки в строку формата
  * @details Формат вывода:
  *          ГГГГ-ММ-ДД ЧЧ:ММ:СС.ммм --- [имя_потока] : сообщение
+ *          Алгоритм работы:
+ *          1. При первом вызове запускает поток записи
+ *          2. Формирует строку в стеке: дата до секунды берется из кэша буфера потока,
+ *             localtime_r вызывается только при смене секунды
+ *          3. Кладет строку в кольцевой буфер потока без блокировок
+ * @note Если буфер потока получить не удалось, строка выводится сразу через write
  */
-void proxy_log(const char *format, ...) {
-    struct timeval tv; // Объявление структуры для времени с микросекундной точностью
-    gettimeofday(&tv, NULL); // Получение текущего времени с микросекундной точностью
-    time_t stamp_time = time(NULL); // Получение текущего времени в секундах
-    struct tm *tm = localtime(&stamp_time); // Преобразование времени в локальное (с учетом часового пояса)
-    char text[MAX_LOG_MESSAGE_LENGTH + 1];
+void proxy_log_write(const char *format, ...) {
+    int saved_errno = errno; // Вызывающий код может проверять errno после логирования
+    pthread_once(&log_once, log_init);
+    log_ring_t *ring = ring_key_created ? log_get_ring() : NULL;
+    char line[MAX_LOG_LINE_LENGTH];
+    size_t len = log_format_prefix(ring, line);
     va_list args;
     va_start(args, format); // Работа с переменными аргументами
-    vsnprintf(text, MAX_LOG_MESSAGE_LENGTH, format, args); // Форматирование
+    int text_len = vsnprintf(line + len, MAX_LOG_MESSAGE_LENGTH, format, args); // Форматирование
     va_end(args);
-    char thread_name[256] = {0};
-    pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name)); // Получение имени потока
-    printf("%04d-%02d-%02d %02d:%02d:%02d.%03d --- [%15s] : %s\n",
-           tm->tm_year + 1900,
-           tm->tm_mon + 1,
-           tm->tm_mday,
-           tm->tm_hour,
-           tm->tm_min,
-           tm->tm_sec,
-           (int)(tv.tv_usec / 1000),
-           thread_name,
-           text);
-    fflush(stdout);
+    if (text_len < 0) text_len = 0;
+    if (text_len >= MAX_LOG_MESSAGE_LENGTH) text_len = MAX_LOG_MESSAGE_LENGTH - 1; // Сообщение обрезано
+    len += (size_t) text_len;
+    line[len++] = '\n';
+    if (ring == NULL) {
+        struct iovec iov = {.iov_base = line, .iov_len = len};
+        log_writev_all(&iov, 1);
+    } else {
+        log_ring_push(ring, line, len);
+    }
+    errno = saved_errno;
+}
+
+/**
+ * @brief Устанавливает наибольший выводимый уровень сообщений
+ * @param level LOG_LEVEL_ERROR, LOG_LEVEL_INFO или LOG_LEVEL_DEBUG
+ */
+void proxy_log_set_level(int level) {
+    proxy_log_level = level;
+}
+
+/**
+ * @brief Устанавливает имя текущего потока, которое выводится в логах
+ * @param name Имя потока (не длиннее 15 символов)
+ * @details На macOS pthread_setname_np именует только вызывающий поток,
+ *          на Linux принимает дескриптор потока первым аргументом.
+ *          Имя, сохраненное в буфере лога потока, обновляется тоже.
+ */
+void proxy_set_thread_name(const char *name) {
+#ifdef __APPLE__
+    pthread_setname_np(name);
+#else
+    pthread_setname_np(pthread_self(), name);
+#endif
+    if (local_ring != NULL) snprintf(local_ring->thread_name, THREAD_NAME_SIZE, "%s", name);
+}
+
+/**
+ * @brief Создает ключ буферов потоков и запускает поток записи логов
+ * @details Алгоритм работы:
+ *          1. Создает ключ, деструктор которого освобождает буфер завершившегося потока
+ *          2. Запускает поток записи и регистрирует log_shutdown через atexit
+ *          3. Если поток записи не запустился, writer_running остается 0 и каждая
+ *             строка выводится потоком, который ее записал
+ */
+static void log_init(void) {
+    if (pthread_key_create(&ring_key, log_release_ring) != 0) return; // Без буферов вывод синхронный
+    ring_key_created = 1;
+    atomic_store(&writer_running, 1);
+    if (pthread_create(&writer, NULL, log_writer, NULL) != 0) {
+        atomic_store(&writer_running, 0);
+        return;
+    }
+    atexit(log_shutdown);
+}
+
+/**
+ * @brief Останавливает поток записи и выводит оставшиеся строки
+ * @details Сначала сбрасывает writer_running: поток, положивший строку после этого,
+ *          сам выводит ее в log_ring_push, поэтому строки не теряются.
+ */
+static void log_shutdown(void) {
+    atomic_store(&writer_running, 0);
+    pthread_mutex_lock(&writer_mutex);
+    writer_stop = 1;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    pthread_join(writer, NULL);
+    log_flush();
+}
+
+/**
+ * @brief Функция потока записи логов
+ * @param arg Не используется
+ * @return NULL
+ * @details Выводит накопленные строки, а если выводить нечего - ждет LOG_FLUSH_INTERVAL_MS
+ *          или сигнала от потока, чей буфер заполнен наполовину.
+ */
+static void *log_writer(__attribute__((unused)) void *arg) {
+    proxy_set_thread_name("log-writer");
+    pthread_mutex_lock(&writer_mutex);
+    while (!writer_stop) {
+        pthread_mutex_unlock(&writer_mutex);
+        size_t written = log_flush();
+        pthread_mutex_lock(&writer_mutex);
+        if (written == 0 && !writer_stop) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writer_cond, &writer_mutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Возвращает буфер текущего потока, создавая его при первом вызове
+ * @return Буфер или NULL, если выделить его не удалось
+ * @details Алгоритм работы:
+ *          1. Ищет буфер завершившегося потока и занимает его через CAS на orphaned
+ *          2. Если такого нет, выделяет новый и добавляет в конец списка через CAS,
+ *             чтобы поток записи выводил строки старых потоков (например, main) первыми
+ *          3. Запоминает имя потока и привязывает буфер к ключу потока
+ * @note Буферы не удаляются из списка до завершения процесса, поэтому поток записи
+ *       обходит список без блокировок
+ */
+static log_ring_t *log_get_ring(void) {
+    if (local_ring != NULL) return local_ring;
+    log_ring_t *ring = NULL;
+    for (log_ring_t *r = atomic_load(&rings); r != NULL; r = r->next) {
+        int expected = 1;
+        if (atomic_compare_exchange_strong(&r->orphaned, &expected, 0)) {
+            ring = r;
+            break;
+        }
+    }
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(log_ring_t));
+        if (ring == NULL) return NULL;
+        _Atomic(log_ring_t *) *link = &rings;
+        log_ring_t *last = NULL;
+        while (!atomic_compare_exchange_strong(link, &last, ring)) { // Добавляет в конец списка
+            link = &last->next;
+            last = NULL;
+        }
+    }
+    ring->prefix_second = -1;
+    pthread_getname_np(pthread_self(), ring->thread_name, THREAD_NAME_SIZE);
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+    return ring;
+}
+
+/**
+ * @brief Отмечает буфер завершившегося потока свободным
+ * @param arg Буфер
+ * @details Невыведенные строки остаются в буфере, поток записи выведет их как обычно.
+ */
+static void log_release_ring(void *arg) {
+    log_ring_t *ring = (log_ring_t *) arg;
+    local_ring = NULL;
+    atomic_store(&ring->orphaned, 1);
+}
+
+/**
+ * @brief Записывает в line дату, время и имя потока
+ * @param ring Буфер текущего потока (кэширует дату и имя) или NULL
+ * @param line Буфер строки размера MAX_LOG_LINE_LENGTH
+ * @return Длина префикса
+ */
+static size_t log_format_prefix(log_ring_t *ring, char *line) {
+    struct timeval tv; // Объявление структуры для времени с микросекундной точностью
+    gettimeofday(&tv, NULL); // Получение текущего времени с микросекундной точностью
+    char local_prefix[PREFIX_SIZE], local_name[THREAD_NAME_SIZE] = {0};
+    char *prefix = ring != NULL ? ring->prefix : local_prefix;
+    const char *name = ring != NULL ? ring->thread_name : local_name;
+    if (ring == NULL) pthread_getname_np(pthread_self(), local_name, THREAD_NAME_SIZE);
+    if (ring == NULL || ring->prefix_second != tv.tv_sec) { // Дата меняется раз в секунду
+        struct tm tm;
+        localtime_r(&tv.tv_sec, &tm); // Преобразование времени в локальное (с учетом часового пояса)
+        strftime(prefix, PREFIX_SIZE, "%Y-%m-%d %H:%M:%S", &tm);
+        if (ring != NULL) ring->prefix_second = tv.tv_sec;
+    }
+    int len = snprintf(line, MAX_LOG_LINE_LENGTH, "%s.%03d --- [%15s] : ", prefix, (int) (tv.tv_usec / 1000), name);
+    return len < 0 ? 0 : (size_t) len;
+}
+
+/**
+ * @brief Кладет строку в буфер потока
+ * @param ring Буфер текущего потока
+ * @param line Строка
+ * @param len  Длина строки (не больше MAX_LOG_LINE_LENGTH)
+ * @details Алгоритм работы:
+ *          1. Если места нет, будит поток записи и уступает процессор, пока место не появится
+ *          2. Копирует строку (с переходом через конец буфера) и публикует новый head
+ *          3. Если буфер заполнился наполовину, будит поток записи, не дожидаясь интервала сброса
+ *          4. Если поток записи уже остановлен, выводит буфер сам
+ */
+static void log_ring_push(log_ring_t *ring, const char *line, size_t len) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    while (LOG_RING_SIZE - (head - tail) < len) { // Буфер полон
+        if (atomic_load(&writer_running)) {
+            pthread_cond_signal(&writer_cond);
+            sched_yield();
+        } else {
+            log_flush();
+        }
+        tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+    size_t offset = head & (LOG_RING_SIZE - 1);
+    size_t first = MIN(len, LOG_RING_SIZE - offset);
+    memcpy(ring->data + offset, line, first);
+    memcpy(ring->data, line + first, len - first);
+    atomic_store(&ring->head, head + len);
+    if (!atomic_load(&writer_running)) {
+        log_flush(); // Поток записи остановлен или не запустился
+    } else if (head - tail < LOG_RING_SIZE / 2 && head + len - tail >= LOG_RING_SIZE / 2) {
+        pthread_cond_signal(&writer_cond);
+    }
+}
+
+/**
+ * @brief Выводит все накопленные строки под drain_mutex
+ * @return Количество выведенных байт
+ * @details Алгоритм работы:
+ *          1. Обходит список буферов и собирает занятые части в массив iovec
+ *             (часть, переходящая через конец буфера, дает два фрагмента)
+ *          2. Когда массив заполнен или буферы кончились, выводит его одним writev
+ *          3. После вывода публикует новые tail, освобождая место писателям
+ */
+static size_t log_flush(void) {
+    struct iovec iov[LOG_BATCH_SIZE];
+    log_ring_t *owners[LOG_BATCH_SIZE];
+    size_t ends[LOG_BATCH_SIZE];
+    int count = 0;
+    size_t total = 0;
+    pthread_mutex_lock(&drain_mutex);
+    for (log_ring_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load(&ring->head);
+        while (tail != head) {
+            size_t offset = tail & (LOG_RING_SIZE - 1);
+            size_t chunk = MIN(head - tail, LOG_RING_SIZE - offset);
+            iov[count].iov_base = ring->data + offset;
+            iov[count].iov_len = chunk;
+            owners[count] = ring;
+            tail += chunk;
+            ends[count] = tail;
+            total += chunk;
+            if (++count == LOG_BATCH_SIZE) {
+                log_writev_all(iov, count);
+                for (int i = 0; i < count; i++) atomic_store_explicit(&owners[i]->tail, ends[i], memory_order_release);
+                count = 0;
+            }
+        }
+    }
+    if (count > 0) {
+        log_writev_all(iov, count);
+        for (int i = 0; i < count; i++) atomic_store_explicit(&owners[i]->tail, ends[i], memory_order_release);
+    }
+    pthread_mutex_unlock(&drain_mutex);
+    return total;
+}
+
+/**
+ * @brief Выводит фрагменты через writev, повторяя вызов при частичной записи
+ * @param iov   Фрагменты (изменяются)
+ * @param count Количество фрагментов
+ * @note При ошибке вывода (например, закрытом stdout) строки отбрасываются
+ */
+static void log_writev_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(STDOUT_FILENO, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= (ssize_t) iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= (size_t) written;
+        }
+    }
 }
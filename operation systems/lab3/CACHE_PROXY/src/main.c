@@ -4,9 +4,12 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "clock.h"
 #include "env.h"
+#include "http.h"
 #include "log.h"
 #include "proxy.h"
+#include "trace.h"
 
 /**
  * @brief Выводит справку по использованию программы
@@ -26,13 +29,33 @@ int main(int argc, char **argv) {
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
-    int handler_count = env_get_client_handler_count(); // Получение количества потоков-обработчиков
-    time_t cache_expired_time_ms = env_get_cache_expired_time_ms(); // Получение времени жизни элементов кэша
+    proxy_clock_start(); // Часы сроков жизни и таймаутов нужны всем модулям
+    proxy_log_set_level(env_get_log_level()); // Уровень логирования нужен до чтения остальных настроек
+    trace_init(env_get_trace_sample(), env_get_trace_file()); // Трассировка включается до создания потоков
+    proxy_config_t config;
+    config.handler_count = env_get_client_handler_count(); // Получение количества потоков-обработчиков
+    config.fetcher_count = env_get_fetcher_count(); // Получение количества потоков-загрузчиков
+    config.cache_expired_time_ms = env_get_cache_expired_time_ms(); // Получение времени жизни элементов кэша
+    config.cache_shards = env_get_cache_shards(); // Получение количества сегментов кэша
+    config.cache_size = env_get_cache_size(); // Получение бюджета памяти кэша
+    config.cache_policy = env_get_cache_policy(); // Получение политики вытеснения
+    config.upstream_idle_per_host = env_get_upstream_idle_per_host(); // Получение предела постоянных соединений с сервером
+    config.upstream_idle_timeout_ms = env_get_upstream_idle_timeout_ms(); // Получение времени простоя соединения с сервером
+    config.client_idle_timeout_ms = env_get_client_idle_timeout_ms(); // Получение времени простоя клиентского соединения
+    config.dns_server = env_get_dns_server(); // Получение адреса сервера имен
+    config.dns_negative_ttl_ms = env_get_dns_negative_ttl_ms(); // Получение времени отрицательного кэширования DNS
+    config.acceptor_count = env_get_acceptor_count(); // Получение количества потоков приема соединений
+    config.listen_backlog = env_get_listen_backlog(); // Получение длины очереди подключений
+    config.admin_port = env_get_admin_port(); // Получение порта администрирования
+    config.io_mode = env_get_io_mode(); // Получение режима обработки соединений
     int port = get_port(argv[1]); // Парсинг номера порта из аргументов
-    proxy_t *proxy = proxy_create(handler_count, cache_expired_time_ms); // Создает и инициализирует структуру прокси с заданными параметрами
+    http_init(); // Выбор реализации разборщика HTTP
+    proxy_t *proxy = proxy_create(&config); // Создает и инициализирует структуру прокси с заданными параметрами
+    if (proxy == NULL) return EXIT_FAILURE;
     proxy_log("Proxy PID: %d", getpid());
     proxy_start(proxy, port);
     proxy_destroy(proxy);
+    trace_dump(); // Все потоки, пишущие трассы, уже остановлены
     return EXIT_SUCCESS;
 }
 
@@ -53,7 +76,7 @@ static int get_port(char *port_str) {
     errno = 0;
     char *end;
     int handler_count = (int) strtol(port_str, &end, 0); // Преобразование строки в число
-    if (errno != 0) proxy_log("Port getting error: %s", strerror(errno));
-    if (end == port_str) proxy_log("Port getting error: no digits were found");
+    if (errno != 0) proxy_log_error("Port getting error: %s", strerror(errno));
+    if (end == port_str) proxy_log_error("Port getting error: no digits were found");
     return handler_count;
 }
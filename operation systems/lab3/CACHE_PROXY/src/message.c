@@ -1,73 +1,243 @@
 #include "message.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "log.h"
 
+#define MESSAGE_CHUNK_MIN       4096            // Размер первого куска сообщения
+#define MESSAGE_CHUNK_MAX       (64 * 1024)     // Предельный размер куска, такие куски переиспользуются
+#define CHUNK_POOL_CAPACITY     256             // Сколько свободных кусков MESSAGE_CHUNK_MAX хранит пул
+
 /**
- * @brief Добавляет новую часть в конец связанного списка сообщений
- * @param message Указатель на указатель на начало списка сообщений
- * @param part    Данные для добавления (будут скопированы)
- * @param part_len Длина данных в байтах
- * @return SUCCESS (0) при успешном добавлении, ERROR (-1) при ошибке
+ * @brief Пул свободных кусков размера MESSAGE_CHUNK_MAX
+ * @details Куски освобожденных ответов складываются в стек и выдаются следующим
+ *          сообщениям, поэтому при загрузке больших ответов память почти не запрашивается
+ *          у аллокатора. Размер пула ограничен CHUNK_POOL_CAPACITY.
+ * @var mutex Мьютекс, защищающий стек
+ * @var head  Вершина стека свободных кусков (связаны через next)
+ * @var count Количество кусков в стеке
+ */
+static struct {
+    pthread_mutex_t mutex;
+    message_chunk_t *head;
+    size_t count;
+} chunk_pool = {PTHREAD_MUTEX_INITIALIZER, NULL, 0};
+
+/**
+ * @brief Выделяет кусок сообщения
+ * @param capacity Размер области данных
+ * @return Указатель на кусок или NULL при ошибке
+ */
+static message_chunk_t *chunk_alloc(size_t capacity);
+
+/**
+ * @brief Освобождает кусок сообщения
+ * @param chunk Кусок
+ */
+static void chunk_free(message_chunk_t *chunk);
+
+/**
+ * @brief Выделяет кусок сообщения
+ * @param capacity Размер области данных
+ * @return Указатель на кусок или NULL при ошибке
+ * @details Кусок максимального размера сначала ищется в пуле, остальные
+ *          выделяются через malloc.
+ */
+static message_chunk_t *chunk_alloc(size_t capacity) {
+    message_chunk_t *chunk = NULL;
+    if (capacity == MESSAGE_CHUNK_MAX) {
+        pthread_mutex_lock(&chunk_pool.mutex);
+        chunk = chunk_pool.head;
+        if (chunk != NULL) {
+            chunk_pool.head = chunk->next;
+            chunk_pool.count--;
+        }
+        pthread_mutex_unlock(&chunk_pool.mutex);
+    }
+    if (chunk == NULL) {
+        errno = 0;
+        chunk = malloc(sizeof(message_chunk_t) + capacity);
+        if (chunk == NULL) {
+            proxy_log_error("Message chunk allocation error: %s", strerror(errno));
+            return NULL;
+        }
+    }
+    chunk->next = NULL;
+    chunk->capacity = capacity;
+    return chunk;
+}
+
+/**
+ * @brief Освобождает кусок сообщения
+ * @param chunk Кусок
+ * @details Кусок максимального размера возвращается в пул, если там есть место.
+ */
+static void chunk_free(message_chunk_t *chunk) {
+    if (chunk->capacity == MESSAGE_CHUNK_MAX) {
+        pthread_mutex_lock(&chunk_pool.mutex);
+        if (chunk_pool.count < CHUNK_POOL_CAPACITY) {
+            chunk->next = chunk_pool.head;
+            chunk_pool.head = chunk;
+            chunk_pool.count++;
+            chunk = NULL;
+        }
+        pthread_mutex_unlock(&chunk_pool.mutex);
+    }
+    free(chunk);
+}
+
+/**
+ * @brief Возвращает свободное место в конце сообщения для записи без промежуточного буфера
+ * @param message Указатель на указатель на сообщение
+ * @param hint    Сколько байт писатель собирается записать
+ * @param len     Указатель для сохранения размера свободного места
+ * @return Указатель на свободное место или NULL при ошибке
  * @details Алгоритм:
- *          1. Проверяет корректность указателя message
- *          2. Выделяет память для нового узла списка
- *          3. Выделяет память для копии данных part
- *          4. Копирует данные из part в выделенную память
- *          5. Добавляет узел в конец списка
+ *          1. Проверяет корректность указателя message, при необходимости создает сообщение
+ *          2. Если в последнем куске нет места, выделяет следующий: вдвое больше предыдущего
+ *             (или сразу под hint), но не больше MESSAGE_CHUNK_MAX
+ *          3. Возвращает свободную часть последнего куска
  */
-int message_add_part(message_t **message, char *part, size_t part_len) {
+char *message_reserve(message_t **message, size_t hint, size_t *len) {
+    *len = 0;
     if (message == NULL) {
-        proxy_log("Message part adding error: message pointer is NULL");
-        return ERROR;
-    }
-    errno = 0;
-    message_t *part_msg = malloc(sizeof(message_t)); // Выделяет память для структуры message_t
-    if (part_msg == NULL) {
-        if (errno == ENOMEM) proxy_log("Message part adding error: %s", strerror(errno));
-        else proxy_log("Message part adding error: failed to reallocate memory");
-        return ERROR;
+        proxy_log_error("Message reserving error: message pointer is NULL");
+        return NULL;
     }
-    errno = 0;
-    part_msg->part = calloc(sizeof(char), part_len); // Выделение памяти для данных части сообщения
-    if (part_msg->part == NULL) {
-        if (errno == ENOMEM) proxy_log("Message part adding error: %s", strerror(errno));
-        else proxy_log("Message part adding error: failed to reallocate memory");
-        free(part_msg);
-        return ERROR;
+    if (*message == NULL) {
+        errno = 0;
+        message_t *created = malloc(sizeof(message_t));
+        if (created == NULL) {
+            proxy_log_error("Message reserving error: %s", strerror(errno));
+            return NULL;
+        }
+        created->head = NULL;
+        created->tail = NULL;
+        created->tail_len = 0;
+        atomic_init(&created->length, 0);
+        *message = created;
     }
-    strncpy(part_msg->part, part, part_len); // Копирование данных в выделенную память
-    part_msg->part_len = part_len;
-    part_msg->next = NULL;
-    if (*message == NULL) { // Добавление узла в пустой список
-        *message = part_msg;
-        return SUCCESS;
+    message_t *msg = *message;
+    if (msg->tail == NULL || msg->tail_len == msg->tail->capacity) { // Нужен новый кусок
+        size_t capacity = msg->tail == NULL ? MESSAGE_CHUNK_MIN : msg->tail->capacity * 2;
+        if (capacity < hint) capacity = hint; // Сразу кусок под всю порцию
+        if (capacity > MESSAGE_CHUNK_MAX) capacity = MESSAGE_CHUNK_MAX;
+        message_chunk_t *chunk = chunk_alloc(capacity);
+        if (chunk == NULL) return NULL;
+        if (msg->tail == NULL) msg->head = chunk;
+        else msg->tail->next = chunk;
+        msg->tail = chunk;
+        msg->tail_len = 0;
     }
-    message_t *end = *message;
-    while (end->next != NULL) end = end->next; // Цикл поиска последнего элемента. Перемещается по списку пока не найдет элемент с next == NULL.
-    end->next = part_msg; // Добавление узла в конец списка
+    *len = msg->tail->capacity - msg->tail_len;
+    return msg->tail->data + msg->tail_len;
+}
+
+/**
+ * @brief Публикует данные, записанные в место, полученное от message_reserve
+ * @param message Сообщение
+ * @param len     Количество записанных байт
+ * @details Новый размер записывается с release-семантикой: читатель, увидевший его,
+ *          видит и сами данные, и ссылки на новые куски.
+ */
+void message_commit(message_t *message, size_t len) {
+    message->tail_len += len;
+    size_t length = atomic_load_explicit(&message->length, memory_order_relaxed); // Меняет length только писатель
+    atomic_store_explicit(&message->length, length + len, memory_order_release);
+}
+
+/**
+ * @brief Дописывает данные в конец сообщения
+ * @param message  Указатель на указатель на сообщение
+ * @param part     Данные для добавления (будут скопированы)
+ * @param part_len Длина данных в байтах
+ * @return SUCCESS (0) при успешном добавлении, ERROR (-1) при ошибке
+ * @details Алгоритм:
+ *          1. Получает свободное место в конце сообщения через message_reserve()
+ *          2. Копирует в него столько данных, сколько помещается, и публикует их
+ *          3. Повторяет, пока не скопированы все данные
+ * @note При ошибке уже скопированная часть данных остается опубликованной
+ */
+int message_add_part(message_t **message, const char *part, size_t part_len) {
+    do {
+        size_t len;
+        char *space = message_reserve(message, part_len, &len);
+        if (space == NULL) return ERROR;
+        if (len > part_len) len = part_len;
+        memcpy(space, part, len); // Ответ может содержать нулевые байты
+        message_commit(*message, len);
+        part += len;
+        part_len -= len;
+    } while (part_len > 0);
     return SUCCESS;
 }
 
 /**
- * @brief Полностью уничтожает связанный список сообщений
- * @param message Указатель на указатель на начало списка сообщений
- * @details Освобождает всю память, связанную со списком:
- *          1. Память данных каждой части (part)
- *          2. Память узлов списка (message_t)
+ * @brief Возвращает опубликованный размер сообщения
+ * @param message Сообщение (может быть NULL)
+ * @return Количество байт, доступных читателям
+ */
+size_t message_length(const message_t *message) {
+    if (message == NULL) return 0;
+    return atomic_load_explicit(&message->length, memory_order_acquire);
+}
+
+/**
+ * @brief Возвращает непрерывный участок данных, доступных читателю
+ * @param message Сообщение (может быть NULL)
+ * @param reader  Позиция читателя
+ * @param len     Указатель для сохранения длины участка (0 если новых данных нет)
+ * @return Указатель на данные или NULL если новых данных нет
+ * @details Алгоритм:
+ *          1. Читает опубликованный размер сообщения
+ *          2. Если читатель дошел до конца заполненного куска, переходит к следующему
+ *             (он существует, раз опубликованный размер больше)
+ *          3. Возвращает данные от позиции читателя до конца куска или опубликованных данных
+ */
+const char *message_peek(const message_t *message, message_reader_t *reader, size_t *len) {
+    *len = 0;
+    size_t length = message_length(message);
+    if (length <= reader->chunk_start + reader->offset) return NULL;
+    if (reader->chunk == NULL) reader->chunk = message->head;
+    if (reader->offset == reader->chunk->capacity) {
+        reader->chunk_start += reader->chunk->capacity;
+        reader->chunk = reader->chunk->next;
+        reader->offset = 0;
+    }
+    size_t end = length - reader->chunk_start;
+    if (end > reader->chunk->capacity) end = reader->chunk->capacity;
+    *len = end - reader->offset;
+    return reader->chunk->data + reader->offset;
+}
+
+/**
+ * @brief Сдвигает позицию читателя
+ * @param reader Позиция читателя
+ * @param len    Количество прочитанных байт
+ */
+void message_consume(message_reader_t *reader, size_t len) {
+    reader->offset += len;
+}
+
+/**
+ * @brief Полностью уничтожает сообщение
+ * @param message Указатель на указатель на сообщение
+ * @details Освобождает всю память, связанную с сообщением:
+ *          1. Куски данных (большие возвращаются в пул)
+ *          2. Саму структуру message_t
  *          3. Устанавливает *message = NULL
  */
 void message_destroy(message_t **message) {
     if (*message == NULL) return;
-    message_t *curr = *message, *tmp = NULL; // curr: указатель на текущий элемент (начинает с головы); tmp: указатель на элемент для освобождения
+    message_chunk_t *curr = (*message)->head;
     while (curr != NULL) {
-        tmp = curr;
-        curr = curr->next;
-        free(tmp->part);
-        free(tmp);
+        message_chunk_t *next = curr->next;
+        chunk_free(curr);
+        curr = next;
     }
+    free(*message);
     *message = NULL;
 }
@@ -0,0 +1,404 @@
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CACHE_LINE_SIZE         64
+#define HISTOGRAM_SUB_BITS      3 // 8 корзин на каждую степень двойки: погрешность не больше 12.5%
+#define HISTOGRAM_SUB_COUNT     (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_VALUE     ((UINT64_C(1) << 36) - 1) // Около 19 часов, большие значения обрезаются
+#define HISTOGRAM_BUCKETS       (2 * HISTOGRAM_SUB_COUNT + (36 - HISTOGRAM_SUB_BITS - 1) * HISTOGRAM_SUB_COUNT)
+#define EXPORT_MIN_POWER        6  // Наименьшая граница корзины при выводе: 2^6 мкс = 64 мкс
+#define EXPORT_MAX_POWER        26 // Наибольшая граница корзины при выводе: 2^26 мкс ~ 67 с
+
+/**
+ * @brief Гистограмма одного потока в стиле HDR
+ * @details Значения меньше 2 * HISTOGRAM_SUB_COUNT хранятся точно, остальные - в корзинах,
+ *          делящих каждый интервал [2^k, 2^(k+1)) на HISTOGRAM_SUB_COUNT равных частей.
+ * @var buckets Количество значений в корзинах
+ * @var count   Общее количество значений
+ * @var sum     Сумма значений (мкс)
+ */
+struct histogram_data_t {
+    atomic_uint_fast64_t buckets[HISTOGRAM_BUCKETS];
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+};
+typedef struct histogram_data_t histogram_data_t;
+
+/**
+ * @brief Метрики одного потока
+ * @details Занимает целое число строк кэша, поэтому потоки не делят строки друг с другом.
+ *          Пишет только поток-владелец, читает поток, выводящий метрики.
+ * @var counters   Счетчики
+ * @var histograms Гистограммы
+ * @var orphaned   Поток-владелец завершился, копию может занять новый поток
+ * @var next       Следующая копия в списке всех копий
+ */
+struct metrics_slot_t {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t counters[METRIC_COUNTER_COUNT];
+    histogram_data_t histograms[METRIC_HISTOGRAM_COUNT];
+    atomic_int orphaned;
+    _Atomic(struct metrics_slot_t *) next;
+};
+typedef struct metrics_slot_t metrics_slot_t;
+
+/**
+ * @brief Описание счетчика для вывода
+ * @var name   Имя семейства (счетчики одного семейства идут подряд)
+ * @var labels Метки или NULL
+ * @var help   Описание семейства
+ */
+struct counter_info_t {
+    const char *name;
+    const char *labels;
+    const char *help;
+};
+typedef struct counter_info_t counter_info_t;
+
+/**
+ * @brief Описание гистограммы для вывода
+ * @var name Имя семейства (без суффикса _seconds)
+ * @var help Описание семейства
+ */
+struct histogram_info_t {
+    const char *name;
+    const char *help;
+};
+typedef struct histogram_info_t histogram_info_t;
+
+static const counter_info_t counter_info[METRIC_COUNTER_COUNT] = {
+    [METRIC_REQUESTS]          = {"cache_proxy_requests_total", NULL, "Client requests received."},
+    [METRIC_CACHE_HITS]        = {"cache_proxy_cache_lookups_total", "result=\"hit\"", "Cache lookups by result."},
+    [METRIC_CACHE_MISSES]      = {"cache_proxy_cache_lookups_total", "result=\"miss\"", NULL},
+    [METRIC_CACHE_COALESCED]   = {"cache_proxy_cache_lookups_total", "result=\"coalesced\"", NULL},
+    [METRIC_CACHE_BYPASS]      = {"cache_proxy_cache_lookups_total", "result=\"bypass\"", NULL},
+    [METRIC_BYTES_FROM_CACHE]  = {"cache_proxy_response_bytes_total", "source=\"cache\"", "Response bytes sent to clients by source."},
+    [METRIC_BYTES_FROM_ORIGIN] = {"cache_proxy_response_bytes_total", "source=\"origin\"", NULL},
+    [METRIC_CACHE_EVICTIONS]   = {"cache_proxy_cache_evictions_total", NULL, "Cache entries evicted to stay within the memory budget."},
+    [METRIC_CACHE_EXPIRATIONS] = {"cache_proxy_cache_expirations_total", NULL, "Cache entries removed by the garbage collector after their lifetime."},
+    [METRIC_CACHE_REFRESHED]   = {"cache_proxy_cache_revalidations_total", "result=\"not_modified\"", "Stale cache entries revalidated with the origin by result."},
+    [METRIC_CACHE_REPLACED]    = {"cache_proxy_cache_revalidations_total", "result=\"modified\"", NULL},
+    [METRIC_POOL_TASKS]        = {"cache_proxy_thread_pool_tasks_total", NULL, "Tasks executed by thread pools."},
+};
+
+static const histogram_info_t histogram_info[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_TIME_TO_FIRST_BYTE] = {"cache_proxy_time_to_first_byte", "Time from a complete request to the first response byte sent."},
+    [METRIC_REQUEST_DURATION]   = {"cache_proxy_request_duration", "Time from a complete request to the last response byte sent."},
+    [METRIC_POOL_TASK_WAIT]     = {"cache_proxy_thread_pool_task_wait", "Time tasks spend queued in thread pools."},
+};
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static _Atomic(metrics_slot_t *) slots = NULL;              // Копии всех потоков (только добавляются)
+static _Thread_local metrics_slot_t *local_slot = NULL;     // Копия текущего потока
+static pthread_key_t slot_key;                              // Освобождает копию при завершении потока
+static int slot_key_created = 0;
+static pthread_once_t metrics_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Создает ключ, освобождающий копии метрик завершившихся потоков
+ */
+static void metrics_init(void);
+
+/**
+ * @brief Отмечает копию метрик завершившегося потока свободной
+ * @param arg Копия метрик
+ */
+static void metrics_release_slot(void *arg);
+
+/**
+ * @brief Возвращает копию метрик текущего потока, создавая ее при первом вызове
+ * @return Копия или NULL, если выделить ее не удалось
+ */
+static metrics_slot_t *metrics_get_slot(void);
+
+/**
+ * @brief Увеличивает значение, которое пишет только один поток
+ * @param value Значение
+ * @param delta Приращение
+ */
+static void slot_add(atomic_uint_fast64_t *value, uint64_t delta);
+
+/**
+ * @brief Вычисляет номер корзины гистограммы для значения
+ * @param value Значение (не больше HISTOGRAM_MAX_VALUE)
+ * @return Номер корзины
+ */
+static int histogram_index(uint64_t value);
+
+/**
+ * @brief Вычисляет верхнюю (не входящую в корзину) границу корзины
+ * @param index Номер корзины
+ * @return Граница в микросекундах
+ */
+static uint64_t histogram_upper_bound(int index);
+
+/**
+ * @brief Возвращает текущее время монотонных часов в микросекундах
+ * @return Время в микросекундах
+ */
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Увеличивает счетчик текущего потока
+ * @param counter Счетчик
+ * @param value   Приращение
+ */
+void metrics_add(metrics_counter_t counter, uint64_t value) {
+    metrics_slot_t *slot = metrics_get_slot();
+    if (slot == NULL) return;
+    slot_add(&slot->counters[counter], value);
+}
+
+/**
+ * @brief Добавляет значение в гистограмму текущего потока
+ * @param histogram Гистограмма
+ * @param value_us  Значение в микросекундах
+ */
+void metrics_record(metrics_histogram_t histogram, uint64_t value_us) {
+    metrics_slot_t *slot = metrics_get_slot();
+    if (slot == NULL) return;
+    if (value_us > HISTOGRAM_MAX_VALUE) value_us = HISTOGRAM_MAX_VALUE;
+    histogram_data_t *data = &slot->histograms[histogram];
+    slot_add(&data->buckets[histogram_index(value_us)], 1);
+    slot_add(&data->count, 1);
+    slot_add(&data->sum, value_us);
+}
+
+/**
+ * @brief Начинает измерение запроса и учитывает его в METRIC_REQUESTS
+ * @param request Состояние измерения
+ */
+void metrics_request_start(metrics_request_t *request) {
+    request->start_us = metrics_now_us();
+    request->first_byte = 0;
+    request->from_cache = 0;
+    metrics_add(METRIC_REQUESTS, 1);
+}
+
+/**
+ * @brief Учитывает результат поиска запроса в кэше
+ * @param request Состояние измерения
+ * @param lookup  Результат поиска
+ */
+void metrics_request_lookup(metrics_request_t *request, metrics_lookup_t lookup) {
+    static const metrics_counter_t counters[] = {
+        [METRICS_LOOKUP_HIT] = METRIC_CACHE_HITS,
+        [METRICS_LOOKUP_MISS] = METRIC_CACHE_MISSES,
+        [METRICS_LOOKUP_COALESCED] = METRIC_CACHE_COALESCED,
+        [METRICS_LOOKUP_BYPASS] = METRIC_CACHE_BYPASS,
+    };
+    request->from_cache = lookup == METRICS_LOOKUP_HIT || lookup == METRICS_LOOKUP_COALESCED;
+    metrics_add(counters[lookup], 1);
+}
+
+/**
+ * @brief Учитывает отправленные клиенту байты ответа
+ * @param request Состояние измерения
+ * @param bytes   Количество отправленных байт
+ */
+void metrics_request_sent(metrics_request_t *request, size_t bytes) {
+    if (bytes == 0) return;
+    if (!request->first_byte) {
+        request->first_byte = 1;
+        metrics_record(METRIC_TIME_TO_FIRST_BYTE, metrics_now_us() - request->start_us);
+    }
+    metrics_add(request->from_cache ? METRIC_BYTES_FROM_CACHE : METRIC_BYTES_FROM_ORIGIN, bytes);
+}
+
+/**
+ * @brief Завершает измерение запроса, записывая его длительность
+ * @param request Состояние измерения
+ */
+void metrics_request_finish(metrics_request_t *request) {
+    metrics_record(METRIC_REQUEST_DURATION, metrics_now_us() - request->start_us);
+}
+
+/**
+ * @brief Выводит счетчики и гистограммы в текстовом формате Prometheus
+ * @param out Поток вывода
+ * @details Алгоритм работы:
+ *          1. Суммирует копии счетчиков всех потоков и выводит их, группируя по семействам
+ *          2. Для каждой гистограммы суммирует корзины всех потоков
+ *          3. Выводит накопленные количества для границ 2^EXPORT_MIN_POWER..2^EXPORT_MAX_POWER мкс
+ *             (они совпадают с границами внутренних корзин), +Inf, сумму и количество
+ *          4. Выводит квантили как верхние границы корзин, в которые они попали
+ * @note Копии читаются без остановки потоков, поэтому значения разных счетчиков
+ *       могут относиться к немного разным моментам времени
+ */
+void metrics_write(FILE *out) {
+    uint64_t counters[METRIC_COUNTER_COUNT] = {0};
+    for (metrics_slot_t *slot = atomic_load(&slots); slot != NULL; slot = atomic_load(&slot->next)) {
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++) counters[i] += atomic_load_explicit(&slot->counters[i], memory_order_relaxed);
+    }
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        if (i == 0 || strcmp(counter_info[i].name, counter_info[i - 1].name) != 0) {
+            metrics_write_header(out, counter_info[i].name, "counter", counter_info[i].help);
+        }
+        metrics_write_sample(out, counter_info[i].name, counter_info[i].labels, (double) counters[i]);
+    }
+    static uint64_t buckets[HISTOGRAM_BUCKETS]; // Вызывается только из потока администрирования
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        uint64_t sum = 0;
+        memset(buckets, 0, sizeof(buckets));
+        for (metrics_slot_t *slot = atomic_load(&slots); slot != NULL; slot = atomic_load(&slot->next)) {
+            histogram_data_t *data = &slot->histograms[h];
+            for (int i = 0; i < HISTOGRAM_BUCKETS; i++) buckets[i] += atomic_load_explicit(&data->buckets[i], memory_order_relaxed);
+            sum += atomic_load_explicit(&data->sum, memory_order_relaxed);
+        }
+        const char *name = histogram_info[h].name;
+        fprintf(out, "# HELP %s_seconds %s\n# TYPE %s_seconds histogram\n", name, histogram_info[h].help, name);
+        uint64_t cumulative = 0, total = 0;
+        int index = 0;
+        for (int power = EXPORT_MIN_POWER; power <= EXPORT_MAX_POWER; power++) {
+            uint64_t bound = UINT64_C(1) << power;
+            while (index < HISTOGRAM_BUCKETS && histogram_upper_bound(index) <= bound) cumulative += buckets[index++];
+            fprintf(out, "%s_seconds_bucket{le=\"%.6f\"} %llu\n", name, (double) bound / 1e6, (unsigned long long) cumulative);
+        }
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++) total += buckets[i];
+        fprintf(out, "%s_seconds_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) total);
+        fprintf(out, "%s_seconds_sum %.6f\n", name, (double) sum / 1e6);
+        fprintf(out, "%s_seconds_count %llu\n", name, (unsigned long long) total); // Из корзин, чтобы не расходиться с ними
+        fprintf(out, "# HELP %s_quantile_seconds Quantiles of %s_seconds since start.\n# TYPE %s_quantile_seconds gauge\n", name, name, name);
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            double value = 0;
+            if (total > 0) {
+                uint64_t rank = (uint64_t) (quantiles[q] * (double) total + 0.5);
+                if (rank == 0) rank = 1;
+                uint64_t seen = 0;
+                for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+                    seen += buckets[i];
+                    if (seen >= rank) {
+                        value = (double) histogram_upper_bound(i) / 1e6;
+                        break;
+                    }
+                }
+            }
+            fprintf(out, "%s_quantile_seconds{quantile=\"%g\"} %.6f\n", name, quantiles[q], value);
+        }
+    }
+}
+
+/**
+ * @brief Выводит строки HELP и TYPE семейства метрик
+ * @param out  Поток вывода
+ * @param name Имя семейства
+ * @param type Тип ("counter" или "gauge")
+ * @param help Описание
+ */
+void metrics_write_header(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @brief Выводит одно значение метрики
+ * @param out    Поток вывода
+ * @param name   Имя семейства
+ * @param labels Метки без фигурных скобок или NULL
+ * @param value  Значение
+ */
+void metrics_write_sample(FILE *out, const char *name, const char *labels, double value) {
+    if (labels != NULL) fprintf(out, "%s{%s} %.17g\n", name, labels, value);
+    else fprintf(out, "%s %.17g\n", name, value);
+}
+
+/**
+ * @brief Создает ключ, освобождающий копии метрик завершившихся потоков
+ */
+static void metrics_init(void) {
+    if (pthread_key_create(&slot_key, metrics_release_slot) == 0) slot_key_created = 1;
+}
+
+/**
+ * @brief Отмечает копию метрик завершившегося потока свободной
+ * @param arg Копия метрик
+ * @details Значения не обнуляются: счетчики остаются монотонными, а новый владелец продолжает их.
+ */
+static void metrics_release_slot(void *arg) {
+    metrics_slot_t *slot = (metrics_slot_t *) arg;
+    local_slot = NULL;
+    atomic_store(&slot->orphaned, 1);
+}
+
+/**
+ * @brief Возвращает копию метрик текущего потока, создавая ее при первом вызове
+ * @return Копия или NULL, если выделить ее не удалось
+ * @details Алгоритм работы:
+ *          1. Ищет копию завершившегося потока и занимает ее через CAS на orphaned
+ *          2. Если такой нет, выделяет новую, выровненную по строке кэша,
+ *             и добавляет в конец списка через CAS
+ *          3. Привязывает копию к ключу потока
+ */
+static metrics_slot_t *metrics_get_slot(void) {
+    if (local_slot != NULL) return local_slot;
+    pthread_once(&metrics_once, metrics_init);
+    if (!slot_key_created) return NULL;
+    metrics_slot_t *slot = NULL;
+    for (metrics_slot_t *s = atomic_load(&slots); s != NULL; s = atomic_load(&s->next)) {
+        int expected = 1;
+        if (atomic_compare_exchange_strong(&s->orphaned, &expected, 0)) {
+            slot = s;
+            break;
+        }
+    }
+    if (slot == NULL) {
+        slot = aligned_alloc(CACHE_LINE_SIZE, sizeof(metrics_slot_t));
+        if (slot == NULL) return NULL;
+        memset(slot, 0, sizeof(metrics_slot_t));
+        _Atomic(metrics_slot_t *) *link = &slots;
+        metrics_slot_t *last = NULL;
+        while (!atomic_compare_exchange_strong(link, &last, slot)) { // Добавляет в конец списка
+            link = &last->next;
+            last = NULL;
+        }
+    }
+    pthread_setspecific(slot_key, slot);
+    local_slot = slot;
+    return slot;
+}
+
+/**
+ * @brief Увеличивает значение, которое пишет только один поток
+ * @param value Значение
+ * @param delta Приращение
+ * @details Обычные чтение и запись вместо атомарного сложения: единственный писатель
+ *          не теряет приращений, а читатель видит значение целиком.
+ */
+static void slot_add(atomic_uint_fast64_t *value, uint64_t delta) {
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+/**
+ * @brief Вычисляет номер корзины гистограммы для значения
+ * @param value Значение (не больше HISTOGRAM_MAX_VALUE)
+ * @return Номер корзины
+ * @details Значения меньше 2 * HISTOGRAM_SUB_COUNT дают номер, равный значению.
+ *          Для остальных старшие HISTOGRAM_SUB_BITS + 1 бит задают корзину внутри
+ *          интервала [2^k, 2^(k+1)), а k - номер интервала.
+ */
+static int histogram_index(uint64_t value) {
+    if (value < 2 * HISTOGRAM_SUB_COUNT) return (int) value;
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    return 2 * HISTOGRAM_SUB_COUNT + (shift - 1) * HISTOGRAM_SUB_COUNT + (int) (value >> shift) - HISTOGRAM_SUB_COUNT;
+}
+
+/**
+ * @brief Вычисляет верхнюю (не входящую в корзину) границу корзины
+ * @param index Номер корзины
+ * @return Граница в микросекундах
+ */
+static uint64_t histogram_upper_bound(int index) {
+    if (index < 2 * HISTOGRAM_SUB_COUNT) return (uint64_t) index + 1;
+    int shift = (index - 2 * HISTOGRAM_SUB_COUNT) / HISTOGRAM_SUB_COUNT + 1;
+    uint64_t mantissa = (uint64_t) ((index - 2 * HISTOGRAM_SUB_COUNT) % HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_COUNT);
+    return (mantissa + 1) << shift;
+}
@@ -3,98 +3,326 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <netdb.h>
 #include <netinet/in.h>
-#include <regex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
+#include "admin.h"
 #include "cache.h"
+#include "dns.h"
+#include "http.h"
 #include "log.h"
+#include "metrics.h"
 #include "thread_pool.h"
+#include "trace.h"
+#include "upstream.h"
 
-#include "../picohttpparser/picohttpparser.h"
+#ifdef CACHE_PROXY_HAVE_EPOLL
+#include "reactor.h"
+#endif
+#ifdef CACHE_PROXY_HAVE_IO_URING
+#include "uring.h"
+#endif
 
 #define BUFFER_SIZE             4096
-#define CACHE_CAPACITY          100
-#define TASK_QUEUE_CAPACITY     100
-#define MAX_USERS_COUNT         10
+#define FETCH_BUFFER_SIZE       (64 * 1024)
+#define MAX_HEADER_SIZE         (64 * 1024)
+#define MAX_REQUEST_SIZE        (1024 * 1024)   // Предел запроса вместе с телом
+#define TASK_QUEUE_CAPACITY     128             // Емкость дека исполнителя; лишние задачи уходят в общую очередь пула
+#define CLIENT_IDLE_POLL_MS     100             // Как часто простаивающее соединение проверяет, не ждут ли поток другие клиенты
 #define ACCEPT_TIMEOUT_MS       1000
+#define ACCEPT_BATCH            64              // Сколько соединений поток приема забирает из очереди за одно пробуждение
+#define ACCEPT_BACKOFF_MS       100             // Пауза приема при нехватке дескрипторов или памяти
 #define READ_WRITE_TIMEOUT_MS   60000
+#define SPLICE_CHUNK            (64 * 1024)     // Емкость канала по умолчанию
+#define SPLICE_UNLIMITED        ((size_t) -1)
 
 #define SUCCESS             0
 #define ERROR               (-1)
-#define NO_CLIENT           (-2)
 
 /**
  * @brief Единственный экземпляр прокси-сервера (singleton)
  */
 static proxy_t *instance = NULL;
 
+/**
+ * @brief Контекст обработчика клиента (см. struct client_handler_context_t)
+ */
+typedef struct client_handler_context_t client_handler_context_t;
+
+/**
+ * @brief Поток приема соединений (см. struct acceptor_t)
+ */
+typedef struct acceptor_t acceptor_t;
+
 /**
  * @brief Обработчик сигналов для завершения работы прокси-сервера
  * @param signal Номер полученного сигнала (не используется)
  * @details Функция-обработчик сигналов, которая инициирует корректное завершение
- *          работы прокси-сервера. Устанавливает флаг running в 0, что приводит
- *          к остановке основного цикла приема соединений.
+ *          работы прокси-сервера. Устанавливает флаг running в 0 и пишет в канал
+ *          пробуждения, что приводит к остановке потоков приема соединений.
  * @note Использует __attribute__((unused)) для подавления предупреждений компилятора
  */
 static void termination_handler(__attribute__((unused)) int signal);
 
 /**
  * @brief Создает и настраивает серверный сокет для прослушивания входящих соединений
- * @param port Порт, на котором будет работать прокси-сервер
+ * @param port      Порт, на котором будет работать прокси-сервер
+ * @param backlog   Длина очереди подключений
+ * @param reuseport 1 если на том же порту будут слушать другие сокеты (SO_REUSEPORT)
  * @return Дескриптор созданного сокета или ERROR (-1) при ошибке
  * @details Алгоритм создания серверного сокета:
  *          1. Создает TCP сокет (AF_INET, SOCK_STREAM)
  *          2. Устанавливает опцию SO_REUSEADDR для быстрого перезапуска
+ *             и, если нужно, SO_REUSEPORT
  *          3. Настраивает структуру адреса (слушает все интерфейсы, заданный порт)
  *          4. Привязывает сокет к адресу (bind)
- *          5. Переводит сокет в режим прослушивания (listen)
+ *          5. Переводит сокет в режим прослушивания (listen) и в неблокирующий режим
  *          6. Логирует успешное создание
  * @note Использует IPv4 (AF_INET), для IPv6 нужно использовать AF_INET6
  * @note Слушает на всех сетевых интерфейсах (INADDR_ANY)
- * @note Максимальная очередь подключений определяется MAX_USERS_COUNT
+ * @note Ядро ограничивает очередь подключений значением net.core.somaxconn
+ */
+static int create_server_socket(int port, int backlog, int reuseport);
+
+/**
+ * @brief Основная функция потока приема соединений
+ * @param arg Указатель на acceptor_t
+ * @return NULL
+ * @details Алгоритм работы:
+ *          1. Закрепляет поток за ядром (если потоков приема несколько)
+ *          2. Ждет входящих соединений на своем сокете или пробуждения через канал
+ *             (сигнал остановки) через poll()
+ *          3. Забирает из очереди подключений все ожидающие соединения (accept_clients)
+ *          4. Повторяет, пока прокси работает
+ */
+static void *acceptor_routine(void *arg);
+
+/**
+ * @brief Принимает ожидающие клиентские соединения пачкой
+ * @param acceptor Поток приема
+ * @return SUCCESS или ERROR при ошибке, после которой прием нужно остановить
+ * @details Алгоритм работы:
+ *          1. Принимает соединения через accept4(SOCK_NONBLOCK), пока очередь не опустеет
+ *             или не будет принято ACCEPT_BATCH соединений
+ *          2. Пропускает соединения, оборванные клиентом до приема
+ *          3. При нехватке дескрипторов или памяти делает паузу ACCEPT_BACKOFF_MS:
+ *             очередь разберется, когда обработчики закроют соединения
+ *          4. Передает каждое соединение обработчикам (dispatch_client)
  */
-static int create_server_socket(int port);
+static int accept_clients(acceptor_t *acceptor);
 
 /**
- * @brief Принимает входящее клиентское соединение
- * @param server_socket Дескриптор серверного сокета
- * @return Дескриптор клиентского сокета или -1 при ошибке
+ * @brief Передает принятое соединение пулу потоков или событийному циклу
+ * @param acceptor      Поток приема
+ * @param client_socket Дескриптор клиентского сокета (функция забирает владение)
  */
-static int accept_client(int server_socket);
+static void dispatch_client(acceptor_t *acceptor, int client_socket);
+
+/**
+ * @brief Берет контекст обработчика из списка свободных контекстов потока приема
+ * @param acceptor Поток приема
+ * @return Контекст или NULL, если список пуст и выделить новый не удалось
+ * @details Сначала берется собственный список потока приема; если он пуст,
+ *          целиком забираются контексты, возвращенные обработчиками.
+ */
+static client_handler_context_t *acquire_context(acceptor_t *acceptor);
+
+/**
+ * @brief Возвращает контекст обработчика потоку приема, который его выдал
+ * @param ctx Контекст обслуженного клиента
+ */
+static void release_context(client_handler_context_t *ctx);
 
 /**
  * @brief Основная функция обработки клиентского HTTP соединения
  * @param arg Указатель на client_handler_context_t (контекст клиента)
  * @details Алгоритм работы:
- *          1. Прием и парсинг HTTP-запроса от клиента
- *          2. Проверка кэша (для GET запросов)
- *          3. Если кэш есть - отдача из кэша
- *          4. Если кэша нет - подключение к целевому серверу
- *          5. Проксирование данных между клиентом и сервером
- *          6. Кэширование ответа (для поддерживаемых запросов)
- *          7. Освобождение ресурсов
+ *          1. Накапливает данные клиента в буфере, пока в нем нет целого запроса
+ *          2. Вырезает из начала буфера очередной запрос и обслуживает его (serve_request);
+ *             следующие запросы, отправленные клиентом без ожидания ответа (конвейер),
+ *             остаются в буфере и обслуживаются по порядку
+ *          3. Если буфер пуст, а соединение постоянное, ждет следующего запроса (wait_next_request)
+ *          4. Закрывает соединение, когда клиент или ответ этого требует, по таймауту простоя
+ *             или при ошибке, и освобождает ресурсы
  */
 static void handle_client(void *arg);
 
+/**
+ * @brief Обслуживает один HTTP-запрос клиента
+ * @param ctx         Контекст клиента
+ * @param request     Запрос (выделен через malloc, функция забирает владение)
+ * @param request_len Длина запроса
+ * @return SUCCESS если по соединению можно отправить следующий ответ, ERROR если его нужно закрыть
+ * @details Алгоритм работы:
+ *          1. Парсинг запроса
+ *          2. Для GET атомарно ищет элемент в кэше или добавляет новый; ответы на остальные
+ *             методы пересылает через splice() (relay_uncacheable), а если splice() недоступен -
+ *             создает для них частный (не добавляемый в кэш) элемент
+ *          3. Если элемент новый - ставит его загрузку в пул загрузчиков (start_fetch);
+ *             элемент, заменивший устаревший, уже загружает проверка этого устаревшего
+ *          4. Отдает данные элемента клиенту по мере их появления, как и любой другой читатель
+ *          5. Соединение остается открытым, если клиент его не закрывает, а конец ответа
+ *             обозначен Content-Length или chunked (иначе клиент ждет закрытия соединения)
+ * @note Загрузка не зависит от скорости клиента, который ее запустил:
+ *       медленный клиент не задерживает остальных читателей того же элемента
+ */
+static int serve_request(client_handler_context_t *ctx, char *request, size_t request_len);
+
+/**
+ * @brief Ждет следующего запроса по постоянному соединению
+ * @param ctx Контекст клиента
+ * @return SUCCESS если клиент прислал данные (или закрыл соединение), ERROR если соединение
+ *         нужно закрыть: истек client_idle_timeout_ms, прокси останавливается
+ *         или свободного потока ждут новые клиенты
+ * @details Ожидание идет отрезками по CLIENT_IDLE_POLL_MS: простаивающее соединение
+ *          не должно занимать поток-обработчик, пока в очереди есть другие клиенты.
+ *          Используется poll(): у постоянных соединений номер сокета может превышать FD_SETSIZE.
+ */
+static int wait_next_request(client_handler_context_t *ctx);
+
+/**
+ * @brief Ставит загрузку ответа для элемента в пул загрузчиков
+ * @param proxy   Прокси
+ * @param entry   Новый элемент (загрузчик захватывает на него собственную ссылку;
+ *                NULL - элемент создается, только если ответ изменился)
+ * @param stale   Устаревший элемент, который нужно проверить условным запросом (NULL - обычная загрузка)
+ * @param indexed 1 если элемент добавлен в кэш, 0 для частного элемента
+ * @return SUCCESS или ERROR, если задачу не удалось создать
+ */
+static int start_fetch(proxy_t *proxy, cache_entry_t *entry, cache_entry_t *stale, int indexed);
+
+/**
+ * @brief Запускает проверку устаревшего элемента кэша (cache_revalidate_t)
+ * @param arg     Указатель на proxy_t
+ * @param stale   Устаревший элемент
+ * @param pending Элемент, заменивший его в кэше (NULL - не заменен)
+ * @return SUCCESS или ERROR, если задачу не удалось создать
+ */
+static int revalidate_entry(void *arg, cache_entry_t *stale, cache_entry_t *pending);
+
+/**
+ * @brief Задача пула загрузчиков: загружает ответ сервера в элемент кэша
+ * @param arg Указатель на fetch_context_t
+ * @details Алгоритм работы:
+ *          1. Извлекает хост из запроса элемента и переводит запрос на keep-alive (версия клиента сохраняется)
+ *          2. Пересылает запрос серверу по соединению из пула или по новому (open_upstream)
+ *          3. Принимает ответ прямо в свободное место буфера элемента (message_reserve),
+ *             порциями до FETCH_BUFFER_SIZE, и публикует их, оповещая читателей;
+ *             пока заголовки не разобраны, копит их отдельно
+ *          4. После разбора заголовков убирает элемент из кэша, если статус не кэшируется,
+ *             и запоминает Vary, срок свежести и валидаторы
+ *          5. Завершает загрузку по Content-Length, концу тела chunked или закрытию соединения сервером
+ *          6. Помечает элемент завершенным или прерванным (убирая его из кэша) и оповещает читателей
+ *          7. Возвращает соединение в пул, если ответ прочитан ровно до конца и сервер его не закрывает
+ *          При проверке устаревшего элемента запрос условный, а заголовки ответа копятся отдельно:
+ *          ответ 304 только продлевает свежесть (cache_refresh), иначе ответ загружается как обычно
+ */
+static void fetch_origin(void *arg);
+
 /**
  * @brief Устанавливает TCP соединение с удаленным сервером
- * @param host Имя хоста или IP-адрес целевого сервера
- * @param port Порт целевого сервера
+ * @param resolver Резолвер имен
+ * @param host     Имя хоста или IP-адрес целевого сервера
+ * @param port     Порт целевого сервера
  * @return Дескриптор установленного сокета или ERROR при ошибке
  * @details Алгоритм работы:
- *          1. Разрешение имени хоста в IP-адрес
+ *          1. Разрешение имени хоста в IP-адрес (из кэша резолвера или ожиданием
+ *             DNS-запроса, общего с другими потоками, ждущими то же имя)
  *          2. Создание TCP сокета
  *          3. Настройка структуры адреса сервера
  *          4. Установка соединения
  *          5. Возврат дескриптора готового сокета
  */
-static int connect_to_remote(const char *host, int port);
+static int connect_to_remote(dns_resolver_t *resolver, const char *host, int port);
+
+/**
+ * @brief Подключается к серверу, указанному в заголовке Host запроса
+ * @param resolver  Резолвер имен
+ * @param host_port Значение заголовка Host (host[:port], без завершающего нуля)
+ * @param host_len  Длина значения
+ * @return Дескриптор установленного сокета или ERROR при ошибке
+ */
+static int connect_to_origin(dns_resolver_t *resolver, const char *host_port, size_t host_len);
+
+/**
+ * @brief Извлекает имя хоста и порт сервера из значения заголовка Host
+ * @param host_port Значение заголовка Host (host[:port], без завершающего нуля)
+ * @param host_len  Длина значения
+ * @param host      Буфер размера BUFFER_SIZE для сохранения имени хоста
+ * @param port      Указатель для сохранения порта
+ * @return SUCCESS или ERROR при ошибке
+ */
+static int get_origin_address(const char *host_port, size_t host_len, char *host, int *port);
+
+/**
+ * @brief Открывает соединение с сервером и отправляет ему запрос
+ * @param proxy       Прокси (пул постоянных соединений)
+ * @param host        Имя хоста сервера
+ * @param port        Порт сервера
+ * @param request     Запрос к серверу
+ * @param request_len Длина запроса
+ * @param retry       1 если запрос можно повторить на новом соединении (идемпотентный метод)
+ * @return Дескриптор сокета, из которого читается ответ, или ERROR при ошибке
+ * @details Алгоритм работы:
+ *          1. Берет простаивающее соединение из пула и отправляет по нему запрос
+ *          2. Дожидается первого байта ответа: сервер мог закрыть соединение
+ *             одновременно с его выдачей из пула
+ *          3. Если соединения в пуле не было или сервер закрыл его, не ответив,
+ *             подключается заново (для неидемпотентного запроса - только если
+ *             соединения в пуле не было) и отправляет запрос
+ */
+static int open_upstream(proxy_t *proxy, const char *host, int port, const char *request, size_t request_len, int retry);
+
+#ifdef CACHE_PROXY_HAVE_SPLICE
+/**
+ * @brief Пересылает некэшируемый ответ клиенту, не копируя тело ответа в память процесса
+ * @param resolver      Резолвер имен
+ * @param client_socket Дескриптор клиентского сокета
+ * @param request       HTTP-запрос клиента
+ * @param request_len   Длина запроса
+ * @param delimited     Указатель для сохранения признака ответа, длина которого известна клиенту
+ *                      (Content-Length или ответ без тела)
+ * @return SUCCESS или ERROR при ошибке
+ * @details Алгоритм работы:
+ *          1. Подключается к серверу и пересылает ему запрос с "Connection: close":
+ *             тело неизвестной длины (в том числе chunked) заканчивается закрытием соединения
+ *          2. Читает ответ, пока заголовки не получены полностью, и отправляет прочитанное клиенту
+ *          3. Остаток тела (по Content-Length или до закрытия соединения сервером)
+ *             передает через канал splice() из сокета сервера в сокет клиента
+ */
+static int relay_uncacheable(dns_resolver_t *resolver, int client_socket, const char *request, size_t request_len, int *delimited);
+
+/**
+ * @brief Передает данные из сокета в сокет через канал без копирования в память процесса
+ * @param in_fd  Дескриптор сокета-источника
+ * @param out_fd Дескриптор сокета-приемника
+ * @param limit  Сколько байт передать (SPLICE_UNLIMITED - до закрытия соединения источником)
+ * @return SUCCESS или ERROR при ошибке, таймауте или преждевременном закрытии соединения
+ * @details Алгоритм работы:
+ *          1. Создает канал (pipe), страницы которого splice() заполняет данными сокета
+ *          2. Ждет данных источника через poll() с таймаутом и переносит в канал до SPLICE_CHUNK байт
+ *          3. Переносит содержимое канала в приемник, дожидаясь его готовности к записи
+ *          4. Повторяет, пока не передано limit байт или источник не закрыл соединение
+ */
+static int splice_relay(int in_fd, int out_fd, size_t limit);
+
+#endif
+
+/**
+ * @brief Ждет готовности сокета к чтению или записи
+ * @param fd    Дескриптор сокета
+ * @param write 1 для ожидания записи, 0 для ожидания чтения
+ * @return SUCCESS или ERROR при ошибке/таймауте
+ */
+static int wait_socket(int fd, int write);
 
 /**
  * @brief Принимает данные из сокета с таймаутом
@@ -103,7 +331,7 @@ static int connect_to_remote(const char *host, int port);
  * @param buf_len Максимальный размер буфера
  * @return Количество принятых байт, 0 при закрытии соединения, ERROR при ошибке/таймауте
  * @details Алгоритм работы:
- *          1. Использует select() для ожидания доступности данных с таймаутом
+ *          1. Использует poll() для ожидания доступности данных с таймаутом
  *          2. Если данные доступны, вызывает recv() для их чтения
  *          3. Обрабатывает различные сценарии: данные, таймаут, ошибки, закрытие соединения
  */
@@ -116,28 +344,12 @@ static ssize_t receive_with_timeout(int fd, char *buf, size_t buf_len);
  * @param data_len Длина данных для отправки
  * @return Количество отправленных байт или ERROR при ошибке/таймауте
  * @details Алгоритм работы:
- *          1. Использует select() для ожидания готовности сокета к записи
+ *          1. Использует poll() для ожидания готовности сокета к записи
  *          2. Если сокет готов, вызывает send() для отправки данных
  *          3. Обрабатывает таймауты, ошибки и прерывания
  */
 static ssize_t send_with_timeout(int fd, const char *data, size_t data_len);
 
-/**
- * @brief Полностью читает все данные из сокета до закрытия соединения или ошибки
- * @param fd Дескриптор сокета для чтения
- * @param data Указатель на буфер, который будет выделен для хранения всех данных
- * @return Общее количество прочитанных байт или ERROR при ошибке
- * @details Алгоритм работы:
- *          1. Инициализирует пустой буфер
- *          2. В цикле читает данные порциями через receive_with_timeout()
- *          3. Перевыделяет буфер для добавления новых данных
- *          4. Копирует полученные данные в буфер
- *          5. Прекращает чтение при закрытии соединения, ошибке или неполном чтении
- * @note Динамически увеличивает буфер по мере чтения данных
- * @note Использует временный буфер фиксированного размера BUFFER_SIZE
- */
-static ssize_t receive_full_data(int fd, char **data);
-
 /**
  * @brief Гарантированно отправляет все данные через сокет с поддержкой таймаутов
  * @param fd Дескриптор сокета для отправки данных
@@ -152,157 +364,105 @@ static ssize_t receive_full_data(int fd, char **data);
  */
 static ssize_t send_full_data(int fd, const char *data, size_t data_len);
 
-/**
- * @brief Принимает данные из одного сокета и одновременно отправляет в другой
- * @param ifd Входной файловый дескриптор (input fd) - откуда читать данные
- * @param ofd Выходной файловый дескриптор (output fd) - куда отправлять данные
- * @param data Указатель на буфер для сохранения принятых данных
- * @return Общее количество прочитанных и пересланных байт или ERROR при ошибке
- * @details Алгоритм работы:
- *          1. Читает порцию данных из ifd с помощью receive_with_timeout()
- *          2. Немедленно отправляет эту порцию в ofd с помощью send_with_timeout()
- *          3. Сохраняет данные в буфер *data (если не NULL) для последующей обработки
- *          4. Повторяет до закрытия соединения или ошибки
- * @note Одновременно выполняет чтение, отправку и сохранение данных
- */
-static ssize_t receive_and_send_data(int ifd, int ofd, char **data);
-
-/**
- * @brief Принимает, отправляет и собирает структурированное сообщение
- * @param ifd Входной файловый дескриптор (input fd) - откуда читать данные
- * @param ofd Выходной файловый дескриптор (output fd) - куда отправлять данные
- * @param message Указатель на указатель структуры message_t для сборки сообщения
- * @return Общее количество отправленных байт или ERROR при ошибке
- * @details Алгоритм работы:
- *          1. Читает порцию данных из ifd через receive_with_timeout()
- *          2. Немедленно отправляет порцию в ofd через send_with_timeout()
- *          3. Добавляет порцию в структурированное сообщение через message_add_part()
- *          4. Повторяет до закрытия соединения, ошибки или неполного чтения
- */
-static ssize_t receive_and_send_message(int ifd, int ofd, message_t **message);
-
 /**
  * @brief Отправляет кэшированные данные клиенту с поддержкой потоковой загрузки
  * @param entry Указатель на запись в кэше, содержащую данные для отправки
  * @param client_socket Дескриптор клиентского сокета для отправки данных
+ * @param metrics Измерение запроса, в котором учитываются отправленные байты
  * @return Общее количество отправленных байт или ERROR при ошибке
  * @details Алгоритм работы:
  *          1. Блокирует мьютекс записи в кэше для безопасного доступа
- *          2. Проходит по цепочке message_t в entry->response
- *          3. Для каждой части сообщения:
- *             а) Отправляет данные клиенту через send_full_data()
- *             б) Обновляет счетчик отправленных байт
+ *          2. Запоминает флаги завершения (до чтения размера ответа, чтобы не потерять хвост)
+ *          3. Пока в entry->response есть неотправленные данные:
+ *             а) Отправляет их клиенту через send_full_data() без блокировки
+ *             б) Сдвигает позицию читателя и обновляет счетчик отправленных байт
  *          4. Если данные еще не полностью загружены в кэш, ожидает на condition variable
  *          5. Просыпается при добавлении новых данных или завершении загрузки
  *          6. Продолжает отправку, пока все данные не будут отправлены
  */
-static ssize_t stream_cache_to_client(cache_entry_t *entry, int client_socket);
+static ssize_t stream_cache_to_client(cache_entry_t *entry, int client_socket, metrics_request_t *metrics);
 
 /**
- * @brief Извлекает хост и порт из строки URL или адреса сервера
- * @param host_port Входная строка (URL или "host:port")
- * @param host Буфер для сохранения имени хоста
- * @param port Указатель на переменную для сохранения номера порта
- * @return 0 при успехе, ERROR (-1) при ошибке парсинга
+ * @brief Ожидает готовности найденной в кэше записи
+ * @param entry Захваченная запись кэша
+ * @return SUCCESS если данные появились, ERROR если загрузка прервана
  * @details Алгоритм работы:
- *          1. Компилирует регулярное выражение для парсинга URL
- *          2. Выполняет сопоставление регулярного выражения со входной строкой
- *          3. Извлекает хост из соответствующей группы
- *          4. Извлекает порт, если указан, иначе использует порт по умолчанию
- *          5. Определяет порт по умолчанию на основе схемы (http/https)
- *          6. Освобождает ресурсы регулярного выражения
- */
-static int get_host_port(const char *host_port, char *host, int *port);
-
-/**
- * @brief Парсит HTTP-запрос и извлекает метод и заголовок Host
- * @param request Строка с HTTP-запросом
- * @param request_len Длина строки запроса
- * @param method Указатель для сохранения указателя на метод в request
- * @param method_len Указатель для сохранения длины метода
- * @param host Указатель для сохранения указателя на значение Host в request
- * @param host_len Указатель для сохранения длины значения Host
- * @return SUCCESS (0) при успехе, ERROR (-1) при ошибке
- * @details Алгоритм работы:
- *          1. Использует библиотеку PicoHTTPParser для парсинга HTTP-запроса
- *          2. Извлекает метод HTTP (GET, POST, CONNECT и т.д.)
- *          3. Ищет заголовок Host в списке заголовков
- *          4. Сохраняет указатели на метод и Host в исходном буфере
- */
-static int parse_request(const char *request, size_t request_len, const char **method, size_t *method_len, const char **host, size_t *host_len);
-
-/**
- * @brief Парсит HTTP-ответ и извлекает статус, длину контента и позицию заголовка Content-Length
- * @param response Строка с HTTP-ответом
- * @param response_len Длина строки ответа
- * @param status Указатель для сохранения HTTP статус-кода (200, 404, 500 и т.д.)
- * @param content_len Указатель для сохранения фактической длины тела ответа
- * @param content_length_header Указатель для сохранения значения заголовка Content-Length
- * @return SUCCESS (0) при успехе, ERROR (-1) при ошибке
- * @details Алгоритм работы:
- *          1. Использует PicoHTTPParser для парсинга HTTP-ответа
- *          2. Извлекает HTTP статус-код
- *          3. Ищет заголовок Content-Length и парсит его значение
- *          4. Вычисляет фактическую длину тела ответа
- *          5. Проверяет корректность формата ответа
- */
-static int parse_response(const char *response, size_t response_len, int *status, size_t *content_len, size_t *content_length_header);
-
-/**
- * @brief Проверяет, является ли HTTP-запрос кэшируемым
- * @param method Указатель на строку с HTTP-методом
- * @param method_len Длина строки метода
- * @return 1 (true) если метод кэшируемый, 0 (false) если нет
- * @details В текущей реализации кэшируются только GET-запросы.
- */
-static int check_request(const char *method, size_t method_len);
-
-/**
- * @brief Проверяет, является ли HTTP-ответ кэшируемым на основе статус-кода
- * @param status HTTP статус-код ответа (200, 404, 500 и т.д.)
- * @return 1 (true) если ответ можно кэшировать, 0 (false) если нет
- * @details В текущей реализации кэшируются все ответы со статусом < 400.
- * @note Кэшируются успешные ответы (2xx) и перенаправления (3xx)
- * @note Не кэшируются клиентские (4xx) и серверные (5xx) ошибки
+ *          1. Блокирует мьютекс записи: загрузчик создает entry->response под этим же мьютексом
+ *          2. Если ответа еще нет, ожидает на condition variable, пока данные не появятся
+ *             или загрузка не прервется
+ *          3. Проверяет, появились ли данные, и разблокирует мьютекс
+ * @note Реализует паттерн "ожидание готовности данных" для конкурентного доступа
+ * @note Позволяет нескольким клиентам ждать одну и ту же загружаемую запись
+ * @note Ссылку на запись освобождает вызывающая сторона
  */
-static int check_response(int status);
+static int wait_cache_entry(cache_entry_t *entry);
 
 /**
- * @brief Находит запись в кэше и ожидает её готовности если необходимо
- * @param cache Указатель на структуру кэша
- * @param request Строка HTTP-запроса для поиска
- * @param request_len Длина строки запроса
- * @return Указатель на найденную запись кэша или NULL если не найдено/удалено
- * @details Алгоритм работы:
- *          1. Ищет запись в кэше по запросу с помощью cache_get()
- *          2. Если запись найдена, но ответ еще не готов (entry->response == NULL):
- *             а) Блокирует мьютекс записи
- *             б) Ожидает на condition variable, пока данные не появятся или запись не удалят
- *             в) Проверяет, не была ли запись удалена во время ожидания
- *             г) Разблокирует мьютекс
- *          3. Возвращает найденную запись или NULL
- * @note Реализует паттерн "ожидание готовности данных" для конкурентного доступа
- * @note Позволяет нескольким клиентам ждать одну и ту же загружаемую запись
- * @note Обрабатывает случай удаления записи во время ожидания
- * @note Гарантирует потокобезопасный доступ к записи кэша
+ * @brief Дописывает к метрикам сервера администрирования состояние прокси
+ * @param out Поток вывода
+ * @param arg Указатель на proxy_t
  */
-static cache_entry_t *find_cache_entry(cache_t *cache, const char *request, size_t request_len);
+static void write_proxy_metrics(FILE *out, void *arg);
 
 /**
  * @brief Структура прокси-сервера
  * @details Содержит все состояние прокси-сервера:
  *          - Кэш HTTP-ответов
- *          - Мьютекс для синхронизации доступа к кэшу
- *          - Пул потоков для обработки клиентов
+ *          - Пул потоков для обработки клиентов (режим PROXY_IO_THREADS)
+ *          - Пул потоков-загрузчиков ответов с серверов (режим PROXY_IO_THREADS)
+ *          - Пул постоянных соединений с серверами (режим PROXY_IO_THREADS)
+ *          - Время простоя постоянных клиентских соединений (режим PROXY_IO_THREADS)
+ *          - Событийный обработчик epoll (режим PROXY_IO_EPOLL)
+ *          - Обработчик на io_uring (режим PROXY_IO_URING)
+ *          - Сервер администрирования, отдающий метрики (если задан admin_port)
+ *          - Потоки приема соединений со своими слушающими сокетами
+ *            и канал, через который обработчик сигналов их будит
  *          - Атомарный флаг работы сервера
  */
 struct proxy_t {
     cache_t *cache;
-    pthread_mutex_t cache_mutex;
+    proxy_io_mode_t io_mode;
     thread_pool_t *handlers;
+    thread_pool_t *fetchers;
+    upstream_pool_t *upstreams;
+    dns_resolver_t *resolver;
+    time_t client_idle_timeout_ms;
+#ifdef CACHE_PROXY_HAVE_EPOLL
+    reactor_t *reactor;
+#endif
+#ifdef CACHE_PROXY_HAVE_IO_URING
+    uring_t *uring;
+#endif
+    admin_server_t *admin;
+    int acceptor_count;
+    int listen_backlog;
+    acceptor_t *acceptors;
+    int wake[2];
     atomic_int running;
 };
 
+/**
+ * @brief Поток приема соединений
+ * @details Каждый поток принимает соединения со своего сокета: ядро распределяет
+ *          подключения между сокетами SO_REUSEPORT, и потоки не делят одну очередь.
+ *          Контексты обслуженных клиентов возвращаются потоку, который их выдал,
+ *          поэтому на каждое соединение не приходится malloc/free.
+ * @var proxy             Прокси
+ * @var index             Номер потока приема
+ * @var server_socket     Слушающий сокет (без SO_REUSEPORT - общий для всех потоков)
+ * @var thread            Поток
+ * @var free_contexts     Свободные контексты (только для самого потока приема)
+ * @var returned_contexts Контексты, возвращенные обработчиками (стек, в который добавляют через CAS)
+ */
+struct acceptor_t {
+    proxy_t *proxy;
+    int index;
+    int server_socket;
+    pthread_t thread;
+    client_handler_context_t *free_contexts;
+    _Atomic(client_handler_context_t *) returned_contexts;
+};
+
 /**
  * @brief Контекст обработчика клиента
  * @details Передается в handle_client при создании задачи в пуле потоков.
@@ -311,41 +471,132 @@ struct proxy_t {
 struct client_handler_context_t {
     proxy_t *proxy;
     int client_socket;
+    acceptor_t *acceptor; // поток приема, которому контекст возвращается после обслуживания
+    client_handler_context_t *next; // следующий контекст в списке свободных
 };
-typedef struct client_handler_context_t client_handler_context_t;
+
+/**
+ * @brief Контекст загрузки ответа с сервера
+ * @details Передается в fetch_origin при создании задачи в пуле загрузчиков.
+ */
+struct fetch_context_t {
+    proxy_t *proxy;
+    cache_entry_t *entry; // захваченная ссылка на загружаемый элемент (NULL - еще не создан)
+    cache_entry_t *stale; // захваченная ссылка на проверяемый устаревший элемент (NULL - обычная загрузка)
+    int indexed; // элемент добавлен в кэш (0 - частный элемент некэшируемого запроса)
+    uint64_t trace; // трассируемый запрос, запустивший загрузку (0 - не трассируется)
+};
+typedef struct fetch_context_t fetch_context_t;
 
 /**
  * @brief Создает и инициализирует экземпляр прокси-сервера
- * @param handler_count Количество потоков-обработчиков в пуле
- * @param cache_expired_time_ms Время жизни записей в кэше
+ * @param config Параметры прокси
  * @return Указатель на созданный прокси-сервер или NULL при ошибке
  * @details Алгоритм работы:
  *          1. Выделяет память под структуру proxy_t
  *          2. Инициализирует кэш HTTP-ответов с заданным временем жизни
- *          3. Создает пул потоков для обработки клиентских соединений
- *          4. Инициализирует мьютекс для синхронизации доступа к кэшу
- *          5. Устанавливает флаг running в 1 (сервер работает)
+ *             и резолвер имен серверов
+ *          3. Создает пул загрузчиков (он же проверяет устаревшие элементы кэша) и пул соединений с серверами
+ *          4. Создает пул потоков, событийные циклы epoll или кольца io_uring для обработки клиентских соединений
+ *          5. Запускает сервер администрирования, если задан admin_port
+ *          6. Устанавливает флаг running в 1 (сервер работает)
+ * @note Если io_uring недоступен (старое ядро или запрет в kernel.io_uring_disabled),
+ *       используется режим PROXY_IO_EPOLL
+ * @note Если epoll недоступен на платформе, используется режим PROXY_IO_THREADS
  */
-proxy_t *proxy_create(int handler_count, time_t cache_expired_time_ms) {
+proxy_t *proxy_create(const proxy_config_t *config) {
     errno = 0;
     proxy_t *proxy = malloc(sizeof(proxy_t)); // Выделение памяти под основную структуру прокси
     if (proxy == NULL) {
-        if (errno == ENOMEM) proxy_log("Proxy creation error: %s", strerror(errno));
-        else proxy_log("Proxy creation error: failed to reallocate memory");
+        if (errno == ENOMEM) proxy_log_error("Proxy creation error: %s", strerror(errno));
+        else proxy_log_error("Proxy creation error: failed to reallocate memory");
         return NULL;
     }
-    proxy->cache = cache_create(CACHE_CAPACITY, cache_expired_time_ms); // Создает структуру кэша с заданными параметрам
+    proxy->cache = cache_create(config->cache_size, config->cache_shards, config->cache_policy, config->cache_expired_time_ms); // Создает структуру кэша с заданными параметрам
     if (proxy->cache == NULL) {
         free(proxy);
         return NULL;
     }
-    proxy->handlers = thread_pool_create(handler_count, TASK_QUEUE_CAPACITY); // Создает пул потоков с заданным количеством обработчиков
-    if (proxy->handlers == NULL) {
+    proxy->resolver = dns_resolver_create(config->dns_server, config->dns_negative_ttl_ms); // Общий резолвер имен серверов
+    if (proxy->resolver == NULL) {
         cache_destroy(proxy->cache);
         free(proxy);
         return NULL;
     }
-    pthread_mutex_init(&proxy->cache_mutex, NULL); // Инициализирует мьютекс
+    proxy->io_mode = config->io_mode;
+    proxy->handlers = NULL;
+    proxy->fetchers = NULL;
+    proxy->upstreams = NULL;
+    proxy->client_idle_timeout_ms = config->client_idle_timeout_ms;
+    proxy->acceptor_count = config->acceptor_count;
+    proxy->listen_backlog = config->listen_backlog;
+    proxy->acceptors = NULL;
+    proxy->wake[0] = proxy->wake[1] = ERROR;
+    proxy->fetchers = thread_pool_create(config->fetcher_count, TASK_QUEUE_CAPACITY); // Отдельный пул: обработчики ждут загрузчиков, но не наоборот
+    if (proxy->fetchers == NULL) {
+        dns_resolver_destroy(proxy->resolver);
+        cache_destroy(proxy->cache);
+        free(proxy);
+        return NULL;
+    }
+    proxy->upstreams = upstream_pool_create(config->upstream_idle_per_host, config->upstream_idle_timeout_ms);
+    if (proxy->upstreams == NULL) {
+        thread_pool_shutdown(proxy->fetchers);
+        dns_resolver_destroy(proxy->resolver);
+        cache_destroy(proxy->cache);
+        free(proxy);
+        return NULL;
+    }
+    cache_set_revalidator(proxy->cache, revalidate_entry, proxy); // Проверки устаревших элементов идут в пуле загрузчиков в любом режиме
+#ifdef CACHE_PROXY_HAVE_IO_URING
+    proxy->uring = NULL;
+    if (proxy->io_mode == PROXY_IO_URING) {
+        proxy->uring = uring_create(config->handler_count, proxy->cache, proxy->resolver); // Создает циклы с кольцами io_uring
+        if (proxy->uring == NULL) {
+            proxy_log_error("Proxy creation error: io_uring is not available, fallback to epoll");
+            proxy->io_mode = PROXY_IO_EPOLL;
+        }
+    }
+#else
+    if (proxy->io_mode == PROXY_IO_URING) {
+        proxy_log_error("Proxy creation error: io_uring is not supported, fallback to epoll");
+        proxy->io_mode = PROXY_IO_EPOLL;
+    }
+#endif
+#ifdef CACHE_PROXY_HAVE_EPOLL
+    proxy->reactor = NULL;
+    if (proxy->io_mode == PROXY_IO_EPOLL) {
+        proxy->reactor = reactor_create(config->handler_count, proxy->cache, proxy->resolver); // Создает событийные циклы epoll
+        if (proxy->reactor == NULL) {
+            thread_pool_shutdown(proxy->fetchers);
+            upstream_pool_destroy(proxy->upstreams);
+            dns_resolver_destroy(proxy->resolver);
+            cache_destroy(proxy->cache);
+            free(proxy);
+            return NULL;
+        }
+    }
+#else
+    if (proxy->io_mode == PROXY_IO_EPOLL) {
+        proxy_log_error("Proxy creation error: epoll is not supported, fallback to threads");
+        proxy->io_mode = PROXY_IO_THREADS;
+    }
+#endif
+    if (proxy->io_mode == PROXY_IO_THREADS) {
+        proxy->handlers = thread_pool_create(config->handler_count, TASK_QUEUE_CAPACITY); // Создает пул потоков с заданным количеством обработчиков
+        if (proxy->handlers == NULL) {
+            thread_pool_shutdown(proxy->fetchers);
+            upstream_pool_destroy(proxy->upstreams);
+            dns_resolver_destroy(proxy->resolver);
+            cache_destroy(proxy->cache);
+            free(proxy);
+            return NULL;
+        }
+    }
+    proxy->admin = NULL;
+    if (config->admin_port > 0) { // Метрики необязательны: без сервера администрирования прокси работает как обычно
+        proxy->admin = admin_server_create(config->admin_port, write_proxy_metrics, proxy);
+    }
     proxy->running = 1; // Устанавливает флаг работы
     return proxy;
 }
@@ -358,41 +609,80 @@ proxy_t *proxy_create(int handler_count, time_t cache_expired_time_ms) {
  *          1. Проверяет корректность переданного указателя proxy
  *          2. Сохраняет proxy в глобальной переменной instance (singleton)
  *          3. Регистрирует обработчики сигналов для graceful shutdown
- *          4. Создает серверный сокет для прослушивания порта
- *          5. В основном цикле принимает клиентские соединения
- *          6. Для каждого соединения создает контекст и отправляет в пул потоков
- *          7. При получении сигнала остановки корректно завершает работу
+ *          4. Создает канал пробуждения и acceptor_count потоков приема, каждый со своим сокетом SO_REUSEPORT
+ *             на том же порту (без SO_REUSEPORT потоки делят один сокет)
+ *          5. Потоки приема принимают соединения и отправляют их в пул потоков
+ *             (в режиме epoll - передают сокет событийному циклу)
+ *          В режиме io_uring соединения принимают сами циклы (multishot accept)
+ *          с единственного сокета, а основной поток только ждет сигнала остановки.
+ *          6. При получении сигнала остановки дожидается потоков приема и закрывает сокеты
  */
 void proxy_start(proxy_t *proxy, int port) {
     if (proxy == NULL) {
-        proxy_log("Proxy starting error: proxy is NULL");
+        proxy_log_error("Proxy starting error: proxy is NULL");
         return;
     }
     instance = proxy; // Сохраняет экземпляр прокси в глобальную переменную
     signal(SIGINT, termination_handler); // Регистрирует обработчик сигналов
     signal(SIGTERM, termination_handler);
-    int server_socket = create_server_socket(port); // Создает серверный сокет
-    if (server_socket == ERROR) goto delete_proxy_instance;
-    while (proxy->running) { // В основном цикле принимает клиентские соединения
-        int client_socket = accept_client(server_socket);
-        if (client_socket == NO_CLIENT) continue;
-        if (client_socket == ERROR) goto close_server_socket;
-        errno = 0;
-        client_handler_context_t *ctx = malloc(sizeof(client_handler_context_t)); // Выделение памяти под контекст
-        if (ctx == NULL) {
-            if (errno == ENOMEM) proxy_log("Client handler context creation error: %s", strerror(errno));
-            else proxy_log("Client handler context creation error: failed to reallocate memory");
-            close(client_socket);
-            goto close_server_socket;
+    signal(SIGPIPE, SIG_IGN); // Запись в закрытое клиентом или сервером соединение возвращает EPIPE
+#ifdef CACHE_PROXY_HAVE_IO_URING
+    if (proxy->io_mode == PROXY_IO_URING) {
+        int server_socket = create_server_socket(port, proxy->listen_backlog, 0); // Создает серверный сокет
+        if (server_socket == ERROR) goto delete_proxy_instance;
+        uring_listen(proxy->uring, server_socket); // Циклы сами ставят accept на слушающий сокет
+        while (proxy->running) usleep(ACCEPT_TIMEOUT_MS * 1000); // Сигнал остановки прерывает ожидание
+        close(server_socket);
+        goto delete_proxy_instance;
+    }
+#endif
+#ifdef CACHE_PROXY_HAVE_REUSEPORT
+    int reuseport = 1;
+#else
+    int reuseport = 0;
+#endif
+    errno = 0;
+    proxy->acceptors = calloc(proxy->acceptor_count, sizeof(acceptor_t));
+    if (proxy->acceptors == NULL) {
+        if (errno == ENOMEM) proxy_log_error("Acceptors creation error: %s", strerror(errno));
+        else proxy_log_error("Acceptors creation error: failed to reallocate memory");
+        goto delete_proxy_instance;
+    }
+    if (pipe(proxy->wake) == ERROR) { // Сигнал остановки будит потоки приема, не дожидаясь таймаута poll()
+        proxy_log_error("Acceptors creation error: %s", strerror(errno));
+        proxy->wake[0] = proxy->wake[1] = ERROR;
+        goto delete_proxy_instance;
+    }
+    int started = 0;
+    for (int i = 0; i < proxy->acceptor_count; i++) {
+        acceptor_t *acceptor = &proxy->acceptors[i];
+        acceptor->proxy = proxy;
+        acceptor->index = i;
+        acceptor->free_contexts = NULL;
+        atomic_init(&acceptor->returned_contexts, NULL);
+        int own_socket = i == 0 || reuseport;
+        acceptor->server_socket = own_socket ? create_server_socket(port, proxy->listen_backlog, reuseport) : proxy->acceptors[0].server_socket;
+        if (acceptor->server_socket == ERROR) break;
+        if (pthread_create(&acceptor->thread, NULL, acceptor_routine, acceptor) != 0) {
+            proxy_log_error("Acceptor thread creation error");
+            if (own_socket) close(acceptor->server_socket);
+            break;
         }
-        ctx->client_socket = client_socket; // Сохраняет дескриптор клиентского соединения
-        ctx->proxy = proxy; // Сохраняет указатель на экземпляр прокси
-        thread_pool_execute(proxy->handlers, handle_client, ctx); // Отправляет контекст в пул потоков
+        started++;
     }
-    close_server_socket:
-    close(server_socket);
+    if (started > 0 && started < proxy->acceptor_count) proxy_log_error("Proxy starting error: only %d of %d acceptors started", started, proxy->acceptor_count);
+    for (int i = 0; i < started; i++) pthread_join(proxy->acceptors[i].thread, NULL); // Потоки приема выходят по сигналу остановки
+    for (int i = 0; i < started; i++) {
+        if (i == 0 || reuseport) close(proxy->acceptors[i].server_socket);
+    }
+    proxy->acceptor_count = started; // Контексты остальных потоков не выдавались
     delete_proxy_instance:
     instance = NULL;
+    if (proxy->wake[0] != ERROR) {
+        close(proxy->wake[0]);
+        close(proxy->wake[1]);
+        proxy->wake[0] = proxy->wake[1] = ERROR;
+    }
 }
 
 /**
@@ -400,22 +690,55 @@ void proxy_start(proxy_t *proxy, int port) {
  * @param proxy Указатель на структуру proxy_t для уничтожения
  * @details Алгоритм работы:
  *          1. Проверяет валидность указателя proxy
- *          2. Останавливает пул потоков-обработчиков
- *          3. Уничтожает кэш HTTP-ответов
- *          4. Уничтожает мьютекс синхронизации кэша
+ *          2. Останавливает сервер администрирования, затем пул потоков-обработчиков,
+ *             событийные циклы или циклы io_uring, и освобождает контексты потоков приема
+ *          3. Уничтожает пул соединений с серверами и резолвер имен
+ *          4. Уничтожает кэш HTTP-ответов
  *          5. Освобождает память структуры proxy
  *          6. Сбрасывает глобальный указатель instance в NULL
  */
 void proxy_destroy(proxy_t *proxy) {
     if (proxy == NULL) {
-        proxy_log("Proxy destroying error: proxy is NULL");
+        proxy_log_error("Proxy destroying error: proxy is NULL");
         return;
     }
+    admin_server_destroy(proxy->admin); // Первым: метрики читают пулы и резолвер
     proxy_log("Destroy handlers");
-    thread_pool_shutdown(proxy->handlers); // Остановка пула потоков-обработчиков
+    if (proxy->handlers != NULL) thread_pool_shutdown(proxy->handlers); // Остановка пула потоков-обработчиков
+#ifdef CACHE_PROXY_HAVE_EPOLL
+    if (proxy->reactor != NULL) reactor_destroy(proxy->reactor); // Остановка событийных циклов
+#endif
+#ifdef CACHE_PROXY_HAVE_IO_URING
+    if (proxy->uring != NULL) uring_destroy(proxy->uring); // Остановка циклов io_uring
+#endif
+    thread_pool_shutdown(proxy->fetchers); // Загрузчики останавливаются после обработчиков, которые их ждут и запускают проверки
+    if (proxy->acceptors != NULL) { // Обработчиков больше нет, контексты никто не вернет
+        for (int i = 0; i < proxy->acceptor_count; i++) {
+            acceptor_t *acceptor = &proxy->acceptors[i];
+            client_handler_context_t *lists[2] = {acceptor->free_contexts, atomic_exchange(&acceptor->returned_contexts, NULL)};
+            for (int j = 0; j < 2; j++) {
+                while (lists[j] != NULL) {
+                    client_handler_context_t *next = lists[j]->next;
+                    free(lists[j]);
+                    lists[j] = next;
+                }
+            }
+        }
+        free(proxy->acceptors);
+    }
+    if (proxy->upstreams != NULL) { // Загрузчиков больше нет, соединения никто не заберет
+        upstream_stats_t stats;
+        upstream_get_stats(proxy->upstreams, &stats);
+        proxy_log("Upstream pool: %zu hits, %zu misses, %zu idle", stats.hits, stats.misses, stats.idle);
+        upstream_pool_destroy(proxy->upstreams);
+    }
+    dns_stats_t dns_stats; // Обработчиков больше нет, имена никто не разрешает
+    dns_get_stats(proxy->resolver, &dns_stats);
+    proxy_log("DNS resolver: %zu hits, %zu misses, %zu coalesced, %zu failures",
+              dns_stats.hits, dns_stats.misses, dns_stats.coalesced, dns_stats.failures);
+    dns_resolver_destroy(proxy->resolver);
     proxy_log("Destroy cache");
     cache_destroy(proxy->cache); // Освобождает все ресурсы, связанные с кэшем
-    pthread_mutex_destroy(&proxy->cache_mutex); // Уничтожение мьютекса синхронизации кэша
     proxy_log("Destroy proxy");
     free(proxy); // Освобождает память, выделенную под структуру proxy_t
     instance = NULL;
@@ -425,40 +748,57 @@ void proxy_destroy(proxy_t *proxy) {
  * @brief Обработчик сигналов для завершения работы прокси-сервера
  * @param signal Номер полученного сигнала (не используется)
  * @details Функция-обработчик сигналов, которая инициирует корректное завершение
- *          работы прокси-сервера. Устанавливает флаг running в 0, что приводит
- *          к остановке основного цикла приема соединений.
+ *          работы прокси-сервера. Устанавливает флаг running в 0 и пишет в канал
+ *          пробуждения, что приводит к остановке потоков приема соединений.
  * @note Использует __attribute__((unused)) для подавления предупреждений компилятора
  */
 static void termination_handler(__attribute__((unused)) int signal) {
     if (instance != NULL && instance->running) {
         instance->running = 0;
+        if (instance->wake[1] != ERROR) { // Канал никто не читает: он остается готовым к чтению для всех потоков приема
+            char byte = 0;
+            ssize_t ret = write(instance->wake[1], &byte, 1);
+            (void) ret;
+        }
         proxy_log("Wait for the job to complete");
     }
 }
 
 /**
  * @brief Создает и настраивает серверный сокет для прослушивания входящих соединений
- * @param port Порт, на котором будет работать прокси-сервер
+ * @param port      Порт, на котором будет работать прокси-сервер
+ * @param backlog   Длина очереди подключений
+ * @param reuseport 1 если на том же порту будут слушать другие сокеты (SO_REUSEPORT)
  * @return Дескриптор созданного сокета или ERROR (-1) при ошибке
  * @details Алгоритм создания серверного сокета:
  *          1. Создает TCP сокет (AF_INET, SOCK_STREAM)
  *          2. Устанавливает опцию SO_REUSEADDR для быстрого перезапуска
+ *             и, если нужно, SO_REUSEPORT
  *          3. Настраивает структуру адреса (слушает все интерфейсы, заданный порт)
  *          4. Привязывает сокет к адресу (bind)
- *          5. Переводит сокет в режим прослушивания (listen)
+ *          5. Переводит сокет в режим прослушивания (listen) и в неблокирующий режим
  *          6. Логирует успешное создание
  * @note Использует IPv4 (AF_INET), для IPv6 нужно использовать AF_INET6
  * @note Слушает на всех сетевых интерфейсах (INADDR_ANY)
- * @note Максимальная очередь подключений определяется MAX_USERS_COUNT
+ * @note Ядро ограничивает очередь подключений значением net.core.somaxconn
  */
-static int create_server_socket(int port) {
+static int create_server_socket(int port, int backlog, int reuseport) {
     int server_socket = socket(AF_INET, SOCK_STREAM, 0); // Создание TCP сокета
     if (server_socket == ERROR) {
-        proxy_log("Creating server socket error: %s", strerror(errno));
+        proxy_log_error("Creating server socket error: %s", strerror(errno));
         return ERROR;
     }
     int true = 1;
     setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &true, sizeof(int)); // Разрешает повторное использование локального адреса
+#ifdef CACHE_PROXY_HAVE_REUSEPORT
+    if (reuseport && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &true, sizeof(int)) == ERROR) { // Ядро распределяет подключения между сокетами порта
+        proxy_log_error("Creating server socket error: SO_REUSEPORT: %s", strerror(errno));
+        close(server_socket);
+        return ERROR;
+    }
+#else
+    (void) reuseport;
+#endif
     struct sockaddr_in server_addr; // Инициализирует структуру sockaddr_in для bind()
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET; // IPv4
@@ -466,197 +806,646 @@ static int create_server_socket(int port) {
     server_addr.sin_port = htons(port); // порт в сетевом порядке
     int err = bind(server_socket, (struct sockaddr *) &server_addr, sizeof(server_addr)); // Связывает сокет с конкретным сетевым адресом и портом
     if (err == ERROR) {
-        proxy_log("Bind socket error: %s", strerror(errno));
+        proxy_log_error("Bind socket error: %s", strerror(errno));
         close(server_socket);
         return ERROR;
     }
-    err = listen(server_socket, MAX_USERS_COUNT); // Перевод сокета в режим прослушивания (listen)
+    err = listen(server_socket, backlog); // Перевод сокета в режим прослушивания (listen)
     if (err == ERROR) {
-        proxy_log("Listen socket error: %s", strerror(errno));
+        proxy_log_error("Listen socket error: %s", strerror(errno));
         close(server_socket);
         return ERROR;
     }
+    int flags = fcntl(server_socket, F_GETFL, 0); // accept() на пустой очереди не должен блокировать поток приема
+    fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
     proxy_log("Proxy listen on port %d", port);
     return server_socket;
 }
 
 /**
- * @brief Принимает входящее клиентское соединение с таймаутом
- * @param server_socket Дескриптор серверного сокета в режиме прослушивания
- * @return Дескриптор клиентского сокета, NO_CLIENT если нет соединений, ERROR при ошибке
+ * @brief Основная функция потока приема соединений
+ * @param arg Указатель на acceptor_t
+ * @return NULL
  * @details Алгоритм работы:
- *          1. Ожидает готовности серверного сокета к accept() с помощью select() и таймаутом
- *          2. При наличии соединения принимает его через accept()
- *          3. Устанавливает клиентский сокет в неблокирующий режим
- *          4. Логирует информацию о подключившемся клиенте
- *          5. Возвращает дескриптор клиентского сокета
+ *          1. Закрепляет поток за ядром (если потоков приема несколько)
+ *          2. Ждет входящих соединений на своем сокете или пробуждения через канал
+ *             (сигнал остановки) через poll()
+ *          3. Забирает из очереди подключений все ожидающие соединения (accept_clients)
+ *          4. Повторяет, пока прокси работает
  */
-static int accept_client(int server_socket) {
-    fd_set read_fds; //  Подготавливает набор файловых дескрипторов для мониторинга
-    FD_ZERO(&read_fds);
-    FD_SET(server_socket, &read_fds);
-    struct timeval timeout; // Настройка таймаута для select()
-    timeout.tv_sec = ACCEPT_TIMEOUT_MS / 1000;
-    timeout.tv_usec = (ACCEPT_TIMEOUT_MS % 1000) * 1000;
-    int ready = select(server_socket + 1, &read_fds, NULL, NULL, &timeout); // Ожидает, пока серверный сокет не будет готов к accept(). select() позволяет одному потоку следить за множеством файловых дескрипторов и ждать, пока хотя бы один из них не будет готов для операций ввода/вывода
-    if (ready == ERROR) {
-        if (errno != EINTR) proxy_log("Accept client error: %s", strerror(errno));
-        return ERROR;
+static void *acceptor_routine(void *arg) {
+    acceptor_t *acceptor = (acceptor_t *) arg;
+    proxy_t *proxy = acceptor->proxy;
+    char name[16];
+    snprintf(name, sizeof(name), "acceptor-%d", acceptor->index);
+    proxy_set_thread_name(name);
+#ifdef CACHE_PROXY_HAVE_REUSEPORT
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (proxy->acceptor_count > 1 && cpus > 1) { // Подключения сокета обрабатываются прерываниями того же ядра
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(acceptor->index % cpus, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) proxy_log_error("Acceptor affinity error: %s", strerror(err));
+    }
+#endif
+    while (proxy->running) {
+        struct pollfd fds[2] = {{.fd = proxy->wake[0], .events = POLLIN}, {.fd = acceptor->server_socket, .events = POLLIN}};
+        int ready = poll(fds, 2, ACCEPT_TIMEOUT_MS);
+        if (ready == ERROR) {
+            if (errno == EINTR) continue; // Сигнал остановки проверяется в условии цикла
+            proxy_log_error("Accept client error: %s", strerror(errno));
+            break;
+        }
+        if (ready == 0 || !(fds[1].revents & POLLIN)) continue; // Таймаут или пробуждение: проверяет, не остановлен ли прокси
+        if (accept_clients(acceptor) == ERROR) break;
     }
-    else if (ready == 0) return NO_CLIENT; // Если select() вернул 0 (таймаут истек), возвращает NO_CLIENT
-    struct sockaddr_in client_addr; // для хранения адреса клиента
-    socklen_t client_addr_size = sizeof(client_addr); // размер структуры
-    int client_socket = accept(server_socket, (struct sockaddr *) &client_addr, &client_addr_size); // Принимает ожидающее соединение из очереди серверного сокета
-    if (client_socket == ERROR) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) return NO_CLIENT;
-        else {
-            proxy_log("Accept client error: %s", strerror(errno));
+    proxy->running = 0; // Поток приема остановился из-за ошибки - останавливает остальные
+    return NULL;
+}
+
+/**
+ * @brief Принимает ожидающие клиентские соединения пачкой
+ * @param acceptor Поток приема
+ * @return SUCCESS или ERROR при ошибке, после которой прием нужно остановить
+ * @details Алгоритм работы:
+ *          1. Принимает соединения через accept4(SOCK_NONBLOCK), пока очередь не опустеет
+ *             или не будет принято ACCEPT_BATCH соединений
+ *          2. Пропускает соединения, оборванные клиентом до приема
+ *          3. При нехватке дескрипторов или памяти делает паузу ACCEPT_BACKOFF_MS:
+ *             очередь разберется, когда обработчики закроют соединения
+ *          4. Передает каждое соединение обработчикам (dispatch_client)
+ */
+static int accept_clients(acceptor_t *acceptor) {
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+        struct sockaddr_in client_addr; // для хранения адреса клиента
+        socklen_t client_addr_size = sizeof(client_addr); // размер структуры
+#ifdef CACHE_PROXY_HAVE_ACCEPT4
+        int client_socket = accept4(acceptor->server_socket, (struct sockaddr *) &client_addr, &client_addr_size, SOCK_NONBLOCK); // Сокет сразу неблокирующий, без fcntl()
+#else
+        int client_socket = accept(acceptor->server_socket, (struct sockaddr *) &client_addr, &client_addr_size);
+        if (client_socket != ERROR) {
+            int flags = fcntl(client_socket, F_GETFL, 0); //  Получить текущие настройки сокета
+            fcntl(client_socket, F_SETFL, flags | O_NONBLOCK); // Добавить флаг O_NONBLOCK (бит отвечающий за неблокирующий режим)
+        }
+#endif
+        if (client_socket == ERROR) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return SUCCESS; // Очередь пуста (или соединение забрал другой поток)
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue; // Клиент оборвал соединение до приема
+            int err = errno;
+            proxy_log_error("Accept client error: %s", strerror(err));
+            if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+                usleep(ACCEPT_BACKOFF_MS * 1000);
+                return SUCCESS;
+            }
             return ERROR;
         }
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, address, sizeof(address)); // inet_ntoa() использует общий статический буфер
+        proxy_log("Accept client %s:%d", address, ntohs(client_addr.sin_port));
+        dispatch_client(acceptor, client_socket);
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Передает принятое соединение пулу потоков или событийному циклу
+ * @param acceptor      Поток приема
+ * @param client_socket Дескриптор клиентского сокета (функция забирает владение)
+ */
+static void dispatch_client(acceptor_t *acceptor, int client_socket) {
+    proxy_t *proxy = acceptor->proxy;
+#ifdef CACHE_PROXY_HAVE_EPOLL
+    if (proxy->io_mode == PROXY_IO_EPOLL) {
+        reactor_submit(proxy->reactor, client_socket); // Передает сокет одному из событийных циклов
+        return;
+    }
+#endif
+    client_handler_context_t *ctx = acquire_context(acceptor);
+    if (ctx == NULL) {
+        close(client_socket);
+        return;
+    }
+    ctx->client_socket = client_socket; // Сохраняет дескриптор клиентского соединения
+    if (thread_pool_execute(proxy->handlers, handle_client, ctx) != SUCCESS) { // Отправляет контекст в пул потоков
+        close(client_socket);
+        release_context(ctx);
+    }
+}
+
+/**
+ * @brief Берет контекст обработчика из списка свободных контекстов потока приема
+ * @param acceptor Поток приема
+ * @return Контекст или NULL, если список пуст и выделить новый не удалось
+ * @details Сначала берется собственный список потока приема; если он пуст,
+ *          целиком забираются контексты, возвращенные обработчиками.
+ */
+static client_handler_context_t *acquire_context(acceptor_t *acceptor) {
+    client_handler_context_t *ctx = acceptor->free_contexts;
+    if (ctx == NULL) ctx = atomic_exchange_explicit(&acceptor->returned_contexts, NULL, memory_order_acquire);
+    if (ctx != NULL) {
+        acceptor->free_contexts = ctx->next;
+        return ctx;
     }
-    int flags = fcntl(client_socket, F_GETFL, 0); //  Получить текущие настройки сокета
-    fcntl(client_socket, F_SETFL, flags | O_NONBLOCK); // Добавить флаг O_NONBLOCK (бит отвечающий за неблокирующий режим)
-    proxy_log("Accept client %s:%d", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-    return client_socket;
+    errno = 0;
+    ctx = malloc(sizeof(client_handler_context_t)); // Выделение памяти под контекст
+    if (ctx == NULL) {
+        if (errno == ENOMEM) proxy_log_error("Client handler context creation error: %s", strerror(errno));
+        else proxy_log_error("Client handler context creation error: failed to reallocate memory");
+        return NULL;
+    }
+    ctx->proxy = acceptor->proxy; // Сохраняет указатель на экземпляр прокси
+    ctx->acceptor = acceptor;
+    return ctx;
+}
+
+/**
+ * @brief Возвращает контекст обработчика потоку приема, который его выдал
+ * @param ctx Контекст обслуженного клиента
+ */
+static void release_context(client_handler_context_t *ctx) {
+    acceptor_t *acceptor = ctx->acceptor;
+    client_handler_context_t *head = atomic_load_explicit(&acceptor->returned_contexts, memory_order_relaxed);
+    do {
+        ctx->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&acceptor->returned_contexts, &head, ctx, memory_order_release, memory_order_relaxed));
 }
 
 /**
  * @brief Основная функция обработки клиентского HTTP соединения
  * @param arg Указатель на client_handler_context_t (контекст клиента)
  * @details Алгоритм работы:
- *          1. Прием и парсинг HTTP-запроса от клиента
- *          2. Проверка кэша (для GET запросов)
- *          3. Если кэш есть - отдача из кэша
- *          4. Если кэша нет - подключение к целевому серверу
- *          5. Проксирование данных между клиентом и сервером
- *          6. Кэширование ответа (для поддерживаемых запросов)
- *          7. Освобождение ресурсов
+ *          1. Накапливает данные клиента в буфере, пока в нем нет целого запроса
+ *          2. Вырезает из начала буфера очередной запрос и обслуживает его (serve_request);
+ *             следующие запросы, отправленные клиентом без ожидания ответа (конвейер),
+ *             остаются в буфере и обслуживаются по порядку
+ *          3. Если буфер пуст, а соединение постоянное, ждет следующего запроса (wait_next_request)
+ *          4. Закрывает соединение, когда клиент или ответ этого требует, по таймауту простоя
+ *             или при ошибке, и освобождает ресурсы
  */
 static void handle_client(void *arg) {
     if (arg == NULL) {
-        proxy_log("Proxy error: client handler context is NULL");
+        proxy_log_error("Proxy error: client handler context is NULL");
         return;
     }
     client_handler_context_t *ctx = (client_handler_context_t *) arg;
-    char *request = NULL;
-    ssize_t request_len = receive_full_data(ctx->client_socket, &request); // Полностью читает HTTP-запрос от клиента
-    if (request_len == ERROR) goto destroy_ctx;
-    char *method, *host_port;
+    char *buf = NULL; // Полученные от клиента, но еще не обслуженные данные
+    size_t buf_len = 0, buf_capacity = 0;
+    int served = 0; // Количество обслуженных запросов
+    int receiving = 0; // Начат прием очередного запроса
+    uint64_t receive_start = 0; // Начало этапа приема трассируемого запроса
+    while (1) {
+        ssize_t request_len = buf_len == 0 ? PARTIAL : http_request_length(buf, buf_len);
+        if (request_len == ERROR) {
+            proxy_log_error("Request parsing error: failed");
+            send_full_data(ctx->client_socket, HTTP_BAD_REQUEST_RESPONSE, sizeof(HTTP_BAD_REQUEST_RESPONSE) - 1);
+            break;
+        }
+        if (request_len == PARTIAL) { // Запрос получен не полностью
+            if (buf_len == 0 && served > 0 && wait_next_request(ctx) == ERROR) break;
+            if (!receiving) { // Первая порция нового запроса (ожидание простаивающего соединения в прием не входит)
+                receiving = 1;
+                trace_request_begin();
+                receive_start = trace_span_begin();
+            }
+            if (buf_len == MAX_REQUEST_SIZE) {
+                proxy_log_error("Request parsing error: request is too large");
+                break;
+            }
+            if (buf_len == buf_capacity) {
+                size_t capacity = buf_capacity == 0 ? BUFFER_SIZE : buf_capacity * 2;
+                if (capacity > MAX_REQUEST_SIZE) capacity = MAX_REQUEST_SIZE;
+                char *temp = realloc(buf, capacity);
+                if (temp == NULL) {
+                    proxy_log_error("Data receiving error: failed to reallocate memory");
+                    break;
+                }
+                buf = temp;
+                buf_capacity = capacity;
+            }
+            ssize_t received = receive_with_timeout(ctx->client_socket, buf + buf_len, buf_capacity - buf_len);
+            if (received == ERROR || received == 0) break; // Ошибка или клиент закрыл соединение
+            buf_len += received;
+            continue;
+        }
+        errno = 0;
+        char *request = malloc(request_len); // Запрос отдается элементу кэша, буфер остается для следующих
+        if (request == NULL) {
+            proxy_log_error("Data receiving error: %s", strerror(errno));
+            break;
+        }
+        memcpy(request, buf, request_len);
+        buf_len -= request_len;
+        memmove(buf, buf + request_len, buf_len); // Следующие запросы конвейера
+        if (!receiving) trace_request_begin(); // Запрос конвейера уже был в буфере целиком
+        trace_span_end("receive", receive_start);
+        receiving = 0;
+        receive_start = 0;
+        served++;
+        if (serve_request(ctx, request, request_len) == ERROR) break;
+    }
+    trace_request_end();
+    free(buf);
+    close(ctx->client_socket);
+    release_context(ctx);
+}
+
+/**
+ * @brief Обслуживает один HTTP-запрос клиента
+ * @param ctx         Контекст клиента
+ * @param request     Запрос (выделен через malloc, функция забирает владение)
+ * @param request_len Длина запроса
+ * @return SUCCESS если по соединению можно отправить следующий ответ, ERROR если его нужно закрыть
+ * @details Алгоритм работы:
+ *          1. Парсинг запроса
+ *          2. Для GET атомарно ищет элемент в кэше или добавляет новый; ответы на остальные
+ *             методы пересылает через splice() (relay_uncacheable), а если splice() недоступен -
+ *             создает для них частный (не добавляемый в кэш) элемент
+ *          3. Если элемент новый - ставит его загрузку в пул загрузчиков (start_fetch);
+ *             элемент, заменивший устаревший, уже загружает проверка этого устаревшего
+ *          4. Отдает данные элемента клиенту по мере их появления, как и любой другой читатель
+ *          5. Соединение остается открытым, если клиент его не закрывает, а конец ответа
+ *             обозначен Content-Length или chunked (иначе клиент ждет закрытия соединения)
+ * @note Загрузка не зависит от скорости клиента, который ее запустил:
+ *       медленный клиент не задерживает остальных читателей того же элемента
+ */
+static int serve_request(client_handler_context_t *ctx, char *request, size_t request_len) {
+    cache_entry_t *entry = NULL; // Захваченная ссылка на элемент кэша
+    int ret = ERROR;
+    metrics_request_t metrics;
+    metrics_request_start(&metrics);
+    uint64_t request_start = trace_span_begin();
+    uint64_t span = trace_span_begin();
+    const char *method, *host_port;
     size_t method_len, host_len;
     // Извлекает из запроса метод и хост
-    if (parse_request(request, request_len, (const char **) &method, &method_len, (const char **) &host_port, &host_len) == ERROR) goto destroy_ctx;
-    cache_entry_t *entry = NULL;
-    if (check_request(method, method_len)) { // определяет, можно ли кэшировать запрос
-        pthread_mutex_lock(&ctx->proxy->cache_mutex);
-        entry = find_cache_entry(ctx->proxy->cache, request, request_len); // Ищем запись
-        if (entry != NULL) { // если нашли
-            pthread_mutex_unlock(&ctx->proxy->cache_mutex);
-            proxy_log("Cache hit, start streaming from cache");
-            stream_cache_to_client(entry, ctx->client_socket); // Отдаем из кэша
-            goto destroy_ctx;
+    if (http_parse_request(request, request_len, &method, &method_len, &host_port, &host_len) == ERROR) goto free_request;
+    int keep_alive = http_request_keep_alive(request, request_len) && ctx->proxy->client_idle_timeout_ms > 0;
+    int cacheable = http_check_request(method, method_len); // определяет, можно ли кэшировать запрос
+    trace_span_end("parse", span);
+#ifdef CACHE_PROXY_HAVE_SPLICE
+    if (!cacheable) { // Ответ не сохраняется, поэтому тело идет от сервера к клиенту в обход памяти процесса
+        proxy_log("Uncacheable request, relay through pipe");
+        metrics_request_lookup(&metrics, METRICS_LOOKUP_BYPASS);
+        int delimited = 0;
+        span = trace_span_begin();
+        int relayed = relay_uncacheable(ctx->proxy->resolver, ctx->client_socket, request, request_len, &delimited);
+        trace_span_end("relay", span);
+        if (relayed == SUCCESS) {
+            metrics_request_finish(&metrics); // Байты идут в обход процесса, поэтому учитывается только длительность
+            if (delimited && keep_alive) ret = SUCCESS;
+        }
+        goto free_request;
+    }
+#endif
+    for (;;) {
+        int created = 0;
+        span = trace_span_begin();
+        if (cacheable) {
+            // Ищем запись, а если ее нет - атомарно добавляем новую (она получает буфер запроса)
+            entry = cache_get_or_add(ctx->proxy->cache, request, request_len, &created);
+        } else {
+            entry = cache_entry_create(request, request_len, NULL);
+            created = entry != NULL;
         }
-        entry = cache_entry_create(request, request_len, NULL); // // CACHE MISS - создаем новую запись
-        if (entry == NULL) {
-            pthread_mutex_unlock(&ctx->proxy->cache_mutex);
-            goto destroy_ctx;
+        trace_span_end("cache_lookup", span);
+        if (entry == NULL) goto free_request;
+        if (!created) metrics_request_lookup(&metrics, entry->finished ? METRICS_LOOKUP_HIT : METRICS_LOOKUP_COALESCED);
+        else metrics_request_lookup(&metrics, cacheable ? METRICS_LOOKUP_MISS : METRICS_LOOKUP_BYPASS);
+        if (created) request = NULL; // Буфером запроса теперь владеет элемент
+        if (created == CACHE_REVALIDATING) proxy_log("Cache entry is stale, revalidate");
+        if (created == 1) {
+            proxy_log(cacheable ? "Cache miss" : "Uncacheable request, relay through private entry");
+            if (start_fetch(ctx->proxy, entry, NULL, cacheable) == ERROR) {
+                if (cacheable) cache_remove_entry(ctx->proxy->cache, entry); // Сначала из кэша, чтобы ожидающие повторили поиск и не нашли эту запись
+                entry->failed = 1;
+                cache_entry_notify(entry);
+                goto free_request;
+            }
         }
-        if (cache_add(ctx->proxy->cache, entry) == ERROR) {
-            pthread_mutex_unlock(&ctx->proxy->cache_mutex);
-            cache_entry_destroy(entry);
-            goto destroy_ctx;
+        span = trace_span_begin();
+        int ready = wait_cache_entry(entry);
+        trace_span_end("wait_ready", span);
+        if (ready == SUCCESS) {
+            if (!created) proxy_log("Cache hit, start streaming from cache");
+            // Отдаем данные по мере загрузки; после ответа, длина которого известна клиенту, соединение можно не закрывать
+            span = trace_span_begin();
+            ssize_t streamed = stream_cache_to_client(entry, ctx->client_socket, &metrics);
+            trace_span_end("stream", span);
+            if (streamed != ERROR && entry->finished) {
+                metrics_request_finish(&metrics);
+                if (entry->delimited && keep_alive) ret = SUCCESS;
+            }
+            goto free_request;
         }
-        pthread_mutex_unlock(&ctx->proxy->cache_mutex);
+        cache_entry_release(entry);
+        entry = NULL;
+        if (created) goto free_request; // Прервана загрузка, запущенная для этого клиента
+        // Чужая загрузка прервана и запись уже убрана из кэша - повторяем поиск
     }
-    proxy_log("Cache miss"); // Если не нашли
-    char host_port1[BUFFER_SIZE];
-    strncpy(host_port1, host_port, host_len); // Извлекает хост
+    free_request:
+    if (entry != NULL) cache_entry_release(entry); // Буфер запроса освобождается вместе с элементом
+    free(request);
+    trace_span_end("request", request_start);
+    trace_request_end();
+    return ret;
+}
+
+/**
+ * @brief Ждет следующего запроса по постоянному соединению
+ * @param ctx Контекст клиента
+ * @return SUCCESS если клиент прислал данные (или закрыл соединение), ERROR если соединение
+ *         нужно закрыть: истек client_idle_timeout_ms, прокси останавливается
+ *         или свободного потока ждут новые клиенты
+ * @details Ожидание идет отрезками по CLIENT_IDLE_POLL_MS: простаивающее соединение
+ *          не должно занимать поток-обработчик, пока в очереди есть другие клиенты.
+ *          Используется poll(): у постоянных соединений номер сокета может превышать FD_SETSIZE.
+ */
+static int wait_next_request(client_handler_context_t *ctx) {
+    proxy_t *proxy = ctx->proxy;
+    time_t waited_ms = 0;
+    while (waited_ms < proxy->client_idle_timeout_ms) {
+        if (!proxy->running || thread_pool_pending(proxy->handlers) > 0) return ERROR;
+        time_t slice_ms = proxy->client_idle_timeout_ms - waited_ms;
+        if (slice_ms > CLIENT_IDLE_POLL_MS) slice_ms = CLIENT_IDLE_POLL_MS;
+        struct pollfd pfd = {.fd = ctx->client_socket, .events = POLLIN};
+        int ready = poll(&pfd, 1, (int) slice_ms);
+        if (ready == -1) {
+            if (errno != EINTR) proxy_log_error("Client waiting error: %s", strerror(errno));
+            return ERROR;
+        }
+        if (ready > 0) return SUCCESS;
+        waited_ms += slice_ms;
+    }
+    return ERROR;
+}
+
+/**
+ * @brief Ставит загрузку ответа для элемента в пул загрузчиков
+ * @param proxy   Прокси
+ * @param entry   Новый элемент (загрузчик захватывает на него собственную ссылку;
+ *                NULL - элемент создается, только если ответ изменился)
+ * @param stale   Устаревший элемент, который нужно проверить условным запросом (NULL - обычная загрузка)
+ * @param indexed 1 если элемент добавлен в кэш, 0 для частного элемента
+ * @return SUCCESS или ERROR, если задачу не удалось создать
+ */
+static int start_fetch(proxy_t *proxy, cache_entry_t *entry, cache_entry_t *stale, int indexed) {
+    errno = 0;
+    fetch_context_t *ctx = malloc(sizeof(fetch_context_t));
+    if (ctx == NULL) {
+        proxy_log_error("Fetch context creation error: %s", strerror(errno));
+        return ERROR;
+    }
+    ctx->proxy = proxy;
+    ctx->entry = cache_entry_acquire(entry);
+    ctx->stale = cache_entry_acquire(stale);
+    ctx->indexed = indexed;
+    ctx->trace = trace_current; // Этапы загрузки попадут в трассу запроса, который ее запустил
+    if (thread_pool_execute(proxy->fetchers, fetch_origin, ctx) != SUCCESS) {
+        cache_entry_release(entry);
+        cache_entry_release(stale);
+        free(ctx);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Запускает проверку устаревшего элемента кэша (cache_revalidate_t)
+ * @param arg     Указатель на proxy_t
+ * @param stale   Устаревший элемент
+ * @param pending Элемент, заменивший его в кэше (NULL - не заменен)
+ * @return SUCCESS или ERROR, если задачу не удалось создать
+ * @details Вызывается кэшем из обработчика запроса в любом режиме: проверка идет
+ *          в пуле загрузчиков и не задерживает клиента, получившего устаревший ответ.
+ */
+static int revalidate_entry(void *arg, cache_entry_t *stale, cache_entry_t *pending) {
+    proxy_t *proxy = (proxy_t *) arg;
+    return start_fetch(proxy, pending, stale, 1);
+}
+
+/**
+ * @brief Задача пула загрузчиков: загружает ответ сервера в элемент кэша
+ * @param arg Указатель на fetch_context_t
+ * @details Алгоритм работы:
+ *          1. Извлекает хост из запроса элемента и переводит запрос на keep-alive (версия клиента сохраняется)
+ *          2. Пересылает запрос серверу по соединению из пула или по новому (open_upstream)
+ *          3. Принимает ответ прямо в свободное место буфера элемента (message_reserve),
+ *             порциями до FETCH_BUFFER_SIZE, и публикует их, оповещая читателей;
+ *             пока заголовки не разобраны, копит их отдельно
+ *          4. После разбора заголовков убирает элемент из кэша, если статус не кэшируется,
+ *             и запоминает Vary
+ *          5. Завершает загрузку по Content-Length, концу тела chunked или закрытию соединения сервером
+ *          6. Помечает элемент завершенным или прерванным (убирая его из кэша) и оповещает читателей
+ *          7. Возвращает соединение в пул, если ответ прочитан ровно до конца и сервер его не закрывает
+ */
+static void fetch_origin(void *arg) {
+    fetch_context_t *ctx = (fetch_context_t *) arg;
+    trace_request_resume(ctx->trace);
+    uint64_t fetch_start = trace_span_begin();
+    uint64_t headers_start = 0; // Ожидание заголовков ответа после отправки запроса
+    cache_entry_t *entry = ctx->entry;
+    cache_entry_t *stale = ctx->stale;
+    cache_t *cache = ctx->proxy->cache;
+    const char *request = entry != NULL ? entry->request : stale->request; // Без элемента проверяется запрос, сохранивший ответ
+    size_t request_len = entry != NULL ? entry->request_len : stale->request_len;
+    int remote_socket = ERROR;
+    int failed = 1;
+    int reusable = 0; // Ответ прочитан ровно до конца, соединение можно вернуть в пул
+    char *upstream_request = NULL; // Запрос клиента, переведенный на постоянное соединение
+    char *header = NULL; // Начало ответа, пока заголовки не получены полностью
+    size_t header_len = 0;
+    int header_parsed = 0;
+    size_t body_received = 0;
+    size_t content_length = HTTP_CONTENT_LENGTH_UNKNOWN;
+    int chunked = 0, keep_alive = 0;
+    http_chunked_t chunks = {0}; // Поиск конца тела в кодировке chunked
+    const char *method, *host_port;
+    size_t method_len, host_len;
     char host[BUFFER_SIZE];
     int port;
-    get_host_port(host_port1, host, &port); // Извлекает порт
-    int remote_socket = connect_to_remote(host, port); // Устанавливает TCP соединение с целевым сервером
-    if (remote_socket == ERROR) goto destroy_entry;
-    if (send_full_data(remote_socket, request, request_len) == ERROR) goto destroy_entry; // Пересылка запроса серверу
-    char *response_data = NULL;
-    ssize_t response_data_len = receive_and_send_data(remote_socket, ctx->client_socket, &response_data); // Принимает ответ от сервера и сразу отправляет клиенту
-    if (response_data_len == ERROR) {
-        if (response_data != NULL) free(response_data);
-        goto destroy_entry;
-    }
-    // Парсинг HTTP-ответа
-    int status;
-    size_t content_length_header;
-    size_t content_len;
-    if (parse_response(response_data, response_data_len, &status, &content_len, &content_length_header) == ERROR) {
-        free(response_data);
-        goto destroy_entry;
-    }
-    message_t *response = NULL;
-    message_add_part(&response, response_data, response_data_len); // Сохранение первой части ответа для кэша
-    // Уведомление ждущих потоков о частичном ответе
-    if (check_request(method, method_len)) {
-        entry->response = response;
-        pthread_mutex_lock(&entry->mutex);
-        pthread_cond_broadcast(&entry->ready_cond);
-        pthread_mutex_unlock(&entry->mutex);
-    }
-    // Читает и пересылает оставшуюся часть ответа
-    while (content_len < content_length_header) {
-        response_data_len = receive_and_send_message(remote_socket, ctx->client_socket, &response);
-        if (response_data_len == ERROR) {
-            message_destroy(&response);
-            goto destroy_entry;
-        }
-        // Так реализуется streaming кэша: клиенты получают данные по мере загрузки
-        // Уведомление ждущих потоков о частичном ответе
-        content_len += response_data_len;
-        if (check_request(method, method_len)) {
-            pthread_mutex_lock(&entry->mutex);
-            pthread_cond_broadcast(&entry->ready_cond);
+    if (http_parse_request(request, request_len, &method, &method_len, &host_port, &host_len) == ERROR) goto finish;
+    if (get_origin_address(host_port, host_len, host, &port) == ERROR) goto finish;
+    size_t upstream_request_len;
+    if (stale != NULL) { // Условный запрос: сервер ответит 304, если сохраненный ответ не изменился
+        pthread_mutex_lock(&stale->mutex);
+        upstream_request = http_build_conditional_request(request, request_len, stale->etag, stale->last_modified, &upstream_request_len);
+        pthread_mutex_unlock(&stale->mutex);
+    } else {
+        upstream_request = http_build_upstream_request(request, request_len, 1, &upstream_request_len);
+    }
+    if (upstream_request == NULL) goto finish;
+    uint64_t span = trace_span_begin();
+    remote_socket = open_upstream(ctx->proxy, host, port, upstream_request, upstream_request_len, ctx->indexed);
+    trace_span_end("upstream_open", span);
+    if (remote_socket == ERROR) goto finish;
+    headers_start = trace_span_begin();
+    while (1) {
+        // При проверке заголовки копятся отдельно: ответ 304 не должен попасть в элемент
+        int direct = stale == NULL || header_parsed;
+        char *space;
+        size_t space_len;
+        if (direct) {
+            pthread_mutex_lock(&entry->mutex); // Читатели обращаются к response под мьютексом, пока он может быть создан
+            space = message_reserve(&entry->response, FETCH_BUFFER_SIZE, &space_len);
             pthread_mutex_unlock(&entry->mutex);
+        } else {
+            space = realloc(header, header_len + FETCH_BUFFER_SIZE);
+            if (space != NULL) {
+                header = space;
+                space = header + header_len;
+                space_len = FETCH_BUFFER_SIZE;
+            }
+        }
+        if (space == NULL) goto finish;
+        ssize_t received = receive_with_timeout(remote_socket, space, space_len); // Прием сразу в кусок ответа, без промежуточного буфера
+        if (received == ERROR) goto finish;
+        if (received == 0) { // Сервер закрыл соединение: ответ без Content-Length завершен
+            failed = !header_parsed || chunked || (content_length != HTTP_CONTENT_LENGTH_UNKNOWN && body_received < content_length);
+            if (failed) proxy_log_error("Data receiving error: remote closed connection before end of response");
+            goto finish;
+        }
+        if (direct) {
+            message_commit(entry->response, received); // Клиенты получают данные по мере загрузки
+            if (ctx->indexed) cache_account(cache, entry, received); // Учитываем данные в бюджете кэша
+        }
+        const char *body = space; // Часть порции, относящаяся к телу ответа
+        size_t body_len = received;
+        if (!header_parsed) {
+            body_len = 0;
+            if (direct) {
+                char *temp = realloc(header, header_len + received);
+                if (temp == NULL) {
+                    proxy_log_error("Response parsing error: failed to reallocate memory");
+                    goto finish;
+                }
+                header = temp;
+                memcpy(header + header_len, space, received);
+            }
+            header_len += received;
+            int status;
+            int ret = http_parse_response(header, header_len, &status, &body_received, &content_length);
+            if (ret == ERROR || (ret == PARTIAL && header_len > MAX_HEADER_SIZE)) goto finish;
+            if (ret == SUCCESS) {
+                header_parsed = 1;
+                trace_span_end("origin_headers", headers_start);
+                if (http_get_framing(header, header_len, &chunked, &keep_alive) == ERROR) goto finish;
+                if (!http_response_has_body(method, method_len, status)) {
+                    chunked = 0; // Ответ без тела, даже если заголовки описывают его длину
+                    content_length = 0;
+                } else if (chunked) {
+                    content_length = HTTP_CONTENT_LENGTH_UNKNOWN; // Content-Length игнорируется при chunked
+                }
+                body_len = body_received; // Начало тела пришло в этой же порции вслед за заголовками
+                body = space + received - body_len;
+                body_received = 0;
+                if (stale != NULL && status == 304) { // Сохраненный ответ не изменился - продлеваем его свежесть
+                    proxy_log("Cache entry is not modified");
+                    if (cache_refresh(cache, stale, entry, header, header_len) == ERROR) goto finish;
+                    metrics_add(METRIC_CACHE_REFRESHED, 1);
+                    failed = 0;
+                    reusable = keep_alive && body_len == 0;
+                    goto finish;
+                }
+                if (stale != NULL && entry == NULL && !http_check_response(status)) { // Ошибку сервера не показываем: клиенты получают устаревший ответ
+                    proxy_log("Response status %d on revalidation, keep stale entry", status);
+                    goto finish;
+                }
+                if (stale != NULL) { // Ответ изменился: загружаем его как обычно, начиная с уже принятых байт
+                    metrics_add(METRIC_CACHE_REPLACED, 1);
+                    if (entry == NULL) {
+                        char *request_copy = malloc(request_len);
+                        if (request_copy != NULL) memcpy(request_copy, request, request_len);
+                        entry = request_copy != NULL ? cache_entry_create(request_copy, request_len, NULL) : NULL;
+                        if (entry == NULL) {
+                            free(request_copy);
+                            goto finish;
+                        }
+                        if (cache_replace_entry(cache, stale, entry) == ERROR) goto finish;
+                    }
+                    pthread_mutex_lock(&entry->mutex);
+                    int added = message_add_part(&entry->response, header, header_len);
+                    pthread_mutex_unlock(&entry->mutex);
+                    if (added == ERROR) goto finish;
+                    cache_account(cache, entry, header_len);
+                }
+                // Если ответ не кэшируется - убираем из кэша, но клиенты, уже читающие элемент, получат ответ целиком
+                if (ctx->indexed && !http_check_response(status)) {
+                    proxy_log("Response status %d is not cacheable", status);
+                    cache_remove_entry(cache, entry);
+                } else if (ctx->indexed) {
+                    cache_set_vary(cache, entry, header, header_len); // Запоминаем, от каких заголовков запроса зависит ответ
+                    cache_set_freshness(cache, entry, header, header_len); // и сколько он остается свежим
+                }
+            }
+        }
+        body_received += body_len;
+        int complete = 0;
+        if (header_parsed && chunked) {
+            ssize_t parsed = http_chunked_parse(&chunks, body, body_len);
+            if (parsed == ERROR) goto finish;
+            complete = parsed != PARTIAL;
+            reusable = complete && keep_alive && (size_t) parsed == body_len;
+        } else if (header_parsed && content_length != HTTP_CONTENT_LENGTH_UNKNOWN && body_received >= content_length) {
+            complete = 1;
+            reusable = keep_alive && body_received == content_length;
+        }
+        if (header_parsed) { // Тело при проверке могло начаться в буфере заголовков, поэтому он живет до разбора порции
+            free(header);
+            header = NULL;
+        }
+        cache_entry_notify(entry); // Уведомление ждущих потоков о частичном ответе
+        if (complete) {
+            failed = 0;
+            entry->delimited = 1; // Клиенты могут не закрывать соединение после этого ответа
+            goto finish;
         }
     }
-    // Проверка, можно ли кэшировать ответ
-    if (!check_response(status)) goto destroy_entry;
-    if (check_request(method, method_len)) {
-        entry->finished = 1;
-        entry->response = response;
-        pthread_mutex_lock(&entry->mutex);
-        pthread_cond_broadcast(&entry->ready_cond);
-        pthread_mutex_unlock(&entry->mutex);
-        proxy_log("Set response to entry");
-    }
-    goto destroy_ctx;
-    destroy_entry:
-    if (check_request(method, method_len)) {
-        size_t deleted_request_len = entry->request_len;
-        char *deleted_request = entry->request;
-        pthread_mutex_lock(&entry->mutex);
-        entry->deleted = 1;
-        pthread_mutex_unlock(&entry->mutex);
-        pthread_cond_broadcast(&entry->ready_cond);
-        cache_delete(ctx->proxy->cache, deleted_request, deleted_request_len);
-    }
-    destroy_ctx:
-    close(ctx->client_socket);
+    finish:
+    if (entry != NULL) {
+        if (failed && ctx->indexed) cache_remove_entry(cache, entry); // Сначала из кэша, чтобы ожидающие повторили поиск и не нашли эту запись
+        if (failed) entry->failed = 1;
+        else entry->finished = 1;
+        cache_entry_notify(entry);
+        if (!failed && ctx->indexed) proxy_log("Set response to entry");
+    }
+    free(header);
+    free(upstream_request);
+    if (remote_socket != ERROR) {
+        if (!failed && reusable) upstream_put(ctx->proxy->upstreams, host, port, remote_socket); // Соединение готово для следующего запроса
+        else close(remote_socket);
+    }
+    if (stale != NULL) {
+        atomic_store(&stale->revalidating, 0); // Следующий устаревший ответ снова можно проверить
+        cache_entry_release(stale);
+    }
+    cache_entry_release(entry);
     free(ctx);
+    trace_span_end("fetch", fetch_start);
+    trace_request_end();
 }
 
 /**
  * @brief Устанавливает TCP соединение с удаленным сервером
- * @param host Имя хоста или IP-адрес целевого сервера
- * @param port Порт целевого сервера
+ * @param resolver Резолвер имен
+ * @param host     Имя хоста или IP-адрес целевого сервера
+ * @param port     Порт целевого сервера
  * @return Дескриптор установленного сокета или ERROR при ошибке
  * @details Алгоритм работы:
- *          1. Разрешение имени хоста в IP-адрес
+ *          1. Разрешение имени хоста в IP-адрес (из кэша резолвера или ожиданием
+ *             DNS-запроса, общего с другими потоками, ждущими то же имя)
  *          2. Создание TCP сокета
  *          3. Настройка структуры адреса сервера
  *          4. Установка соединения
  *          5. Возврат дескриптора готового сокета
  */
-static int connect_to_remote(const char *host, int port) {
-    struct hostent *h = gethostbyname(host); // Преобразуетт имя хоста в IP-адрес
-    if (h == NULL) {
-        proxy_log("Connect to remote error: %s", hstrerror(h_errno));
+static int connect_to_remote(dns_resolver_t *resolver, const char *host, int port) {
+    struct in_addr host_addr;
+    uint64_t span = trace_span_begin();
+    int resolved = dns_resolve_wait(resolver, host, &host_addr);
+    trace_span_end("resolve", span);
+    if (resolved == ERROR) { // Преобразует имя хоста в IP-адрес
+        proxy_log_error("Connect to remote error: host name lookup failure");
         return ERROR;
     }
     // Заполняет структуру sockaddr_in для connect()
@@ -664,21 +1453,243 @@ static int connect_to_remote(const char *host, int port) {
     memset(&addr, 0, sizeof(addr));
     addr.sin_port = htons(port);
     addr.sin_family = AF_INET;
-    memcpy(&addr.sin_addr, h->h_addr, h->h_length);
+    addr.sin_addr = host_addr;
     // Создает TCP сокет
     int remote_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (remote_socket == ERROR) {
-        proxy_log("Connect to remote error: %s", strerror(errno));
+        proxy_log_error("Connect to remote error: %s", strerror(errno));
+        return ERROR;
+    }
+    span = trace_span_begin();
+    int connected = connect(remote_socket, (struct sockaddr *) &addr, sizeof(struct sockaddr_in)); // Устанавливает соединение
+    trace_span_end("connect", span);
+    if (connected == ERROR) {
+        proxy_log_error("Connect to remote error: %s", strerror(errno));
+        close(remote_socket);
         return ERROR;
     }
-    if (connect(remote_socket, (struct sockaddr *) &addr, sizeof(struct sockaddr_in)) == ERROR) { // Устанавливает соединение
-        proxy_log("Connect to remote error: %s", strerror(errno));
+    return remote_socket;
+}
+
+/**
+ * @brief Подключается к серверу, указанному в заголовке Host запроса
+ * @param resolver  Резолвер имен
+ * @param host_port Значение заголовка Host (host[:port], без завершающего нуля)
+ * @param host_len  Длина значения
+ * @return Дескриптор установленного сокета или ERROR при ошибке
+ */
+static int connect_to_origin(dns_resolver_t *resolver, const char *host_port, size_t host_len) {
+    char host[BUFFER_SIZE];
+    int port;
+    if (get_origin_address(host_port, host_len, host, &port) == ERROR) return ERROR;
+    return connect_to_remote(resolver, host, port);
+}
+
+/**
+ * @brief Извлекает имя хоста и порт сервера из значения заголовка Host
+ * @param host_port Значение заголовка Host (host[:port], без завершающего нуля)
+ * @param host_len  Длина значения
+ * @param host      Буфер размера BUFFER_SIZE для сохранения имени хоста
+ * @param port      Указатель для сохранения порта
+ * @return SUCCESS или ERROR при ошибке
+ */
+static int get_origin_address(const char *host_port, size_t host_len, char *host, int *port) {
+    return http_get_host_port(host_port, host_len, host, BUFFER_SIZE, port);
+}
+
+/**
+ * @brief Открывает соединение с сервером и отправляет ему запрос
+ * @param proxy       Прокси (пул постоянных соединений)
+ * @param host        Имя хоста сервера
+ * @param port        Порт сервера
+ * @param request     Запрос к серверу
+ * @param request_len Длина запроса
+ * @param retry       1 если запрос можно повторить на новом соединении (идемпотентный метод)
+ * @return Дескриптор сокета, из которого читается ответ, или ERROR при ошибке
+ * @details Алгоритм работы:
+ *          1. Берет простаивающее соединение из пула и отправляет по нему запрос
+ *          2. Дожидается первого байта ответа: сервер мог закрыть соединение
+ *             одновременно с его выдачей из пула
+ *          3. Если соединения в пуле не было или сервер закрыл его, не ответив,
+ *             подключается заново (для неидемпотентного запроса - только если
+ *             соединения в пуле не было) и отправляет запрос
+ */
+static int open_upstream(proxy_t *proxy, const char *host, int port, const char *request, size_t request_len, int retry) {
+    int remote_socket = upstream_take(proxy->upstreams, host, port);
+    if (remote_socket != ERROR) {
+        if (send_full_data(remote_socket, request, request_len) != ERROR) {
+            if (wait_socket(remote_socket, 0) == ERROR) { // Сервер долго не отвечает - повтор не поможет
+                close(remote_socket);
+                return ERROR;
+            }
+            char byte;
+            if (recv(remote_socket, &byte, 1, MSG_PEEK) > 0) return remote_socket; // Сервер начал отвечать
+        }
+        close(remote_socket);
+        if (!retry) return ERROR;
+        proxy_log("Pooled connection to %s:%d was closed by remote, reconnect", host, port);
+    }
+    remote_socket = connect_to_remote(proxy->resolver, host, port); // Устанавливает TCP соединение с целевым сервером
+    if (remote_socket == ERROR) return ERROR;
+    if (send_full_data(remote_socket, request, request_len) == ERROR) { // Пересылка запроса серверу
         close(remote_socket);
         return ERROR;
     }
     return remote_socket;
 }
 
+#ifdef CACHE_PROXY_HAVE_SPLICE
+/**
+ * @brief Пересылает некэшируемый ответ клиенту, не копируя тело ответа в память процесса
+ * @param resolver      Резолвер имен
+ * @param client_socket Дескриптор клиентского сокета
+ * @param request       HTTP-запрос клиента
+ * @param request_len   Длина запроса
+ * @param delimited     Указатель для сохранения признака ответа, длина которого известна клиенту
+ *                      (Content-Length или ответ без тела)
+ * @return SUCCESS или ERROR при ошибке
+ * @details Алгоритм работы:
+ *          1. Подключается к серверу и пересылает ему запрос с "Connection: close":
+ *             тело неизвестной длины (в том числе chunked) заканчивается закрытием соединения
+ *          2. Читает ответ, пока заголовки не получены полностью, и отправляет прочитанное клиенту
+ *          3. Остаток тела (по Content-Length или до закрытия соединения сервером)
+ *             передает через канал splice() из сокета сервера в сокет клиента
+ */
+static int relay_uncacheable(dns_resolver_t *resolver, int client_socket, const char *request, size_t request_len, int *delimited) {
+    *delimited = 0;
+    const char *method, *host_port;
+    size_t method_len, host_len;
+    if (http_parse_request(request, request_len, &method, &method_len, &host_port, &host_len) == ERROR) return ERROR;
+    size_t upstream_request_len;
+    char *upstream_request = http_build_upstream_request(request, request_len, 0, &upstream_request_len);
+    if (upstream_request == NULL) return ERROR;
+    int remote_socket = connect_to_origin(resolver, host_port, host_len);
+    if (remote_socket == ERROR) {
+        free(upstream_request);
+        return ERROR;
+    }
+    int ret = ERROR;
+    char *header = NULL;
+    size_t header_len = 0;
+    size_t body_received = 0;
+    size_t content_length = HTTP_CONTENT_LENGTH_UNKNOWN;
+    int status = 0;
+    if (send_full_data(remote_socket, upstream_request, upstream_request_len) == ERROR) goto close_remote; // Пересылка запроса серверу
+    errno = 0;
+    header = malloc(MAX_HEADER_SIZE);
+    if (header == NULL) {
+        proxy_log_error("Relay error: %s", strerror(errno));
+        goto close_remote;
+    }
+    int parsed;
+    do { // Заголовки читаются в память процесса: по ним определяется длина тела
+        if (header_len == MAX_HEADER_SIZE) goto close_remote;
+        ssize_t received = receive_with_timeout(remote_socket, header + header_len, MAX_HEADER_SIZE - header_len);
+        if (received == ERROR) goto close_remote;
+        if (received == 0) {
+            proxy_log_error("Data receiving error: remote closed connection before end of response");
+            goto close_remote;
+        }
+        header_len += received;
+        parsed = http_parse_response(header, header_len, &status, &body_received, &content_length);
+        if (parsed == ERROR) goto close_remote;
+    } while (parsed == PARTIAL);
+    if (send_full_data(client_socket, header, header_len) == ERROR) goto close_remote; // Заголовки и уже прочитанное начало тела
+    *delimited = content_length != HTTP_CONTENT_LENGTH_UNKNOWN || !http_response_has_body(method, method_len, status);
+    if (!http_response_has_body(method, method_len, status)) ret = SUCCESS;
+    else if (content_length == HTTP_CONTENT_LENGTH_UNKNOWN) ret = splice_relay(remote_socket, client_socket, SPLICE_UNLIMITED);
+    else if (body_received < content_length) ret = splice_relay(remote_socket, client_socket, content_length - body_received);
+    else ret = SUCCESS;
+    close_remote:
+    free(upstream_request);
+    free(header);
+    close(remote_socket);
+    return ret;
+}
+
+/**
+ * @brief Передает данные из сокета в сокет через канал без копирования в память процесса
+ * @param in_fd  Дескриптор сокета-источника
+ * @param out_fd Дескриптор сокета-приемника
+ * @param limit  Сколько байт передать (SPLICE_UNLIMITED - до закрытия соединения источником)
+ * @return SUCCESS или ERROR при ошибке, таймауте или преждевременном закрытии соединения
+ * @details Алгоритм работы:
+ *          1. Создает канал (pipe), страницы которого splice() заполняет данными сокета
+ *          2. Ждет данных источника через poll() с таймаутом и переносит в канал до SPLICE_CHUNK байт
+ *          3. Переносит содержимое канала в приемник, дожидаясь его готовности к записи
+ *          4. Повторяет, пока не передано limit байт или источник не закрыл соединение
+ */
+static int splice_relay(int in_fd, int out_fd, size_t limit) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == ERROR) {
+        proxy_log_error("Relay error: %s", strerror(errno));
+        return ERROR;
+    }
+    int ret = SUCCESS;
+    while (limit > 0) {
+        if (wait_socket(in_fd, 0) == ERROR) {
+            ret = ERROR;
+            break;
+        }
+        size_t chunk = limit < SPLICE_CHUNK ? limit : SPLICE_CHUNK;
+        ssize_t in = splice(in_fd, NULL, pipe_fds[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in == ERROR) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            proxy_log_error("Relay error: %s", strerror(errno));
+            ret = ERROR;
+            break;
+        }
+        if (in == 0) { // Источник закрыл соединение
+            if (limit != SPLICE_UNLIMITED) {
+                proxy_log_error("Data receiving error: remote closed connection before end of response");
+                ret = ERROR;
+            }
+            break;
+        }
+        if (limit != SPLICE_UNLIMITED) limit -= in;
+        while (in > 0) { // Канал нужно опустошить целиком перед следующим чтением
+            if (wait_socket(out_fd, 1) == ERROR) {
+                ret = ERROR;
+                goto close_pipe;
+            }
+            ssize_t out = splice(pipe_fds[0], NULL, out_fd, NULL, in, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (out == ERROR) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                proxy_log_error("Relay error: %s", strerror(errno));
+                ret = ERROR;
+                goto close_pipe;
+            }
+            in -= out;
+        }
+    }
+    close_pipe:
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return ret;
+}
+#endif
+
+/**
+ * @brief Ждет готовности сокета к чтению или записи
+ * @param fd    Дескриптор сокета
+ * @param write 1 для ожидания записи, 0 для ожидания чтения
+ * @return SUCCESS или ERROR при ошибке/таймауте
+ * @note poll() не ограничен FD_SETSIZE: номер сокета сервера может превышать 1023
+ */
+static int wait_socket(int fd, int write) {
+    struct pollfd pfd = {.fd = fd, .events = write ? POLLOUT : POLLIN};
+    int ready = poll(&pfd, 1, READ_WRITE_TIMEOUT_MS);
+    if (ready == -1) {
+        if (errno != EINTR) proxy_log_error("Socket waiting error: %s", strerror(errno));
+        return ERROR;
+    }
+    if (ready == 0) {
+        proxy_log_error("Socket waiting error: timeout");
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
 /**
  * @brief Принимает данные из сокета с таймаутом
  * @param fd Дескриптор сокета для чтения
@@ -686,33 +1697,27 @@ static int connect_to_remote(const char *host, int port) {
  * @param buf_len Максимальный размер буфера
  * @return Количество принятых байт, 0 при закрытии соединения, ERROR при ошибке/таймауте
  * @details Алгоритм работы:
- *          1. Использует select() для ожидания доступности данных с таймаутом
+ *          1. Использует poll() для ожидания доступности данных с таймаутом
  *          2. Если данные доступны, вызывает recv() для их чтения
  *          3. Обрабатывает различные сценарии: данные, таймаут, ошибки, закрытие соединения
  */
 static ssize_t receive_with_timeout(int fd, char *buf, size_t buf_len) {
-    // Подготавливает набор дескрипторов для мониторинга
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(fd, &read_fds);
-    // Настройка таймаута для select()
-    struct timeval timeout;
-    timeout.tv_sec  = READ_WRITE_TIMEOUT_MS / 1000;
-    timeout.tv_usec = (READ_WRITE_TIMEOUT_MS % 1000) * 1000;
-    int ready = select(fd + 1, &read_fds, NULL, NULL, &timeout); // Ждет, пока в сокете не появятся данные для чтения
+    // poll(), а не select(): номер сокета может превышать FD_SETSIZE, когда соединений больше тысячи
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, READ_WRITE_TIMEOUT_MS); // Ждет, пока в сокете не появятся данные для чтения
     if (ready == -1) {
         if (errno != EINTR) {
-            proxy_log("Data receiving error: %s", strerror(errno));
+            proxy_log_error("Data receiving error: %s", strerror(errno));
         }
         return ERROR;
     }
     if (ready == 0) {
-        proxy_log("Data receiving error: timeout");
+        proxy_log_error("Data receiving error: timeout");
         return ERROR;
     }
     ssize_t received_bytes = recv(fd, buf, buf_len, 0); // Чтение данных из сокета
     if (received_bytes < 0) {
-        proxy_log("Data receiving error: %s", strerror(errno));
+        proxy_log_error("Data receiving error: %s", strerror(errno));
         return ERROR;
     }
     return received_bytes;
@@ -725,75 +1730,29 @@ static ssize_t receive_with_timeout(int fd, char *buf, size_t buf_len) {
  * @param data_len Длина данных для отправки
  * @return Количество отправленных байт или ERROR при ошибке/таймауте
  * @details Алгоритм работы:
- *          1. Использует select() для ожидания готовности сокета к записи
+ *          1. Использует poll() для ожидания готовности сокета к записи
  *          2. Если сокет готов, вызывает send() для отправки данных
  *          3. Обрабатывает таймауты, ошибки и прерывания
  */
 static ssize_t send_with_timeout(int fd, const char *data, size_t data_len) {
-    // Подготавливает набор дескрипторов для мониторинга возможности записи
-    fd_set write_fds;
-    FD_ZERO(&write_fds);
-    FD_SET(fd, &write_fds);
-    // Настройка таймаута
-    struct timeval timeout;
-    timeout.tv_sec = READ_WRITE_TIMEOUT_MS / 1000;
-    timeout.tv_usec = (READ_WRITE_TIMEOUT_MS % 1000) * 1000;
-    int ready = select(fd + 1, NULL, &write_fds, NULL, &timeout); // Ждет, пока сокет не будет готов для операции отправки
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    int ready = poll(&pfd, 1, READ_WRITE_TIMEOUT_MS); // Ждет, пока сокет не будет готов для операции отправки
     if (ready == -1) {
-        if (errno != EINTR) proxy_log("Data sending error: %s", strerror(errno));
+        if (errno != EINTR) proxy_log_error("Data sending error: %s", strerror(errno));
         return ERROR;
     } else if (ready == 0) {
-        proxy_log("Data sending error: timeout");
+        proxy_log_error("Data sending error: timeout");
         return ERROR;
     }
     ssize_t sent_bytes = send(fd, data, data_len, 0); // Пытается отправить все данные за один вызов
     if (sent_bytes == ERROR) {
-        proxy_log("Data sending error: %s", strerror(errno));
+        proxy_log_error("Data sending error: %s", strerror(errno));
         return ERROR;
     }
-    proxy_log("Sent: %s", data);
+    proxy_log_debug("Sent %zd bytes", sent_bytes); // Данные могут быть бинарными и не оканчиваться нулем
     return sent_bytes;
 }
 
-/**
- * @brief Полностью читает все данные из сокета до закрытия соединения или ошибки
- * @param fd Дескриптор сокета для чтения
- * @param data Указатель на буфер, который будет выделен для хранения всех данных
- * @return Общее количество прочитанных байт или ERROR при ошибке
- * @details Алгоритм работы:
- *          1. Инициализирует пустой буфер
- *          2. В цикле читает данные порциями через receive_with_timeout()
- *          3. Перевыделяет буфер для добавления новых данных
- *          4. Копирует полученные данные в буфер
- *          5. Прекращает чтение при закрытии соединения, ошибке или неполном чтении
- * @note Динамически увеличивает буфер по мере чтения данных
- * @note Использует временный буфер фиксированного размера BUFFER_SIZE
- */
-static ssize_t receive_full_data(int fd, char **data) {
-    *data = NULL;
-    ssize_t all_received_bytes = 0; // Инициализация счетчика прочитанных байт
-    char buf[BUFFER_SIZE + 1]; // Объявление временного буфера
-    while (1) {
-        memset(buf, 0, BUFFER_SIZE);
-        ssize_t received_bytes = receive_with_timeout(fd, buf, BUFFER_SIZE); // Читает до BUFFER_SIZE байт из сокета с таймаутом
-        if (received_bytes == ERROR) return ERROR;
-        if (received_bytes == 0) break;
-        all_received_bytes += received_bytes;
-        char *temp = realloc(*data, all_received_bytes + 1); // Перевыделение основного буфера
-        if (temp == NULL) {
-            if (errno == ENOMEM) proxy_log("Data receiving error: %s", strerror(errno));
-            else proxy_log("Data receiving error: failed to reallocate memory");
-            free(*data);
-            *data = NULL;
-            return ERROR;
-        }
-        *data = temp;
-        strncpy(*data + all_received_bytes - received_bytes, buf, received_bytes); // Копирование данных из временного буфера в основной
-        if (received_bytes < BUFFER_SIZE) break;
-    }
-    return all_received_bytes;
-}
-
 /**
  * @brief Гарантированно отправляет все данные через сокет с поддержкой таймаутов
  * @param fd Дескриптор сокета для отправки данных
@@ -818,358 +1777,107 @@ static ssize_t send_full_data(int fd, const char *data, size_t data_len) {
     return all_sent_bytes;
 }
 
-/**
- * @brief Принимает данные из одного сокета и одновременно отправляет в другой
- * @param ifd Входной файловый дескриптор (input fd) - откуда читать данные
- * @param ofd Выходной файловый дескриптор (output fd) - куда отправлять данные
- * @param data Указатель на буфер для сохранения принятых данных
- * @return Общее количество прочитанных и пересланных байт или ERROR при ошибке
- * @details Алгоритм работы:
- *          1. Читает порцию данных из ifd с помощью receive_with_timeout()
- *          2. Немедленно отправляет эту порцию в ofd с помощью send_with_timeout()
- *          3. Сохраняет данные в буфер *data (если не NULL) для последующей обработки
- *          4. Повторяет до закрытия соединения или ошибки
- * @note Одновременно выполняет чтение, отправку и сохранение данных
- */
-static ssize_t receive_and_send_data(int ifd, int ofd, char **data) {
-    char buf[BUFFER_SIZE + 1]; // Временный буфер для чтения порций данных
-    ssize_t all_received_bytes = 0; // Счетчик всех принятых байт
-    // Запускает цикл чтения-отправки данных до ошибки, либо закрытия входного соединения, либо частичного чтения
-    while (1) {
-        memset(buf, 0, BUFFER_SIZE);
-        ssize_t received_bytes = receive_with_timeout(ifd, buf, BUFFER_SIZE); // Чтение порции данных из входного сокета
-        if (received_bytes == ERROR) return ERROR;
-        if (received_bytes == 0) break;
-        ssize_t sent_bytes = send_with_timeout(ofd, buf, received_bytes); // Отправка прочитанных данных в выходной сокет
-        if (sent_bytes == ERROR) return ERROR;
-        all_received_bytes += received_bytes;
-        char *temp = realloc(*data, all_received_bytes); // Расширяет буфер *data для сохранения прочитанных данных
-        if (temp == NULL) {
-            if (errno == ENOMEM) proxy_log("Data receiving error: %s", strerror(errno));
-            else proxy_log("Data receiving error: failed to reallocate memory");
-            free(*data);
-            *data = NULL;
-            return ERROR;
-        }
-        *data = temp;
-        strncpy(*data + all_received_bytes - received_bytes, buf, received_bytes); // Копирование данных из временного буфера в основной
-        if (received_bytes < BUFFER_SIZE) break;
-    }
-    return all_received_bytes;
-}
-
-/**
- * @brief Принимает, отправляет и собирает структурированное сообщение
- * @param ifd Входной файловый дескриптор (input fd) - откуда читать данные
- * @param ofd Выходной файловый дескриптор (output fd) - куда отправлять данные
- * @param message Указатель на указатель структуры message_t для сборки сообщения
- * @return Общее количество отправленных байт или ERROR при ошибке
- * @details Алгоритм работы:
- *          1. Читает порцию данных из ifd через receive_with_timeout()
- *          2. Немедленно отправляет порцию в ofd через send_with_timeout()
- *          3. Добавляет порцию в структурированное сообщение через message_add_part()
- *          4. Повторяет до закрытия соединения, ошибки или неполного чтения
- */
-static ssize_t receive_and_send_message(int ifd, int ofd, message_t **message) {
-    char buf[BUFFER_SIZE + 1];
-    ssize_t all_sent_bytes = 0;
-    while (1) {
-        memset(buf, 0, BUFFER_SIZE);
-        ssize_t received_bytes = receive_with_timeout(ifd, buf, BUFFER_SIZE);
-        if (received_bytes == ERROR) return ERROR;
-        if (received_bytes == 0) break;
-        ssize_t sent_bytes = send_with_timeout(ofd, buf, received_bytes);
-        if (sent_bytes == ERROR) return ERROR;
-        if (message_add_part(message, buf, received_bytes) == ERROR) return ERROR;
-        all_sent_bytes += sent_bytes;
-        if (received_bytes < BUFFER_SIZE) break;
-    }
-    return all_sent_bytes;
-}
-
 /**
  * @brief Отправляет кэшированные данные клиенту с поддержкой потоковой загрузки
  * @param entry Указатель на запись в кэше, содержащую данные для отправки
  * @param client_socket Дескриптор клиентского сокета для отправки данных
+ * @param metrics Измерение запроса, в котором учитываются отправленные байты
  * @return Общее количество отправленных байт или ERROR при ошибке
  * @details Алгоритм работы:
  *          1. Блокирует мьютекс записи в кэше для безопасного доступа
- *          2. Проходит по цепочке message_t в entry->response
- *          3. Для каждой части сообщения:
- *             а) Отправляет данные клиенту через send_full_data()
- *             б) Обновляет счетчик отправленных байт
+ *          2. Запоминает флаги завершения (до чтения размера ответа, чтобы не потерять хвост)
+ *          3. Пока в entry->response есть неотправленные данные:
+ *             а) Отправляет их клиенту через send_full_data() без блокировки
+ *             б) Сдвигает позицию читателя и обновляет счетчик отправленных байт
  *          4. Если данные еще не полностью загружены в кэш, ожидает на condition variable
  *          5. Просыпается при добавлении новых данных или завершении загрузки
  *          6. Продолжает отправку, пока все данные не будут отправлены
  */
-static ssize_t stream_cache_to_client(cache_entry_t *entry, int client_socket) {
+static ssize_t stream_cache_to_client(cache_entry_t *entry, int client_socket, metrics_request_t *metrics) {
     if (entry == NULL) return ERROR;
     ssize_t total_sent = 0; // Общее количество отправленных байт
+    message_reader_t reader = {0}; // Позиция отправки в ответе
     pthread_mutex_lock(&entry->mutex); // Блокировка мьютекса
-    message_t *curr = entry->response; // Текущая часть сообщения
-    message_t *last_sent = NULL; // Последняя отправленная часть
-    // Запускает бесконечный цикл отправки данных до тех пор, пока не возникнет ошибка, либо все данные не отправятся, либо удаление записи кэша
+    // Запускает бесконечный цикл отправки данных до тех пор, пока не возникнет ошибка, либо все данные не отправятся, либо загрузка не прервется
     while (1) {
-        while (curr != NULL) {
-            message_t *to_send = curr; // Сохранение указателя на текущую часть
+        int done = entry->failed || entry->finished; // Проверка завершения или прерывания загрузки
+        size_t len;
+        const char *data = message_peek(entry->response, &reader, &len);
+        if (data != NULL) {
             pthread_mutex_unlock(&entry->mutex);
-            ssize_t sent = send_full_data(client_socket, to_send->part, to_send->part_len); // Отправляет часть сообщения клиенту с гарантией полной отправки.
+            uint64_t span = trace_span_begin();
+            ssize_t sent = send_full_data(client_socket, data, len); // Отправляет данные клиенту с гарантией полной отправки.
+            trace_span_end("send", span);
             if (sent == ERROR) {
                 return ERROR;
             }
+            message_consume(&reader, len);
             total_sent += sent;
+            metrics_request_sent(metrics, (size_t) sent);
             pthread_mutex_lock(&entry->mutex);
-            last_sent = to_send; // Запоминает, какую часть только что отправили
-            curr = curr->next; // Переход к следующей части
+            continue;
         }
-        if (entry->deleted || entry->finished) { // Проверка завершения или удаления записи
+        if (done) {
             pthread_mutex_unlock(&entry->mutex);
             break;
         }
+        uint64_t span = trace_span_begin();
         pthread_cond_wait(&entry->ready_cond, &entry->mutex); // Блокирует текущий поток в ожидании новых данных
-        if (last_sent == NULL) { // еще ничего не отправляли, начинаем с начала
-            curr = entry->response;
-        } else {
-            curr = last_sent->next; //  продолжаем со следующей части после последней отправленной
-        }
+        trace_span_end("wait_data", span);
     }
     return total_sent;
 }
 
 /**
- * @brief Извлекает хост и порт из строки URL или адреса сервера
- * @param host_port Входная строка (URL или "host:port")
- * @param host Буфер для сохранения имени хоста
- * @param port Указатель на переменную для сохранения номера порта
- * @return 0 при успехе, ERROR (-1) при ошибке парсинга
+ * @brief Ожидает готовности найденной в кэше записи
+ * @param entry Захваченная запись кэша
+ * @return SUCCESS если данные появились, ERROR если загрузка прервана
  * @details Алгоритм работы:
- *          1. Компилирует регулярное выражение для парсинга URL
- *          2. Выполняет сопоставление регулярного выражения со входной строкой
- *          3. Извлекает хост из соответствующей группы
- *          4. Извлекает порт, если указан, иначе использует порт по умолчанию
- *          5. Определяет порт по умолчанию на основе схемы (http/https)
- *          6. Освобождает ресурсы регулярного выражения
- */
-static int get_host_port(const char *host_port, char *host, int *port) {
-    regex_t regex = {}; // Регулярное выражение
-    char *pattern = "^(http|https)?(://)?([^:/]+)(:([0-9]+))?"; // Паттерн для регулярного выражения
-    regmatch_t match[6] = {}; // Массив для хранения результатов сопоставления
-    int ret = regcomp(&regex, pattern, REG_EXTENDED); // Компилирует регулярное выражение с указанным паттерном
-    if (ret != 0) {
-        proxy_log("Host and port getting error: failed to regex pattern compilation");
-        return ERROR;
-    }
-    ret = regexec(&regex, host_port, 6, match, 0); // Выполняет сопоставление регулярного выражения со входной строкой
-    if (ret == 0) {
-        int host_start = match[3].rm_so; // Извлекает хост из соответствующей группы
-        int host_end = match[3].rm_eo;
-        strncpy(host, &host_port[host_start], host_end - host_start); // Копирует хост в буфер
-        host[host_end - host_start] = '\0';
-        int port_start = match[5].rm_so; // Извлекает порт
-        int port_end = match[5].rm_eo;
-        if (port_start != -1 && port_end != -1) {
-            char port_str[port_end - port_start + 1]; // Копирует порт в буфер
-            strncpy(port_str, &host_port[port_start], port_end - port_start);
-            errno = 0;
-            char *end;
-            *port = (int) strtol(port_str, &end, 0); // Преобразует строку в целое число
-            if (errno != 0) {
-                proxy_log("Host and port getting error: %s", strerror(errno));
-                return ERROR;
-            }
-            if (end == port_str) {
-                proxy_log("Host and port getting error: no digits were found");
-                return ERROR;
-            }
-        } else {
-            *port = (match[1].rm_so != -1 &&
-                     match[1].rm_eo != -1 &&
-                     strncmp("https", &host_port[match[1].rm_so], match[1].rm_eo - match[1].rm_so) == 0) ? 443 : 80; // Определяет порт по умолчанию
-        }
-    } else if (ret == REG_NOMATCH) { // Если регулярное выражение не сопоставлено
-        proxy_log("Host and port gett   ing error: no host or/and port");
-        return ERROR;
-    } else {
-        char buf[BUFFER_SIZE];
-        regerror(ret, &regex, buf, BUFFER_SIZE);
-        proxy_log("Host and port getting error: %s", buf);
-        return ERROR;
-    }
-    regfree(&regex);
-    return 0;
-}
-
-/**
- * @brief Парсит HTTP-запрос и извлекает метод и заголовок Host
- * @param request Строка с HTTP-запросом
- * @param request_len Длина строки запроса
- * @param method Указатель для сохранения указателя на метод в request
- * @param method_len Указатель для сохранения длины метода
- * @param host Указатель для сохранения указателя на значение Host в request
- * @param host_len Указатель для сохранения длины значения Host
- * @return SUCCESS (0) при успехе, ERROR (-1) при ошибке
- * @details Алгоритм работы:
- *          1. Использует библиотеку PicoHTTPParser для парсинга HTTP-запроса
- *          2. Извлекает метод HTTP (GET, POST, CONNECT и т.д.)
- *          3. Ищет заголовок Host в списке заголовков
- *          4. Сохраняет указатели на метод и Host в исходном буфере
+ *          1. Блокирует мьютекс записи: загрузчик создает entry->response под этим же мьютексом
+ *          2. Если ответа еще нет, ожидает на condition variable, пока данные не появятся
+ *             или загрузка не прервется
+ *          3. Проверяет, появились ли данные, и разблокирует мьютекс
+ * @note Реализует паттерн "ожидание готовности данных" для конкурентного доступа
+ * @note Позволяет нескольким клиентам ждать одну и ту же загружаемую запись
+ * @note Ссылку на запись освобождает вызывающая сторона
  */
-static int parse_request(const char *request, size_t request_len, const char **method, size_t *method_len, const char **host, size_t *host_len) {
-    char *path; // Указатель на путь
-    struct phr_header headers[100]; // Массив заголовков
-    size_t path_len, num_headers = 100; // Длина пути и количество заголовков
-    int minor_version; // Минорная версия HTTP
-    // Разбирает HTTP-запрос и заполняет выходные параметры
-    int pret = phr_parse_request(request, request_len, method, method_len, (const char **) &path,
-                                 &path_len, &minor_version, headers, &num_headers, 0);
-    if (pret == -2) { // Обработка неполного запроса
-        proxy_log("Request parsing error: request is partial");
-        return ERROR;
-    }
-    if (pret == -1) { // Если запрос некорректен
-        proxy_log("Request parsing error: failed");
-        return ERROR;
-    }
-    for (int i = 0; i < 100; ++i) { // Ищет заголовок Host в массиве заголовков и сохраняет его значение
-        if (strncmp(headers[i].name, "Host", 4) == 0) {
-            *host = headers[i].value;
-            *host_len = headers[i].value_len;
-            break;
-        }
-    }
-    if (host == NULL) {
-        proxy_log("Request parsing error: host header not found");
-        return ERROR;
-    }
-    return SUCCESS;
+static int wait_cache_entry(cache_entry_t *entry) {
+    pthread_mutex_lock(&entry->mutex);
+    while (entry->response == NULL && !entry->failed) pthread_cond_wait(&entry->ready_cond, &entry->mutex); // Ждет, пока данные не появятся или загрузка не прервется
+    int ret = entry->response != NULL ? SUCCESS : ERROR; // Уже полученную часть прерванного ответа отдает stream_cache_to_client
+    pthread_mutex_unlock(&entry->mutex);
+    return ret;
 }
 
 /**
- * @brief Парсит HTTP-ответ и извлекает статус, длину контента и позицию заголовка Content-Length
- * @param response Строка с HTTP-ответом
- * @param response_len Длина строки ответа
- * @param status Указатель для сохранения HTTP статус-кода (200, 404, 500 и т.д.)
- * @param content_len Указатель для сохранения фактической длины тела ответа
- * @param content_length_header Указатель для сохранения значения заголовка Content-Length
- * @return SUCCESS (0) при успехе, ERROR (-1) при ошибке
- * @details Алгоритм работы:
- *          1. Использует PicoHTTPParser для парсинга HTTP-ответа
- *          2. Извлекает HTTP статус-код
- *          3. Ищет заголовок Content-Length и парсит его значение
- *          4. Вычисляет фактическую длину тела ответа
- *          5. Проверяет корректность формата ответа
+ * @brief Дописывает к метрикам сервера администрирования состояние прокси
+ * @param out Поток вывода
+ * @param arg Указатель на proxy_t
+ * @details Выводит длину очередей пулов потоков (пул обработчиков - в режиме PROXY_IO_THREADS),
+ *          счетчики пула соединений с серверами и счетчики резолвера.
  */
-static int parse_response(const char *response, size_t response_len, int *status, size_t *content_len, size_t *content_length_header) {
-    const char *msg = NULL; // Сообщение cтатуса (например, "OK" для 200)
-    struct phr_header headers[100]; // Массив заголовков
-    size_t msg_len = 0; // Длина сообщения
-    size_t num_headers = 100; // Количество заголовков
-    int minor_version = 0; // Минорная версия HTTP
-    // Парсинг HTTP-ответа
-    int pret = phr_parse_response(response, response_len, &minor_version, status, &msg, &msg_len, headers,
-                                  &num_headers, 0);
-    if (pret == -2) { // Обработка неполного ответа
-        proxy_log("Response parsing error: response is partial");
-        return ERROR;
-    }
-    if (pret == -1) { //. Обработка ошибки парсинга
-        proxy_log("Response parsing error: failed");
-        return ERROR;
-    }
-    int content_length_idx = -1;
-    // Поиск заголовка Content-Length
-    for (int i = 0; i < 100; ++i) {
-        if (strncmp(headers[i].name, "Content-Length", 14) == 0) {
-            content_length_idx = i;
-            break;
-        }
-    }
-    if (content_length_idx == -1) {
-        proxy_log("Response parsing error: Content-Length header not found");
-        return ERROR;
-    }
-    errno = 0;
-    // Создание временной строки для Content-Length
-    char content_length_value[headers[content_length_idx].value_len + 1];
-    // Копирует значение Content-Length во временный буфер
-    strncpy(content_length_value, headers[content_length_idx].value, headers[content_length_idx].value_len);
-    char *end = NULL;
-    long temp = strtol(content_length_value, &end, 0); // Преобразует строку Content-Length в число
-    *content_length_header = (int) strtol(content_length_value, &end, 0);
-    if (errno != 0) {
-        proxy_log("Response parsing error: %s", strerror(errno));
-        return ERROR;
-    }
-    if (end == content_length_value) {
-        proxy_log("Response parsing error: no digits were found");
-        return ERROR;
+static void write_proxy_metrics(FILE *out, void *arg) {
+    proxy_t *proxy = (proxy_t *) arg;
+    metrics_write_header(out, "cache_proxy_thread_pool_queue_depth", "gauge", "Tasks waiting for a free thread.");
+    if (proxy->handlers != NULL) {
+        metrics_write_sample(out, "cache_proxy_thread_pool_queue_depth", "pool=\"handlers\"", thread_pool_pending(proxy->handlers));
     }
-    *content_length_header = (size_t)temp; // Сохранение значения Content-Length
-    // Ищет последовательность "\r\n\r\n", разделяющую заголовки и тело
-    char *before_content = strstr(response, "\r\n\r\n");
-    if (before_content == NULL) {
-        proxy_log("Response parsing error: no newlines before content");
-        return ERROR;
-    }
-    *content_len = response_len - (before_content + 4 - response); // Вычисление фактической длины тела
-    return SUCCESS;
-}
-
-/**
- * @brief Проверяет, является ли HTTP-запрос кэшируемым
- * @param method Указатель на строку с HTTP-методом
- * @param method_len Длина строки метода
- * @return 1 (true) если метод кэшируемый, 0 (false) если нет
- * @details В текущей реализации кэшируются только GET-запросы.
- */
-static int check_request(const char *method, size_t method_len) {
-    return strncmp(method, "GET", method_len) == 0; // Сравнивает строку метода с константой "GET"
-}
-
-/**
- * @brief Проверяет, является ли HTTP-ответ кэшируемым на основе статус-кода
- * @param status HTTP статус-код ответа (200, 404, 500 и т.д.)
- * @return 1 (true) если ответ можно кэшировать, 0 (false) если нет
- * @details В текущей реализации кэшируются все ответы со статусом < 400.
- * @note Кэшируются успешные ответы (2xx) и перенаправления (3xx)
- * @note Не кэшируются клиентские (4xx) и серверные (5xx) ошибки
- */
-static int check_response(int status) {
-    return status < 400;
-}
-
-/**
- * @brief Находит запись в кэше и ожидает её готовности если необходимо
- * @param cache Указатель на структуру кэша
- * @param request Строка HTTP-запроса для поиска
- * @param request_len Длина строки запроса
- * @return Указатель на найденную запись кэша или NULL если не найдено/удалено
- * @details Алгоритм работы:
- *          1. Ищет запись в кэше по запросу с помощью cache_get()
- *          2. Если запись найдена, но ответ еще не готов (entry->response == NULL):
- *             а) Блокирует мьютекс записи
- *             б) Ожидает на condition variable, пока данные не появятся или запись не удалят
- *             в) Проверяет, не была ли запись удалена во время ожидания
- *             г) Разблокирует мьютекс
- *          3. Возвращает найденную запись или NULL
- * @note Реализует паттерн "ожидание готовности данных" для конкурентного доступа
- * @note Позволяет нескольким клиентам ждать одну и ту же загружаемую запись
- * @note Обрабатывает случай удаления записи во время ожидания
- * @note Гарантирует потокобезопасный доступ к записи кэша
- */
-static cache_entry_t *find_cache_entry(cache_t *cache, const char *request, size_t request_len) {
-    cache_entry_t *entry = cache_get(cache, request, request_len); // Ищет запись кэша, соответствующую данному HTTP-запросу
-    if (entry == NULL) return NULL;
-    if (entry->response == NULL) { // Проверяет, готовы ли данные в найденной записи
-        // entry->response != NULL: данные готовы (cache hit) → можно сразу использовать
-        // entry->response == NULL: данные еще загружаются → нужно подождать
-        pthread_mutex_lock(&entry->mutex);
-        while (entry->response == NULL && !entry->deleted) pthread_cond_wait(&entry->ready_cond, &entry->mutex); // Ждет, пока данные не появятся или запись не будет удалена
-        if (entry->deleted) {
-            pthread_mutex_unlock(&entry->mutex);
-            return NULL;
-        }
-        pthread_mutex_unlock(&entry->mutex);
+    metrics_write_sample(out, "cache_proxy_thread_pool_queue_depth", "pool=\"fetchers\"", thread_pool_pending(proxy->fetchers));
+    if (proxy->upstreams != NULL) {
+        upstream_stats_t stats;
+        upstream_get_stats(proxy->upstreams, &stats);
+        metrics_write_header(out, "cache_proxy_upstream_connections_total", "counter", "Origin connections taken from the pool (reused) or opened anew.");
+        metrics_write_sample(out, "cache_proxy_upstream_connections_total", "result=\"reused\"", (double) stats.hits);
+        metrics_write_sample(out, "cache_proxy_upstream_connections_total", "result=\"new\"", (double) stats.misses);
+        metrics_write_header(out, "cache_proxy_upstream_idle_connections", "gauge", "Idle origin connections kept in the pool.");
+        metrics_write_sample(out, "cache_proxy_upstream_idle_connections", NULL, (double) stats.idle);
     }
-    return entry;
+    dns_stats_t dns_stats;
+    dns_get_stats(proxy->resolver, &dns_stats);
+    metrics_write_header(out, "cache_proxy_dns_lookups_total", "counter", "Host name lookups by result.");
+    metrics_write_sample(out, "cache_proxy_dns_lookups_total", "result=\"hit\"", (double) dns_stats.hits);
+    metrics_write_sample(out, "cache_proxy_dns_lookups_total", "result=\"miss\"", (double) dns_stats.misses);
+    metrics_write_sample(out, "cache_proxy_dns_lookups_total", "result=\"coalesced\"", (double) dns_stats.coalesced);
+    metrics_write_header(out, "cache_proxy_dns_failures_total", "counter", "DNS queries that failed.");
+    metrics_write_sample(out, "cache_proxy_dns_failures_total", NULL, (double) dns_stats.failures);
 }
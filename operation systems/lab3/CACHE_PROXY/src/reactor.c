@@ -0,0 +1,1074 @@
+#include "reactor.h"
+
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "http.h"
+#include "log.h"
+#include "metrics.h"
+
+#define REACTOR_BUFFER_SIZE     16384
+#define MAX_EVENTS              256
+#define MAX_REQUEST_SIZE        (64 * 1024)
+#define MAX_HOST_SIZE           1024
+#define LOOP_TICK_MS            1000
+#define READ_WRITE_TIMEOUT_MS   60000
+
+/**
+ * @brief Тип объекта, зарегистрированного в epoll
+ */
+typedef enum {
+    HANDLE_EVENT,   // eventfd цикла (новые соединения и оповещения от кэша)
+    HANDLE_CLIENT,  // клиентское соединение
+    HANDLE_ORIGIN   // соединение с целевым сервером
+} handle_type_t;
+
+/**
+ * @brief Дескриптор, зарегистрированный в epoll
+ * @details В edge-triggered режиме событие приходит только при смене состояния,
+ *          поэтому готовность к чтению/записи запоминается до получения EAGAIN.
+ * @var type     Тип владельца
+ * @var fd       Файловый дескриптор
+ * @var readable Можно читать (до EAGAIN)
+ * @var writable Можно писать (до EAGAIN)
+ * @var owner    Владелец (reactor_loop_t, client_conn_t или origin_conn_t)
+ */
+typedef struct {
+    handle_type_t type;
+    int fd;
+    int readable;
+    int writable;
+    void *owner;
+} reactor_handle_t;
+
+/**
+ * @brief Состояние клиентского соединения
+ */
+typedef enum {
+    CLIENT_READ_REQUEST,    // накопление HTTP-запроса
+    CLIENT_STREAM           // отдача данных элемента кэша
+} client_state_t;
+
+/**
+ * @brief Состояние соединения с целевым сервером
+ */
+typedef enum {
+    ORIGIN_RESOLVING,       // ожидание ответа резолвера имен
+    ORIGIN_CONNECTING,      // ожидание завершения неблокирующего connect
+    ORIGIN_SEND_REQUEST,    // отправка запроса
+    ORIGIN_RECEIVE          // прием ответа в элемент кэша
+} origin_state_t;
+
+struct reactor_loop_t;
+typedef struct reactor_loop_t reactor_loop_t;
+
+/**
+ * @brief Клиентское соединение
+ * @var handle         Дескриптор в epoll
+ * @var loop           Цикл, которому принадлежит соединение
+ * @var state          Текущее состояние автомата
+ * @var request        Буфер запроса (после разбора передается элементу кэша)
+ * @var request_len    Количество байт в буфере
+ * @var request_cap    Размер буфера
+ * @var entry          Элемент кэша, из которого отдаются данные (захвачен)
+ * @var reader         Позиция отдачи в ответе элемента
+ * @var subscriber     Подписка на новые данные элемента
+ * @var subscribed     Подписка активна
+ * @var pending        Соединение стоит в очереди оповещений цикла
+ * @var last_activity  Время последней активности (мс, монотонные часы)
+ * @var metrics        Измерение текущего запроса
+ */
+typedef struct client_conn_t {
+    reactor_handle_t handle;
+    reactor_loop_t *loop;
+    client_state_t state;
+    char *request;
+    size_t request_len;
+    size_t request_cap;
+    cache_entry_t *entry;
+    message_reader_t reader;
+    cache_entry_subscriber_t subscriber;
+    int subscribed;
+    int pending;
+    struct client_conn_t *pending_prev;
+    struct client_conn_t *pending_next;
+    long long last_activity;
+    metrics_request_t metrics;
+    struct client_conn_t *prev;
+    struct client_conn_t *next;
+} client_conn_t;
+
+/**
+ * @brief Соединение с целевым сервером, заполняющее элемент кэша
+ * @details Загрузка не зависит от клиента, который ее инициировал:
+ *          если он отключится, остальные клиенты получат ответ целиком.
+ * @var handle          Дескриптор в epoll (ERROR, пока имя сервера не разрешено)
+ * @var loop            Цикл, которому принадлежит соединение
+ * @var state           Текущее состояние автомата
+ * @var entry           Заполняемый элемент кэша (захвачен)
+ * @var indexed         Элемент добавлен в кэш (иначе - частный буфер для некэшируемого запроса)
+ * @var port            Порт сервера
+ * @var query           Запрос к резолверу имен
+ * @var resolved        Соединение стоит в очереди разрешенных имен цикла
+ * @var method          Метод запроса (указывает в запрос элемента)
+ * @var method_len      Длина метода
+ * @var request         Запрос к серверу (с "Connection: close")
+ * @var request_len     Длина запроса к серверу
+ * @var sent            Количество отправленных байт запроса
+ * @var framing         Поиск конца ответа
+ * @var last_activity   Время последней активности (мс, монотонные часы)
+ */
+typedef struct origin_conn_t {
+    reactor_handle_t handle;
+    reactor_loop_t *loop;
+    origin_state_t state;
+    cache_entry_t *entry;
+    int indexed;
+    int port;
+    dns_query_t query;
+    int resolved;
+    struct origin_conn_t *resolved_next;
+    const char *method;
+    size_t method_len;
+    char *request;
+    size_t request_len;
+    size_t sent;
+    http_response_framing_t framing;
+    long long last_activity;
+    struct origin_conn_t *prev;
+    struct origin_conn_t *next;
+} origin_conn_t;
+
+/**
+ * @brief Поток-цикл событийного обработчика
+ * @var reactor       Обработчик, которому принадлежит цикл
+ * @var index         Номер цикла
+ * @var epoll_fd      Дескриптор epoll
+ * @var event         eventfd для пробуждения цикла из других потоков
+ * @var thread        Поток цикла
+ * @var mutex         Защищает incoming, очередь оповещений и очередь разрешенных имен
+ * @var incoming      Принятые, но еще не зарегистрированные сокеты
+ * @var incoming_len  Количество сокетов в incoming
+ * @var incoming_cap  Размер массива incoming
+ * @var pending_head  Очередь клиентов, у элементов которых появились данные
+ * @var resolved_head Очередь соединений с серверами, для которых резолвер разрешил имя
+ * @var clients       Все клиентские соединения цикла (только поток цикла)
+ * @var origins       Все соединения с серверами (только поток цикла)
+ */
+struct reactor_loop_t {
+    reactor_t *reactor;
+    int index;
+    int epoll_fd;
+    reactor_handle_t event;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    int *incoming;
+    size_t incoming_len;
+    size_t incoming_cap;
+    client_conn_t *pending_head;
+    origin_conn_t *resolved_head;
+    client_conn_t *clients;
+    origin_conn_t *origins;
+};
+
+/**
+ * @brief Событийный обработчик
+ * @var cache         Общий кэш
+ * @var resolver      Общий резолвер имен
+ * @var loops         Массив циклов
+ * @var loop_count    Количество циклов
+ * @var next_loop     Счетчик для распределения соединений по кругу
+ * @var running       Флаг работы циклов
+ */
+struct reactor_t {
+    cache_t *cache;
+    dns_resolver_t *resolver;
+    reactor_loop_t *loops;
+    int loop_count;
+    atomic_uint next_loop;
+    atomic_int running;
+};
+
+/**
+ * @brief Функция потока-цикла
+ * @param arg Указатель на reactor_loop_t
+ * @return NULL
+ */
+static void *loop_routine(void *arg);
+
+/**
+ * @brief Будит цикл через eventfd
+ * @param loop Цикл
+ */
+static void loop_wakeup(reactor_loop_t *loop);
+
+/**
+ * @brief Обрабатывает новые сокеты и очередь оповещений цикла
+ * @param loop Цикл
+ */
+static void loop_drain_mailbox(reactor_loop_t *loop);
+
+/**
+ * @brief Закрывает соединения, не проявлявшие активности дольше READ_WRITE_TIMEOUT_MS
+ * @param loop Цикл
+ */
+static void loop_sweep_timeouts(reactor_loop_t *loop);
+
+/**
+ * @brief Создает клиентское соединение и регистрирует его в epoll
+ * @param loop          Цикл
+ * @param client_socket Неблокирующий клиентский сокет
+ */
+static void client_open(reactor_loop_t *loop, int client_socket);
+
+/**
+ * @brief Продвигает автомат клиентского соединения, пока это возможно без блокировки
+ * @param conn Клиентское соединение
+ */
+static void client_progress(client_conn_t *conn);
+
+/**
+ * @brief Обрабатывает полностью полученный запрос: поиск в кэше и запуск загрузки
+ * @param conn        Клиентское соединение
+ * @param request_len Длина запроса
+ * @return SUCCESS или ERROR
+ */
+static int client_start_request(client_conn_t *conn, size_t request_len);
+
+/**
+ * @brief Отдает клиенту доступные данные элемента кэша
+ * @param conn Клиентское соединение
+ * @return 1 если можно продолжать, 0 если нужно ждать события, ERROR если соединение нужно закрыть
+ */
+static int client_stream(client_conn_t *conn);
+
+/**
+ * @brief Оповещение от элемента кэша: ставит соединение в очередь цикла
+ * @param arg Указатель на client_conn_t
+ * @note Вызывается под entry->mutex из любого потока
+ */
+static void client_notify(void *arg);
+
+/**
+ * @brief Закрывает клиентское соединение и освобождает его ресурсы
+ * @param conn Клиентское соединение
+ */
+static void client_close(client_conn_t *conn);
+
+/**
+ * @brief Запускает загрузку ответа с целевого сервера в элемент кэша
+ * @param loop          Цикл
+ * @param entry         Заполняемый элемент кэша
+ * @param indexed       Элемент добавлен в кэш
+ * @param method        Метод запроса (в запросе элемента)
+ * @param method_len    Длина метода
+ * @param host_port     Значение заголовка Host
+ * @param host_port_len Длина значения
+ * @return SUCCESS или ERROR
+ */
+static int origin_open(reactor_loop_t *loop, cache_entry_t *entry, int indexed, const char *method, size_t method_len,
+                       const char *host_port, size_t host_port_len);
+
+/**
+ * @brief Оповещение от резолвера: имя сервера разрешено
+ * @param query Запрос, встроенный в origin_conn_t
+ */
+static void origin_resolved(dns_query_t *query);
+
+/**
+ * @brief Начинает неблокирующее подключение к разрешенному адресу сервера
+ * @param conn Соединение с сервером (адрес в conn->query)
+ */
+static void origin_connect(origin_conn_t *conn);
+
+/**
+ * @brief Продвигает автомат соединения с сервером, пока это возможно без блокировки
+ * @param conn Соединение с сервером
+ */
+static void origin_progress(origin_conn_t *conn);
+
+/**
+ * @brief Обрабатывает порцию ответа сервера, уже принятую в элемент: учитывает и разбирает заголовки
+ * @param conn Соединение с сервером
+ * @param data Принятые данные (внутри ответа элемента)
+ * @param len  Длина данных
+ * @return 1 если ответ принят полностью, 0 если нужно читать дальше, ERROR при ошибке
+ */
+static int origin_consume(origin_conn_t *conn, const char *data, size_t len);
+
+/**
+ * @brief Завершает загрузку и закрывает соединение с сервером
+ * @param conn   Соединение с сервером
+ * @param failed 1 если загрузка прервана, 0 если ответ получен полностью
+ */
+static void origin_close(origin_conn_t *conn, int failed);
+
+/**
+ * @brief Создает событийный обработчик и запускает его циклы
+ * @param loop_count Количество потоков-циклов
+ * @param cache Кэш HTTP-ответов
+ * @param resolver Резолвер имен серверов
+ * @return Указатель на обработчик или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Выделяет память под обработчик и массив циклов
+ *          2. Для каждого цикла создает epoll и eventfd, регистрирует eventfd
+ *          3. Запускает потоки циклов
+ */
+reactor_t *reactor_create(int loop_count, cache_t *cache, dns_resolver_t *resolver) {
+    if (loop_count <= 0) loop_count = 1;
+    errno = 0;
+    reactor_t *reactor = malloc(sizeof(reactor_t));
+    if (reactor == NULL) {
+        proxy_log_error("Reactor creation error: %s", strerror(errno));
+        return NULL;
+    }
+    reactor->loops = calloc(loop_count, sizeof(reactor_loop_t));
+    if (reactor->loops == NULL) {
+        proxy_log_error("Reactor creation error: %s", strerror(errno));
+        free(reactor);
+        return NULL;
+    }
+    reactor->cache = cache;
+    reactor->resolver = resolver;
+    reactor->loop_count = 0;
+    reactor->next_loop = 0;
+    reactor->running = 1;
+    for (int i = 0; i < loop_count; i++) {
+        reactor_loop_t *loop = &reactor->loops[i];
+        loop->reactor = reactor;
+        loop->index = i;
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->event.type = HANDLE_EVENT;
+        loop->event.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop->event.owner = loop;
+        if (loop->epoll_fd == ERROR || loop->event.fd == ERROR) {
+            proxy_log_error("Reactor creation error: %s", strerror(errno));
+            if (loop->epoll_fd != ERROR) close(loop->epoll_fd);
+            if (loop->event.fd != ERROR) close(loop->event.fd);
+            break;
+        }
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.ptr = &loop->event};
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->event.fd, &ev);
+        pthread_mutex_init(&loop->mutex, NULL);
+        if (pthread_create(&loop->thread, NULL, loop_routine, loop) != 0) {
+            proxy_log_error("Reactor creation error: failed to create loop thread");
+            pthread_mutex_destroy(&loop->mutex);
+            close(loop->epoll_fd);
+            close(loop->event.fd);
+            break;
+        }
+        reactor->loop_count++;
+    }
+    if (reactor->loop_count != loop_count) {
+        reactor_destroy(reactor);
+        return NULL;
+    }
+    proxy_log("Reactor started with %d loops", loop_count);
+    return reactor;
+}
+
+/**
+ * @brief Передает принятое клиентское соединение одному из циклов
+ * @param reactor Событийный обработчик
+ * @param client_socket Дескриптор клиентского сокета
+ * @details Сокет кладется в очередь incoming выбранного цикла,
+ *          цикл пробуждается через eventfd и сам регистрирует сокет в epoll.
+ */
+void reactor_submit(reactor_t *reactor, int client_socket) {
+    reactor_loop_t *loop = &reactor->loops[atomic_fetch_add(&reactor->next_loop, 1) % reactor->loop_count];
+    pthread_mutex_lock(&loop->mutex);
+    if (loop->incoming_len == loop->incoming_cap) {
+        size_t new_cap = loop->incoming_cap == 0 ? 64 : loop->incoming_cap * 2;
+        int *temp = realloc(loop->incoming, new_cap * sizeof(int));
+        if (temp == NULL) {
+            pthread_mutex_unlock(&loop->mutex);
+            proxy_log_error("Reactor submit error: failed to reallocate memory");
+            close(client_socket);
+            return;
+        }
+        loop->incoming = temp;
+        loop->incoming_cap = new_cap;
+    }
+    loop->incoming[loop->incoming_len++] = client_socket;
+    pthread_mutex_unlock(&loop->mutex);
+    loop_wakeup(loop);
+}
+
+/**
+ * @brief Останавливает циклы и освобождает ресурсы обработчика
+ * @param reactor Событийный обработчик
+ * @details Каждый цикл перед выходом сам закрывает свои соединения,
+ *          поэтому здесь достаточно дождаться потоков и закрыть дескрипторы.
+ */
+void reactor_destroy(reactor_t *reactor) {
+    if (reactor == NULL) return;
+    atomic_store(&reactor->running, 0);
+    for (int i = 0; i < reactor->loop_count; i++) loop_wakeup(&reactor->loops[i]);
+    for (int i = 0; i < reactor->loop_count; i++) {
+        reactor_loop_t *loop = &reactor->loops[i];
+        pthread_join(loop->thread, NULL);
+        for (size_t j = 0; j < loop->incoming_len; j++) close(loop->incoming[j]);
+        free(loop->incoming);
+        pthread_mutex_destroy(&loop->mutex);
+        close(loop->epoll_fd);
+        close(loop->event.fd);
+    }
+    free(reactor->loops);
+    free(reactor);
+}
+
+/**
+ * @brief Функция потока-цикла
+ * @param arg Указатель на reactor_loop_t
+ * @return NULL
+ * @details Алгоритм работы:
+ *          1. Ждет событий epoll не дольше LOOP_TICK_MS
+ *          2. Для сокетов - запоминает готовность и продвигает автомат владельца
+ *          3. Если сработал eventfd - принимает новые сокеты и обрабатывает оповещения кэша
+ *          4. Раз в LOOP_TICK_MS закрывает соединения по таймауту
+ *          5. При остановке закрывает все свои соединения
+ */
+static void *loop_routine(void *arg) {
+    reactor_loop_t *loop = (reactor_loop_t *) arg;
+    char thread_name[16];
+    snprintf(thread_name, sizeof(thread_name), "reactor-%d", loop->index);
+    proxy_set_thread_name(thread_name);
+    struct epoll_event events[MAX_EVENTS];
+    long long last_sweep = proxy_clock_now_ms();
+    while (atomic_load(&loop->reactor->running)) {
+        int ready = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, LOOP_TICK_MS);
+        if (ready == ERROR && errno != EINTR) {
+            proxy_log_error("Reactor loop error: %s", strerror(errno));
+            break;
+        }
+        int mailbox = 0;
+        for (int i = 0; i < ready; i++) {
+            reactor_handle_t *handle = events[i].data.ptr;
+            if (handle->type == HANDLE_EVENT) {
+                uint64_t value;
+                while (read(handle->fd, &value, sizeof(value)) > 0); // Сброс счетчика eventfd
+                mailbox = 1;
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) handle->readable = 1;
+            if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) handle->writable = 1;
+            if (handle->type == HANDLE_CLIENT) client_progress(handle->owner);
+            else origin_progress(handle->owner);
+        }
+        // Очередь разбирается после пачки событий: обработка оповещения может закрыть
+        // соединение, событие которого еще лежит в массиве events
+        if (mailbox) loop_drain_mailbox(loop);
+        long long now = proxy_clock_now_ms();
+        if (now - last_sweep >= LOOP_TICK_MS) {
+            loop_sweep_timeouts(loop);
+            last_sweep = now;
+        }
+    }
+    while (loop->clients != NULL) client_close(loop->clients);
+    while (loop->origins != NULL) origin_close(loop->origins, 1);
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Будит цикл через eventfd
+ * @param loop Цикл
+ */
+static void loop_wakeup(reactor_loop_t *loop) {
+    uint64_t one = 1;
+    ssize_t ret = write(loop->event.fd, &one, sizeof(one));
+    (void) ret; // Переполнение счетчика eventfd означает, что цикл и так будет разбужен
+}
+
+/**
+ * @brief Обрабатывает новые сокеты, очередь оповещений и очередь разрешенных имен цикла
+ * @param loop Цикл
+ * @details Очереди разбираются по одному элементу, не удерживая
+ *          мьютекс во время обработки: закрытие соединения само удаляет его
+ *          из очереди, поэтому в ней не остается висячих указателей.
+ */
+static void loop_drain_mailbox(reactor_loop_t *loop) {
+    while (1) {
+        pthread_mutex_lock(&loop->mutex);
+        if (loop->incoming_len == 0) {
+            pthread_mutex_unlock(&loop->mutex);
+            break;
+        }
+        int client_socket = loop->incoming[--loop->incoming_len];
+        pthread_mutex_unlock(&loop->mutex);
+        client_open(loop, client_socket);
+    }
+    while (1) {
+        pthread_mutex_lock(&loop->mutex);
+        client_conn_t *conn = loop->pending_head;
+        if (conn == NULL) {
+            pthread_mutex_unlock(&loop->mutex);
+            break;
+        }
+        loop->pending_head = conn->pending_next;
+        if (loop->pending_head != NULL) loop->pending_head->pending_prev = NULL;
+        conn->pending = 0;
+        conn->pending_prev = conn->pending_next = NULL;
+        pthread_mutex_unlock(&loop->mutex);
+        client_progress(conn);
+    }
+    while (1) {
+        pthread_mutex_lock(&loop->mutex);
+        origin_conn_t *conn = loop->resolved_head;
+        if (conn == NULL) {
+            pthread_mutex_unlock(&loop->mutex);
+            break;
+        }
+        loop->resolved_head = conn->resolved_next;
+        conn->resolved = 0;
+        conn->resolved_next = NULL;
+        pthread_mutex_unlock(&loop->mutex);
+        origin_connect(conn);
+    }
+}
+
+/**
+ * @brief Закрывает соединения, не проявлявшие активности дольше READ_WRITE_TIMEOUT_MS
+ * @param loop Цикл
+ */
+static void loop_sweep_timeouts(reactor_loop_t *loop) {
+    long long now = proxy_clock_now_ms();
+    client_conn_t *client = loop->clients;
+    while (client != NULL) {
+        client_conn_t *next = client->next;
+        if (now - client->last_activity >= READ_WRITE_TIMEOUT_MS) {
+            proxy_log("Client connection timeout");
+            client_close(client);
+        }
+        client = next;
+    }
+    origin_conn_t *origin = loop->origins;
+    while (origin != NULL) {
+        origin_conn_t *next = origin->next;
+        if (now - origin->last_activity >= READ_WRITE_TIMEOUT_MS) {
+            proxy_log("Remote connection timeout");
+            origin_close(origin, 1);
+        }
+        origin = next;
+    }
+}
+
+/**
+ * @brief Создает клиентское соединение и регистрирует его в epoll
+ * @param loop Цикл
+ * @param client_socket Неблокирующий клиентский сокет
+ */
+static void client_open(reactor_loop_t *loop, int client_socket) {
+    client_conn_t *conn = calloc(1, sizeof(client_conn_t));
+    if (conn == NULL) {
+        proxy_log_error("Client connection creation error: failed to allocate memory");
+        close(client_socket);
+        return;
+    }
+    conn->handle.type = HANDLE_CLIENT;
+    conn->handle.fd = client_socket;
+    conn->handle.owner = conn;
+    conn->loop = loop;
+    conn->state = CLIENT_READ_REQUEST;
+    conn->subscriber.notify = client_notify;
+    conn->subscriber.arg = conn;
+    conn->last_activity = proxy_clock_now_ms();
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = &conn->handle};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) == ERROR) {
+        proxy_log_error("Client connection registration error: %s", strerror(errno));
+        close(client_socket);
+        free(conn);
+        return;
+    }
+    conn->next = loop->clients;
+    if (loop->clients != NULL) loop->clients->prev = conn;
+    loop->clients = conn;
+}
+
+/**
+ * @brief Продвигает автомат клиентского соединения
+ * @param conn Клиентское соединение
+ * @details Состояния:
+ *          - CLIENT_READ_REQUEST: читает сокет до EAGAIN и проверяет, получен ли запрос целиком;
+ *            после этого выполняет поиск в кэше и переходит в CLIENT_STREAM
+ *          - CLIENT_STREAM: отправляет клиенту данные элемента кэша, пока сокет
+ *            принимает данные; если данные кончились - ждет оповещения от элемента.
+ *            Входящие данные клиента в этом состоянии отбрасываются, а закрытие
+ *            соединения клиентом завершает отдачу.
+ */
+static void client_progress(client_conn_t *conn) {
+    while (1) {
+        if (conn->state == CLIENT_READ_REQUEST) {
+            if (!conn->handle.readable) return;
+            if (conn->request_len == conn->request_cap) {
+                if (conn->request_cap >= MAX_REQUEST_SIZE) {
+                    proxy_log_error("Request receiving error: request is too large");
+                    client_close(conn);
+                    return;
+                }
+                size_t new_cap = conn->request_cap == 0 ? BUFSIZ : conn->request_cap * 2;
+                char *temp = realloc(conn->request, new_cap);
+                if (temp == NULL) {
+                    proxy_log_error("Request receiving error: failed to reallocate memory");
+                    client_close(conn);
+                    return;
+                }
+                conn->request = temp;
+                conn->request_cap = new_cap;
+            }
+            ssize_t received = recv(conn->handle.fd, conn->request + conn->request_len, conn->request_cap - conn->request_len, 0);
+            if (received == ERROR && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                conn->handle.readable = 0;
+                return;
+            }
+            if (received <= 0) {
+                if (received == ERROR) proxy_log_error("Request receiving error: %s", strerror(errno));
+                client_close(conn);
+                return;
+            }
+            conn->request_len += received;
+            conn->last_activity = proxy_clock_now_ms();
+            ssize_t request_len = http_request_length(conn->request, conn->request_len);
+            if (request_len == PARTIAL) continue;
+            if (request_len == ERROR) { // Ответ 400 без ожидания: если буфер сокета полон, клиент просто увидит закрытие
+                send(conn->handle.fd, HTTP_BAD_REQUEST_RESPONSE, sizeof(HTTP_BAD_REQUEST_RESPONSE) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+                client_close(conn);
+                return;
+            }
+            if (client_start_request(conn, request_len) == ERROR) {
+                client_close(conn);
+                return;
+            }
+            continue;
+        }
+        if (conn->handle.readable) { // Клиент что-то прислал или закрыл соединение во время отдачи
+            char buf[BUFSIZ];
+            ssize_t received = recv(conn->handle.fd, buf, sizeof(buf), 0);
+            if (received == ERROR && (errno == EAGAIN || errno == EWOULDBLOCK)) conn->handle.readable = 0;
+            else if (received <= 0) {
+                client_close(conn);
+                return;
+            }
+            continue;
+        }
+        int ret = client_stream(conn);
+        if (ret == ERROR) {
+            client_close(conn);
+            return;
+        }
+        if (ret == 0) return;
+    }
+}
+
+/**
+ * @brief Обрабатывает полностью полученный запрос
+ * @param conn Клиентское соединение
+ * @param request_len Длина запроса
+ * @return SUCCESS или ERROR
+ * @details Алгоритм работы:
+ *          1. Извлекает метод и Host
+ *          2. Для GET атомарно ищет элемент в кэше или добавляет новый
+ *          3. Для остальных методов создает частный (не добавляемый в кэш) элемент
+ *          4. Если элемент новый - запускает загрузку с сервера (элемент, заменивший устаревший,
+ *             загружает проверка устаревшего)
+ *          5. Подписывается на элемент и переходит к отдаче данных
+ */
+static int client_start_request(client_conn_t *conn, size_t request_len) {
+    reactor_t *reactor = conn->loop->reactor;
+    const char *method, *host_port;
+    size_t method_len, host_port_len;
+    metrics_request_start(&conn->metrics);
+    if (http_parse_request(conn->request, request_len, &method, &method_len, &host_port, &host_port_len) == ERROR) return ERROR;
+    int cacheable = http_check_request(method, method_len);
+    cache_entry_t *entry = NULL;
+    int created = 0;
+    if (cacheable) {
+        entry = cache_get_or_add(reactor->cache, conn->request, request_len, &created);
+    } else {
+        entry = cache_entry_create(conn->request, request_len, NULL);
+        created = entry != NULL;
+    }
+    if (entry == NULL) return ERROR;
+    if (!created) metrics_request_lookup(&conn->metrics, entry->finished ? METRICS_LOOKUP_HIT : METRICS_LOOKUP_COALESCED);
+    else metrics_request_lookup(&conn->metrics, cacheable ? METRICS_LOOKUP_MISS : METRICS_LOOKUP_BYPASS);
+    if (created) conn->request = NULL; // Буфером запроса теперь владеет элемент кэша
+    if (created == CACHE_REVALIDATING) { // Ответ загрузит проверка устаревшего элемента в пуле загрузчиков
+        proxy_log("Cache entry is stale, revalidate");
+    } else if (created) {
+        proxy_log(cacheable ? "Cache miss" : "Uncacheable request, relay through private entry");
+        if (origin_open(conn->loop, entry, cacheable, method, method_len, host_port, host_port_len) == ERROR) {
+            if (cacheable) cache_remove_entry(reactor->cache, entry); // Сначала из кэша, чтобы повторный запрос не нашел прерванный элемент
+            entry->failed = 1;
+            cache_entry_notify(entry);
+            cache_entry_release(entry);
+            return ERROR;
+        }
+    } else {
+        proxy_log("Cache hit, start streaming from cache");
+    }
+    conn->entry = entry;
+    conn->state = CLIENT_STREAM;
+    cache_entry_subscribe(entry, &conn->subscriber);
+    conn->subscribed = 1;
+    return SUCCESS;
+}
+
+/**
+ * @brief Отдает клиенту доступные данные элемента кэша
+ * @param conn Клиентское соединение
+ * @return 1 если можно продолжать, 0 если нужно ждать события, ERROR если соединение нужно закрыть
+ * @details Позиция отдачи хранится в conn->reader. Флаги завершения читаются раньше
+ *          размера ответа: если загрузка завершена, все ее данные уже опубликованы.
+ *          Записанные данные не перемещаются и отправляются без блокировки.
+ */
+static int client_stream(client_conn_t *conn) {
+    cache_entry_t *entry = conn->entry;
+    pthread_mutex_lock(&entry->mutex);
+    int finished = entry->finished, failed = entry->failed;
+    message_t *response = entry->response;
+    pthread_mutex_unlock(&entry->mutex);
+    size_t len;
+    const char *data = message_peek(response, &conn->reader, &len);
+    if (len == 0) {
+        if (finished && !failed) metrics_request_finish(&conn->metrics);
+        if (finished || failed) return ERROR; // Все отдано (или загрузка прервана) - соединение закрывается
+        return 0; // Ждем оповещения о новых данных
+    }
+    if (!conn->handle.writable) return 0;
+    ssize_t sent = send(conn->handle.fd, data, len, MSG_NOSIGNAL);
+    if (sent == ERROR) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            conn->handle.writable = 0;
+            return 0;
+        }
+        proxy_log_error("Data sending error: %s", strerror(errno));
+        return ERROR;
+    }
+    message_consume(&conn->reader, sent);
+    metrics_request_sent(&conn->metrics, (size_t) sent);
+    conn->last_activity = proxy_clock_now_ms();
+    return 1;
+}
+
+/**
+ * @brief Оповещение от элемента кэша
+ * @param arg Указатель на client_conn_t
+ */
+static void client_notify(void *arg) {
+    client_conn_t *conn = (client_conn_t *) arg;
+    reactor_loop_t *loop = conn->loop;
+    pthread_mutex_lock(&loop->mutex);
+    if (!conn->pending) {
+        conn->pending = 1;
+        conn->pending_prev = NULL;
+        conn->pending_next = loop->pending_head;
+        if (loop->pending_head != NULL) loop->pending_head->pending_prev = conn;
+        loop->pending_head = conn;
+    }
+    pthread_mutex_unlock(&loop->mutex);
+    loop_wakeup(loop);
+}
+
+/**
+ * @brief Закрывает клиентское соединение
+ * @param conn Клиентское соединение
+ * @details Сначала отписывается от элемента (после этого оповещения не приходят),
+ *          затем удаляет соединение из очереди оповещений и освобождает ресурсы.
+ */
+static void client_close(client_conn_t *conn) {
+    reactor_loop_t *loop = conn->loop;
+    if (conn->subscribed) cache_entry_unsubscribe(conn->entry, &conn->subscriber);
+    pthread_mutex_lock(&loop->mutex);
+    if (conn->pending) {
+        if (conn->pending_prev != NULL) conn->pending_prev->pending_next = conn->pending_next;
+        else loop->pending_head = conn->pending_next;
+        if (conn->pending_next != NULL) conn->pending_next->pending_prev = conn->pending_prev;
+    }
+    pthread_mutex_unlock(&loop->mutex);
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else loop->clients = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    close(conn->handle.fd);
+    cache_entry_release(conn->entry);
+    free(conn->request);
+    free(conn);
+}
+
+/**
+ * @brief Запускает загрузку ответа с целевого сервера
+ * @param loop Цикл
+ * @param entry Заполняемый элемент кэша
+ * @param indexed Элемент добавлен в кэш
+ * @param method Метод запроса (в запросе элемента)
+ * @param method_len Длина метода
+ * @param host_port Значение заголовка Host
+ * @param host_port_len Длина значения
+ * @return SUCCESS или ERROR
+ * @details Алгоритм работы:
+ *          1. Извлекает хост и порт
+ *          2. Строит запрос к серверу с "Connection: close": клиентское соединение не переиспользуется,
+ *             а сервер, закрывающий соединение, не держит его до таймаута
+ *          3. Создает соединение и передает имя хоста резолверу
+ *          3. Если адрес есть в кэше резолвера - сразу начинает подключение;
+ *             иначе соединение ждет в состоянии ORIGIN_RESOLVING, пока резолвер
+ *             не передаст его циклу через очередь разрешенных имен
+ * @note Поток цикла не блокируется на разрешении имени
+ */
+static int origin_open(reactor_loop_t *loop, cache_entry_t *entry, int indexed, const char *method, size_t method_len,
+                       const char *host_port, size_t host_port_len) {
+    char host[MAX_HOST_SIZE];
+    int port;
+    if (http_get_host_port(host_port, host_port_len, host, sizeof(host), &port) == ERROR) return ERROR;
+    origin_conn_t *conn = calloc(1, sizeof(origin_conn_t));
+    if (conn == NULL) {
+        proxy_log_error("Connect to remote error: failed to allocate memory");
+        return ERROR;
+    }
+    conn->request = http_build_upstream_request(entry->request, entry->request_len, 0, &conn->request_len);
+    if (conn->request == NULL) {
+        free(conn);
+        return ERROR;
+    }
+    conn->handle.type = HANDLE_ORIGIN;
+    conn->handle.fd = ERROR;
+    conn->handle.owner = conn;
+    conn->loop = loop;
+    conn->state = ORIGIN_RESOLVING;
+    conn->indexed = indexed;
+    conn->port = port;
+    conn->method = method;
+    conn->method_len = method_len;
+    conn->query.callback = origin_resolved;
+    conn->query.arg = conn;
+    conn->last_activity = proxy_clock_now_ms();
+    int ret = dns_resolve(loop->reactor->resolver, host, &conn->query);
+    if (ret == ERROR) {
+        proxy_log_error("Connect to remote error: host name lookup failure");
+        free(conn->request);
+        free(conn);
+        return ERROR;
+    }
+    conn->entry = cache_entry_acquire(entry);
+    conn->next = loop->origins;
+    if (loop->origins != NULL) loop->origins->prev = conn;
+    loop->origins = conn;
+    if (ret == SUCCESS) origin_connect(conn); // Адрес был в кэше резолвера
+    return SUCCESS;
+}
+
+/**
+ * @brief Оповещение от резолвера: имя сервера разрешено
+ * @param query Запрос, встроенный в origin_conn_t
+ * @details Вызывается потоком резолвера. Соединение кладется в очередь разрешенных
+ *          имен цикла, подключение начнет сам цикл после пробуждения.
+ */
+static void origin_resolved(dns_query_t *query) {
+    origin_conn_t *conn = (origin_conn_t *) query->arg;
+    reactor_loop_t *loop = conn->loop;
+    pthread_mutex_lock(&loop->mutex);
+    conn->resolved = 1;
+    conn->resolved_next = loop->resolved_head;
+    loop->resolved_head = conn;
+    pthread_mutex_unlock(&loop->mutex);
+    loop_wakeup(loop);
+}
+
+/**
+ * @brief Начинает неблокирующее подключение к разрешенному адресу сервера
+ * @param conn Соединение с сервером (адрес в conn->query)
+ * @details Алгоритм работы:
+ *          1. Если имя не разрешилось - завершает загрузку ошибкой
+ *          2. Создает неблокирующий сокет и начинает connect
+ *          3. Регистрирует сокет в epoll; завершение connect придет событием EPOLLOUT
+ */
+static void origin_connect(origin_conn_t *conn) {
+    if (conn->query.status == ERROR) {
+        proxy_log_error("Connect to remote error: host name lookup failure");
+        origin_close(conn, 1);
+        return;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(conn->port);
+    addr.sin_addr = conn->query.addr;
+    conn->handle.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (conn->handle.fd == ERROR) {
+        proxy_log_error("Connect to remote error: %s", strerror(errno));
+        origin_close(conn, 1);
+        return;
+    }
+    conn->state = ORIGIN_CONNECTING;
+    int ret = connect(conn->handle.fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret == ERROR && errno != EINPROGRESS) {
+        proxy_log_error("Connect to remote error: %s", strerror(errno));
+        origin_close(conn, 1);
+        return;
+    }
+    conn->handle.writable = ret == 0; // connect мог завершиться сразу
+    conn->last_activity = proxy_clock_now_ms();
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = &conn->handle};
+    if (epoll_ctl(conn->loop->epoll_fd, EPOLL_CTL_ADD, conn->handle.fd, &ev) == ERROR) {
+        proxy_log_error("Connect to remote error: %s", strerror(errno));
+        origin_close(conn, 1);
+        return;
+    }
+    origin_progress(conn);
+}
+
+/**
+ * @brief Продвигает автомат соединения с сервером
+ * @param conn Соединение с сервером
+ * @details Состояния:
+ *          - ORIGIN_CONNECTING: проверяет результат connect через SO_ERROR
+ *          - ORIGIN_SEND_REQUEST: отправляет запрос к серверу
+ *          - ORIGIN_RECEIVE: читает ответ до EAGAIN, дописывая его в элемент,
+ *            и один раз за пачку оповещает читателей элемента
+ */
+static void origin_progress(origin_conn_t *conn) {
+    cache_entry_t *entry = conn->entry;
+    if (conn->state == ORIGIN_CONNECTING) {
+        if (!conn->handle.writable) return;
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        getsockopt(conn->handle.fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+        if (err != 0) {
+            proxy_log_error("Connect to remote error: %s", strerror(err));
+            origin_close(conn, 1);
+            return;
+        }
+        conn->state = ORIGIN_SEND_REQUEST;
+    }
+    if (conn->state == ORIGIN_SEND_REQUEST) {
+        while (conn->sent < conn->request_len) {
+            if (!conn->handle.writable) return;
+            ssize_t sent = send(conn->handle.fd, conn->request + conn->sent, conn->request_len - conn->sent, MSG_NOSIGNAL);
+            if (sent == ERROR) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    conn->handle.writable = 0;
+                    return;
+                }
+                proxy_log_error("Data sending error: %s", strerror(errno));
+                origin_close(conn, 1);
+                return;
+            }
+            conn->sent += sent;
+            conn->last_activity = proxy_clock_now_ms();
+        }
+        conn->state = ORIGIN_RECEIVE;
+    }
+    int appended = 0;
+    while (conn->handle.readable) {
+        // Данные принимаются прямо в свободное место ответа элемента, без промежуточного буфера
+        size_t space_len;
+        pthread_mutex_lock(&entry->mutex);
+        char *space = message_reserve(&entry->response, REACTOR_BUFFER_SIZE, &space_len);
+        pthread_mutex_unlock(&entry->mutex);
+        if (space == NULL) {
+            origin_close(conn, 1);
+            return;
+        }
+        ssize_t received = recv(conn->handle.fd, space, space_len, 0);
+        if (received == ERROR && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            conn->handle.readable = 0;
+            break;
+        }
+        if (received == ERROR) {
+            proxy_log_error("Data receiving error: %s", strerror(errno));
+            origin_close(conn, 1);
+            return;
+        }
+        if (received == 0) { // Сервер закрыл соединение: ответ без Content-Length завершен
+            int complete = http_response_framing_eof(&conn->framing);
+            if (!complete) proxy_log_error("Data receiving error: remote closed connection before end of response");
+            origin_close(conn, !complete);
+            return;
+        }
+        conn->last_activity = proxy_clock_now_ms();
+        appended = 1;
+        message_commit(entry->response, received); // Клиенты получают данные по мере загрузки
+        int ret = origin_consume(conn, space, received);
+        if (ret != 0) {
+            origin_close(conn, ret == ERROR);
+            return;
+        }
+    }
+    if (appended) cache_entry_notify(entry);
+}
+
+/**
+ * @brief Обрабатывает порцию ответа сервера
+ * @param conn Соединение с сервером
+ * @param data Принятые данные
+ * @param len Длина данных
+ * @return 1 если ответ принят полностью, 0 если нужно читать дальше, ERROR при ошибке
+ * @details Данные к этому моменту уже опубликованы в ответе элемента.
+ *          Конец ответа ищет http_response_framing_parse: ответы без тела, с телом chunked
+ *          и по Content-Length завершаются, не дожидаясь закрытия соединения.
+ *          Если ответ не подлежит кэшированию, элемент удаляется из кэша,
+ *          но клиенты, уже получившие его, дочитывают ответ до конца.
+ */
+static int origin_consume(origin_conn_t *conn, const char *data, size_t len) {
+    cache_entry_t *entry = conn->entry;
+    http_response_framing_t *framing = &conn->framing;
+    if (conn->indexed) cache_account(conn->loop->reactor->cache, entry, len); // Учитываем данные в бюджете кэша
+    int header_parsed = framing->header_parsed;
+    int ret = http_response_framing_parse(framing, conn->method, conn->method_len, data, len);
+    if (ret == ERROR || header_parsed || !framing->header_parsed) return ret;
+    if (conn->indexed && !http_check_response(framing->status) && !entry->deleted) {
+        proxy_log("Response status %d is not cacheable", framing->status);
+        cache_remove_entry(conn->loop->reactor->cache, entry);
+    } else if (conn->indexed) {
+        cache_set_vary(conn->loop->reactor->cache, entry, framing->header, framing->header_len); // Запоминаем, от каких заголовков запроса зависит ответ
+        cache_set_freshness(conn->loop->reactor->cache, entry, framing->header, framing->header_len); // и сколько он остается свежим
+    }
+    http_response_framing_free(framing);
+    return ret;
+}
+
+/**
+ * @brief Завершает загрузку и закрывает соединение с сервером
+ * @param conn Соединение с сервером
+ * @param failed 1 если загрузка прервана, 0 если ответ получен полностью
+ * @details При успехе помечает элемент завершенным, при ошибке - прерванным
+ *          и удаляет его из кэша. В обоих случаях оповещает читателей.
+ *          Соединение, ждущее резолвер, сначала снимается с ожидания и из очереди
+ *          разрешенных имен, чтобы оповещение не пришло для освобожденной памяти.
+ */
+static void origin_close(origin_conn_t *conn, int failed) {
+    reactor_loop_t *loop = conn->loop;
+    cache_entry_t *entry = conn->entry;
+    if (conn->state == ORIGIN_RESOLVING) {
+        dns_cancel(loop->reactor->resolver, &conn->query); // После возврата резолвер не обращается к conn
+        pthread_mutex_lock(&loop->mutex);
+        if (conn->resolved) {
+            origin_conn_t **link = &loop->resolved_head;
+            while (*link != conn) link = &(*link)->resolved_next;
+            *link = conn->resolved_next;
+        }
+        pthread_mutex_unlock(&loop->mutex);
+    }
+    if (failed && conn->indexed) cache_remove_entry(loop->reactor->cache, entry);
+    if (failed) entry->failed = 1;
+    else entry->finished = 1;
+    cache_entry_notify(entry);
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else loop->origins = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    if (conn->handle.fd != ERROR) close(conn->handle.fd);
+    cache_entry_release(entry);
+    http_response_framing_free(&conn->framing);
+    free(conn->request);
+    free(conn);
+}
@@ -3,121 +3,264 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef CACHE_PROXY_HAVE_FUTEX
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "log.h"
+#include "metrics.h"
 
-static long id_counter = 0; // Счетчик для генерации уникальных ID задач
+#define CACHE_LINE_SIZE         64
+#define DEQUE_CAPACITY_DEFAULT  256 // Емкость дека исполнителя, если task_queue_capacity <= 0
 
-/**
- * @brief Функция потока-исполнителя
- * @param arg Указатель на thread_pool_t
- * @return NULL
- * @details Каждый поток-исполнитель выполняет бесконечный цикл:
- *          1. Ждет пока в очереди появится задача
- *          2. Берет задачу из очереди
- *          3. Выполняет задачу (routine)
- *          4. Освобождает ресурсы задачи
- *          5. Повторяет
- *          Цикл прерывается когда устанавливается флаг shutdown.
- */
-static void *executor_routine(void *arg);
+#define SUCCESS     0
+#define ERROR       (-1)
+
+static atomic_long id_counter = 0; // Счетчик для генерации уникальных ID задач (общий для всех пулов)
 
 /**
  * @brief Структура задачи для выполнения в пуле потоков
+ * @details Задача выделяется при постановке в пул и освобождается исполнителем
+ *          перед запуском. Поле next связывает задачи во входящей и общей очередях.
  * @var id Уникальный идентификатор задачи
  * @var routine Функция для выполнения
  * @var arg Аргумент для функции routine
+ * @var enqueued_us Время постановки в очередь (мкс, монотонные часы)
+ * @var next Следующая задача в очереди
  */
 struct task_t {
     long id;
     void (*routine)(void *arg);
     void *arg;
+    uint64_t enqueued_us;
+    struct task_t *next;
 };
 typedef struct task_t task_t;
 
+/**
+ * @brief Дек Чейза-Леви фиксированной емкости
+ * @details Владелец кладет и берет задачи с нижнего конца без блокировок и,
+ *          если не гонится с вором за последнюю задачу, без CAS; другие исполнители
+ *          крадут с верхнего конца через CAS. Индексы только растут, ячейка - index & mask.
+ * @var top    Верхний конец (индекс следующей задачи для кражи)
+ * @var bottom Нижний конец (индекс следующей свободной ячейки)
+ * @var buffer Кольцевой массив задач
+ * @var mask   Емкость минус один (емкость - степень двойки)
+ */
+struct deque_t {
+    _Alignas(CACHE_LINE_SIZE) _Atomic int64_t top;
+    _Alignas(CACHE_LINE_SIZE) _Atomic int64_t bottom;
+    _Atomic(task_t *) *buffer;
+    int64_t mask;
+};
+typedef struct deque_t deque_t;
+
+/**
+ * @brief Поток-исполнитель пула
+ * @var deque  Дек задач исполнителя
+ * @var inbox  Входящая очередь: стек задач от сторонних потоков, забирается целиком
+ * @var pool   Пул, которому принадлежит исполнитель
+ * @var index  Номер исполнителя
+ * @var rng    Состояние генератора для выбора жертвы кражи
+ * @var thread Поток
+ */
+struct executor_t {
+    deque_t deque;
+    _Alignas(CACHE_LINE_SIZE) _Atomic(task_t *) inbox;
+    struct thread_pool_t *pool;
+    int index;
+    uint64_t rng;
+    pthread_t thread;
+};
+typedef struct executor_t executor_t;
+
 /**
  * @brief Структура пула потоков
- * @details Реализует пул потоков с циклической очередью задач.
- *          Потоки-исполнители ждут задачи в очереди, выполняют их,
- *          затем возвращаются в ожидание.
+ * @details Реализует пул потоков с кражей задач. У каждого исполнителя свой дек,
+ *          сторонние потоки кладут задачи во входящие очереди исполнителей по кругу,
+ *          а задачи, не поместившиеся в дек, уходят в общую очередь. Очереди не ограничены,
+ *          поэтому постановка задачи не блокируется. Исполнитель без работы крадет
+ *          у случайно выбранных соседей и только потом засыпает.
  */
 struct thread_pool_t {
-    // Циклическая очередь задач
-    task_t *tasks; // Массив задач
-    int capacity; // Размер массива задач
-    int size; // Количество задач в очереди
-    int front; // Индекс головы очереди
-    int rear; // Индекс хвоста очереди
-    pthread_mutex_t mutex; // Мьютекс
-    pthread_cond_t not_empty_cond; // Условная переменная для сигнализации о том, что очередь не пуста
-    pthread_cond_t not_full_cond;  // Условная переменная для сигнализации о том, что очередь не полна
-    // Потоки-исполнители
-    pthread_t *executors; // Массив потоков
-    int num_executors; // Количество потоков
+    // Исполнители
+    executor_t *executors; // Массив исполнителей
+    int num_executors; // Количество исполнителей
+    int deque_capacity; // Емкость дека исполнителя
+    _Alignas(CACHE_LINE_SIZE) atomic_uint next_executor; // Исполнитель для следующей сторонней задачи (по кругу)
+    // Общая очередь для задач, не поместившихся в деки
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t global_mutex; // Мьютекс общей очереди
+    task_t *global_head; // Голова общей очереди
+    task_t *global_tail; // Хвост общей очереди
+    atomic_long global_size; // Длина общей очереди (читается без мьютекса)
+    // Учет задач и сон исполнителей
+    _Alignas(CACHE_LINE_SIZE) atomic_long pending; // Задачи, поставленные, но еще не взятые на выполнение
+    _Alignas(CACHE_LINE_SIZE) atomic_int searching; // Исполнители, которые ищут задачи у других
+    atomic_int sleepers; // Количество спящих исполнителей
+    atomic_uint wake_seq; // Счетчик пробуждений (слово futex)
+#ifndef CACHE_PROXY_HAVE_FUTEX
+    pthread_mutex_t park_mutex; // Мьютекс для сна без futex
+    pthread_cond_t park_cond; // Условная переменная для сна без futex
+#endif
     // Управление завершением
     atomic_int shutdown; // Флаг завершения
 };
 
+static _Thread_local executor_t *current_executor = NULL; // Исполнитель, в потоке которого идет выполнение
+
+/**
+ * @brief Функция потока-исполнителя
+ * @param arg Указатель на executor_t
+ * @return NULL
+ * @details Каждый поток-исполнитель выполняет цикл:
+ *          1. Ищет задачу: в своем деке, своей входящей очереди, общей очереди, у соседей
+ *          2. Выполняет задачу (routine)
+ *          3. Если задач нет нигде - засыпает до постановки новой
+ *          Цикл прерывается когда устанавливается флаг shutdown.
+ */
+static void *executor_routine(void *arg);
+
+/**
+ * @brief Кладет задачу на нижний конец дека (только владелец)
+ * @param deque Дек
+ * @param task  Задача
+ * @return SUCCESS или ERROR, если дек заполнен
+ */
+static int deque_push(deque_t *deque, task_t *task);
+
+/**
+ * @brief Берет задачу с нижнего конца дека (только владелец)
+ * @param deque Дек
+ * @return Задача или NULL, если дек пуст
+ */
+static task_t *deque_pop(deque_t *deque);
+
+/**
+ * @brief Крадет задачу с верхнего конца дека
+ * @param deque Дек
+ * @return Задача или NULL, если дек пуст или задачу забрал другой поток
+ */
+static task_t *deque_steal(deque_t *deque);
+
+/**
+ * @brief Забирает входящую очередь исполнителя victim целиком
+ * @param executor Исполнитель, который забирает задачи
+ * @param victim   Исполнитель, чья входящая очередь забирается (может совпадать с executor)
+ * @return Самая старая задача (ее нужно выполнить) или NULL, если очередь пуста
+ */
+static task_t *take_inbox(executor_t *executor, executor_t *victim);
+
+/**
+ * @brief Берет задачу из общей очереди
+ * @param pool Пул потоков
+ * @return Задача или NULL, если очередь пуста
+ */
+static task_t *take_global(thread_pool_t *pool);
+
+/**
+ * @brief Пытается украсть задачу у других исполнителей, начиная со случайного
+ * @param executor Исполнитель, который ищет работу
+ * @return Задача или NULL, если красть нечего
+ */
+static task_t *steal_task(executor_t *executor);
+
+/**
+ * @brief Будит один спящий поток-исполнитель, если такие есть и никто не ищет задачи
+ * @param pool Пул потоков
+ */
+static void wake_executor(thread_pool_t *pool);
+
+/**
+ * @brief Усыпляет поток-исполнитель, пока в пуле нет задач
+ * @param pool Пул потоков
+ */
+static void park_executor(thread_pool_t *pool);
+
 /**
  * @brief Создает и инициализирует пул потоков
  * @param executor_count Количество потоков-исполнителей в пуле
- * @param task_queue_capacity Максимальное количество задач в очереди
+ * @param task_queue_capacity Емкость дека каждого исполнителя
  * @return Указатель на созданный пул потоков или NULL при ошибке
  * @details Алгоритм работы:
  *          1. Выделяет память под структуру пула потоков
- *          2. Создает циклическую очередь задач заданной емкости
- *          3. Инициализирует мьютекс и условные переменные
- *          4. Создает массив для хранения идентификаторов потоков
- *          5. Запускает заданное количество потоков-исполнителей
- *          6. Устанавливает имена потокам
+ *          2. Округляет емкость дека до степени двойки
+ *          3. Инициализирует общую очередь, счетчики и объекты синхронизации
+ *          4. Создает исполнителей и их деки
+ *          5. Запускает потоки-исполнители, которые устанавливают себе имена при запуске
  */
 thread_pool_t * thread_pool_create(int executor_count, int task_queue_capacity) {
     errno = 0;
-    thread_pool_t *pool = malloc(sizeof(thread_pool_t)); // Выделение памяти под структуру пула потоков
+    thread_pool_t *pool = aligned_alloc(CACHE_LINE_SIZE, sizeof(thread_pool_t)); // Выделение памяти под структуру пула потоков
     if (pool == NULL) {
-        if (errno == ENOMEM) proxy_log("Thread pool creation error: %s", strerror(errno));
-        else proxy_log("Thread pool creation error: failed to reallocate memory");
-        return NULL;
-    }
-    errno = 0;
-    pool->tasks = calloc(sizeof(task_t), task_queue_capacity); // Выделяет и обнуляет память для массива задач
-    if (pool->tasks == NULL) {
-        if (errno == ENOMEM) proxy_log("Thread pool creation error: %s", strerror(errno));
-        else proxy_log("Thread pool creation error: failed to reallocate memory");
-        free(pool);
+        if (errno == ENOMEM) proxy_log_error("Thread pool creation error: %s", strerror(errno));
+        else proxy_log_error("Thread pool creation error: failed to reallocate memory");
         return NULL;
     }
-    pool->capacity = task_queue_capacity;
-    pool->size = 0;
-    pool->front = 0;
-    pool->rear = 0;
-    pool->shutdown = 0;
+    memset(pool, 0, sizeof(thread_pool_t));
+    int capacity = 2;
+    while (capacity < (task_queue_capacity > 0 ? task_queue_capacity : DEQUE_CAPACITY_DEFAULT)) capacity *= 2;
+    pool->deque_capacity = capacity;
     pool->num_executors = executor_count;
-    pthread_mutex_init(&pool->mutex, NULL);
-    pthread_cond_init(&pool->not_empty_cond, NULL);
-    pthread_cond_init(&pool->not_full_cond, NULL);
+    atomic_init(&pool->next_executor, 0);
+    pthread_mutex_init(&pool->global_mutex, NULL);
+    pool->global_head = NULL;
+    pool->global_tail = NULL;
+    atomic_init(&pool->global_size, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->searching, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->wake_seq, 0);
+#ifndef CACHE_PROXY_HAVE_FUTEX
+    pthread_mutex_init(&pool->park_mutex, NULL);
+    pthread_cond_init(&pool->park_cond, NULL);
+#endif
+    atomic_init(&pool->shutdown, 0);
     errno = 0;
-    pool->executors = calloc(sizeof(pthread_t), executor_count); // Выделение памяти для массива идентификаторов потоков
+    pool->executors = aligned_alloc(CACHE_LINE_SIZE, sizeof(executor_t) * (size_t) executor_count); // Исполнители с их деками
     if (pool->executors == NULL) {
-        if (errno == ENOMEM) proxy_log("Thread pool creation error: %s", strerror(errno));
-        else proxy_log("Thread pool creation error: failed to reallocate memory");
-        pthread_mutex_destroy(&pool->mutex);
-        pthread_cond_destroy(&pool->not_empty_cond);
-        pthread_cond_destroy(&pool->not_full_cond);
-        free(pool);
-        return NULL;
+        if (errno == ENOMEM) proxy_log_error("Thread pool creation error: %s", strerror(errno));
+        else proxy_log_error("Thread pool creation error: failed to reallocate memory");
+        goto destroy_pool;
     }
-    char thread_name[16];
-    // Создание потоков-исполнителей
+    memset(pool->executors, 0, sizeof(executor_t) * (size_t) executor_count);
     for (int i = 0; i < executor_count; i++) {
-        pthread_create(&pool->executors[i], NULL, executor_routine, pool);
-        snprintf(thread_name, 16, "thread-pool-%d", i);
-        pthread_setname_np(thread_name);
+        executor_t *executor = &pool->executors[i];
+        executor->deque.buffer = calloc((size_t) capacity, sizeof(_Atomic(task_t *)));
+        if (executor->deque.buffer == NULL) {
+            proxy_log_error("Thread pool creation error: %s", strerror(errno));
+            for (int j = 0; j < i; j++) free(pool->executors[j].deque.buffer);
+            free(pool->executors);
+            goto destroy_pool;
+        }
+        executor->deque.mask = capacity - 1;
+        atomic_init(&executor->deque.top, 0);
+        atomic_init(&executor->deque.bottom, 0);
+        atomic_init(&executor->inbox, NULL);
+        executor->pool = pool;
+        executor->index = i;
+        executor->rng = 0x9E3779B97F4A7C15ULL * (uint64_t) (i + 1);
     }
+    // Создание потоков-исполнителей (имена потоки устанавливают себе сами)
+    for (int i = 0; i < executor_count; i++) pthread_create(&pool->executors[i].thread, NULL, executor_routine, &pool->executors[i]);
     return pool;
+
+    destroy_pool:
+    pthread_mutex_destroy(&pool->global_mutex);
+#ifndef CACHE_PROXY_HAVE_FUTEX
+    pthread_mutex_destroy(&pool->park_mutex);
+    pthread_cond_destroy(&pool->park_cond);
+#endif
+    free(pool);
+    return NULL;
 }
 
 /**
@@ -127,32 +270,47 @@ thread_pool_t * thread_pool_create(int executor_count, int task_queue_capacity)
  * @param arg Аргумент для передачи в функцию routine
  * @details Алгоритм работы:
  *          1. Проверяет, не завершен ли пул (shutdown флаг)
- *          2. Захватывает мьютекс для синхронизации доступа к очереди
- *          3. Ожидает, пока в очереди не появится свободное место
- *          4. Добавляет задачу в циклическую очередь
- *          5. Сигнализирует потокам-исполнителям о новой задаче
- *          6. Освобождает мьютекс
- */
-void thread_pool_execute(thread_pool_t *pool, routine_t routine, void *arg) {
-    if (pool->shutdown) {
-        proxy_log("Thread pool execution error: thread pool was shutdown");
-        return;
+ *          2. Создает задачу
+ *          3. Если вызов идет из исполнителя этого же пула - кладет задачу в его дек
+ *          4. Иначе кладет задачу во входящую очередь следующего по кругу исполнителя (CAS)
+ *          5. Увеличивает счетчик ожидающих задач и будит спящий поток, если он есть
+ * @return 0 если задача поставлена в очередь, -1 если пул уже остановлен
+ */
+int thread_pool_execute(thread_pool_t *pool, routine_t routine, void *arg) {
+    if (atomic_load(&pool->shutdown)) {
+        proxy_log_error("Thread pool execution error: thread pool was shutdown");
+        return ERROR;
     }
-    pthread_mutex_lock(&pool->mutex); // Захват мьютекса для синхронизации
-    while (pool->size == pool->capacity && !pool->shutdown) pthread_cond_wait(&pool->not_full_cond, &pool->mutex); // Проверяет, заполнена ли очередь, и если да - ждет сигнала
-    if (pool->shutdown) {
-        pthread_mutex_unlock(&pool->mutex);
-        return;
+    errno = 0;
+    task_t *task = malloc(sizeof(task_t));
+    if (task == NULL) {
+        proxy_log_error("Thread pool execution error: %s", strerror(errno));
+        return ERROR;
     }
-    // Помещает новую задачу в конец очереди и обновляет индекс
-    pool->tasks[pool->rear].id = id_counter++;
-    pool->tasks[pool->rear].routine = routine;
-    pool->tasks[pool->rear].arg = arg;
-    pool->rear = (pool->rear + 1) % pool->capacity;
-    pool->size++;
-    // Пробуждает один поток, ожидающий на условной переменной not_empty_cond
-    pthread_cond_signal(&pool->not_empty_cond);
-    pthread_mutex_unlock(&pool->mutex);
+    task->id = atomic_fetch_add_explicit(&id_counter, 1, memory_order_relaxed);
+    task->routine = routine;
+    task->arg = arg;
+    task->enqueued_us = metrics_now_us();
+    executor_t *executor = current_executor;
+    if (executor == NULL || executor->pool != pool || deque_push(&executor->deque, task) == ERROR) {
+        unsigned index = atomic_fetch_add_explicit(&pool->next_executor, 1, memory_order_relaxed);
+        executor = &pool->executors[index % (unsigned) pool->num_executors];
+        task->next = atomic_load_explicit(&executor->inbox, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&executor->inbox, &task->next, task,
+                                                      memory_order_release, memory_order_relaxed));
+    }
+    atomic_fetch_add(&pool->pending, 1); // seq_cst: упорядочено с проверкой sleepers ниже (см. park_executor)
+    wake_executor(pool);
+    return SUCCESS;
+}
+
+/**
+ * @brief Возвращает количество задач, ожидающих свободного потока
+ * @param pool Указатель на структуру пула потоков
+ * @return Количество поставленных, но еще не взятых на выполнение задач
+ */
+int thread_pool_pending(thread_pool_t *pool) {
+    return (int) atomic_load_explicit(&pool->pending, memory_order_relaxed);
 }
 
 /**
@@ -160,62 +318,307 @@ void thread_pool_execute(thread_pool_t *pool, routine_t routine, void *arg) {
  * @param pool Указатель на структуру пула потоков для остановки
  * @details Алгоритм работы:
  *          1. Устанавливает флаг shutdown в 1
- *          2. Пробуждает все потоки, ожидающие на условных переменных
+ *          2. Будит все спящие потоки-исполнители
  *          3. Ожидает завершения всех потоков-исполнителей
- *          4. Освобождает все выделенные ресурсы
+ *          4. Освобождает невыполненные задачи, деки и общую очередь
  *          5. Уничтожает объекты синхронизации
  *          6. Освобождает память структуры пула
  */
 void thread_pool_shutdown(thread_pool_t *pool) {
-    pool->shutdown = 1;
-    // Пробуждение всех ожидающих потоков
-    pthread_cond_broadcast(&pool->not_empty_cond);
-    pthread_cond_broadcast(&pool->not_full_cond);
+    atomic_store(&pool->shutdown, 1);
+    // Пробуждение всех спящих потоков
+    atomic_fetch_add(&pool->wake_seq, 1);
+#ifdef CACHE_PROXY_HAVE_FUTEX
+    syscall(SYS_futex, &pool->wake_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&pool->park_mutex);
+    pthread_cond_broadcast(&pool->park_cond);
+    pthread_mutex_unlock(&pool->park_mutex);
+#endif
     // Блокирует текущий поток до завершения каждого потока-исполнителя
-    for (int i = 0; i < pool->num_executors; i++) pthread_join(pool->executors[i], NULL);
-    free(pool->tasks);
+    for (int i = 0; i < pool->num_executors; i++) pthread_join(pool->executors[i].thread, NULL);
+    for (int i = 0; i < pool->num_executors; i++) {
+        executor_t *executor = &pool->executors[i];
+        task_t *task;
+        while ((task = deque_pop(&executor->deque)) != NULL) free(task);
+        task = atomic_load(&executor->inbox);
+        while (task != NULL) {
+            task_t *next = task->next;
+            free(task);
+            task = next;
+        }
+        free(executor->deque.buffer);
+    }
+    while (pool->global_head != NULL) {
+        task_t *next = pool->global_head->next;
+        free(pool->global_head);
+        pool->global_head = next;
+    }
     free(pool->executors);
-    pthread_mutex_destroy(&pool->mutex);
-    pthread_cond_destroy(&pool->not_empty_cond);
-    pthread_cond_destroy(&pool->not_full_cond);
+    pthread_mutex_destroy(&pool->global_mutex);
+#ifndef CACHE_PROXY_HAVE_FUTEX
+    pthread_mutex_destroy(&pool->park_mutex);
+    pthread_cond_destroy(&pool->park_cond);
+#endif
     free(pool);
 }
 
 /**
- * @brief Функция-исполнитель, выполняющая задачи из очереди пула потоков
- * @param arg Указатель на структуру thread_pool_t
+ * @brief Функция-исполнитель, выполняющая задачи пула потоков
+ * @param arg Указатель на структуру executor_t
  * @return NULL
  * @details Алгоритм работы потока-исполнителя:
- *          1. Бесконечный цикл ожидания и выполнения задач
- *          2. Захватывает мьютекс для доступа к очереди
- *          3. Ожидает, пока в очереди не появится задача
- *          4. Если пул остановлен - завершает работу потока
- *          5. Извлекает задачу из начала очереди
- *          6. Сигнализирует, что в очереди появилось свободное место
- *          7. Выполняет задачу вне критической секции
- *          8. Возвращается к ожиданию следующей задачи
+ *          1. Берет задачу с нижнего конца своего дека (свежие задачи, горячие в кэше)
+ *          2. Если дек пуст - забирает свою входящую очередь: самую старую задачу выполняет,
+ *             остальные перекладывает в дек
+ *          3. Если и она пуста - берет задачу из общей очереди
+ *          4. Если работы нет - крадет у соседей, начиная со случайного;
+ *             пока идет поиск, постановка задач не будит спящих; последний ищущий,
+ *             найдя задачу, будит следующего, если задачи еще остались
+ *          5. Если красть нечего - засыпает, пока не появится новая задача
+ *          6. Выполняет задачу вне каких-либо блокировок
+ *          7. Завершает работу, когда установлен флаг shutdown
  */
 static void *executor_routine(void *arg) {
-    thread_pool_t *pool = (thread_pool_t *) arg;
-    // Запускает цикл потока-исполнителя
-    while (1) {
-        pthread_mutex_lock(&pool->mutex);
-        // Ожидание появления задач в очереди
-        while (pool->size == 0 && !pool->shutdown) pthread_cond_wait(&pool->not_empty_cond, &pool->mutex);
-        if (pool->shutdown) {
-            pthread_mutex_unlock(&pool->mutex);
-            pthread_exit(NULL);
+    executor_t *executor = (executor_t *) arg;
+    thread_pool_t *pool = executor->pool;
+    current_executor = executor;
+    char thread_name[16];
+    snprintf(thread_name, sizeof(thread_name), "thread-pool-%d", executor->index);
+    proxy_set_thread_name(thread_name);
+    while (!atomic_load_explicit(&pool->shutdown, memory_order_relaxed)) {
+        task_t *task = deque_pop(&executor->deque);
+        if (task == NULL) task = take_inbox(executor, executor);
+        if (task == NULL) {
+            atomic_fetch_add(&pool->searching, 1);
+            task = take_global(pool);
+            if (task == NULL) task = steal_task(executor);
+            int last_searching = atomic_fetch_sub(&pool->searching, 1) == 1;
+            // Пока шел поиск, новые задачи никого не будили: последний ищущий передает эстафету
+            if (task != NULL && last_searching && atomic_load(&pool->pending) > 1) wake_executor(pool);
         }
-        // Берет задачу из начала очереди и обновляет состояние
-        task_t task = pool->tasks[pool->front]; // Копируем структуру задачи
-        pool->front = (pool->front + 1) % pool->capacity; // Увеличиваем front с циклическим переносом
-        pool->size--;
-        // Пробуждает один поток, ожидающий на not_full_cond
-        pthread_cond_signal(&pool->not_full_cond);
-        pthread_mutex_unlock(&pool->mutex);
+        if (task == NULL) {
+            park_executor(pool);
+            continue;
+        }
+        atomic_fetch_sub_explicit(&pool->pending, 1, memory_order_relaxed);
+        task_t copy = *task;
+        free(task);
+        metrics_record(METRIC_POOL_TASK_WAIT, metrics_now_us() - copy.enqueued_us);
+        metrics_add(METRIC_POOL_TASKS, 1);
         // Выполнение задачи
-        proxy_log("Start executing task %d", task.id);
-        task.routine(task.arg);
-        proxy_log("Finish executing task %d", task.id);
+        proxy_log_debug("Start executing task %ld", copy.id);
+        copy.routine(copy.arg);
+        proxy_log_debug("Finish executing task %ld", copy.id);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Кладет задачу на нижний конец дека (только владелец)
+ * @param deque Дек
+ * @param task  Задача
+ * @return SUCCESS или ERROR, если дек заполнен
+ * @details Ячейка записывается до публикации нового bottom (release),
+ *          поэтому вор, увидевший bottom, видит и задачу. Барьеры заменены упорядочиванием
+ *          самих операций: atomic_thread_fence не поддерживается ThreadSanitizer.
+ */
+static int deque_push(deque_t *deque, task_t *task) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top > deque->mask) return ERROR;
+    atomic_store_explicit(&deque->buffer[bottom & deque->mask], task, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return SUCCESS;
+}
+
+/**
+ * @brief Берет задачу с нижнего конца дека (только владелец)
+ * @param deque Дек
+ * @return Задача или NULL, если дек пуст
+ * @details Алгоритм работы:
+ *          1. Уменьшает bottom, резервируя последнюю задачу; запись и следующее чтение top
+ *             seq_cst, чтобы воры увидели резерв раньше, чем владелец прочитает top
+ *          2. Если задач больше одной - забирает задачу без CAS
+ *          3. Если задача последняя - соревнуется за нее с ворами через CAS на top
+ *          4. Восстанавливает bottom, если дек оказался пуст
+ */
+static task_t *deque_pop(deque_t *deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_seq_cst);
+    if (top > bottom) { // Дек пуст
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    task_t *task = atomic_load_explicit(&deque->buffer[bottom & deque->mask], memory_order_relaxed);
+    if (top == bottom) { // Последняя задача: ее может забирать и вор
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+/**
+ * @brief Крадет задачу с верхнего конца дека
+ * @param deque Дек
+ * @return Задача или NULL, если дек пуст или задачу забрал другой поток
+ */
+static task_t *deque_steal(deque_t *deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_seq_cst);
+    if (top >= bottom) return NULL;
+    task_t *task = atomic_load_explicit(&deque->buffer[top & deque->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return task;
+}
+
+/**
+ * @brief Забирает входящую очередь исполнителя victim целиком
+ * @param executor Исполнитель, который забирает задачи
+ * @param victim   Исполнитель, чья входящая очередь забирается (может совпадать с executor)
+ * @return Самая старая задача (ее нужно выполнить) или NULL, если очередь пуста
+ * @details Алгоритм работы:
+ *          1. Атомарно забирает весь стек (от новых задач к старым)
+ *          2. Самую старую задачу возвращает для выполнения
+ *          3. Остальные кладет в свой дек, начиная с новых, чтобы владелец брал их
+ *             от старых к новым, а воры - от новых к старым
+ *          4. Самые новые задачи, которым не хватило места в деке, переносит в общую очередь
+ */
+static task_t *take_inbox(executor_t *executor, executor_t *victim) {
+    if (atomic_load_explicit(&victim->inbox, memory_order_relaxed) == NULL) return NULL;
+    task_t *stack = atomic_exchange_explicit(&victim->inbox, NULL, memory_order_acquire);
+    if (stack == NULL) return NULL;
+    long count = 0;
+    for (task_t *task = stack; task != NULL; task = task->next) count++;
+    deque_t *deque = &executor->deque;
+    long free_slots = (long) (deque->mask + 1) - (long) (atomic_load_explicit(&deque->bottom, memory_order_relaxed)
+                                                          - atomic_load_explicit(&deque->top, memory_order_relaxed));
+    long spill = count - 1 - free_slots;
+    task_t *spilled = NULL, *spilled_tail = NULL;
+    long spilled_count = 0;
+    while (spill-- > 0) { // Новые задачи в общую очередь; разворот дает порядок от старых к новым
+        task_t *task = stack;
+        stack = task->next;
+        task->next = spilled;
+        spilled = task;
+        if (spilled_tail == NULL) spilled_tail = task;
+        spilled_count++;
+    }
+    if (spilled != NULL) {
+        pthread_mutex_lock(&executor->pool->global_mutex);
+        if (executor->pool->global_tail != NULL) executor->pool->global_tail->next = spilled;
+        else executor->pool->global_head = spilled;
+        executor->pool->global_tail = spilled_tail;
+        atomic_fetch_add(&executor->pool->global_size, spilled_count);
+        pthread_mutex_unlock(&executor->pool->global_mutex);
+    }
+    while (stack->next != NULL) {
+        task_t *task = stack;
+        stack = task->next;
+        if (deque_push(deque, task) == ERROR) { // Дек успели заполнить - отдает задачу в общую очередь
+            task->next = NULL;
+            pthread_mutex_lock(&executor->pool->global_mutex);
+            if (executor->pool->global_tail != NULL) executor->pool->global_tail->next = task;
+            else executor->pool->global_head = task;
+            executor->pool->global_tail = task;
+            atomic_fetch_add(&executor->pool->global_size, 1);
+            pthread_mutex_unlock(&executor->pool->global_mutex);
+        }
+    }
+    return stack;
+}
+
+/**
+ * @brief Берет задачу из общей очереди
+ * @param pool Пул потоков
+ * @return Задача или NULL, если очередь пуста
+ */
+static task_t *take_global(thread_pool_t *pool) {
+    if (atomic_load_explicit(&pool->global_size, memory_order_relaxed) == 0) return NULL;
+    pthread_mutex_lock(&pool->global_mutex);
+    task_t *task = pool->global_head;
+    if (task != NULL) {
+        pool->global_head = task->next;
+        if (pool->global_head == NULL) pool->global_tail = NULL;
+        atomic_fetch_sub(&pool->global_size, 1);
+    }
+    pthread_mutex_unlock(&pool->global_mutex);
+    return task;
+}
+
+/**
+ * @brief Пытается украсть задачу у других исполнителей, начиная со случайного
+ * @param executor Исполнитель, который ищет работу
+ * @return Задача или NULL, если красть нечего
+ * @details У каждого соседа сначала пробует дек, затем входящую очередь:
+ *          занятый долгой задачей исполнитель не должен задерживать адресованные ему задачи.
+ */
+static task_t *steal_task(executor_t *executor) {
+    thread_pool_t *pool = executor->pool;
+    executor->rng ^= executor->rng << 13; // xorshift64
+    executor->rng ^= executor->rng >> 7;
+    executor->rng ^= executor->rng << 17;
+    int start = (int) (executor->rng % (uint64_t) pool->num_executors);
+    for (int i = 0; i < pool->num_executors; i++) {
+        executor_t *victim = &pool->executors[(start + i) % pool->num_executors];
+        if (victim == executor) continue;
+        task_t *task = deque_steal(&victim->deque);
+        if (task == NULL) task = take_inbox(executor, victim);
+        if (task != NULL) return task;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Будит один спящий поток-исполнитель, если такие есть и никто не ищет задачи
+ * @param pool Пул потоков
+ * @details Когда спящих нет, стоит двух чтений: все исполнители заняты
+ *          и найдут задачу сами, закончив текущую. Ищущий исполнитель перед сном
+ *          проверяет счетчик задач, поэтому будить кого-то еще незачем.
+ */
+static void wake_executor(thread_pool_t *pool) {
+    if (atomic_load(&pool->searching) > 0 || atomic_load(&pool->sleepers) == 0) return;
+    atomic_fetch_add(&pool->wake_seq, 1);
+#ifdef CACHE_PROXY_HAVE_FUTEX
+    syscall(SYS_futex, &pool->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&pool->park_mutex);
+    pthread_cond_signal(&pool->park_cond);
+    pthread_mutex_unlock(&pool->park_mutex);
+#endif
+}
+
+/**
+ * @brief Усыпляет поток-исполнитель, пока в пуле нет задач
+ * @param pool Пул потоков
+ * @details Алгоритм работы:
+ *          1. Запоминает счетчик пробуждений и увеличивает число спящих
+ *          2. Проверяет счетчик ожидающих задач: постановка увеличивает его до проверки
+ *             спящих, а сон - число спящих до проверки задач (обе операции seq_cst),
+ *             поэтому хотя бы одна сторона видит другую и пробуждение не теряется
+ *          3. Если задачи есть - уступает процессор и возвращается к поиску
+ *             (задача может быть в пути между очередями)
+ *          4. Иначе спит на futex, пока счетчик пробуждений не изменится
+ */
+static void park_executor(thread_pool_t *pool) {
+    unsigned seq = atomic_load(&pool->wake_seq);
+    atomic_fetch_add(&pool->sleepers, 1);
+    if (atomic_load(&pool->pending) > 0 || atomic_load(&pool->shutdown)) {
+        atomic_fetch_sub(&pool->sleepers, 1);
+        sched_yield();
+        return;
     }
+#ifdef CACHE_PROXY_HAVE_FUTEX
+    syscall(SYS_futex, &pool->wake_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&pool->park_mutex);
+    while (atomic_load(&pool->wake_seq) == seq) pthread_cond_wait(&pool->park_cond, &pool->park_mutex);
+    pthread_mutex_unlock(&pool->park_mutex);
+#endif
+    atomic_fetch_sub(&pool->sleepers, 1);
 }
@@ -0,0 +1,193 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define TRACE_BUFFER_EVENTS     16384 // Этапов на поток (около 512 КБ)
+#define TRACE_THREAD_NAME_SIZE  16
+
+/**
+ * @brief Записанный этап запроса
+ * @var name     Имя этапа (строковый литерал)
+ * @var request  Идентификатор запроса
+ * @var start    Время начала (мкс, монотонные часы)
+ * @var duration Длительность (мкс)
+ */
+struct trace_event_t {
+    const char *name;
+    uint64_t request;
+    uint64_t start;
+    uint64_t duration;
+};
+typedef struct trace_event_t trace_event_t;
+
+/**
+ * @brief Буфер этапов одного потока
+ * @details Выделяется при первой записи в потоке и живет до trace_dump:
+ *          этапы завершившихся потоков тоже попадают в файл.
+ * @var tid         Номер потока в трассе
+ * @var thread_name Имя потока
+ * @var count       Количество записанных этапов (пишет только поток-владелец)
+ * @var dropped     Количество этапов, не поместившихся в буфер
+ * @var next        Следующий буфер в списке всех буферов
+ * @var events      Этапы
+ */
+struct trace_buffer_t {
+    int tid;
+    char thread_name[TRACE_THREAD_NAME_SIZE];
+    atomic_size_t count;
+    atomic_size_t dropped;
+    _Atomic(struct trace_buffer_t *) next;
+    trace_event_t events[TRACE_BUFFER_EVENTS];
+};
+typedef struct trace_buffer_t trace_buffer_t;
+
+int trace_sample_rate = 0;
+_Thread_local uint64_t trace_current = 0;
+
+static const char *trace_path = NULL;                    // Файл для trace_dump
+static uint64_t trace_origin = 0;                        // Время включения трассировки, от него отсчитываются метки
+static atomic_uint_fast64_t request_counter = 0;         // Источник идентификаторов запросов
+static atomic_int tid_counter = 0;                       // Источник номеров потоков
+static _Atomic(trace_buffer_t *) buffers = NULL;         // Буферы всех потоков (только добавляются)
+static _Thread_local trace_buffer_t *local_buffer = NULL; // Буфер текущего потока
+static _Thread_local unsigned long sample_counter = 0;   // Запросы текущего потока
+
+/**
+ * @brief Возвращает буфер текущего потока, создавая его при первом вызове
+ * @return Буфер или NULL, если выделить его не удалось
+ */
+static trace_buffer_t *trace_get_buffer(void);
+
+/**
+ * @brief Включает трассировку
+ * @param sample_rate Трассировать каждый sample_rate-й запрос потока (0 - выключить)
+ * @param path        Файл, в который trace_dump выведет трассы
+ */
+void trace_init(int sample_rate, const char *path) {
+    trace_sample_rate = sample_rate > 0 ? sample_rate : 0;
+    trace_path = path;
+    trace_origin = trace_now_us();
+    if (trace_sample_rate > 0) proxy_log("Tracing every %d request per thread into %s", trace_sample_rate, trace_path);
+}
+
+/**
+ * @brief Выбирает, трассировать ли очередной запрос потока, и заполняет trace_current
+ * @details Счетчик запросов у каждого потока свой, поэтому выбор не требует синхронизации;
+ *          атомарный счетчик идентификаторов трогают только выбранные запросы.
+ */
+void trace_sample_request(void) {
+    trace_current = 0;
+    if (++sample_counter % (unsigned long) trace_sample_rate != 0) return;
+    trace_current = atomic_fetch_add_explicit(&request_counter, 1, memory_order_relaxed) + 1;
+}
+
+/**
+ * @brief Возвращает текущее время монотонных часов в микросекундах
+ * @return Время в микросекундах
+ */
+uint64_t trace_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Записывает этап запроса trace_current в буфер текущего потока
+ * @param name  Имя этапа (строковый литерал)
+ * @param start Время начала этапа (trace_now_us)
+ */
+void trace_record(const char *name, uint64_t start) {
+    trace_buffer_t *buffer = trace_get_buffer();
+    if (buffer == NULL) return;
+    size_t count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    if (count == TRACE_BUFFER_EVENTS) {
+        atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    trace_event_t *event = &buffer->events[count];
+    event->name = name;
+    event->request = trace_current;
+    event->start = start;
+    event->duration = trace_now_us() - start;
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release); // Публикует этап целиком
+}
+
+/**
+ * @brief Выводит записанные трассы в файл, заданный в trace_init, и освобождает буферы
+ * @details Алгоритм работы:
+ *          1. Открывает файл и начинает объект {"traceEvents": [...]}
+ *          2. Для каждого буфера выводит событие метаданных с именем потока
+ *             и этапы как события "X" (начало и длительность в микросекундах от trace_init)
+ *          3. Сообщает в лог о потерянных из-за переполнения этапах
+ *          4. Освобождает буферы
+ */
+void trace_dump(void) {
+    if (trace_sample_rate == 0) return;
+    FILE *out = fopen(trace_path, "w");
+    if (out == NULL) {
+        proxy_log_error("Trace dumping error: %s: %s", trace_path, strerror(errno));
+        return;
+    }
+    int pid = (int) getpid();
+    size_t total = 0, dropped = 0;
+    const char *separator = "";
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (trace_buffer_t *buffer = atomic_load(&buffers); buffer != NULL; buffer = atomic_load(&buffer->next)) {
+        fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                separator, pid, buffer->tid, buffer->thread_name);
+        separator = ",";
+        size_t count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            trace_event_t *event = &buffer->events[i];
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,"
+                         "\"args\":{\"request\":%llu}}",
+                    event->name, (unsigned long long) (event->start - trace_origin), (unsigned long long) event->duration,
+                    pid, buffer->tid, (unsigned long long) event->request);
+        }
+        total += count;
+        dropped += atomic_load(&buffer->dropped);
+    }
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) proxy_log_error("Trace dumping error: %s: %s", trace_path, strerror(errno));
+    else proxy_log("Trace: %zu spans written to %s", total, trace_path);
+    if (dropped > 0) proxy_log_error("Trace error: %zu spans dropped, per-thread buffers are full", dropped);
+    trace_buffer_t *buffer = atomic_exchange(&buffers, NULL);
+    while (buffer != NULL) {
+        trace_buffer_t *next = atomic_load(&buffer->next);
+        free(buffer);
+        buffer = next;
+    }
+}
+
+/**
+ * @brief Возвращает буфер текущего потока, создавая его при первом вызове
+ * @return Буфер или NULL, если выделить его не удалось
+ * @details Новый буфер добавляется в начало списка через CAS; порядок буферов
+ *          в файле не важен, потоки различаются номерами.
+ */
+static trace_buffer_t *trace_get_buffer(void) {
+    if (local_buffer != NULL) return local_buffer;
+    trace_buffer_t *buffer = malloc(sizeof(trace_buffer_t));
+    if (buffer == NULL) return NULL;
+    buffer->tid = atomic_fetch_add(&tid_counter, 1) + 1;
+    if (pthread_getname_np(pthread_self(), buffer->thread_name, sizeof(buffer->thread_name)) != 0) {
+        snprintf(buffer->thread_name, sizeof(buffer->thread_name), "thread-%d", buffer->tid);
+    }
+    atomic_init(&buffer->count, 0);
+    atomic_init(&buffer->dropped, 0);
+    trace_buffer_t *head = atomic_load(&buffers);
+    do {
+        atomic_store(&buffer->next, head);
+    } while (!atomic_compare_exchange_weak(&buffers, &head, buffer));
+    local_buffer = buffer;
+    return buffer;
+}
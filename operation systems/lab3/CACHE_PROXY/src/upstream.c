@@ -0,0 +1,364 @@
+#include "upstream.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "hash.h"
+#include "log.h"
+
+#define MIN(x, y) (x < y) ? x : y
+
+#define UPSTREAM_BUCKET_COUNT   64  // Количество корзин таблицы серверов (степень двойки)
+
+/**
+ * @brief Простаивающее соединение с сервером
+ * @var socket     Дескриптор сокета
+ * @var idle_since Время возврата соединения в пул (мс, proxy_clock_now_ms)
+ * @var next       Следующее (более давнее) соединение того же сервера
+ */
+typedef struct upstream_conn_t {
+    int socket;
+    long long idle_since;
+    struct upstream_conn_t *next;
+} upstream_conn_t;
+
+/**
+ * @brief Сервер и его простаивающие соединения
+ * @details Соединения хранятся стеком: последнее возвращенное выдается первым,
+ *          потому что сервер вряд ли успел его закрыть. Поэтому список упорядочен
+ *          от новых к старым, и устаревшие соединения всегда находятся в его конце.
+ * @var host       Имя хоста
+ * @var port       Порт
+ * @var hash       Хэш пары (хост, порт)
+ * @var idle       Список простаивающих соединений
+ * @var idle_count Длина списка idle
+ * @var next       Следующий сервер в цепочке коллизий
+ */
+typedef struct upstream_host_t {
+    char *host;
+    int port;
+    uint64_t hash;
+    upstream_conn_t *idle;
+    int idle_count;
+    struct upstream_host_t *next;
+} upstream_host_t;
+
+/**
+ * @brief Пул постоянных соединений с серверами
+ * @var mutex             Мьютекс, защищающий таблицу серверов
+ * @var reaper_cond       Условная переменная, по которой фоновый поток будят при уничтожении пула
+ * @var buckets           Корзины таблицы серверов
+ * @var max_idle_per_host Предел простаивающих соединений одного сервера
+ * @var idle_timeout_ms   Время простоя, после которого соединение закрывается
+ * @var idle_count        Общее количество простаивающих соединений
+ * @var hits              Счетчик запросов, получивших соединение из пула
+ * @var misses            Счетчик запросов, не нашедших соединения в пуле
+ * @var reaper_running    Атомарный флаг работы фонового потока
+ * @var reaper            Дескриптор фонового потока
+ */
+struct upstream_pool_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t reaper_cond;
+    upstream_host_t *buckets[UPSTREAM_BUCKET_COUNT];
+    int max_idle_per_host;
+    time_t idle_timeout_ms;
+    size_t idle_count;
+    atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_int reaper_running;
+    pthread_t reaper;
+};
+
+/**
+ * @brief Находит сервер в таблице
+ * @param pool   Пул (мьютекс должен быть захвачен)
+ * @param host   Имя хоста
+ * @param port   Порт
+ * @param hash   Хэш пары (хост, порт)
+ * @param create 1 чтобы добавить отсутствующий сервер
+ * @return Сервер или NULL, если его нет (или не удалось выделить память)
+ */
+static upstream_host_t *find_host(upstream_pool_t *pool, const char *host, int port, uint64_t hash, int create);
+
+/**
+ * @brief Проверяет, что сервер не закрыл простаивающее соединение
+ * @param socket Дескриптор сокета
+ * @return 1 если соединение можно использовать, 0 если нет
+ */
+static int connection_alive(int socket);
+
+/**
+ * @brief Функция фонового потока, закрывающего простаивающие соединения
+ * @param arg Указатель на upstream_pool_t
+ */
+static void *reaper_routine(void *arg);
+
+/**
+ * @brief Создает пул соединений и запускает поток, закрывающий простаивающие соединения
+ * @param max_idle_per_host Сколько простаивающих соединений хранится для одного сервера
+ * @param idle_timeout_ms Через сколько миллисекунд простоя соединение закрывается
+ * @return Указатель на пул или NULL при ошибке
+ */
+upstream_pool_t *upstream_pool_create(int max_idle_per_host, time_t idle_timeout_ms) {
+    errno = 0;
+    upstream_pool_t *pool = calloc(1, sizeof(upstream_pool_t));
+    if (pool == NULL) {
+        proxy_log_error("Upstream pool creation error: %s", strerror(errno));
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->reaper_cond, NULL);
+    pool->max_idle_per_host = max_idle_per_host;
+    pool->idle_timeout_ms = idle_timeout_ms;
+    atomic_init(&pool->hits, 0);
+    atomic_init(&pool->misses, 0);
+    atomic_store(&pool->reaper_running, 1);
+    if (pthread_create(&pool->reaper, NULL, reaper_routine, pool) != 0) {
+        proxy_log_error("Upstream pool creation error: failed to create reaper thread");
+        pthread_cond_destroy(&pool->reaper_cond);
+        pthread_mutex_destroy(&pool->mutex);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/**
+ * @brief Забирает из пула живое соединение с сервером
+ * @param pool Пул соединений
+ * @param host Имя хоста сервера
+ * @param port Порт сервера
+ * @return Дескриптор сокета или ERROR, если подходящего соединения нет
+ * @details Алгоритм работы:
+ *          1. Под мьютексом снимает с вершины стека сервера последнее возвращенное соединение
+ *          2. Вне мьютекса проверяет, что сервер его не закрыл; закрытое отбрасывает
+ *             и берет следующее
+ *          3. Обновляет счетчик попаданий или промахов
+ */
+int upstream_take(upstream_pool_t *pool, const char *host, int port) {
+    uint64_t hash = hash_bytes(host, strlen(host), (uint64_t) port);
+    for (;;) {
+        upstream_conn_t *conn = NULL;
+        pthread_mutex_lock(&pool->mutex);
+        upstream_host_t *entry = find_host(pool, host, port, hash, 0);
+        if (entry != NULL && entry->idle != NULL) {
+            conn = entry->idle;
+            entry->idle = conn->next;
+            entry->idle_count--;
+            pool->idle_count--;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        if (conn == NULL) {
+            atomic_fetch_add(&pool->misses, 1);
+            return ERROR;
+        }
+        int socket = conn->socket;
+        free(conn);
+        if (connection_alive(socket)) {
+            atomic_fetch_add(&pool->hits, 1);
+            return socket;
+        }
+        close(socket); // Сервер закрыл соединение, пока оно простаивало
+    }
+}
+
+/**
+ * @brief Возвращает соединение в пул после полностью прочитанного ответа
+ * @param pool Пул соединений
+ * @param host Имя хоста сервера
+ * @param port Порт сервера
+ * @param socket Дескриптор сокета
+ * @details Соединение кладется на вершину стека сервера. Если стек заполнен
+ *          или памяти не хватило, сокет закрывается.
+ */
+void upstream_put(upstream_pool_t *pool, const char *host, int port, int socket) {
+    uint64_t hash = hash_bytes(host, strlen(host), (uint64_t) port);
+    errno = 0;
+    upstream_conn_t *conn = malloc(sizeof(upstream_conn_t));
+    if (conn == NULL) {
+        proxy_log_error("Upstream pool error: %s", strerror(errno));
+        close(socket);
+        return;
+    }
+    conn->socket = socket;
+    conn->idle_since = proxy_clock_now_ms();
+    pthread_mutex_lock(&pool->mutex);
+    upstream_host_t *entry = find_host(pool, host, port, hash, 1);
+    if (entry != NULL && entry->idle_count < pool->max_idle_per_host) {
+        conn->next = entry->idle;
+        entry->idle = conn;
+        entry->idle_count++;
+        pool->idle_count++;
+        conn = NULL;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    if (conn != NULL) {
+        close(conn->socket);
+        free(conn);
+    }
+}
+
+/**
+ * @brief Возвращает счетчики пула
+ * @param pool Пул соединений
+ * @param stats Указатель для сохранения счетчиков
+ */
+void upstream_get_stats(upstream_pool_t *pool, upstream_stats_t *stats) {
+    stats->hits = atomic_load(&pool->hits);
+    stats->misses = atomic_load(&pool->misses);
+    pthread_mutex_lock(&pool->mutex);
+    stats->idle = pool->idle_count;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * @brief Останавливает фоновый поток, закрывает все соединения и уничтожает пул
+ * @param pool Пул соединений
+ */
+void upstream_pool_destroy(upstream_pool_t *pool) {
+    if (pool == NULL) return;
+    pthread_mutex_lock(&pool->mutex);
+    atomic_store(&pool->reaper_running, 0);
+    pthread_cond_signal(&pool->reaper_cond); // Поток не дожидается конца периода
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_join(pool->reaper, NULL);
+    for (int i = 0; i < UPSTREAM_BUCKET_COUNT; i++) {
+        upstream_host_t *entry = pool->buckets[i];
+        while (entry != NULL) {
+            upstream_host_t *next = entry->next;
+            upstream_conn_t *conn = entry->idle;
+            while (conn != NULL) {
+                upstream_conn_t *next_conn = conn->next;
+                close(conn->socket);
+                free(conn);
+                conn = next_conn;
+            }
+            free(entry->host);
+            free(entry);
+            entry = next;
+        }
+    }
+    pthread_cond_destroy(&pool->reaper_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+/**
+ * @brief Находит сервер в таблице
+ * @param pool Пул (мьютекс должен быть захвачен)
+ * @param host Имя хоста
+ * @param port Порт
+ * @param hash Хэш пары (хост, порт)
+ * @param create 1 чтобы добавить отсутствующий сервер
+ * @return Сервер или NULL, если его нет (или не удалось выделить память)
+ */
+static upstream_host_t *find_host(upstream_pool_t *pool, const char *host, int port, uint64_t hash, int create) {
+    upstream_host_t **bucket = &pool->buckets[hash & (UPSTREAM_BUCKET_COUNT - 1)];
+    for (upstream_host_t *entry = *bucket; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->port == port && strcmp(entry->host, host) == 0) return entry;
+    }
+    if (!create) return NULL;
+    errno = 0;
+    upstream_host_t *entry = malloc(sizeof(upstream_host_t));
+    char *host_copy = strdup(host);
+    if (entry == NULL || host_copy == NULL) {
+        proxy_log_error("Upstream pool error: %s", strerror(errno));
+        free(entry);
+        free(host_copy);
+        return NULL;
+    }
+    entry->host = host_copy;
+    entry->port = port;
+    entry->hash = hash;
+    entry->idle = NULL;
+    entry->idle_count = 0;
+    entry->next = *bucket;
+    *bucket = entry;
+    return entry;
+}
+
+/**
+ * @brief Проверяет, что сервер не закрыл простаивающее соединение
+ * @param socket Дескриптор сокета
+ * @return 1 если соединение можно использовать, 0 если нет
+ * @details Между ответами сервер не должен ничего присылать, поэтому неблокирующее
+ *          чтение с MSG_PEEK должно вернуть EAGAIN. Закрытие соединения (0),
+ *          ошибка или лишние данные означают, что соединение использовать нельзя.
+ */
+static int connection_alive(int socket) {
+    char byte;
+    ssize_t ret = recv(socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/**
+ * @brief Функция фонового потока, закрывающего простаивающие соединения
+ * @param arg Указатель на upstream_pool_t
+ * @details Периодически (в 2 раза чаще времени простоя, но не реже раза в секунду)
+ *          просыпается по таймауту reaper_cond и проходит по всем серверам и отрезает от их стеков соединения, простаивающие
+ *          дольше idle_timeout_ms. Сокеты закрываются после освобождения мьютекса.
+ *          Серверы без соединений удаляются из таблицы.
+ */
+static void *reaper_routine(void *arg) {
+    proxy_set_thread_name("upstream-reaper");
+    upstream_pool_t *pool = (upstream_pool_t *) arg;
+    time_t period_ms = MIN(pool->idle_timeout_ms / 2, 1000);
+    if (period_ms == 0) period_ms = 1;
+    struct timeval now; // Срок ожидания reaper_cond задается по системным часам
+    pthread_mutex_lock(&pool->mutex);
+    while (atomic_load(&pool->reaper_running)) {
+        gettimeofday(&now, NULL);
+        long long wake_ns = ((long long) now.tv_usec + (long long) period_ms * 1000) * 1000;
+        struct timespec deadline;
+        deadline.tv_sec = now.tv_sec + (time_t) (wake_ns / 1000000000);
+        deadline.tv_nsec = (long) (wake_ns % 1000000000);
+        pthread_cond_timedwait(&pool->reaper_cond, &pool->mutex, &deadline);
+        if (!atomic_load(&pool->reaper_running)) break;
+        long long now_ms = proxy_clock_now_ms(); // Возраст соединений - по монотонным часам
+        upstream_conn_t *expired = NULL; // Закрываются после освобождения мьютекса
+        for (int i = 0; i < UPSTREAM_BUCKET_COUNT; i++) {
+            upstream_host_t **link = &pool->buckets[i];
+            while (*link != NULL) {
+                upstream_host_t *entry = *link;
+                upstream_conn_t **conn_link = &entry->idle;
+                while (*conn_link != NULL) {
+                    if (now_ms - (*conn_link)->idle_since >= pool->idle_timeout_ms) break; // Дальше только более давние соединения
+                    conn_link = &(*conn_link)->next;
+                }
+                while (*conn_link != NULL) {
+                    upstream_conn_t *conn = *conn_link;
+                    *conn_link = conn->next;
+                    conn->next = expired;
+                    expired = conn;
+                    entry->idle_count--;
+                    pool->idle_count--;
+                }
+                if (entry->idle == NULL) { // Сервер без соединений больше не нужен
+                    *link = entry->next;
+                    free(entry->host);
+                    free(entry);
+                } else {
+                    link = &entry->next;
+                }
+            }
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        while (expired != NULL) {
+            upstream_conn_t *next = expired->next;
+            close(expired->socket);
+            free(expired);
+            expired = next;
+        }
+        pthread_mutex_lock(&pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_exit(NULL);
+}
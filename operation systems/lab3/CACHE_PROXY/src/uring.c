@@ -0,0 +1,1598 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "http.h"
+#include "log.h"
+#include "metrics.h"
+
+#define URING_SQ_ENTRIES        1024
+#define URING_CQ_ENTRIES        4096
+#define URING_BUFFER_COUNT      256     // степень двойки (требование кольца буферов)
+#define URING_BUFFER_SIZE       16384
+#define URING_BUFFER_GROUP      0
+#define URING_OP_MASK           ((uint64_t) 0xF)
+#define MAX_REQUEST_SIZE        (64 * 1024)
+#define MAX_HOST_SIZE           1024
+#define LOOP_TICK_MS            1000
+#define READ_WRITE_TIMEOUT_MS   60000
+
+/**
+ * @brief Тип операции, закодированный в младших битах user_data
+ * @details Структуры соединений выровнены на 16 байт, поэтому 4 младших бита
+ *          указателя свободны. URING_OP_CANCEL (user_data == 0) - служебные отмены,
+ *          их завершения игнорируются.
+ */
+typedef enum {
+    URING_OP_CANCEL,
+    URING_OP_ACCEPT,
+    URING_OP_EVENT,
+    URING_OP_TICK,
+    URING_OP_CLIENT_RECV,
+    URING_OP_CLIENT_SEND,
+    URING_OP_ORIGIN_CONNECT,
+    URING_OP_ORIGIN_SEND,
+    URING_OP_ORIGIN_RECV
+} uring_op_t;
+
+/**
+ * @brief Состояние клиентского соединения
+ */
+typedef enum {
+    CLIENT_READ_REQUEST,    // накопление HTTP-запроса
+    CLIENT_STREAM           // отдача данных элемента кэша
+} client_state_t;
+
+/**
+ * @brief Состояние соединения с целевым сервером
+ */
+typedef enum {
+    ORIGIN_RESOLVING,       // ожидание ответа резолвера имен
+    ORIGIN_CONNECTING,      // ожидание завершения connect
+    ORIGIN_SEND_REQUEST,    // отправка запроса
+    ORIGIN_RECEIVE          // прием ответа в элемент кэша
+} origin_state_t;
+
+/**
+ * @brief Кольца отправки и завершения, отображенные из ядра
+ * @var fd        Дескриптор io_uring
+ * @var sq_head   Голова очереди отправки (двигает ядро)
+ * @var sq_tail   Хвост очереди отправки (двигает цикл)
+ * @var sq_mask   Маска индексов очереди отправки
+ * @var sq_array  Массив индексов SQE
+ * @var sqes      Массив SQE
+ * @var sqe_tail  Локальный хвост: SQE, заполненные, но еще не опубликованные
+ * @var cq_head   Голова очереди завершения (двигает цикл)
+ * @var cq_tail   Хвост очереди завершения (двигает ядро)
+ * @var cq_mask   Маска индексов очереди завершения
+ * @var cqes      Массив CQE
+ */
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *ring_ptr;
+    size_t ring_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+} uring_ring_t;
+
+struct uring_loop_t;
+typedef struct uring_loop_t uring_loop_t;
+
+/**
+ * @brief Клиентское соединение
+ * @var fd             Клиентский сокет
+ * @var loop           Цикл, которому принадлежит соединение
+ * @var state          Текущее состояние автомата
+ * @var request        Буфер запроса (после разбора передается элементу кэша)
+ * @var request_len    Количество байт в буфере
+ * @var request_cap    Размер буфера
+ * @var entry          Элемент кэша, из которого отдаются данные (захвачен)
+ * @var reader         Позиция отдачи в ответе элемента
+ * @var subscriber     Подписка на новые данные элемента
+ * @var subscribed     Подписка активна
+ * @var pending        Соединение стоит в очереди оповещений цикла
+ * @var inflight       Количество незавершенных операций в кольце
+ * @var recv_armed     Multishot recv активен
+ * @var send_inflight  Отправка в процессе
+ * @var closing        Соединение закрыто и ждет завершения своих операций
+ * @var last_activity  Время последней активности (мс, монотонные часы)
+ * @var metrics        Измерение текущего запроса
+ */
+typedef struct client_conn_t {
+    _Alignas(16) int fd;
+    uring_loop_t *loop;
+    client_state_t state;
+    char *request;
+    size_t request_len;
+    size_t request_cap;
+    cache_entry_t *entry;
+    message_reader_t reader;
+    cache_entry_subscriber_t subscriber;
+    int subscribed;
+    int pending;
+    struct client_conn_t *pending_prev;
+    struct client_conn_t *pending_next;
+    int inflight;
+    int recv_armed;
+    int send_inflight;
+    int closing;
+    long long last_activity;
+    metrics_request_t metrics;
+    struct client_conn_t *prev;
+    struct client_conn_t *next;
+} client_conn_t;
+
+/**
+ * @brief Соединение с целевым сервером, заполняющее элемент кэша
+ * @var fd              Сокет соединения с сервером (ERROR, пока имя сервера не разрешено)
+ * @var loop            Цикл, которому принадлежит соединение
+ * @var state           Текущее состояние автомата
+ * @var entry           Заполняемый элемент кэша (захвачен)
+ * @var indexed         Элемент добавлен в кэш (иначе - частный буфер для некэшируемого запроса)
+ * @var port            Порт сервера
+ * @var query           Запрос к резолверу имен
+ * @var resolved        Соединение стоит в очереди разрешенных имен цикла
+ * @var addr            Адрес сервера (должен жить до завершения connect)
+ * @var addr_len        Длина адреса
+ * @var method          Метод запроса (указывает в запрос элемента)
+ * @var method_len      Длина метода
+ * @var request         Запрос к серверу (с "Connection: close")
+ * @var request_len     Длина запроса к серверу
+ * @var sent            Количество отправленных байт запроса
+ * @var framing         Поиск конца ответа
+ * @var inflight        Количество незавершенных операций в кольце
+ * @var recv_armed      Multishot recv активен
+ * @var closing         Соединение закрыто и ждет завершения своих операций
+ * @var last_activity   Время последней активности (мс, монотонные часы)
+ */
+typedef struct origin_conn_t {
+    _Alignas(16) int fd;
+    uring_loop_t *loop;
+    origin_state_t state;
+    cache_entry_t *entry;
+    int indexed;
+    int port;
+    dns_query_t query;
+    int resolved;
+    struct origin_conn_t *resolved_next;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    const char *method;
+    size_t method_len;
+    char *request;
+    size_t request_len;
+    size_t sent;
+    http_response_framing_t framing;
+    int inflight;
+    int recv_armed;
+    int closing;
+    long long last_activity;
+    struct origin_conn_t *prev;
+    struct origin_conn_t *next;
+} origin_conn_t;
+
+/**
+ * @brief Поток-цикл обработчика
+ * @var ring           Кольцо io_uring цикла (используется только потоком цикла)
+ * @var uring          Обработчик, которому принадлежит цикл
+ * @var index          Номер цикла
+ * @var event_fd       eventfd для пробуждения цикла из других потоков
+ * @var event_value    Буфер для чтения eventfd
+ * @var tick           Период таймера проверки таймаутов
+ * @var thread         Поток цикла
+ * @var mutex          Защищает listen_socket, очередь оповещений и очередь разрешенных имен
+ * @var listen_socket  Слушающий сокет (ERROR, пока не задан)
+ * @var accept_armed   Multishot accept активен
+ * @var pending_head   Очередь клиентов, у элементов которых появились данные
+ * @var resolved_head  Очередь соединений с серверами, для которых резолвер разрешил имя
+ * @var clients        Все клиентские соединения цикла (только поток цикла)
+ * @var origins        Все соединения с серверами (только поток цикла)
+ * @var closing_count  Закрытые соединения, ожидающие завершения операций
+ * @var buffers        Память буферов приема
+ * @var buf_ring       Кольцо буферов приема, зарегистрированное в ядре
+ * @var buf_tail       Локальный хвост кольца буферов
+ */
+struct uring_loop_t {
+    _Alignas(16) uring_ring_t ring;
+    uring_t *uring;
+    int index;
+    int event_fd;
+    uint64_t event_value;
+    struct __kernel_timespec tick;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    int listen_socket;
+    int accept_armed;
+    client_conn_t *pending_head;
+    origin_conn_t *resolved_head;
+    client_conn_t *clients;
+    origin_conn_t *origins;
+    int closing_count;
+    char *buffers;
+    struct io_uring_buf_ring *buf_ring;
+    unsigned short buf_tail;
+};
+
+/**
+ * @brief Обработчик на основе io_uring
+ * @var cache         Общий кэш
+ * @var resolver      Общий резолвер имен
+ * @var loops         Массив циклов
+ * @var loop_count    Количество циклов
+ * @var running       Флаг работы циклов
+ */
+struct uring_t {
+    cache_t *cache;
+    dns_resolver_t *resolver;
+    uring_loop_t *loops;
+    int loop_count;
+    atomic_int running;
+};
+
+/**
+ * @brief Создает кольцо io_uring и кольцо буферов приема цикла
+ * @param loop Цикл
+ * @return SUCCESS или ERROR
+ */
+static int loop_init(uring_loop_t *loop);
+
+/**
+ * @brief Освобождает кольца и буферы цикла
+ * @param loop Цикл
+ */
+static void loop_free(uring_loop_t *loop);
+
+/**
+ * @brief Функция потока-цикла
+ * @param arg Указатель на uring_loop_t
+ * @return NULL
+ */
+static void *loop_routine(void *arg);
+
+/**
+ * @brief Будит цикл через eventfd
+ * @param loop Цикл
+ */
+static void loop_wakeup(uring_loop_t *loop);
+
+/**
+ * @brief Возвращает свободный SQE, при переполнении очереди отправляет накопленные
+ * @param loop Цикл
+ * @param op   Тип операции
+ * @param ptr  Владелец операции
+ * @return SQE или NULL при ошибке
+ */
+static struct io_uring_sqe *loop_get_sqe(uring_loop_t *loop, uring_op_t op, void *ptr);
+
+/**
+ * @brief Отправляет накопленные SQE и при необходимости ждет завершений
+ * @param loop         Цикл
+ * @param min_complete Минимальное количество завершений для ожидания
+ * @return Результат io_uring_enter
+ */
+static int loop_enter(uring_loop_t *loop, unsigned min_complete);
+
+/**
+ * @brief Обрабатывает все готовые завершения
+ * @param loop Цикл
+ */
+static void loop_reap(uring_loop_t *loop);
+
+/**
+ * @brief Возвращает буфер приема в кольцо буферов
+ * @param loop Цикл
+ * @param bid  Номер буфера
+ */
+static void loop_recycle_buffer(uring_loop_t *loop, unsigned bid);
+
+/**
+ * @brief Ставит постоянную операцию цикла: чтение eventfd, таймер или прием соединений
+ * @param loop Цикл
+ * @param op   URING_OP_EVENT, URING_OP_TICK или URING_OP_ACCEPT
+ */
+static void loop_arm(uring_loop_t *loop, uring_op_t op);
+
+/**
+ * @brief Обрабатывает очередь оповещений цикла
+ * @param loop Цикл
+ */
+static void loop_drain_mailbox(uring_loop_t *loop);
+
+/**
+ * @brief Закрывает соединения, не проявлявшие активности дольше READ_WRITE_TIMEOUT_MS
+ * @param loop Цикл
+ */
+static void loop_sweep_timeouts(uring_loop_t *loop);
+
+/**
+ * @brief Ставит отмену всех операций сокета
+ * @param loop Цикл
+ * @param fd   Сокет
+ */
+static void loop_cancel(uring_loop_t *loop, int fd);
+
+/**
+ * @brief Создает клиентское соединение и запускает на нем multishot recv
+ * @param loop          Цикл
+ * @param client_socket Клиентский сокет
+ */
+static void client_open(uring_loop_t *loop, int client_socket);
+
+/**
+ * @brief Ставит multishot recv на клиентский сокет
+ * @param conn Клиентское соединение
+ * @return SUCCESS или ERROR
+ */
+static int client_arm_recv(client_conn_t *conn);
+
+/**
+ * @brief Обрабатывает завершение recv клиентского сокета
+ * @param conn  Клиентское соединение
+ * @param res   Результат операции
+ * @param flags Флаги CQE
+ */
+static void client_on_recv(client_conn_t *conn, int res, unsigned flags);
+
+/**
+ * @brief Обрабатывает полностью полученный запрос: поиск в кэше и запуск загрузки
+ * @param conn        Клиентское соединение
+ * @param request_len Длина запроса
+ * @return SUCCESS или ERROR
+ */
+static int client_start_request(client_conn_t *conn, size_t request_len);
+
+/**
+ * @brief Ставит отправку следующей порции данных элемента кэша
+ * @param conn Клиентское соединение
+ */
+static void client_send_next(client_conn_t *conn);
+
+/**
+ * @brief Обрабатывает завершение send клиенту
+ * @param conn Клиентское соединение
+ * @param res  Результат операции
+ */
+static void client_on_send(client_conn_t *conn, int res);
+
+/**
+ * @brief Оповещение от элемента кэша: ставит соединение в очередь цикла
+ * @param arg Указатель на client_conn_t
+ * @note Вызывается под entry->mutex из любого потока
+ */
+static void client_notify(void *arg);
+
+/**
+ * @brief Закрывает клиентское соединение
+ * @param conn Клиентское соединение
+ */
+static void client_close(client_conn_t *conn);
+
+/**
+ * @brief Освобождает закрытое соединение, если у него не осталось операций в кольце
+ * @param conn Клиентское соединение
+ */
+static void client_try_free(client_conn_t *conn);
+
+/**
+ * @brief Запускает загрузку ответа с целевого сервера в элемент кэша
+ * @param loop          Цикл
+ * @param entry         Заполняемый элемент кэша
+ * @param indexed       Элемент добавлен в кэш
+ * @param method        Метод запроса (в запросе элемента)
+ * @param method_len    Длина метода
+ * @param host_port     Значение заголовка Host
+ * @param host_port_len Длина значения
+ * @return SUCCESS или ERROR
+ */
+static int origin_open(uring_loop_t *loop, cache_entry_t *entry, int indexed, const char *method, size_t method_len,
+                       const char *host_port, size_t host_port_len);
+
+/**
+ * @brief Оповещение от резолвера: имя сервера разрешено
+ * @param query Запрос, встроенный в origin_conn_t
+ */
+static void origin_resolved(dns_query_t *query);
+
+/**
+ * @brief Создает сокет и ставит в кольцо connect к разрешенному адресу сервера
+ * @param conn Соединение с сервером (адрес в conn->query)
+ */
+static void origin_connect(origin_conn_t *conn);
+
+/**
+ * @brief Обрабатывает завершение connect
+ * @param conn Соединение с сервером
+ * @param res  Результат операции
+ */
+static void origin_on_connect(origin_conn_t *conn, int res);
+
+/**
+ * @brief Ставит отправку оставшейся части запроса
+ * @param conn Соединение с сервером
+ */
+static void origin_send_next(origin_conn_t *conn);
+
+/**
+ * @brief Обрабатывает завершение send серверу
+ * @param conn Соединение с сервером
+ * @param res  Результат операции
+ */
+static void origin_on_send(origin_conn_t *conn, int res);
+
+/**
+ * @brief Ставит multishot recv на сокет сервера
+ * @param conn Соединение с сервером
+ * @return SUCCESS или ERROR
+ */
+static int origin_arm_recv(origin_conn_t *conn);
+
+/**
+ * @brief Обрабатывает завершение recv сокета сервера
+ * @param conn  Соединение с сервером
+ * @param res   Результат операции
+ * @param flags Флаги CQE
+ */
+static void origin_on_recv(origin_conn_t *conn, int res, unsigned flags);
+
+/**
+ * @brief Обрабатывает порцию ответа сервера: сохраняет в элемент и разбирает заголовки
+ * @param conn Соединение с сервером
+ * @param data Принятые данные
+ * @param len  Длина данных
+ * @return 1 если ответ принят полностью, 0 если нужно читать дальше, ERROR при ошибке
+ */
+static int origin_consume(origin_conn_t *conn, const char *data, size_t len);
+
+/**
+ * @brief Завершает загрузку и закрывает соединение с сервером
+ * @param conn   Соединение с сервером
+ * @param failed 1 если загрузка прервана, 0 если ответ получен полностью
+ */
+static void origin_close(origin_conn_t *conn, int failed);
+
+/**
+ * @brief Освобождает закрытое соединение, если у него не осталось операций в кольце
+ * @param conn Соединение с сервером
+ */
+static void origin_try_free(origin_conn_t *conn);
+
+/**
+ * @brief Создает обработчик и запускает его циклы
+ * @param loop_count Количество потоков-циклов
+ * @param cache Кэш HTTP-ответов
+ * @param resolver Резолвер имен серверов
+ * @return Указатель на обработчик или NULL при ошибке
+ * @details Алгоритм работы:
+ *          1. Выделяет память под обработчик и массив циклов
+ *          2. Для каждого цикла создает кольцо io_uring, eventfd и кольцо буферов приема
+ *          3. Запускает потоки циклов
+ */
+uring_t *uring_create(int loop_count, cache_t *cache, dns_resolver_t *resolver) {
+    if (loop_count <= 0) loop_count = 1;
+    errno = 0;
+    uring_t *uring = malloc(sizeof(uring_t));
+    if (uring == NULL) {
+        proxy_log_error("io_uring creation error: %s", strerror(errno));
+        return NULL;
+    }
+    uring->loops = calloc(loop_count, sizeof(uring_loop_t));
+    if (uring->loops == NULL) {
+        proxy_log_error("io_uring creation error: %s", strerror(errno));
+        free(uring);
+        return NULL;
+    }
+    uring->cache = cache;
+    uring->resolver = resolver;
+    uring->loop_count = 0;
+    uring->running = 1;
+    for (int i = 0; i < loop_count; i++) {
+        uring_loop_t *loop = &uring->loops[i];
+        loop->uring = uring;
+        loop->index = i;
+        loop->listen_socket = ERROR;
+        if (loop_init(loop) == ERROR) break;
+        pthread_mutex_init(&loop->mutex, NULL);
+        if (pthread_create(&loop->thread, NULL, loop_routine, loop) != 0) {
+            proxy_log_error("io_uring creation error: failed to create loop thread");
+            pthread_mutex_destroy(&loop->mutex);
+            loop_free(loop);
+            break;
+        }
+        uring->loop_count++;
+    }
+    if (uring->loop_count != loop_count) {
+        uring_destroy(uring);
+        return NULL;
+    }
+    proxy_log("io_uring started with %d loops", loop_count);
+    return uring;
+}
+
+/**
+ * @brief Начинает прием соединений на слушающем сокете
+ * @param uring Обработчик
+ * @param server_socket Слушающий сокет
+ * @details Кольцо используется только своим потоком, поэтому сокет передается
+ *          циклам через мьютекс, а accept ставят сами циклы после пробуждения.
+ */
+void uring_listen(uring_t *uring, int server_socket) {
+    for (int i = 0; i < uring->loop_count; i++) {
+        uring_loop_t *loop = &uring->loops[i];
+        pthread_mutex_lock(&loop->mutex);
+        loop->listen_socket = server_socket;
+        pthread_mutex_unlock(&loop->mutex);
+        loop_wakeup(loop);
+    }
+}
+
+/**
+ * @brief Останавливает циклы и освобождает ресурсы обработчика
+ * @param uring Обработчик
+ * @details Каждый цикл перед выходом сам закрывает свои соединения
+ *          и дожидается завершения их операций.
+ */
+void uring_destroy(uring_t *uring) {
+    if (uring == NULL) return;
+    atomic_store(&uring->running, 0);
+    for (int i = 0; i < uring->loop_count; i++) loop_wakeup(&uring->loops[i]);
+    for (int i = 0; i < uring->loop_count; i++) {
+        uring_loop_t *loop = &uring->loops[i];
+        pthread_join(loop->thread, NULL);
+        pthread_mutex_destroy(&loop->mutex);
+        loop_free(loop);
+    }
+    free(uring->loops);
+    free(uring);
+}
+
+/**
+ * @brief Создает кольцо io_uring и кольцо буферов приема цикла
+ * @param loop Цикл
+ * @return SUCCESS или ERROR
+ * @details Алгоритм работы:
+ *          1. Создает io_uring (io_uring_setup) и отображает кольца отправки/завершения
+ *          2. Создает eventfd для пробуждения цикла
+ *          3. Выделяет URING_BUFFER_COUNT буферов приема и регистрирует их
+ *             в ядре кольцом буферов (IORING_REGISTER_PBUF_RING): multishot recv
+ *             сам выбирает свободный буфер, цикл возвращает его после обработки
+ */
+static int loop_init(uring_loop_t *loop) {
+    uring_ring_t *ring = &loop->ring;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+    ring->fd = (int) syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+    loop->event_fd = ERROR;
+    if (ring->fd == ERROR) {
+        proxy_log_error("io_uring creation error: %s", strerror(errno));
+        return ERROR;
+    }
+    ring->ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) { // Кольца отправки и завершения отображаются одним вызовом
+        if (ring->cq_size > ring->ring_size) ring->ring_size = ring->cq_size;
+        ring->cq_size = 0;
+    }
+    ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->ring_ptr == MAP_FAILED) goto mmap_error;
+    ring->cq_ptr = ring->ring_ptr;
+    if (ring->cq_size != 0) {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) goto unmap_ring;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto unmap_cq;
+    char *sq = ring->ring_ptr, *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->sqe_tail = *ring->sq_tail;
+    for (unsigned i = 0; i < params.sq_entries; i++) ring->sq_array[i] = i; // SQE используются по порядку
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    loop->event_fd = eventfd(0, EFD_CLOEXEC);
+    if (loop->event_fd == ERROR) goto unmap_sqes;
+    loop->buffers = malloc((size_t) URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (loop->buffers == NULL) goto close_event;
+    loop->buf_ring = mmap(NULL, URING_BUFFER_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (loop->buf_ring == MAP_FAILED) goto free_buffers;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) loop->buf_ring;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == ERROR) goto unmap_buf_ring;
+    loop->buf_tail = 0;
+    for (unsigned i = 0; i < URING_BUFFER_COUNT; i++) loop_recycle_buffer(loop, i);
+    return SUCCESS;
+
+    unmap_buf_ring:
+    munmap(loop->buf_ring, URING_BUFFER_COUNT * sizeof(struct io_uring_buf));
+    free_buffers:
+    free(loop->buffers);
+    close_event:
+    close(loop->event_fd);
+    unmap_sqes:
+    munmap(ring->sqes, ring->sqes_size);
+    unmap_cq:
+    if (ring->cq_size != 0) munmap(ring->cq_ptr, ring->cq_size);
+    unmap_ring:
+    munmap(ring->ring_ptr, ring->ring_size);
+    mmap_error:
+    proxy_log_error("io_uring creation error: %s", strerror(errno));
+    close(ring->fd);
+    return ERROR;
+}
+
+/**
+ * @brief Освобождает кольца и буферы цикла
+ * @param loop Цикл
+ * @note Закрытие дескриптора io_uring отменяет все оставшиеся операции
+ */
+static void loop_free(uring_loop_t *loop) {
+    uring_ring_t *ring = &loop->ring;
+    munmap(loop->buf_ring, URING_BUFFER_COUNT * sizeof(struct io_uring_buf));
+    free(loop->buffers);
+    close(loop->event_fd);
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_size != 0) munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->ring_ptr, ring->ring_size);
+    close(ring->fd);
+}
+
+/**
+ * @brief Функция потока-цикла
+ * @param arg Указатель на uring_loop_t
+ * @return NULL
+ * @details Алгоритм работы:
+ *          1. Ставит чтение eventfd и таймер LOOP_TICK_MS
+ *          2. Одним вызовом io_uring_enter отправляет все накопленные операции
+ *             и ждет хотя бы одного завершения
+ *          3. Обрабатывает все готовые завершения, затем очередь оповещений кэша
+ *          4. При остановке закрывает все соединения и дожидается
+ *             завершения (отмены) их операций
+ */
+static void *loop_routine(void *arg) {
+    uring_loop_t *loop = (uring_loop_t *) arg;
+    char thread_name[16];
+    snprintf(thread_name, sizeof(thread_name), "uring-%d", loop->index);
+    proxy_set_thread_name(thread_name);
+    loop->tick.tv_sec = LOOP_TICK_MS / 1000;
+    loop->tick.tv_nsec = (LOOP_TICK_MS % 1000) * 1000000LL;
+    loop_arm(loop, URING_OP_EVENT);
+    loop_arm(loop, URING_OP_TICK);
+    while (atomic_load(&loop->uring->running)) {
+        if (loop_enter(loop, 1) == ERROR && errno != EINTR) {
+            proxy_log_error("io_uring loop error: %s", strerror(errno));
+            break;
+        }
+        loop_reap(loop);
+        loop_drain_mailbox(loop);
+    }
+    while (loop->clients != NULL) client_close(loop->clients);
+    while (loop->origins != NULL) origin_close(loop->origins, 1);
+    while (loop->closing_count > 0) {
+        if (loop_enter(loop, 1) == ERROR && errno != EINTR) break;
+        loop_reap(loop);
+    }
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Будит цикл через eventfd
+ * @param loop Цикл
+ */
+static void loop_wakeup(uring_loop_t *loop) {
+    uint64_t one = 1;
+    ssize_t ret = write(loop->event_fd, &one, sizeof(one));
+    (void) ret; // Переполнение счетчика eventfd означает, что цикл и так будет разбужен
+}
+
+/**
+ * @brief Возвращает свободный SQE
+ * @param loop Цикл
+ * @param op Тип операции
+ * @param ptr Владелец операции
+ * @return SQE или NULL при ошибке
+ * @details SQE заполняются в локальном хвосте и публикуются ядру пачкой в loop_enter.
+ *          Если очередь заполнена, накопленные SQE отправляются без ожидания.
+ */
+static struct io_uring_sqe *loop_get_sqe(uring_loop_t *loop, uring_op_t op, void *ptr) {
+    uring_ring_t *ring = &loop->ring;
+    if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        loop_enter(loop, 0);
+        if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            proxy_log_error("io_uring submission error: submission queue is full");
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t) (uintptr_t) ptr | op;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/**
+ * @brief Отправляет накопленные SQE и при необходимости ждет завершений
+ * @param loop Цикл
+ * @param min_complete Минимальное количество завершений для ожидания
+ * @return Результат io_uring_enter
+ */
+static int loop_enter(uring_loop_t *loop, unsigned min_complete) {
+    uring_ring_t *ring = &loop->ring;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (to_submit == 0 && min_complete == 0) return SUCCESS;
+    return (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * @brief Обрабатывает все готовые завершения
+ * @param loop Цикл
+ * @details Голова очереди завершения сдвигается до обработки CQE, поэтому
+ *          обработчики могут сами ставить новые операции и вызывать loop_enter.
+ */
+static void loop_reap(uring_loop_t *loop) {
+    uring_ring_t *ring = &loop->ring;
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        void *ptr = (void *) (uintptr_t) (user_data & ~URING_OP_MASK);
+        switch ((uring_op_t) (user_data & URING_OP_MASK)) {
+            case URING_OP_CANCEL:
+                break;
+            case URING_OP_ACCEPT:
+                if (!(flags & IORING_CQE_F_MORE)) loop->accept_armed = 0;
+                if (res >= 0) client_open(loop, res);
+                else if (res != -ECANCELED) proxy_log_error("Accept client error: %s", strerror(-res));
+                loop_arm(loop, URING_OP_ACCEPT);
+                break;
+            case URING_OP_EVENT: // Новые оповещения разбираются после пачки завершений
+                loop_arm(loop, URING_OP_EVENT);
+                loop_arm(loop, URING_OP_ACCEPT); // Слушающий сокет мог быть задан только что
+                break;
+            case URING_OP_TICK:
+                loop_sweep_timeouts(loop);
+                loop_arm(loop, URING_OP_TICK);
+                break;
+            case URING_OP_CLIENT_RECV:
+                client_on_recv(ptr, res, flags);
+                break;
+            case URING_OP_CLIENT_SEND:
+                client_on_send(ptr, res);
+                break;
+            case URING_OP_ORIGIN_CONNECT:
+                origin_on_connect(ptr, res);
+                break;
+            case URING_OP_ORIGIN_SEND:
+                origin_on_send(ptr, res);
+                break;
+            case URING_OP_ORIGIN_RECV:
+                origin_on_recv(ptr, res, flags);
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Возвращает буфер приема в кольцо буферов
+ * @param loop Цикл
+ * @param bid Номер буфера
+ * @note Поле resv первой записи совпадает с хвостом кольца, поэтому записи
+ *       заполняются по полям, а не целиком
+ */
+static void loop_recycle_buffer(uring_loop_t *loop, unsigned bid) {
+    struct io_uring_buf *buf = &loop->buf_ring->bufs[loop->buf_tail & (URING_BUFFER_COUNT - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (loop->buffers + (size_t) bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = (unsigned short) bid;
+    loop->buf_tail++;
+    __atomic_store_n(&loop->buf_ring->tail, loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Ставит постоянную операцию цикла
+ * @param loop Цикл
+ * @param op URING_OP_EVENT, URING_OP_TICK или URING_OP_ACCEPT
+ * @details Чтение eventfd и таймер однократные и перезапускаются после каждого
+ *          завершения. Multishot accept перезапускается, только если ядро его
+ *          завершило (нет IORING_CQE_F_MORE), и только после того, как задан слушающий сокет.
+ */
+static void loop_arm(uring_loop_t *loop, uring_op_t op) {
+    struct io_uring_sqe *sqe;
+    if (op == URING_OP_EVENT) {
+        sqe = loop_get_sqe(loop, URING_OP_EVENT, loop);
+        if (sqe == NULL) return;
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = loop->event_fd;
+        sqe->addr = (uint64_t) (uintptr_t) &loop->event_value;
+        sqe->len = sizeof(loop->event_value);
+        return;
+    }
+    if (op == URING_OP_TICK) {
+        sqe = loop_get_sqe(loop, URING_OP_TICK, loop);
+        if (sqe == NULL) return;
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = (uint64_t) (uintptr_t) &loop->tick;
+        sqe->len = 1;
+        return;
+    }
+    pthread_mutex_lock(&loop->mutex);
+    int listen_socket = loop->listen_socket;
+    pthread_mutex_unlock(&loop->mutex);
+    if (listen_socket == ERROR || loop->accept_armed || !atomic_load(&loop->uring->running)) return;
+    sqe = loop_get_sqe(loop, URING_OP_ACCEPT, loop);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    loop->accept_armed = 1;
+}
+
+/**
+ * @brief Обрабатывает очередь оповещений и очередь разрешенных имен цикла
+ * @param loop Цикл
+ * @details Очереди разбираются по одному элементу, не удерживая мьютекс
+ *          во время обработки: закрытие соединения само удаляет его из очереди.
+ */
+static void loop_drain_mailbox(uring_loop_t *loop) {
+    while (1) {
+        pthread_mutex_lock(&loop->mutex);
+        client_conn_t *conn = loop->pending_head;
+        if (conn == NULL) {
+            pthread_mutex_unlock(&loop->mutex);
+            break;
+        }
+        loop->pending_head = conn->pending_next;
+        if (loop->pending_head != NULL) loop->pending_head->pending_prev = NULL;
+        conn->pending = 0;
+        conn->pending_prev = conn->pending_next = NULL;
+        pthread_mutex_unlock(&loop->mutex);
+        client_send_next(conn);
+    }
+    while (1) {
+        pthread_mutex_lock(&loop->mutex);
+        origin_conn_t *conn = loop->resolved_head;
+        if (conn == NULL) {
+            pthread_mutex_unlock(&loop->mutex);
+            break;
+        }
+        loop->resolved_head = conn->resolved_next;
+        conn->resolved = 0;
+        conn->resolved_next = NULL;
+        pthread_mutex_unlock(&loop->mutex);
+        origin_connect(conn);
+    }
+}
+
+/**
+ * @brief Закрывает соединения, не проявлявшие активности дольше READ_WRITE_TIMEOUT_MS
+ * @param loop Цикл
+ */
+static void loop_sweep_timeouts(uring_loop_t *loop) {
+    long long now = proxy_clock_now_ms();
+    client_conn_t *client = loop->clients;
+    while (client != NULL) {
+        client_conn_t *next = client->next;
+        if (now - client->last_activity >= READ_WRITE_TIMEOUT_MS) {
+            proxy_log("Client connection timeout");
+            client_close(client);
+        }
+        client = next;
+    }
+    origin_conn_t *origin = loop->origins;
+    while (origin != NULL) {
+        origin_conn_t *next = origin->next;
+        if (now - origin->last_activity >= READ_WRITE_TIMEOUT_MS) {
+            proxy_log("Remote connection timeout");
+            origin_close(origin, 1);
+        }
+        origin = next;
+    }
+}
+
+/**
+ * @brief Ставит отмену всех операций сокета
+ * @param loop Цикл
+ * @param fd Сокет
+ * @details Отмененные операции завершаются с -ECANCELED, после чего
+ *          соединение освобождается в client_try_free/origin_try_free.
+ */
+static void loop_cancel(uring_loop_t *loop, int fd) {
+    struct io_uring_sqe *sqe = loop_get_sqe(loop, URING_OP_CANCEL, NULL);
+    if (sqe == NULL) {
+        shutdown(fd, SHUT_RDWR); // Без отмены операции на сокете завершатся после shutdown
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+}
+
+/**
+ * @brief Создает клиентское соединение
+ * @param loop Цикл
+ * @param client_socket Клиентский сокет
+ */
+static void client_open(uring_loop_t *loop, int client_socket) {
+    if (!atomic_load(&loop->uring->running)) {
+        close(client_socket);
+        return;
+    }
+    client_conn_t *conn = calloc(1, sizeof(client_conn_t));
+    if (conn == NULL) {
+        proxy_log_error("Client connection creation error: failed to allocate memory");
+        close(client_socket);
+        return;
+    }
+    conn->fd = client_socket;
+    conn->loop = loop;
+    conn->state = CLIENT_READ_REQUEST;
+    conn->subscriber.notify = client_notify;
+    conn->subscriber.arg = conn;
+    conn->last_activity = proxy_clock_now_ms();
+    conn->next = loop->clients;
+    if (loop->clients != NULL) loop->clients->prev = conn;
+    loop->clients = conn;
+    if (client_arm_recv(conn) == ERROR) client_close(conn);
+}
+
+/**
+ * @brief Ставит multishot recv на клиентский сокет
+ * @param conn Клиентское соединение
+ * @return SUCCESS или ERROR
+ * @details recv остается активным и во время отдачи ответа: так цикл узнает
+ *          о закрытии соединения клиентом.
+ */
+static int client_arm_recv(client_conn_t *conn) {
+    struct io_uring_sqe *sqe = loop_get_sqe(conn->loop, URING_OP_CLIENT_RECV, conn);
+    if (sqe == NULL) return ERROR;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    conn->recv_armed = 1;
+    conn->inflight++;
+    return SUCCESS;
+}
+
+/**
+ * @brief Обрабатывает завершение recv клиентского сокета
+ * @param conn Клиентское соединение
+ * @param res Результат операции
+ * @param flags Флаги CQE
+ * @details Алгоритм работы:
+ *          1. Если ядро завершило multishot recv (нет IORING_CQE_F_MORE) - снимает отметку
+ *          2. Копирует данные из буфера приема и сразу возвращает буфер в кольцо
+ *          3. В состоянии CLIENT_READ_REQUEST накапливает запрос и, когда он получен
+ *             целиком, ищет элемент в кэше и начинает отдачу
+ *          4. В состоянии CLIENT_STREAM отбрасывает данные; 0 байт - клиент закрыл соединение
+ *          5. Если буферы приема кончились (-ENOBUFS), ставит recv заново
+ */
+static void client_on_recv(client_conn_t *conn, int res, unsigned flags) {
+    uring_loop_t *loop = conn->loop;
+    if (!(flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = 0;
+        conn->inflight--;
+    }
+    const char *data = NULL;
+    unsigned bid = 0;
+    if (flags & IORING_CQE_F_BUFFER) {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        data = loop->buffers + (size_t) bid * URING_BUFFER_SIZE;
+    }
+    if (conn->closing) {
+        if (data != NULL) loop_recycle_buffer(loop, bid);
+        client_try_free(conn);
+        return;
+    }
+    if (res == -ENOBUFS) {
+        if (!conn->recv_armed && client_arm_recv(conn) == ERROR) client_close(conn);
+        return;
+    }
+    if (res <= 0 || data == NULL) {
+        if (res < 0) proxy_log_error("Request receiving error: %s", strerror(-res));
+        if (data != NULL) loop_recycle_buffer(loop, bid);
+        client_close(conn);
+        return;
+    }
+    conn->last_activity = proxy_clock_now_ms();
+    if (conn->state == CLIENT_STREAM) { // Клиент что-то прислал во время отдачи
+        loop_recycle_buffer(loop, bid);
+        if (!conn->recv_armed && client_arm_recv(conn) == ERROR) client_close(conn);
+        return;
+    }
+    if (conn->request_len + res > conn->request_cap) {
+        if (conn->request_len + res > MAX_REQUEST_SIZE) {
+            proxy_log_error("Request receiving error: request is too large");
+            loop_recycle_buffer(loop, bid);
+            client_close(conn);
+            return;
+        }
+        size_t new_cap = conn->request_cap == 0 ? BUFSIZ : conn->request_cap;
+        while (new_cap < conn->request_len + res) new_cap *= 2;
+        char *temp = realloc(conn->request, new_cap);
+        if (temp == NULL) {
+            proxy_log_error("Request receiving error: failed to reallocate memory");
+            loop_recycle_buffer(loop, bid);
+            client_close(conn);
+            return;
+        }
+        conn->request = temp;
+        conn->request_cap = new_cap;
+    }
+    memcpy(conn->request + conn->request_len, data, res);
+    conn->request_len += res;
+    loop_recycle_buffer(loop, bid);
+    if (!conn->recv_armed && client_arm_recv(conn) == ERROR) {
+        client_close(conn);
+        return;
+    }
+    ssize_t request_len = http_request_length(conn->request, conn->request_len);
+    if (request_len == PARTIAL) return;
+    if (request_len == ERROR) { // Ответ 400 без ожидания: если буфер сокета полон, клиент просто увидит закрытие
+        send(conn->fd, HTTP_BAD_REQUEST_RESPONSE, sizeof(HTTP_BAD_REQUEST_RESPONSE) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        client_close(conn);
+        return;
+    }
+    if (client_start_request(conn, request_len) == ERROR) {
+        client_close(conn);
+        return;
+    }
+    client_send_next(conn);
+}
+
+/**
+ * @brief Обрабатывает полностью полученный запрос
+ * @param conn Клиентское соединение
+ * @param request_len Длина запроса
+ * @return SUCCESS или ERROR
+ * @details Алгоритм работы:
+ *          1. Извлекает метод и Host
+ *          2. Для GET атомарно ищет элемент в кэше или добавляет новый
+ *          3. Для остальных методов создает частный (не добавляемый в кэш) элемент
+ *          4. Если элемент новый - запускает загрузку с сервера (элемент, заменивший устаревший,
+ *             загружает проверка устаревшего)
+ *          5. Подписывается на элемент и переходит к отдаче данных
+ */
+static int client_start_request(client_conn_t *conn, size_t request_len) {
+    uring_t *uring = conn->loop->uring;
+    const char *method, *host_port;
+    size_t method_len, host_port_len;
+    metrics_request_start(&conn->metrics);
+    if (http_parse_request(conn->request, request_len, &method, &method_len, &host_port, &host_port_len) == ERROR) return ERROR;
+    int cacheable = http_check_request(method, method_len);
+    cache_entry_t *entry = NULL;
+    int created = 0;
+    if (cacheable) {
+        entry = cache_get_or_add(uring->cache, conn->request, request_len, &created);
+    } else {
+        entry = cache_entry_create(conn->request, request_len, NULL);
+        created = entry != NULL;
+    }
+    if (entry == NULL) return ERROR;
+    if (!created) metrics_request_lookup(&conn->metrics, entry->finished ? METRICS_LOOKUP_HIT : METRICS_LOOKUP_COALESCED);
+    else metrics_request_lookup(&conn->metrics, cacheable ? METRICS_LOOKUP_MISS : METRICS_LOOKUP_BYPASS);
+    if (created) conn->request = NULL; // Буфером запроса теперь владеет элемент кэша
+    if (created == CACHE_REVALIDATING) { // Ответ загрузит проверка устаревшего элемента в пуле загрузчиков
+        proxy_log("Cache entry is stale, revalidate");
+    } else if (created) {
+        proxy_log(cacheable ? "Cache miss" : "Uncacheable request, relay through private entry");
+        if (origin_open(conn->loop, entry, cacheable, method, method_len, host_port, host_port_len) == ERROR) {
+            if (cacheable) cache_remove_entry(uring->cache, entry); // Сначала из кэша, чтобы повторный запрос не нашел прерванный элемент
+            entry->failed = 1;
+            cache_entry_notify(entry);
+            cache_entry_release(entry);
+            return ERROR;
+        }
+    } else {
+        proxy_log("Cache hit, start streaming from cache");
+    }
+    conn->entry = entry;
+    conn->state = CLIENT_STREAM;
+    cache_entry_subscribe(entry, &conn->subscriber);
+    conn->subscribed = 1;
+    return SUCCESS;
+}
+
+/**
+ * @brief Ставит отправку следующей порции данных элемента кэша
+ * @param conn Клиентское соединение
+ * @details Одновременно у соединения в кольце не больше одной отправки.
+ *          send ссылается прямо на кусок ответа в элементе кэша: записанные данные
+ *          не перемещаются, а элемент захвачен соединением, поэтому копирование не нужно.
+ *          Флаги завершения читаются раньше размера ответа, чтобы не потерять хвост.
+ *          Если данные кончились и элемент завершен (или загрузка прервана) - закрывает соединение.
+ */
+static void client_send_next(client_conn_t *conn) {
+    if (conn->closing || conn->send_inflight || conn->state != CLIENT_STREAM) return;
+    cache_entry_t *entry = conn->entry;
+    pthread_mutex_lock(&entry->mutex);
+    int finished = entry->finished, failed = entry->failed;
+    message_t *response = entry->response;
+    pthread_mutex_unlock(&entry->mutex);
+    size_t len;
+    const char *data = message_peek(response, &conn->reader, &len);
+    if (len == 0) {
+        if (finished && !failed) metrics_request_finish(&conn->metrics);
+        if (finished || failed) client_close(conn); // Все отдано (или загрузка прервана)
+        return; // Иначе ждем оповещения о новых данных
+    }
+    struct io_uring_sqe *sqe = loop_get_sqe(conn->loop, URING_OP_CLIENT_SEND, conn);
+    if (sqe == NULL) {
+        client_close(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t) (uintptr_t) data;
+    sqe->len = len > INT32_MAX ? INT32_MAX : (unsigned) len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    conn->send_inflight = 1;
+    conn->inflight++;
+}
+
+/**
+ * @brief Обрабатывает завершение send клиенту
+ * @param conn Клиентское соединение
+ * @param res Результат операции
+ */
+static void client_on_send(client_conn_t *conn, int res) {
+    conn->send_inflight = 0;
+    conn->inflight--;
+    if (conn->closing) {
+        client_try_free(conn);
+        return;
+    }
+    if (res < 0) {
+        proxy_log_error("Data sending error: %s", strerror(-res));
+        client_close(conn);
+        return;
+    }
+    message_consume(&conn->reader, (size_t) res);
+    metrics_request_sent(&conn->metrics, (size_t) res);
+    conn->last_activity = proxy_clock_now_ms();
+    client_send_next(conn);
+}
+
+/**
+ * @brief Оповещение от элемента кэша
+ * @param arg Указатель на client_conn_t
+ * @details Цикл разбирает очередь после каждой пачки завершений, поэтому eventfd
+ *          пишется только из чужих потоков и только когда очередь была пуста:
+ *          иначе цикл уже разбужен предыдущим оповещением.
+ */
+static void client_notify(void *arg) {
+    client_conn_t *conn = (client_conn_t *) arg;
+    uring_loop_t *loop = conn->loop;
+    int wakeup = 0;
+    pthread_mutex_lock(&loop->mutex);
+    if (!conn->pending) {
+        wakeup = loop->pending_head == NULL && !pthread_equal(pthread_self(), loop->thread);
+        conn->pending = 1;
+        conn->pending_prev = NULL;
+        conn->pending_next = loop->pending_head;
+        if (loop->pending_head != NULL) loop->pending_head->pending_prev = conn;
+        loop->pending_head = conn;
+    }
+    pthread_mutex_unlock(&loop->mutex);
+    if (wakeup) loop_wakeup(loop);
+}
+
+/**
+ * @brief Закрывает клиентское соединение
+ * @param conn Клиентское соединение
+ * @details Отписывается от элемента, удаляет соединение из очереди оповещений
+ *          и из списка цикла. Если в кольце остались операции соединения,
+ *          ставит их отмену; память освобождается после последнего завершения.
+ */
+static void client_close(client_conn_t *conn) {
+    if (conn->closing) return;
+    uring_loop_t *loop = conn->loop;
+    conn->closing = 1;
+    if (conn->subscribed) cache_entry_unsubscribe(conn->entry, &conn->subscriber);
+    conn->subscribed = 0;
+    pthread_mutex_lock(&loop->mutex);
+    if (conn->pending) {
+        if (conn->pending_prev != NULL) conn->pending_prev->pending_next = conn->pending_next;
+        else loop->pending_head = conn->pending_next;
+        if (conn->pending_next != NULL) conn->pending_next->pending_prev = conn->pending_prev;
+        conn->pending = 0;
+    }
+    pthread_mutex_unlock(&loop->mutex);
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else loop->clients = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    loop->closing_count++;
+    if (conn->inflight > 0) loop_cancel(loop, conn->fd);
+    client_try_free(conn);
+}
+
+/**
+ * @brief Освобождает закрытое соединение, если у него не осталось операций в кольце
+ * @param conn Клиентское соединение
+ */
+static void client_try_free(client_conn_t *conn) {
+    if (conn->inflight > 0) return;
+    conn->loop->closing_count--;
+    if (conn->fd != ERROR) close(conn->fd);
+    cache_entry_release(conn->entry);
+    free(conn->request);
+    free(conn);
+}
+
+/**
+ * @brief Запускает загрузку ответа с целевого сервера
+ * @param loop Цикл
+ * @param entry Заполняемый элемент кэша
+ * @param indexed Элемент добавлен в кэш
+ * @param method Метод запроса (в запросе элемента)
+ * @param method_len Длина метода
+ * @param host_port Значение заголовка Host
+ * @param host_port_len Длина значения
+ * @return SUCCESS или ERROR
+ * @details Алгоритм работы:
+ *          1. Извлекает хост и порт
+ *          2. Строит запрос к серверу с "Connection: close", как и событийный обработчик на epoll
+ *          3. Создает соединение и передает имя хоста резолверу
+ *          4. Если адрес есть в кэше резолвера - сразу ставит connect;
+ *             иначе соединение ждет в состоянии ORIGIN_RESOLVING, пока резолвер
+ *             не передаст его циклу через очередь разрешенных имен
+ * @note Поток цикла не блокируется на разрешении имени
+ */
+static int origin_open(uring_loop_t *loop, cache_entry_t *entry, int indexed, const char *method, size_t method_len,
+                       const char *host_port, size_t host_port_len) {
+    char host[MAX_HOST_SIZE];
+    int port;
+    if (http_get_host_port(host_port, host_port_len, host, sizeof(host), &port) == ERROR) return ERROR;
+    origin_conn_t *conn = calloc(1, sizeof(origin_conn_t));
+    if (conn == NULL) {
+        proxy_log_error("Connect to remote error: failed to allocate memory");
+        return ERROR;
+    }
+    conn->request = http_build_upstream_request(entry->request, entry->request_len, 0, &conn->request_len);
+    if (conn->request == NULL) {
+        free(conn);
+        return ERROR;
+    }
+    conn->fd = ERROR;
+    conn->loop = loop;
+    conn->state = ORIGIN_RESOLVING;
+    conn->indexed = indexed;
+    conn->port = port;
+    conn->method = method;
+    conn->method_len = method_len;
+    conn->query.callback = origin_resolved;
+    conn->query.arg = conn;
+    conn->last_activity = proxy_clock_now_ms();
+    int ret = dns_resolve(loop->uring->resolver, host, &conn->query);
+    if (ret == ERROR) {
+        proxy_log_error("Connect to remote error: host name lookup failure");
+        free(conn->request);
+        free(conn);
+        return ERROR;
+    }
+    conn->entry = cache_entry_acquire(entry);
+    conn->next = loop->origins;
+    if (loop->origins != NULL) loop->origins->prev = conn;
+    loop->origins = conn;
+    if (ret == SUCCESS) origin_connect(conn); // Адрес был в кэше резолвера
+    return SUCCESS;
+}
+
+/**
+ * @brief Оповещение от резолвера: имя сервера разрешено
+ * @param query Запрос, встроенный в origin_conn_t
+ * @details Вызывается потоком резолвера. Соединение кладется в очередь разрешенных
+ *          имен цикла, connect поставит сам цикл после пробуждения.
+ */
+static void origin_resolved(dns_query_t *query) {
+    origin_conn_t *conn = (origin_conn_t *) query->arg;
+    uring_loop_t *loop = conn->loop;
+    pthread_mutex_lock(&loop->mutex);
+    conn->resolved = 1;
+    conn->resolved_next = loop->resolved_head;
+    loop->resolved_head = conn;
+    pthread_mutex_unlock(&loop->mutex);
+    loop_wakeup(loop);
+}
+
+/**
+ * @brief Создает сокет и ставит в кольцо connect к разрешенному адресу сервера
+ * @param conn Соединение с сервером (адрес в conn->query)
+ * @details Если имя не разрешилось или connect поставить не удалось, загрузка
+ *          завершается ошибкой: элемент помечается прерванным, клиенты закроются при отдаче.
+ */
+static void origin_connect(origin_conn_t *conn) {
+    if (conn->query.status == ERROR) {
+        proxy_log_error("Connect to remote error: host name lookup failure");
+        origin_close(conn, 1);
+        return;
+    }
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (conn->fd == ERROR) {
+        proxy_log_error("Connect to remote error: %s", strerror(errno));
+        origin_close(conn, 1);
+        return;
+    }
+    struct sockaddr_in *addr = (struct sockaddr_in *) &conn->addr;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(conn->port);
+    addr->sin_addr = conn->query.addr;
+    conn->addr_len = sizeof(*addr);
+    conn->state = ORIGIN_CONNECTING;
+    struct io_uring_sqe *sqe = loop_get_sqe(conn->loop, URING_OP_ORIGIN_CONNECT, conn);
+    if (sqe == NULL) {
+        origin_close(conn, 1);
+        return;
+    }
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &conn->addr;
+    sqe->off = conn->addr_len;
+    conn->inflight++;
+}
+
+/**
+ * @brief Обрабатывает завершение connect
+ * @param conn Соединение с сервером
+ * @param res Результат операции
+ * @details После подключения сразу ставит и отправку запроса, и multishot recv ответа.
+ */
+static void origin_on_connect(origin_conn_t *conn, int res) {
+    conn->inflight--;
+    if (conn->closing) {
+        origin_try_free(conn);
+        return;
+    }
+    if (res < 0) {
+        proxy_log_error("Connect to remote error: %s", strerror(-res));
+        origin_close(conn, 1);
+        return;
+    }
+    conn->last_activity = proxy_clock_now_ms();
+    conn->state = ORIGIN_SEND_REQUEST;
+    origin_send_next(conn);
+    if (!conn->closing && origin_arm_recv(conn) == ERROR) origin_close(conn, 1);
+}
+
+/**
+ * @brief Ставит отправку оставшейся части запроса
+ * @param conn Соединение с сервером
+ */
+static void origin_send_next(origin_conn_t *conn) {
+    if (conn->sent >= conn->request_len) {
+        conn->state = ORIGIN_RECEIVE;
+        return;
+    }
+    struct io_uring_sqe *sqe = loop_get_sqe(conn->loop, URING_OP_ORIGIN_SEND, conn);
+    if (sqe == NULL) {
+        origin_close(conn, 1);
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t) (uintptr_t) (conn->request + conn->sent);
+    sqe->len = conn->request_len - conn->sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    conn->inflight++;
+}
+
+/**
+ * @brief Обрабатывает завершение send серверу
+ * @param conn Соединение с сервером
+ * @param res Результат операции
+ */
+static void origin_on_send(origin_conn_t *conn, int res) {
+    conn->inflight--;
+    if (conn->closing) {
+        origin_try_free(conn);
+        return;
+    }
+    if (res < 0) {
+        proxy_log_error("Data sending error: %s", strerror(-res));
+        origin_close(conn, 1);
+        return;
+    }
+    conn->sent += res;
+    conn->last_activity = proxy_clock_now_ms();
+    origin_send_next(conn);
+}
+
+/**
+ * @brief Ставит multishot recv на сокет сервера
+ * @param conn Соединение с сервером
+ * @return SUCCESS или ERROR
+ */
+static int origin_arm_recv(origin_conn_t *conn) {
+    struct io_uring_sqe *sqe = loop_get_sqe(conn->loop, URING_OP_ORIGIN_RECV, conn);
+    if (sqe == NULL) return ERROR;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    conn->recv_armed = 1;
+    conn->inflight++;
+    return SUCCESS;
+}
+
+/**
+ * @brief Обрабатывает завершение recv сокета сервера
+ * @param conn Соединение с сервером
+ * @param res Результат операции
+ * @param flags Флаги CQE
+ * @details Данные дописываются в элемент кэша прямо из буфера приема, после чего
+ *          буфер возвращается в кольцо. 0 байт - сервер закрыл соединение:
+ *          ответ, тело которого читается до закрытия, на этом завершен.
+ */
+static void origin_on_recv(origin_conn_t *conn, int res, unsigned flags) {
+    uring_loop_t *loop = conn->loop;
+    if (!(flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = 0;
+        conn->inflight--;
+    }
+    const char *data = NULL;
+    unsigned bid = 0;
+    if (flags & IORING_CQE_F_BUFFER) {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        data = loop->buffers + (size_t) bid * URING_BUFFER_SIZE;
+    }
+    if (conn->closing) {
+        if (data != NULL) loop_recycle_buffer(loop, bid);
+        origin_try_free(conn);
+        return;
+    }
+    if (res == -ENOBUFS) {
+        if (!conn->recv_armed && origin_arm_recv(conn) == ERROR) origin_close(conn, 1);
+        return;
+    }
+    if (res < 0) {
+        proxy_log_error("Data receiving error: %s", strerror(-res));
+        origin_close(conn, 1);
+        return;
+    }
+    if (res == 0 || data == NULL) {
+        if (data != NULL) loop_recycle_buffer(loop, bid);
+        int complete = http_response_framing_eof(&conn->framing);
+        if (!complete) proxy_log_error("Data receiving error: remote closed connection before end of response");
+        origin_close(conn, !complete);
+        return;
+    }
+    conn->last_activity = proxy_clock_now_ms();
+    int ret = origin_consume(conn, data, res);
+    loop_recycle_buffer(loop, bid);
+    if (ret != 0) {
+        origin_close(conn, ret == ERROR);
+        return;
+    }
+    cache_entry_notify(conn->entry);
+    if (!conn->recv_armed && origin_arm_recv(conn) == ERROR) origin_close(conn, 1);
+}
+
+/**
+ * @brief Обрабатывает порцию ответа сервера
+ * @param conn Соединение с сервером
+ * @param data Принятые данные
+ * @param len Длина данных
+ * @return 1 если ответ принят полностью, 0 если нужно читать дальше, ERROR при ошибке
+ * @details Данные сразу дописываются в элемент, чтобы клиенты получали их по мере загрузки.
+ *          Конец ответа ищет http_response_framing_parse, общий с обработчиком на epoll.
+ *          Если ответ не подлежит кэшированию, элемент удаляется из кэша,
+ *          но клиенты, уже получившие его, дочитывают ответ до конца.
+ */
+static int origin_consume(origin_conn_t *conn, const char *data, size_t len) {
+    cache_entry_t *entry = conn->entry;
+    http_response_framing_t *framing = &conn->framing;
+    pthread_mutex_lock(&entry->mutex);
+    int ret = message_add_part(&entry->response, data, len);
+    pthread_mutex_unlock(&entry->mutex);
+    if (ret == ERROR) return ERROR;
+    if (conn->indexed) cache_account(conn->loop->uring->cache, entry, len); // Учитываем данные в бюджете кэша
+    int header_parsed = framing->header_parsed;
+    ret = http_response_framing_parse(framing, conn->method, conn->method_len, data, len);
+    if (ret == ERROR || header_parsed || !framing->header_parsed) return ret;
+    if (conn->indexed && !http_check_response(framing->status) && !entry->deleted) {
+        proxy_log("Response status %d is not cacheable", framing->status);
+        cache_remove_entry(conn->loop->uring->cache, entry);
+    } else if (conn->indexed) {
+        cache_set_vary(conn->loop->uring->cache, entry, framing->header, framing->header_len); // Запоминаем, от каких заголовков запроса зависит ответ
+        cache_set_freshness(conn->loop->uring->cache, entry, framing->header, framing->header_len); // и сколько он остается свежим
+    }
+    http_response_framing_free(framing);
+    return ret;
+}
+
+/**
+ * @brief Завершает загрузку и закрывает соединение с сервером
+ * @param conn Соединение с сервером
+ * @param failed 1 если загрузка прервана, 0 если ответ получен полностью
+ * @details При успехе помечает элемент завершенным, при ошибке - прерванным
+ *          и удаляет его из кэша. В обоих случаях оповещает читателей.
+ *          Соединение, ждущее резолвер, сначала снимается с ожидания и из очереди
+ *          разрешенных имен. Оставшиеся операции сокета отменяются, память
+ *          освобождается после последнего завершения.
+ */
+static void origin_close(origin_conn_t *conn, int failed) {
+    if (conn->closing) return;
+    uring_loop_t *loop = conn->loop;
+    cache_entry_t *entry = conn->entry;
+    conn->closing = 1;
+    if (conn->state == ORIGIN_RESOLVING) {
+        dns_cancel(loop->uring->resolver, &conn->query); // После возврата резолвер не обращается к conn
+        pthread_mutex_lock(&loop->mutex);
+        if (conn->resolved) {
+            origin_conn_t **link = &loop->resolved_head;
+            while (*link != conn) link = &(*link)->resolved_next;
+            *link = conn->resolved_next;
+        }
+        pthread_mutex_unlock(&loop->mutex);
+    }
+    if (failed && conn->indexed) cache_remove_entry(loop->uring->cache, entry);
+    if (failed) entry->failed = 1;
+    else entry->finished = 1;
+    cache_entry_notify(entry);
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else loop->origins = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    loop->closing_count++;
+    if (conn->inflight > 0) loop_cancel(loop, conn->fd);
+    origin_try_free(conn);
+}
+
+/**
+ * @brief Освобождает закрытое соединение, если у него не осталось операций в кольце
+ * @param conn Соединение с сервером
+ */
+static void origin_try_free(origin_conn_t *conn) {
+    if (conn->inflight > 0) return;
+    conn->loop->closing_count--;
+    close(conn->fd);
+    cache_entry_release(conn->entry);
+    http_response_framing_free(&conn->framing);
+    free(conn->request);
+    free(conn);
+}
@@ -0,0 +1,176 @@
+// Микробенчмарк разбора HTTP: скалярный вариант PicoHTTPParser против варианта SSE4.2
+// на наборе реальных заголовков запросов и ответов, а также функции http.c,
+// которыми прокси разбирает каждый запрос и ответ.
+//
+// Сборка: cmake -DCACHE_PROXY_BUILD_BENCHMARKS=ON, цель bench_http
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "http.h"
+#include "picohttpparser.h"
+
+#define ITERATIONS     200000
+#define MAX_HEADERS    100
+
+#ifdef CACHE_PROXY_HAVE_SSE42_PARSER
+int phr_parse_request_sse42(const char *buf, size_t len, const char **method, size_t *method_len, const char **path,
+                            size_t *path_len, int *minor_version, struct phr_header *headers, size_t *num_headers, size_t last_len);
+int phr_parse_response_sse42(const char *buf, size_t len, int *minor_version, int *status, const char **msg, size_t *msg_len,
+                             struct phr_header *headers, size_t *num_headers, size_t last_len);
+#endif
+
+static const char *requests[] = {
+    // Chrome
+    "GET http://www.example.com/articles/2024/performance.html?utm_source=feed HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Referer: http://www.example.com/\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: ru-RU,ru;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+    "Cookie: _ga=GA1.2.1234567890.1700000000; _gid=GA1.2.987654321.1700000000; session=eyJ1c2VyIjoiZ3Vlc3QifQ\r\n"
+    "\r\n",
+    // Firefox
+    "GET http://static.example.org/css/main.min.css HTTP/1.1\r\n"
+    "Host: static.example.org\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://www.example.org/\r\n"
+    "If-Modified-Since: Tue, 07 May 2024 10:21:33 GMT\r\n"
+    "If-None-Match: \"5f3a-6180ab3c1e540\"\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n",
+    // curl
+    "GET http://127.0.0.1:8081/big.bin HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8081\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "Proxy-Connection: Keep-Alive\r\n"
+    "\r\n",
+};
+
+static const char *responses[] = {
+    // nginx
+    "HTTP/1.1 200 OK\r\n"
+    "Server: nginx/1.24.0\r\n"
+    "Date: Wed, 15 May 2024 12:00:00 GMT\r\n"
+    "Content-Type: text/html; charset=utf-8\r\n"
+    "Content-Length: 48213\r\n"
+    "Last-Modified: Tue, 14 May 2024 08:30:00 GMT\r\n"
+    "Connection: keep-alive\r\n"
+    "ETag: \"66431e48-bc55\"\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "\r\n",
+    // CDN
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: image/webp\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: public, max-age=31536000, immutable\r\n"
+    "Vary: Accept, Accept-Encoding\r\n"
+    "Age: 86231\r\n"
+    "Via: 1.1 varnish, 1.1 varnish\r\n"
+    "X-Served-By: cache-fra-etou8220123-FRA, cache-ams21045-AMS\r\n"
+    "X-Cache: HIT, HIT\r\n"
+    "X-Cache-Hits: 12, 407\r\n"
+    "X-Timer: S1715774400.123456,VS0,VE0\r\n"
+    "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "\r\n",
+    // Apache
+    "HTTP/1.0 404 Not Found\r\n"
+    "Date: Wed, 15 May 2024 12:00:00 GMT\r\n"
+    "Server: Apache/2.4.58 (Ubuntu)\r\n"
+    "Content-Length: 274\r\n"
+    "Content-Type: text/html; charset=iso-8859-1\r\n"
+    "\r\n",
+};
+
+#define REQUEST_COUNT  (sizeof(requests) / sizeof(requests[0]))
+#define RESPONSE_COUNT (sizeof(responses) / sizeof(responses[0]))
+
+typedef int (*parse_request_t)(const char *, size_t, const char **, size_t *, const char **, size_t *, int *,
+                               struct phr_header *, size_t *, size_t);
+typedef int (*parse_response_t)(const char *, size_t, int *, int *, const char **, size_t *,
+                                struct phr_header *, size_t *, size_t);
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t request_lens[REQUEST_COUNT];
+static size_t response_lens[RESPONSE_COUNT];
+static volatile size_t sink;
+
+static double bench_parse_request(parse_request_t parse) {
+    struct phr_header headers[MAX_HEADERS];
+    double start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        size_t i = n % REQUEST_COUNT, num_headers = MAX_HEADERS, method_len, path_len;
+        const char *method, *path;
+        int minor_version;
+        sink += parse(requests[i], request_lens[i], &method, &method_len, &path, &path_len, &minor_version, headers, &num_headers, 0);
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+static double bench_parse_response(parse_response_t parse) {
+    struct phr_header headers[MAX_HEADERS];
+    double start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        size_t i = n % RESPONSE_COUNT, num_headers = MAX_HEADERS, msg_len;
+        const char *msg;
+        int minor_version, status;
+        sink += parse(responses[i], response_lens[i], &minor_version, &status, &msg, &msg_len, headers, &num_headers, 0);
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+static double bench_proxy_request(void) {
+    double start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        size_t i = n % REQUEST_COUNT;
+        sink += http_request_length(requests[i], request_lens[i]);
+        sink += http_request_keep_alive(requests[i], request_lens[i]);
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+static double bench_proxy_response(void) {
+    double start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        size_t i = n % RESPONSE_COUNT, content_len, content_length_header;
+        int status, chunked, keep_alive;
+        sink += http_parse_response(responses[i], response_lens[i], &status, &content_len, &content_length_header);
+        sink += http_get_framing(responses[i], response_lens[i], &chunked, &keep_alive);
+    }
+    return (now_ns() - start) / ITERATIONS;
+}
+
+int main() {
+    for (size_t i = 0; i < REQUEST_COUNT; i++) request_lens[i] = strlen(requests[i]);
+    for (size_t i = 0; i < RESPONSE_COUNT; i++) response_lens[i] = strlen(responses[i]);
+
+    printf("phr_parse_request  scalar: %7.1f ns/op\n", bench_parse_request(phr_parse_request));
+#ifdef CACHE_PROXY_HAVE_SSE42_PARSER
+    if (__builtin_cpu_supports("sse4.2")) printf("phr_parse_request  sse4.2: %7.1f ns/op\n", bench_parse_request(phr_parse_request_sse42));
+#endif
+    printf("phr_parse_response scalar: %7.1f ns/op\n", bench_parse_response(phr_parse_response));
+#ifdef CACHE_PROXY_HAVE_SSE42_PARSER
+    if (__builtin_cpu_supports("sse4.2")) printf("phr_parse_response sse4.2: %7.1f ns/op\n", bench_parse_response(phr_parse_response_sse42));
+#endif
+
+    http_init();
+    printf("http request (length + keep-alive): %7.1f ns/op\n", bench_proxy_request());
+    printf("http response (status + framing):   %7.1f ns/op\n", bench_proxy_response());
+    return 0;
+}
@@ -0,0 +1,783 @@
+// Генератор нагрузки с открытым циклом для прокси.
+//
+// Запросы GET http://<origin>/obj/<id> приходят по расписанию с заданной средней
+// частотой (пуассоновский поток) независимо от того, успевает ли прокси отвечать:
+// если все соединения заняты, запрос ждет в очереди, и задержка отсчитывается
+// от запланированного времени отправки, а не от фактического. Так медленный прокси
+// не "притормаживает" нагрузку и не прячет хвост задержек.
+// Объекты выбираются по закону Ципфа (-a 0 - равномерно), соединения постоянные,
+// открываются по мере необходимости, но не больше -c.
+//
+// По окончании выводит в stdout JSON: достигнутую частоту, перцентили задержки,
+// ошибки, долю попаданий в кэш (по счетчику /stats сервера bench_origin),
+// процессорное время и память прокси (по /proc/<pid>, если задан -P).
+//
+// Сборка: cmake -DCACHE_PROXY_BUILD_BENCHMARKS=ON, цель bench_load (только Linux);
+// цель benchmark запускает bench_origin, прокси и bench_load вместе (run_bench.sh)
+//
+// Пример: bench_load -x 127.0.0.1:8080 -o 127.0.0.1:8081 -r 20000 -d 30 -c 2000 -t 4 -n 10000 -a 0.99 -P $(pidof CACHE_PROXY)
+
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SUCCESS             0
+#define ERROR               (-1)
+
+#define MAX_EVENTS          512
+#define MAX_THREADS         64
+#define REQUEST_SIZE        512
+#define RESPONSE_BUFFER     16384
+#define HEADER_MAX          8192
+#define HIST_SUB_BITS       4                                   // 16 поддиапазонов на степень двойки (точность около 6%)
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        (HIST_SUB + (64 - HIST_SUB_BITS) * HIST_SUB)
+
+typedef enum {
+    LCONN_CONNECTING,   // неблокирующее подключение еще не завершено
+    LCONN_IDLE,         // готово к новому запросу
+    LCONN_BUSY          // запрос отправляется или ждет ответа
+} lconn_state_t;
+
+/**
+ * @brief Запланированный запрос
+ * @var scheduled Запланированное время отправки (мкс)
+ * @var id        Номер объекта
+ */
+typedef struct {
+    uint64_t scheduled;
+    uint64_t id;
+} planned_t;
+
+/**
+ * @brief Соединение с прокси
+ * @var fd            Сокет
+ * @var state         Состояние
+ * @var writable      Сокет готов к записи
+ * @var reused        Соединение уже обслужило запрос
+ * @var out           Запрос
+ * @var out_len       Длина запроса
+ * @var out_sent      Отправлено байт запроса
+ * @var in            Принятый заголовок ответа
+ * @var in_len        Принято байт заголовка
+ * @var header_done   Заголовок ответа разобран
+ * @var until_eof     Тело ответа заканчивается закрытием соединения
+ * @var close_after   Сервер закроет соединение после ответа
+ * @var status        Код ответа
+ * @var body_left     Осталось принять байт тела
+ * @var body_len      Принято байт тела
+ * @var request       Обслуживаемый запрос
+ * @var next_idle     Следующее свободное соединение
+ */
+typedef struct lconn_t {
+    int fd;
+    lconn_state_t state;
+    int writable;
+    int reused;
+    char out[REQUEST_SIZE];
+    size_t out_len;
+    size_t out_sent;
+    char in[HEADER_MAX + 1];
+    size_t in_len;
+    int header_done;
+    int until_eof;
+    int close_after;
+    int status;
+    uint64_t body_left;
+    uint64_t body_len;
+    planned_t request;
+    struct lconn_t *next_idle;
+} lconn_t;
+
+/**
+ * @brief Результаты потока (и их сумма по всем потокам)
+ * @var completed     Завершенные запросы в окне измерения
+ * @var errors        Сбои соединения и ответы, отличные от 200
+ * @var timeouts      Запросы, не завершенные к концу ожидания
+ * @var bytes         Принято байт тела
+ * @var sent          Запросы, запланированные в окне измерения
+ * @var connections   Открыто соединений за все время
+ * @var latency_sum   Сумма задержек (мкс)
+ * @var latency_max   Наибольшая задержка (мкс)
+ * @var histogram     Гистограмма задержек
+ */
+typedef struct {
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t bytes;
+    uint64_t sent;
+    uint64_t connections;
+    uint64_t latency_sum;
+    uint64_t latency_max;
+    uint64_t histogram[HIST_BUCKETS];
+} results_t;
+
+/**
+ * @brief Поток генератора
+ * @var index         Номер потока
+ * @var epoll_fd      Дескриптор epoll
+ * @var timer_fd      Таймер следующего запланированного запроса
+ * @var rng           Состояние генератора случайных чисел
+ * @var next_send     Время следующего запроса по расписанию (мкс)
+ * @var queue         Кольцевая очередь запросов, ждущих свободного соединения
+ * @var queue_cap     Емкость очереди
+ * @var queue_head    Начало очереди
+ * @var queue_len     Длина очереди
+ * @var idle          Свободные соединения
+ * @var open          Открытые соединения
+ * @var busy          Соединения с запросом
+ * @var max_conns     Наибольшее число соединений потока
+ * @var results       Результаты
+ * @var thread        Поток
+ */
+typedef struct {
+    int index;
+    int epoll_fd;
+    int timer_fd;
+    uint64_t rng;
+    uint64_t next_send;
+    planned_t *queue;
+    size_t queue_cap;
+    size_t queue_head;
+    size_t queue_len;
+    lconn_t *idle;
+    int open;
+    int busy;
+    int max_conns;
+    results_t results;
+    pthread_t thread;
+} worker_t;
+
+static struct sockaddr_storage proxy_addr;
+static socklen_t proxy_addr_len;
+static char proxy_spec[256] = "127.0.0.1:8080";
+static char origin_spec[256] = "127.0.0.1:8081";
+static double rate = 1000;
+static double duration = 10;
+static double warmup = 2;
+static double drain = 5;
+static int connections = 1000;
+static int thread_count = 1;
+static uint64_t object_count = 1000;
+static double zipf_alpha = 0.99;
+static uint64_t seed = 1;
+static int proxy_pid = 0;
+
+static double *zipf_cdf = NULL;  // Накопленные вероятности объектов по рангу
+static uint64_t measure_start;   // Начало окна измерения (мкс)
+static uint64_t measure_end;     // Конец окна измерения и расписания (мкс)
+static uint64_t schedule_start;  // Начало расписания (мкс)
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = (*state += 0x9E3779B97F4A7C15ULL); // splitmix64
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static double next_uniform(uint64_t *state) {
+    return (double) (next_random(state) >> 11) / (double) (1ULL << 53);
+}
+
+static int hist_index(uint64_t value) {
+    if (value < HIST_SUB) return (int) value;
+    int exp = 63 - __builtin_clzll(value);
+    return HIST_SUB + (exp - HIST_SUB_BITS) * HIST_SUB + (int) ((value >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_upper(int index) {
+    if (index < HIST_SUB) return (uint64_t) index;
+    int exp = (index - HIST_SUB) / HIST_SUB + HIST_SUB_BITS;
+    uint64_t sub = (uint64_t) ((index - HIST_SUB) % HIST_SUB);
+    return ((HIST_SUB + sub + 1) << (exp - HIST_SUB_BITS)) - 1;
+}
+
+static uint64_t hist_percentile(const results_t *results, double percentile) {
+    if (results->completed == 0) return 0;
+    uint64_t rank = (uint64_t) ceil(percentile / 100.0 * (double) results->completed), seen = 0;
+    if (rank == 0) rank = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += results->histogram[i];
+        if (seen >= rank) {
+            uint64_t upper = hist_upper(i);
+            return upper < results->latency_max ? upper : results->latency_max;
+        }
+    }
+    return results->latency_max;
+}
+
+/**
+ * @brief Номер объекта по закону Ципфа: двоичный поиск по накопленным вероятностям
+ */
+static uint64_t zipf_next(uint64_t *state) {
+    double u = next_uniform(state);
+    uint64_t low = 0, high = object_count - 1;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (zipf_cdf[mid] < u) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+static int zipf_init(void) {
+    zipf_cdf = malloc(object_count * sizeof(double));
+    if (zipf_cdf == NULL) return ERROR;
+    double sum = 0;
+    for (uint64_t i = 0; i < object_count; i++) {
+        sum += 1.0 / pow((double) (i + 1), zipf_alpha);
+        zipf_cdf[i] = sum;
+    }
+    for (uint64_t i = 0; i < object_count; i++) zipf_cdf[i] /= sum;
+    zipf_cdf[object_count - 1] = 1.0;
+    return SUCCESS;
+}
+
+static int parse_endpoint(const char *spec, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || (size_t) (colon - spec) >= sizeof(host)) return ERROR;
+    memcpy(host, spec, (size_t) (colon - spec));
+    host[colon - spec] = '\0';
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM}, *result;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) return ERROR;
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return SUCCESS;
+}
+
+/**
+ * @brief Возвращает запрос в начало очереди
+ */
+static int enqueue_front(worker_t *worker, planned_t request);
+
+static void record(worker_t *worker, lconn_t *conn, int ok) {
+    if (conn->request.scheduled < measure_start || conn->request.scheduled >= measure_end) return;
+    results_t *results = &worker->results;
+    if (!ok) {
+        results->errors++;
+        return;
+    }
+    uint64_t latency = now_us() - conn->request.scheduled;
+    results->completed++;
+    results->bytes += conn->body_len;
+    results->latency_sum += latency;
+    if (latency > results->latency_max) results->latency_max = latency;
+    results->histogram[hist_index(latency)]++;
+}
+
+static void conn_close(worker_t *worker, lconn_t *conn) {
+    if (conn->state == LCONN_IDLE) { // Удаляет из списка свободных
+        for (lconn_t **it = &worker->idle; *it != NULL; it = &(*it)->next_idle) {
+            if (*it == conn) {
+                *it = conn->next_idle;
+                break;
+            }
+        }
+    } else {
+        worker->busy--;
+        // Сервер мог закрыть постоянное соединение, не дождавшись запроса: GET повторяется.
+        // Сбой нового соединения не повторяется, поэтому повторы конечны
+        if (conn->reused && conn->in_len == 0) {
+            if (enqueue_front(worker, conn->request) == ERROR) record(worker, conn, 0);
+        } else {
+            record(worker, conn, 0);
+        }
+    }
+    close(conn->fd);
+    worker->open--;
+    free(conn);
+}
+
+/**
+ * @return SUCCESS или ERROR, если соединение закрыто
+ */
+static int conn_send(worker_t *worker, lconn_t *conn) {
+    while (conn->writable && conn->out_sent < conn->out_len) {
+        ssize_t sent = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->writable = 0;
+                return SUCCESS;
+            }
+            conn_close(worker, conn);
+            return ERROR;
+        }
+        conn->out_sent += (size_t) sent;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @return SUCCESS или ERROR, если соединение закрыто
+ */
+static int conn_start(worker_t *worker, lconn_t *conn, planned_t request) {
+    conn->state = LCONN_BUSY;
+    conn->request = request;
+    conn->out_len = (size_t) snprintf(conn->out, sizeof(conn->out), "GET http://%s/obj/%lu HTTP/1.1\r\nHost: %s\r\n\r\n",
+                                      origin_spec, (unsigned long) request.id, origin_spec);
+    conn->out_sent = 0;
+    conn->in_len = 0;
+    conn->header_done = 0;
+    conn->body_len = 0;
+    worker->busy++;
+    return conn_send(worker, conn);
+}
+
+static lconn_t *conn_open(worker_t *worker) {
+    int fd = socket(proxy_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return NULL;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    lconn_t *conn = calloc(1, sizeof(lconn_t));
+    if (conn == NULL || (connect(fd, (struct sockaddr *) &proxy_addr, proxy_addr_len) < 0 && errno != EINPROGRESS)) {
+        free(conn);
+        close(fd);
+        return NULL;
+    }
+    conn->fd = fd;
+    conn->state = LCONN_CONNECTING;
+    struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        free(conn);
+        close(fd);
+        return NULL;
+    }
+    worker->open++;
+    worker->results.connections++;
+    return conn;
+}
+
+/**
+ * @brief Раздает запросы из очереди свободным соединениям, при нехватке открывает новые
+ */
+static void dispatch(worker_t *worker) {
+    while (worker->queue_len > 0 && (worker->idle != NULL || worker->open < worker->max_conns)) {
+        planned_t request = worker->queue[worker->queue_head]; // Снимается до отправки: при сбое запрос может вернуться в очередь
+        worker->queue_head = (worker->queue_head + 1) % worker->queue_cap;
+        worker->queue_len--;
+        lconn_t *conn = worker->idle;
+        if (conn != NULL) {
+            worker->idle = conn->next_idle;
+            conn_start(worker, conn, request);
+            continue;
+        }
+        conn = conn_open(worker);
+        if (conn == NULL) {
+            if (request.scheduled >= measure_start && request.scheduled < measure_end) worker->results.errors++;
+            continue;
+        }
+        conn->request = request; // Отправится после подключения
+        worker->busy++;
+    }
+}
+
+static int queue_grow(worker_t *worker) {
+    if (worker->queue_len == worker->queue_cap) {
+        size_t cap = worker->queue_cap * 2;
+        planned_t *queue = malloc(cap * sizeof(planned_t));
+        if (queue == NULL) return ERROR;
+        for (size_t i = 0; i < worker->queue_len; i++) queue[i] = worker->queue[(worker->queue_head + i) % worker->queue_cap];
+        free(worker->queue);
+        worker->queue = queue;
+        worker->queue_cap = cap;
+        worker->queue_head = 0;
+    }
+    return SUCCESS;
+}
+
+static int enqueue(worker_t *worker, planned_t request) {
+    if (queue_grow(worker) == ERROR) return ERROR;
+    worker->queue[(worker->queue_head + worker->queue_len) % worker->queue_cap] = request;
+    worker->queue_len++;
+    return SUCCESS;
+}
+
+static int enqueue_front(worker_t *worker, planned_t request) {
+    if (queue_grow(worker) == ERROR) return ERROR;
+    worker->queue_head = (worker->queue_head + worker->queue_cap - 1) % worker->queue_cap;
+    worker->queue[worker->queue_head] = request;
+    worker->queue_len++;
+    return SUCCESS;
+}
+
+/**
+ * @brief Разбирает заголовок ответа
+ * @return SUCCESS, ERROR при ошибке или 1, если заголовок еще не принят целиком
+ */
+static int parse_header(lconn_t *conn) {
+    conn->in[conn->in_len] = '\0';
+    char *end = strstr(conn->in, "\r\n\r\n");
+    if (end == NULL) return conn->in_len >= HEADER_MAX ? ERROR : 1;
+    *end = '\0';
+    if (sscanf(conn->in, "HTTP/1.%*d %d", &conn->status) != 1) return ERROR;
+    char *length = strcasestr(conn->in, "\r\nContent-Length:");
+    conn->until_eof = length == NULL;
+    conn->body_left = length != NULL ? strtoull(length + 17, NULL, 10) : UINT64_MAX;
+    conn->close_after = strcasestr(conn->in, "\r\nConnection: close") != NULL || strncmp(conn->in, "HTTP/1.0", 8) == 0;
+    conn->header_done = 1;
+    size_t body_part = conn->in_len - (size_t) (end + 4 - conn->in);
+    if (body_part > conn->body_left) body_part = conn->body_left;
+    conn->body_len = body_part;
+    conn->body_left -= body_part;
+    return SUCCESS;
+}
+
+static void finish(worker_t *worker, lconn_t *conn) {
+    record(worker, conn, conn->status == 200);
+    worker->busy--;
+    if (conn->close_after || conn->until_eof) {
+        conn->state = LCONN_IDLE;
+        conn->next_idle = NULL;
+        close(conn->fd);
+        worker->open--;
+        free(conn);
+        return;
+    }
+    conn->state = LCONN_IDLE;
+    conn->reused = 1;
+    conn->next_idle = worker->idle;
+    worker->idle = conn;
+}
+
+static void conn_receive(worker_t *worker, lconn_t *conn) {
+    char discard[RESPONSE_BUFFER];
+    while (1) {
+        char *buffer = conn->header_done ? discard : conn->in + conn->in_len;
+        size_t size = conn->header_done ? sizeof(discard) : HEADER_MAX - conn->in_len;
+        ssize_t received = recv(conn->fd, buffer, size, 0);
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (received <= 0) {
+            if (conn->state == LCONN_BUSY && conn->header_done && conn->until_eof) {
+                conn->close_after = 1;
+                finish(worker, conn);
+                return;
+            }
+            conn_close(worker, conn);
+            return;
+        }
+        if (conn->state != LCONN_BUSY) { // Данные без запроса
+            conn_close(worker, conn);
+            return;
+        }
+        if (!conn->header_done) {
+            conn->in_len += (size_t) received;
+            int ret = parse_header(conn);
+            if (ret == 1) continue;
+            if (ret == ERROR) {
+                conn_close(worker, conn);
+                return;
+            }
+        } else {
+            uint64_t part = (uint64_t) received < conn->body_left ? (uint64_t) received : conn->body_left;
+            conn->body_len += part;
+            conn->body_left -= part;
+        }
+        if (conn->body_left == 0) {
+            finish(worker, conn);
+            return;
+        }
+    }
+}
+
+static void arm_timer(worker_t *worker) {
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = (time_t) (worker->next_send / 1000000);
+    spec.it_value.tv_nsec = (long) (worker->next_send % 1000000) * 1000;
+    timerfd_settime(worker->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/**
+ * @brief Основная функция потока генератора
+ * @details Алгоритм работы:
+ *          1. Ставит в очередь все запросы, время которых по расписанию наступило,
+ *             и взводит таймер на следующий
+ *          2. Раздает очередь соединениям
+ *          3. Обрабатывает события соединений
+ *          4. После конца расписания ждет ответов не дольше drain секунд,
+ *             незавершенные запросы считает просроченными
+ */
+static void *worker_routine(void *arg) {
+    worker_t *worker = (worker_t *) arg;
+    struct epoll_event events[MAX_EVENTS];
+    double mean_gap = 1e6 * thread_count / rate;
+    uint64_t drain_end = measure_end + (uint64_t) (drain * 1e6);
+    worker->next_send = schedule_start + (uint64_t) (-log(1.0 - next_uniform(&worker->rng)) * mean_gap);
+    arm_timer(worker);
+    while (1) {
+        uint64_t now = now_us();
+        while (worker->next_send <= now && worker->next_send < measure_end) {
+            planned_t request = {.scheduled = worker->next_send, .id = zipf_next(&worker->rng)};
+            if (request.scheduled >= measure_start) worker->results.sent++;
+            if (enqueue(worker, request) == ERROR) worker->results.errors++;
+            worker->next_send += (uint64_t) (-log(1.0 - next_uniform(&worker->rng)) * mean_gap) + 1;
+            if (worker->next_send > now) arm_timer(worker);
+        }
+        dispatch(worker);
+        if (now >= measure_end && worker->queue_len == 0 && worker->busy == 0) break;
+        if (now >= drain_end) break;
+        int timeout = now >= measure_end ? (int) ((drain_end - now) / 1000) + 1 : -1;
+        int count = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                uint64_t expirations;
+                ssize_t ret = read(worker->timer_fd, &expirations, sizeof(expirations));
+                (void) ret;
+                continue;
+            }
+            lconn_t *conn = (lconn_t *) events[i].data.ptr;
+            if (events[i].events & EPOLLERR) {
+                conn_close(worker, conn);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                conn->writable = 1;
+                if (conn->state == LCONN_CONNECTING) {
+                    worker->busy--; // Запрос уже учтен в dispatch
+                    if (conn_start(worker, conn, conn->request) == ERROR) continue;
+                } else if (conn->state == LCONN_BUSY && conn_send(worker, conn) == ERROR) {
+                    continue;
+                }
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) conn_receive(worker, conn);
+        }
+    }
+    for (size_t i = 0; i < worker->queue_len; i++) {
+        planned_t request = worker->queue[(worker->queue_head + i) % worker->queue_cap];
+        if (request.scheduled >= measure_start) worker->results.timeouts++;
+    }
+    worker->results.timeouts += (uint64_t) worker->busy; // Отправленные, но оставшиеся без ответа
+    return NULL;
+}
+
+/**
+ * @brief Запрашивает у bench_origin счетчик обслуженных запросов
+ * @return Счетчик или -1, если сервер недоступен
+ */
+static long long origin_requests(void) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (parse_endpoint(origin_spec, &addr, &addr_len) == ERROR) return -1;
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct timeval timeout = {.tv_sec = 2};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char buffer[1024];
+    int len = snprintf(buffer, sizeof(buffer), "GET /stats HTTP/1.0\r\nHost: %s\r\n\r\n", origin_spec);
+    long long requests = -1;
+    if (connect(fd, (struct sockaddr *) &addr, addr_len) == 0 && send(fd, buffer, (size_t) len, MSG_NOSIGNAL) == len) {
+        size_t received = 0;
+        ssize_t ret;
+        while (received < sizeof(buffer) - 1 && (ret = recv(fd, buffer + received, sizeof(buffer) - 1 - received, 0)) > 0) {
+            received += (size_t) ret;
+        }
+        buffer[received] = '\0';
+        char *field = strstr(buffer, "\"requests\":");
+        if (field != NULL) requests = strtoll(field + 11, NULL, 10);
+    }
+    close(fd);
+    return requests;
+}
+
+/**
+ * @brief Читает процессорное время процесса pid (utime + stime, секунды)
+ */
+static double process_cpu(int pid) {
+    char path[64], buffer[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+    size_t len = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[len] = '\0';
+    char *fields = strrchr(buffer, ')'); // Имя процесса может содержать пробелы
+    unsigned long utime, stime;
+    if (fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * @brief Читает поле памяти (кБ) из /proc/<pid>/status
+ */
+static long process_memory(int pid, const char *field) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+    long value = -1;
+    size_t field_len = strlen(field);
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, field, field_len) == 0 && line[field_len] == ':') {
+            value = strtol(line + field_len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+static void sleep_until(uint64_t time) {
+    uint64_t now;
+    while ((now = now_us()) < time) {
+        struct timespec ts = {.tv_sec = (time_t) ((time - now) / 1000000), .tv_nsec = (long) ((time - now) % 1000000) * 1000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void print_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-x proxy_host:port] [-o origin_host:port] [-r rate] [-d seconds] [-w warmup_seconds]\n"
+            "          [-c connections] [-t threads] [-n objects] [-a zipf_alpha] [-S seed] [-P proxy_pid] [-T drain_seconds]\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "x:o:r:d:w:c:t:n:a:S:P:T:h")) != -1) {
+        switch (opt) {
+            case 'x': snprintf(proxy_spec, sizeof(proxy_spec), "%s", optarg); break;
+            case 'o': snprintf(origin_spec, sizeof(origin_spec), "%s", optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'w': warmup = atof(optarg); break;
+            case 'c': connections = atoi(optarg); break;
+            case 't': thread_count = atoi(optarg); break;
+            case 'n': object_count = strtoull(optarg, NULL, 10); break;
+            case 'a': zipf_alpha = atof(optarg); break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            case 'P': proxy_pid = atoi(optarg); break;
+            case 'T': drain = atof(optarg); break;
+            default: print_usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (rate <= 0 || duration <= 0 || warmup < 0 || object_count == 0 || connections < 1) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > MAX_THREADS) thread_count = MAX_THREADS;
+    if (thread_count > connections) thread_count = connections;
+    if (parse_endpoint(proxy_spec, &proxy_addr, &proxy_addr_len) == ERROR) {
+        fprintf(stderr, "bench_load: cannot resolve %s\n", proxy_spec);
+        return EXIT_FAILURE;
+    }
+    if (zipf_init() == ERROR) return EXIT_FAILURE;
+    signal(SIGPIPE, SIG_IGN);
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) { // Тысячи соединений
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    static worker_t workers[MAX_THREADS];
+    schedule_start = now_us() + 100000;
+    measure_start = schedule_start + (uint64_t) (warmup * 1e6);
+    measure_end = measure_start + (uint64_t) (duration * 1e6);
+    for (int i = 0; i < thread_count; i++) {
+        worker_t *worker = &workers[i];
+        worker->index = i;
+        worker->rng = seed * 0x100000001B3ULL + (uint64_t) i;
+        worker->max_conns = connections / thread_count + (i < connections % thread_count);
+        worker->queue_cap = 1024;
+        worker->queue = malloc(worker->queue_cap * sizeof(planned_t));
+        worker->epoll_fd = epoll_create1(0);
+        worker->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+        if (worker->queue == NULL || worker->epoll_fd < 0 || worker->timer_fd < 0
+            || epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->timer_fd, &event) < 0) {
+            perror("bench_load");
+            return EXIT_FAILURE;
+        }
+    }
+    for (int i = 0; i < thread_count; i++) pthread_create(&workers[i].thread, NULL, worker_routine, &workers[i]);
+
+    sleep_until(measure_start);
+    long long origin_before = origin_requests();
+    double cpu_before = proxy_pid > 0 ? process_cpu(proxy_pid) : -1;
+    struct rusage usage_before, usage_after;
+    getrusage(RUSAGE_SELF, &usage_before);
+    sleep_until(measure_end);
+    long long origin_after = origin_requests();
+    double cpu_after = proxy_pid > 0 ? process_cpu(proxy_pid) : -1;
+    long rss = proxy_pid > 0 ? process_memory(proxy_pid, "VmRSS") : -1;
+    long peak_rss = proxy_pid > 0 ? process_memory(proxy_pid, "VmHWM") : -1;
+    getrusage(RUSAGE_SELF, &usage_after);
+
+    results_t *total = calloc(1, sizeof(results_t));
+    if (total == NULL) return EXIT_FAILURE;
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        results_t *results = &workers[i].results;
+        total->completed += results->completed;
+        total->errors += results->errors;
+        total->timeouts += results->timeouts;
+        total->bytes += results->bytes;
+        total->sent += results->sent;
+        total->connections += results->connections;
+        total->latency_sum += results->latency_sum;
+        if (results->latency_max > total->latency_max) total->latency_max = results->latency_max;
+        for (int j = 0; j < HIST_BUCKETS; j++) total->histogram[j] += results->histogram[j];
+    }
+
+    double generator_cpu = (double) (usage_after.ru_utime.tv_sec - usage_before.ru_utime.tv_sec)
+                           + (double) (usage_after.ru_stime.tv_sec - usage_before.ru_stime.tv_sec)
+                           + (double) (usage_after.ru_utime.tv_usec - usage_before.ru_utime.tv_usec) / 1e6
+                           + (double) (usage_after.ru_stime.tv_usec - usage_before.ru_stime.tv_usec) / 1e6;
+    printf("{\n");
+    printf("  \"config\": {\"proxy\": \"%s\", \"origin\": \"%s\", \"rate\": %.1f, \"duration_s\": %.1f, \"warmup_s\": %.1f, "
+           "\"connections\": %d, \"threads\": %d, \"objects\": %lu, \"zipf_alpha\": %.3f, \"seed\": %lu},\n",
+           proxy_spec, origin_spec, rate, duration, warmup, connections, thread_count, (unsigned long) object_count, zipf_alpha,
+           (unsigned long) seed);
+    printf("  \"requests\": {\"offered\": %lu, \"completed\": %lu, \"errors\": %lu, \"timeouts\": %lu, \"connections_opened\": %lu},\n",
+           (unsigned long) total->sent, (unsigned long) total->completed, (unsigned long) total->errors,
+           (unsigned long) total->timeouts, (unsigned long) total->connections);
+    printf("  \"throughput\": {\"offered_rps\": %.1f, \"rps\": %.1f, \"bytes_per_s\": %.1f},\n",
+           (double) total->sent / duration, (double) total->completed / duration, (double) total->bytes / duration);
+    printf("  \"latency_us\": {\"mean\": %.1f, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu},\n",
+           total->completed > 0 ? (double) total->latency_sum / (double) total->completed : 0.0,
+           (unsigned long) hist_percentile(total, 50), (unsigned long) hist_percentile(total, 90),
+           (unsigned long) hist_percentile(total, 99), (unsigned long) hist_percentile(total, 99.9),
+           (unsigned long) total->latency_max);
+    if (origin_before >= 0 && origin_after >= 0 && total->completed > 0) {
+        double hit_ratio = 1.0 - (double) (origin_after - origin_before) / (double) total->completed;
+        printf("  \"origin\": {\"requests\": %lld, \"hit_ratio\": %.4f},\n", origin_after - origin_before,
+               hit_ratio < 0 ? 0.0 : hit_ratio);
+    } else {
+        printf("  \"origin\": null,\n");
+    }
+    if (cpu_before >= 0 && cpu_after >= 0) {
+        printf("  \"proxy\": {\"pid\": %d, \"cpu_seconds\": %.3f, \"cpu_cores\": %.3f, \"rss_kb\": %ld, \"peak_rss_kb\": %ld},\n",
+               proxy_pid, cpu_after - cpu_before, (cpu_after - cpu_before) / duration, rss, peak_rss);
+    } else {
+        printf("  \"proxy\": null,\n");
+    }
+    printf("  \"generator\": {\"cpu_seconds\": %.3f}\n", generator_cpu);
+    printf("}\n");
+    free(total);
+    free(zipf_cdf);
+    return EXIT_SUCCESS;
+}
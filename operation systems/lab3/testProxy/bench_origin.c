@@ -0,0 +1,464 @@
+// Настраиваемый сервер-источник для нагрузочных тестов прокси.
+//
+// GET /obj/<id> отдает объект id (0 <= id < -n) размера от -s min до max байт
+// (размер объекта детерминированно выбирается по id, логарифмически равномерно),
+// после задержки -l мс и со скоростью не больше -b байт/с на соединение.
+// GET /stats отдает JSON со счетчиками обслуженных запросов и отправленных байт тела,
+// по ним bench_load считает долю попаданий в кэш. Соединения постоянные (HTTP/1.1).
+//
+// Сборка: cmake -DCACHE_PROXY_BUILD_BENCHMARKS=ON, цель bench_origin (только Linux)
+//
+// Пример: bench_origin -p 8081 -t 4 -n 10000 -s 1024:1048576 -l 20 -b 10000000
+
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SUCCESS             0
+#define ERROR               (-1)
+
+#define MAX_EVENTS          256
+#define REQUEST_BUFFER_SIZE 8192
+#define HEADER_BUFFER_SIZE  256
+#define PATTERN_SIZE        65536           // Тело отдается из повторяющегося образца
+#define TICK_US             10000           // Шаг выдачи квоты при ограничении скорости
+#define MAX_THREADS         64
+
+typedef enum {
+    CONN_READ,      // ожидание запроса
+    CONN_DELAYED,   // ответ ждет истечения задержки
+    CONN_WRITE      // отправка ответа
+} conn_state_t;
+
+/**
+ * @brief Клиентское соединение
+ * @var fd          Сокет
+ * @var state       Состояние
+ * @var in          Принятые, но еще не обслуженные байты
+ * @var in_len      Количество байт в in
+ * @var header      Заголовок ответа
+ * @var header_len  Длина заголовка
+ * @var header_sent Отправлено байт заголовка
+ * @var body_len    Длина тела ответа
+ * @var body_sent   Отправлено байт тела
+ * @var body        Тело ответа (для /stats), NULL - образец
+ * @var close_after Закрыть соединение после ответа
+ * @var writable    Сокет готов к записи
+ * @var closed      Соединение закрыто и ждет выхода из очереди задержанных
+ * @var quota       Сколько байт еще можно отправить в текущем шаге
+ * @var ready_at    Когда истекает задержка ответа (мкс)
+ * @var next        Следующее соединение в очереди задержанных
+ * @var write_prev  Предыдущее соединение в списке отправляющих
+ * @var write_next  Следующее соединение в списке отправляющих
+ */
+typedef struct conn_t {
+    int fd;
+    conn_state_t state;
+    char in[REQUEST_BUFFER_SIZE];
+    size_t in_len;
+    char header[HEADER_BUFFER_SIZE];
+    size_t header_len;
+    size_t header_sent;
+    uint64_t body_len;
+    uint64_t body_sent;
+    char *body;
+    int close_after;
+    int writable;
+    int closed;
+    uint64_t quota;
+    uint64_t ready_at;
+    struct conn_t *next;
+    struct conn_t *write_prev;
+    struct conn_t *write_next;
+} conn_t;
+
+/**
+ * @brief Цикл событий одного потока
+ * @var epoll_fd      Дескриптор epoll
+ * @var listen_fd     Слушающий сокет потока (SO_REUSEPORT)
+ * @var delayed_head  Очередь ответов, ждущих задержки (задержка одинакова, поэтому FIFO)
+ * @var delayed_tail  Конец очереди
+ * @var writing       Соединения, отправляющие ответ
+ * @var next_tick     Время следующей выдачи квоты (мкс)
+ * @var thread        Поток
+ */
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    conn_t *delayed_head;
+    conn_t *delayed_tail;
+    conn_t *writing;
+    uint64_t next_tick;
+    pthread_t thread;
+} loop_t;
+
+static int port = 8081;
+static int thread_count = 1;
+static uint64_t object_count = 1000;
+static uint64_t size_min = 1024, size_max = 1024;
+static uint64_t latency_us = 0;
+static uint64_t bandwidth = 0; // байт/с на соединение, 0 - без ограничения
+static int max_age = 3600;
+
+static char pattern[PATTERN_SIZE];
+static atomic_int running = 1;
+static atomic_uint_fast64_t served_requests = 0;
+static atomic_uint_fast64_t served_bytes = 0;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static void stop_handler(int signal) {
+    (void) signal;
+    atomic_store(&running, 0);
+}
+
+/**
+ * @brief Размер объекта id: логарифмически равномерно между size_min и size_max
+ */
+static uint64_t object_size(uint64_t id) {
+    if (size_max <= size_min) return size_min;
+    uint64_t x = id * 0x9E3779B97F4A7C15ULL; // Перемешивание id (splitmix64)
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    double u = (double) (x >> 11) / (double) (1ULL << 53);
+    double log_min = log((double) size_min), log_max = log((double) size_max + 1);
+    uint64_t size = (uint64_t) exp(log_min + u * (log_max - log_min));
+    return size < size_min ? size_min : size > size_max ? size_max : size;
+}
+
+static void writing_add(loop_t *loop, conn_t *conn) {
+    conn->write_prev = NULL;
+    conn->write_next = loop->writing;
+    if (loop->writing != NULL) loop->writing->write_prev = conn;
+    loop->writing = conn;
+}
+
+static void writing_remove(loop_t *loop, conn_t *conn) {
+    if (conn->write_prev != NULL) conn->write_prev->write_next = conn->write_next;
+    else loop->writing = conn->write_next;
+    if (conn->write_next != NULL) conn->write_next->write_prev = conn->write_prev;
+}
+
+static void conn_close(loop_t *loop, conn_t *conn) {
+    if (conn->state == CONN_WRITE) writing_remove(loop, conn);
+    close(conn->fd);
+    free(conn->body);
+    conn->body = NULL;
+    if (conn->state == CONN_DELAYED) conn->closed = 1; // Освободит очередь задержанных
+    else free(conn);
+}
+
+static int conn_process(loop_t *loop, conn_t *conn);
+
+/**
+ * @brief Отправляет ответ, пока сокет принимает данные и не исчерпана квота
+ * @return SUCCESS или ERROR, если соединение закрыто
+ */
+static int conn_write(loop_t *loop, conn_t *conn) {
+    while (conn->writable && (bandwidth == 0 || conn->quota > 0)) {
+        struct iovec iov[2];
+        int iov_count = 0;
+        size_t limit = bandwidth == 0 ? SIZE_MAX : conn->quota;
+        if (conn->header_sent < conn->header_len) {
+            size_t len = conn->header_len - conn->header_sent;
+            if (len > limit) len = limit;
+            iov[iov_count++] = (struct iovec) {conn->header + conn->header_sent, len};
+            limit -= len;
+        }
+        if (conn->body_sent < conn->body_len && limit > 0) {
+            size_t offset = conn->body != NULL ? conn->body_sent : conn->body_sent % PATTERN_SIZE;
+            size_t len = conn->body != NULL ? conn->body_len - conn->body_sent : PATTERN_SIZE - offset;
+            if (len > conn->body_len - conn->body_sent) len = conn->body_len - conn->body_sent;
+            if (len > limit) len = limit;
+            iov[iov_count++] = (struct iovec) {(conn->body != NULL ? conn->body : pattern) + offset, len};
+        }
+        if (iov_count == 0) break;
+        ssize_t sent = writev(conn->fd, iov, iov_count);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->writable = 0;
+                return SUCCESS;
+            }
+            conn_close(loop, conn);
+            return ERROR;
+        }
+        if (bandwidth != 0) conn->quota -= (uint64_t) sent;
+        size_t header_part = conn->header_len - conn->header_sent;
+        if ((size_t) sent <= header_part) {
+            conn->header_sent += (size_t) sent;
+        } else {
+            conn->header_sent = conn->header_len;
+            conn->body_sent += (size_t) sent - header_part;
+            if (conn->body == NULL) atomic_fetch_add_explicit(&served_bytes, (size_t) sent - header_part, memory_order_relaxed);
+        }
+    }
+    if (conn->header_sent < conn->header_len || conn->body_sent < conn->body_len) return SUCCESS;
+    writing_remove(loop, conn); // Ответ отправлен целиком
+    conn->state = CONN_READ;
+    free(conn->body);
+    conn->body = NULL;
+    if (conn->close_after) {
+        conn_close(loop, conn);
+        return ERROR;
+    }
+    return conn_process(loop, conn);
+}
+
+/**
+ * @brief Начинает отправку подготовленного ответа
+ */
+static int conn_start_write(loop_t *loop, conn_t *conn) {
+    conn->state = CONN_WRITE;
+    conn->quota = bandwidth / (1000000 / TICK_US);
+    writing_add(loop, conn);
+    return conn_write(loop, conn);
+}
+
+/**
+ * @brief Разбирает очередной запрос из буфера и готовит ответ на него
+ * @return SUCCESS или ERROR, если соединение закрыто
+ */
+static int conn_process(loop_t *loop, conn_t *conn) {
+    if (conn->state != CONN_READ || conn->in_len == 0) return SUCCESS;
+    conn->in[conn->in_len] = '\0';
+    char *end = strstr(conn->in, "\r\n\r\n");
+    if (end == NULL) {
+        if (conn->in_len >= REQUEST_BUFFER_SIZE - 1) {
+            conn_close(loop, conn);
+            return ERROR;
+        }
+        return SUCCESS;
+    }
+    size_t request_len = (size_t) (end + 4 - conn->in);
+    conn->close_after = strstr(conn->in, "HTTP/1.0") != NULL || strcasestr(conn->in, "\r\nConnection: close") != NULL;
+    int status = 200;
+    uint64_t id;
+    char *body = NULL;
+    uint64_t body_len = 0;
+    char *target = strncmp(conn->in, "GET ", 4) == 0 ? conn->in + 4 : conn->in;
+    if (strncmp(target, "http://", 7) == 0) { // Запрос в абсолютной форме
+        target = strchr(target + 7, '/');
+        if (target == NULL) target = conn->in;
+    }
+    if (target != conn->in && sscanf(target, "/obj/%lu", &id) == 1 && id < object_count) {
+        body_len = object_size(id);
+        atomic_fetch_add_explicit(&served_requests, 1, memory_order_relaxed);
+    } else if (target != conn->in && strncmp(target, "/stats ", 7) == 0) {
+        body = malloc(128);
+        if (body == NULL) {
+            conn_close(loop, conn);
+            return ERROR;
+        }
+        body_len = (uint64_t) snprintf(body, 128, "{\"requests\":%lu,\"bytes\":%lu}\n",
+                                       (unsigned long) atomic_load(&served_requests), (unsigned long) atomic_load(&served_bytes));
+    } else {
+        status = 404;
+    }
+    conn->header_len = (size_t) snprintf(conn->header, sizeof(conn->header),
+                                         "HTTP/1.1 %d %s\r\nContent-Length: %lu\r\nCache-Control: max-age=%d\r\n%s\r\n",
+                                         status, status == 200 ? "OK" : "Not Found", (unsigned long) body_len, max_age,
+                                         conn->close_after ? "Connection: close\r\n" : "");
+    conn->header_sent = 0;
+    conn->body = body;
+    conn->body_len = body_len;
+    conn->body_sent = 0;
+    conn->in_len -= request_len;
+    memmove(conn->in, conn->in + request_len, conn->in_len);
+    if (latency_us == 0 || body != NULL) return conn_start_write(loop, conn);
+    conn->state = CONN_DELAYED;
+    conn->ready_at = now_us() + latency_us;
+    conn->next = NULL;
+    if (loop->delayed_tail != NULL) loop->delayed_tail->next = conn;
+    else loop->delayed_head = conn;
+    loop->delayed_tail = conn;
+    return SUCCESS;
+}
+
+static void conn_read(loop_t *loop, conn_t *conn) {
+    while (1) {
+        if (conn->in_len >= REQUEST_BUFFER_SIZE - 1) break; // Конвейер длиннее буфера - дочитаем после ответа
+        ssize_t received = recv(conn->fd, conn->in + conn->in_len, REQUEST_BUFFER_SIZE - 1 - conn->in_len, 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            conn_close(loop, conn);
+            return;
+        }
+        if (received < 0) break;
+        conn->in_len += (size_t) received;
+    }
+    conn_process(loop, conn);
+}
+
+static void loop_accept(loop_t *loop) {
+    while (1) {
+        int fd = accept4(loop->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) return;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn_t *conn = calloc(1, sizeof(conn_t));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->state = CONN_READ;
+        conn->writable = 1;
+        struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            free(conn);
+        }
+    }
+}
+
+static void *loop_routine(void *arg) {
+    loop_t *loop = (loop_t *) arg;
+    struct epoll_event events[MAX_EVENTS];
+    loop->next_tick = now_us() + TICK_US;
+    while (atomic_load(&running)) {
+        uint64_t now = now_us();
+        int timeout = 100;
+        if (loop->delayed_head != NULL) {
+            uint64_t wait = loop->delayed_head->ready_at > now ? loop->delayed_head->ready_at - now : 0;
+            if ((int) ((wait + 999) / 1000) < timeout) timeout = (int) ((wait + 999) / 1000);
+        }
+        if (bandwidth != 0 && loop->writing != NULL) {
+            uint64_t wait = loop->next_tick > now ? loop->next_tick - now : 0;
+            if ((int) ((wait + 999) / 1000) < timeout) timeout = (int) ((wait + 999) / 1000);
+        }
+        int count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                loop_accept(loop);
+                continue;
+            }
+            conn_t *conn = (conn_t *) events[i].data.ptr;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                conn_close(loop, conn);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                conn->writable = 1;
+                if (conn->state == CONN_WRITE && conn_write(loop, conn) == ERROR) continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP)) conn_read(loop, conn);
+        }
+        now = now_us();
+        while (loop->delayed_head != NULL && loop->delayed_head->ready_at <= now) {
+            conn_t *conn = loop->delayed_head;
+            loop->delayed_head = conn->next;
+            if (loop->delayed_head == NULL) loop->delayed_tail = NULL;
+            if (conn->closed) {
+                free(conn);
+                continue;
+            }
+            conn_start_write(loop, conn);
+        }
+        if (bandwidth != 0 && now >= loop->next_tick) {
+            loop->next_tick = now + TICK_US;
+            conn_t *conn = loop->writing;
+            while (conn != NULL) {
+                conn_t *next = conn->write_next;
+                conn->quota = bandwidth / (1000000 / TICK_US);
+                conn_write(loop, conn);
+                conn = next;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int loop_init(loop_t *loop) {
+    memset(loop, 0, sizeof(*loop));
+    loop->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (loop->listen_fd < 0) return ERROR;
+    int one = 1;
+    setsockopt(loop->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(loop->listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)); // Ядро распределяет подключения по потокам
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY), .sin_port = htons(port)};
+    if (bind(loop->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(loop->listen_fd, SOMAXCONN) < 0) {
+        perror("bench_origin: listen");
+        return ERROR;
+    }
+    loop->epoll_fd = epoll_create1(0);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (loop->epoll_fd < 0 || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &event) < 0) return ERROR;
+    return SUCCESS;
+}
+
+static int parse_size(const char *str, uint64_t *value) {
+    char *end;
+    errno = 0;
+    unsigned long long parsed = strtoull(str, &end, 10);
+    if (errno != 0 || end == str) return ERROR;
+    if (*end == 'k' || *end == 'K') parsed *= 1024, end++;
+    else if (*end == 'm' || *end == 'M') parsed *= 1024 * 1024, end++;
+    *value = parsed;
+    return *end == '\0' || *end == ':' ? SUCCESS : ERROR;
+}
+
+static void print_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-p port] [-t threads] [-n objects] [-s min[:max]] [-l latency_ms] [-b bytes_per_s] [-m max_age]\n"
+            "  -s  object sizes in bytes (suffixes k, m), log-uniform between min and max\n"
+            "  -b  per-connection bandwidth limit, 0 - unlimited\n", name);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:n:s:l:b:m:h")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 't': thread_count = atoi(optarg); break;
+            case 'n': object_count = strtoull(optarg, NULL, 10); break;
+            case 's': {
+                char *colon = strchr(optarg, ':');
+                if (parse_size(optarg, &size_min) == ERROR || (colon != NULL && parse_size(colon + 1, &size_max) == ERROR)) {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                if (colon == NULL) size_max = size_min;
+                break;
+            }
+            case 'l': latency_us = strtoull(optarg, NULL, 10) * 1000; break;
+            case 'b': if (parse_size(optarg, &bandwidth) == ERROR) { print_usage(argv[0]); return EXIT_FAILURE; } break;
+            case 'm': max_age = atoi(optarg); break;
+            default: print_usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > MAX_THREADS) thread_count = MAX_THREADS;
+    if (object_count == 0) object_count = 1;
+    for (size_t i = 0; i < PATTERN_SIZE; i++) pattern[i] = (char) ('a' + i % 26);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    static loop_t loops[MAX_THREADS];
+    for (int i = 0; i < thread_count; i++) {
+        if (loop_init(&loops[i]) == ERROR) return EXIT_FAILURE;
+    }
+    for (int i = 0; i < thread_count; i++) pthread_create(&loops[i].thread, NULL, loop_routine, &loops[i]);
+    fprintf(stderr, "bench_origin: port %d, %d threads, %lu objects of %lu..%lu bytes, latency %lu ms, bandwidth %lu B/s\n",
+            port, thread_count, (unsigned long) object_count, (unsigned long) size_min, (unsigned long) size_max,
+            (unsigned long) (latency_us / 1000), (unsigned long) bandwidth);
+    for (int i = 0; i < thread_count; i++) pthread_join(loops[i].thread, NULL);
+    printf("{\"requests\":%lu,\"bytes\":%lu}\n", (unsigned long) atomic_load(&served_requests), (unsigned long) atomic_load(&served_bytes));
+    return EXIT_SUCCESS;
+}
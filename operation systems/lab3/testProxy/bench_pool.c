@@ -0,0 +1,207 @@
+// Микробенчмарк пула потоков: пул с кражей задач (thread_pool.c) против прежнего пула
+// с одной кольцевой очередью под мьютексом (воспроизведен ниже как ring_pool).
+//
+// Сценарии:
+//   submit  - несколько сторонних потоков ставят короткие задачи (как поток приема соединений
+//             и обработчики, которые ставят загрузки в пул загрузчиков);
+//   fanout  - задачи пула ставят задачи в тот же пул (работа для краж).
+// Выводит пропускную способность (задач в секунду) для каждого пула.
+//
+// Сборка: cmake -DCACHE_PROXY_BUILD_BENCHMARKS=ON, цель bench_pool
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "thread_pool.h"
+
+#define EXECUTORS       4
+#define PRODUCERS       4
+#define TASKS           1000000
+#define RING_CAPACITY   100     // Прежний TASK_QUEUE_CAPACITY
+#define FANOUT          8
+#define WORK_ITERATIONS 64      // Полезная работа задачи, чтобы очередь не была единственной нагрузкой
+
+// Прежний пул: одна очередь, мьютекс и две условные переменные (с теми же метриками)
+
+typedef struct {
+    routine_t routine;
+    void *arg;
+    uint64_t enqueued_us;
+} ring_task_t;
+
+typedef struct {
+    ring_task_t *tasks;
+    int capacity, size, front, rear;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty_cond, not_full_cond;
+    pthread_t *executors;
+    int num_executors;
+    int shutdown;
+} ring_pool_t;
+
+static void *ring_executor(void *arg) {
+    ring_pool_t *pool = arg;
+    while (1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->size == 0 && !pool->shutdown) pthread_cond_wait(&pool->not_empty_cond, &pool->mutex);
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        ring_task_t task = pool->tasks[pool->front];
+        pool->front = (pool->front + 1) % pool->capacity;
+        pool->size--;
+        pthread_cond_signal(&pool->not_full_cond);
+        pthread_mutex_unlock(&pool->mutex);
+        metrics_record(METRIC_POOL_TASK_WAIT, metrics_now_us() - task.enqueued_us);
+        metrics_add(METRIC_POOL_TASKS, 1);
+        task.routine(task.arg);
+    }
+}
+
+static ring_pool_t *ring_create(int executors, int capacity) {
+    ring_pool_t *pool = calloc(1, sizeof(ring_pool_t));
+    pool->tasks = calloc((size_t) capacity, sizeof(ring_task_t));
+    pool->capacity = capacity;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->not_empty_cond, NULL);
+    pthread_cond_init(&pool->not_full_cond, NULL);
+    pool->executors = calloc((size_t) executors, sizeof(pthread_t));
+    pool->num_executors = executors;
+    for (int i = 0; i < executors; i++) pthread_create(&pool->executors[i], NULL, ring_executor, pool);
+    return pool;
+}
+
+static int ring_execute(void *arg, routine_t routine, void *routine_arg) {
+    ring_pool_t *pool = arg;
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->size == pool->capacity && !pool->shutdown) pthread_cond_wait(&pool->not_full_cond, &pool->mutex);
+    pool->tasks[pool->rear] = (ring_task_t) {routine, routine_arg, metrics_now_us()};
+    pool->rear = (pool->rear + 1) % pool->capacity;
+    pool->size++;
+    pthread_cond_signal(&pool->not_empty_cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+static void ring_shutdown(ring_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->not_empty_cond);
+    pthread_cond_broadcast(&pool->not_full_cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->num_executors; i++) pthread_join(pool->executors[i], NULL);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->not_empty_cond);
+    pthread_cond_destroy(&pool->not_full_cond);
+    free(pool->executors);
+    free(pool->tasks);
+    free(pool);
+}
+
+// Общая часть сценариев
+
+typedef int (*execute_t)(void *pool, routine_t routine, void *arg);
+
+static void *bench_pool;
+static execute_t bench_execute;
+static atomic_long done;
+static atomic_uint sink;
+
+static int steal_execute(void *pool, routine_t routine, void *arg) {
+    return thread_pool_execute(pool, routine, arg);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void work(void) {
+    unsigned x = 1;
+    for (int i = 0; i < WORK_ITERATIONS; i++) x = x * 1103515245 + 12345;
+    atomic_fetch_add_explicit(&sink, x, memory_order_relaxed);
+}
+
+static void leaf_task(void *arg) {
+    (void) arg;
+    work();
+    atomic_fetch_add_explicit(&done, 1, memory_order_release);
+}
+
+static void spawn_task(void *arg) {
+    (void) arg;
+    work();
+    for (int i = 0; i < FANOUT; i++) bench_execute(bench_pool, leaf_task, NULL);
+    atomic_fetch_add_explicit(&done, 1, memory_order_release);
+}
+
+static void *producer(void *arg) {
+    long count = (long) (intptr_t) arg;
+    for (long i = 0; i < count; i++) bench_execute(bench_pool, leaf_task, NULL);
+    return NULL;
+}
+
+static void wait_done(long expected) {
+    while (atomic_load_explicit(&done, memory_order_acquire) < expected) sched_yield();
+}
+
+static double run_submit(void) {
+    atomic_store(&done, 0);
+    pthread_t producers[PRODUCERS];
+    double start = now_sec();
+    for (int i = 0; i < PRODUCERS; i++) pthread_create(&producers[i], NULL, producer, (void *) (intptr_t) (TASKS / PRODUCERS));
+    for (int i = 0; i < PRODUCERS; i++) pthread_join(producers[i], NULL);
+    wait_done(TASKS / PRODUCERS * PRODUCERS);
+    return (double) (TASKS / PRODUCERS * PRODUCERS) / (now_sec() - start);
+}
+
+static double run_fanout(void) {
+    atomic_store(&done, 0);
+    long roots = TASKS / (FANOUT + 1);
+    double start = now_sec();
+    for (long i = 0; i < roots; i++) bench_execute(bench_pool, spawn_task, NULL);
+    wait_done(roots * (FANOUT + 1));
+    return (double) (roots * (FANOUT + 1)) / (now_sec() - start);
+}
+
+int main(void) {
+    printf("%d executors, %d producers, %d tasks, %d work iterations per task\n\n", EXECUTORS, PRODUCERS, TASKS, WORK_ITERATIONS);
+    printf("%-10s %18s %18s\n", "scenario", "ring (tasks/s)", "stealing (tasks/s)");
+
+    ring_pool_t *ring = ring_create(EXECUTORS, RING_CAPACITY);
+    bench_pool = ring;
+    bench_execute = ring_execute;
+    double ring_submit = run_submit();
+    ring_shutdown(ring);
+
+    thread_pool_t *pool = thread_pool_create(EXECUTORS, RING_CAPACITY);
+    bench_pool = pool;
+    bench_execute = steal_execute;
+    double steal_submit = run_submit();
+    thread_pool_shutdown(pool);
+    printf("%-10s %18.0f %18.0f\n", "submit", ring_submit, steal_submit);
+
+    // В прежнем пуле задача, ставящая задачи в свой же заполненный пул, может заблокировать
+    // всех исполнителей, поэтому для него очередь берется с запасом на все задачи
+    ring = ring_create(EXECUTORS, TASKS);
+    bench_pool = ring;
+    bench_execute = ring_execute;
+    double ring_fanout = run_fanout();
+    ring_shutdown(ring);
+
+    pool = thread_pool_create(EXECUTORS, RING_CAPACITY);
+    bench_pool = pool;
+    bench_execute = steal_execute;
+    double steal_fanout = run_fanout();
+    thread_pool_shutdown(pool);
+    printf("%-10s %18.0f %18.0f\n", "fanout", ring_fanout, steal_fanout);
+    return 0;
+}
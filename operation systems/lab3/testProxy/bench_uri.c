@@ -0,0 +1,80 @@
+// Микробенчмарк разбора хоста и порта: прежний путь через regcomp/regexec
+// против http_get_host_port на ручном разборщике URI.
+//
+// Сборка: cmake -DCACHE_PROXY_BUILD_BENCHMARKS=ON, цель bench_uri
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http.h"
+
+#define ITERATIONS 1000000
+#define HOST_SIZE  1024
+
+static const char *inputs[] = {
+    "example.com",
+    "localhost:8081",
+    "http://www.example.com/index.html",
+    "https://static.example.org:8443/img/logo.png?v=3",
+    "http://127.0.0.1:8080/a/b/c?x=1#frag",
+};
+
+// Прежняя реализация: регулярное выражение компилируется на каждый вызов
+static int regex_get_host_port(const char *host_port, char *host, int *port) {
+    regex_t regex;
+    regmatch_t match[6];
+    if (regcomp(&regex, "^(http|https)?(://)?([^:/]+)(:([0-9]+))?", REG_EXTENDED) != 0) return -1;
+    int ret = regexec(&regex, host_port, 6, match, 0);
+    if (ret == 0) {
+        int len = match[3].rm_eo - match[3].rm_so;
+        memcpy(host, host_port + match[3].rm_so, len);
+        host[len] = '\0';
+        if (match[5].rm_so != -1) *port = (int) strtol(host_port + match[5].rm_so, NULL, 10);
+        else *port = (match[1].rm_so != -1 && match[1].rm_eo - match[1].rm_so == 5) ? 443 : 80;
+    }
+    regfree(&regex);
+    return ret == 0 ? 0 : -1;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+    size_t count = sizeof(inputs) / sizeof(inputs[0]);
+    char host[HOST_SIZE];
+    int port, sum = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        char regex_host[HOST_SIZE];
+        int regex_port;
+        regex_get_host_port(inputs[i], regex_host, &regex_port);
+        http_get_host_port(inputs[i], strlen(inputs[i]), host, sizeof(host), &port);
+        printf("%-50s regex: %s:%d, parser: %s:%d\n", inputs[i], regex_host, regex_port, host, port);
+    }
+
+    double start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        const char *input = inputs[n % count];
+        regex_get_host_port(input, host, &port);
+        sum += port;
+    }
+    double regex_ns = (now_ns() - start) / ITERATIONS;
+
+    start = now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        const char *input = inputs[n % count];
+        http_get_host_port(input, strlen(input), host, sizeof(host), &port);
+        sum += port;
+    }
+    double parser_ns = (now_ns() - start) / ITERATIONS;
+
+    printf("regex:  %.1f ns/op\n", regex_ns);
+    printf("parser: %.1f ns/op (x%.1f)\n", parser_ns, regex_ns / parser_ns);
+    return sum == 0;
+}
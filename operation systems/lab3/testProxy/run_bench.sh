@@ -0,0 +1,38 @@
+#!/bin/sh
+# Нагрузочный прогон: bench_origin, прокси и bench_load на локальной машине.
+# Результат bench_load (JSON) выводится в stdout и сохраняется в BENCH_OUTPUT.
+#
+# Использование: run_bench.sh <CACHE_PROXY> <bench_origin> <bench_load>
+# Параметры задаются переменными окружения (ниже значения по умолчанию);
+# переменные CACHE_PROXY_* передаются прокси как есть (например, CACHE_PROXY_IO_MODE).
+#
+# Сборка: cmake -DCACHE_PROXY_BUILD_BENCHMARKS=ON, цель benchmark
+
+set -e
+
+PROXY=$1
+ORIGIN=$2
+LOAD=$3
+if [ -z "$PROXY" ] || [ -z "$ORIGIN" ] || [ -z "$LOAD" ]; then
+    echo "Usage: $0 <CACHE_PROXY> <bench_origin> <bench_load>" >&2
+    exit 1
+fi
+
+PROXY_PORT=${BENCH_PROXY_PORT:-18080}
+ORIGIN_PORT=${BENCH_ORIGIN_PORT:-18081}
+ORIGIN_ARGS=${BENCH_ORIGIN_ARGS:-"-t 2 -n 10000 -s 1k:64k -l 5"}
+LOAD_ARGS=${BENCH_LOAD_ARGS:-"-r 2000 -d 10 -w 2 -c 500 -t 2 -n 10000 -a 0.99"}
+OUTPUT=${BENCH_OUTPUT:-bench_result.json}
+
+"$ORIGIN" -p "$ORIGIN_PORT" $ORIGIN_ARGS &
+ORIGIN_PID=$!
+CACHE_PROXY_LOG_LEVEL=${CACHE_PROXY_LOG_LEVEL:-error} "$PROXY" "$PROXY_PORT" > /dev/null &
+PROXY_PID=$!
+trap 'kill $PROXY_PID $ORIGIN_PID 2> /dev/null; wait $PROXY_PID $ORIGIN_PID 2> /dev/null || true' EXIT
+sleep 1
+
+STATUS=0
+"$LOAD" -x "127.0.0.1:$PROXY_PORT" -o "127.0.0.1:$ORIGIN_PORT" -P "$PROXY_PID" $LOAD_ARGS > "$OUTPUT" || STATUS=$?
+cat "$OUTPUT"
+echo "Result saved to $OUTPUT" >&2
+exit $STATUS
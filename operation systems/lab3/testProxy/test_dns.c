@@ -0,0 +1,244 @@
+// Проверка резолвера (src/dns.c) на локальном сервере имен.
+//
+// Запускает на свободном UDP-порту localhost заглушку сервера имен, которая отвечает
+// по первой метке имени:
+//   cname.test   - CNAME на target.cname.test и A-запись этого имени (ответ из двух записей)
+//   trunc.test   - усеченный ответ (TC): A-запись обрезана на середине данных
+//   partial.test - усеченный ответ (TC): первая A-запись целая, вторая обрезана
+//   drop.test    - ответа нет (резолвер должен повторить запрос и завершить его отказом)
+// и проверяет адреса, количество запросов к серверу и время до результата.
+//
+// Сборка: цель test_dns (ctest запускает ее как dns_resolver)
+//
+// Пример: test_dns
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dns.h"
+#include "log.h"
+
+#define PACKET_SIZE         512
+#define NEGATIVE_TTL_MS     60000
+#define RETRY_MS            500     // Таймаут первой попытки резолвера (DNS_RETRY_MS)
+#define ATTEMPTS            3       // Количество попыток резолвера (DNS_ATTEMPTS)
+#define CNAME_ADDR          "10.0.0.7"
+#define PARTIAL_ADDR        "10.0.0.8"
+
+/**
+ * @brief Имена, на которые отвечает заглушка, и счетчики запросов к ним
+ */
+typedef enum {
+    NAME_CNAME,
+    NAME_TRUNC,
+    NAME_PARTIAL,
+    NAME_DROP,
+    NAME_COUNT
+} stub_name_t;
+
+static const char *stub_names[NAME_COUNT] = {"cname.test", "trunc.test", "partial.test", "drop.test"};
+static atomic_int stub_queries[NAME_COUNT];
+static int stub_fd = ERROR;
+
+/**
+ * @brief Дописывает в ответ ресурсную запись, имя которой - ссылка сжатия
+ * @param packet   Ответ
+ * @param len      Длина ответа (увеличивается)
+ * @param name_ptr Смещение имени записи в ответе
+ * @param type     Тип записи
+ * @param ttl      TTL записи в секундах
+ * @param data     Данные записи
+ * @param data_len Длина данных
+ */
+static void put_record(uint8_t *packet, size_t *len, size_t name_ptr, int type, uint32_t ttl,
+                       const void *data, size_t data_len) {
+    uint8_t *p = packet + *len;
+    p[0] = (uint8_t) (0xC0 | name_ptr >> 8);
+    p[1] = (uint8_t) name_ptr;
+    p[2] = 0;
+    p[3] = (uint8_t) type;
+    p[4] = 0;
+    p[5] = 1; // Класс IN
+    p[6] = (uint8_t) (ttl >> 24);
+    p[7] = (uint8_t) (ttl >> 16);
+    p[8] = (uint8_t) (ttl >> 8);
+    p[9] = (uint8_t) ttl;
+    p[10] = (uint8_t) (data_len >> 8);
+    p[11] = (uint8_t) data_len;
+    memcpy(p + 12, data, data_len);
+    *len += 12 + data_len;
+}
+
+/**
+ * @brief Отвечает на запросы резолвера
+ * @param arg Не используется
+ * @return NULL
+ * @details Ответ начинается с заголовка и вопроса запроса; записи ссылаются на имя
+ *          вопроса (смещение 12), как это делают настоящие серверы.
+ */
+static void *stub_routine(__attribute__((unused)) void *arg) {
+    for (;;) {
+        uint8_t query[PACKET_SIZE], packet[PACKET_SIZE];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t received = recvfrom(stub_fd, query, sizeof(query), 0, (struct sockaddr *) &from, &from_len);
+        if (received < 12) {
+            if (received == ERROR) return NULL;
+            continue;
+        }
+        char name[256];
+        size_t name_len = 0, off = 12;
+        while (off < (size_t) received && query[off] != 0 && name_len + query[off] + 1 < sizeof(name)) {
+            if (name_len > 0) name[name_len++] = '.';
+            memcpy(name + name_len, query + off + 1, query[off]);
+            name_len += query[off];
+            off += query[off] + 1;
+        }
+        name[name_len] = '\0';
+        size_t question_end = off + 5; // Нулевая метка, тип и класс
+        if (question_end > (size_t) received) continue;
+        int which = 0;
+        while (which < NAME_COUNT && strcmp(name, stub_names[which]) != 0) which++;
+        if (which == NAME_COUNT) continue;
+        atomic_fetch_add(&stub_queries[which], 1);
+        if (which == NAME_DROP) continue;
+        memcpy(packet, query, question_end);
+        packet[2] = 0x81; // QR, RD
+        packet[3] = 0x80; // RA, NOERROR
+        packet[6] = 0;
+        packet[7] = 2; // Две записи в разделе ответов
+        size_t len = question_end;
+        struct in_addr addr;
+        if (which == NAME_CNAME) {
+            uint8_t target[] = {6, 't', 'a', 'r', 'g', 'e', 't', 0xC0, 12};
+            size_t target_off = len + 12;
+            put_record(packet, &len, 12, 5, 300, target, sizeof(target));
+            inet_pton(AF_INET, CNAME_ADDR, &addr);
+            put_record(packet, &len, target_off, 1, 60, &addr, sizeof(addr));
+        } else {
+            packet[2] |= 0x02; // TC
+            inet_pton(AF_INET, PARTIAL_ADDR, &addr);
+            if (which == NAME_PARTIAL) put_record(packet, &len, 12, 1, 60, &addr, sizeof(addr));
+            put_record(packet, &len, 12, 1, 60, &addr, sizeof(addr));
+            len -= 2; // Последняя запись обрезана
+        }
+        sendto(stub_fd, packet, len, 0, (struct sockaddr *) &from, from_len);
+    }
+}
+
+/**
+ * @brief Возвращает время монотонных часов в миллисекундах
+ * @return Время в миллисекундах
+ */
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Разрешает имя и сверяет результат
+ * @param resolver Резолвер
+ * @param host     Имя
+ * @param expected Ожидаемый адрес или NULL, если ожидается отказ
+ * @param elapsed  Указатель для сохранения времени разрешения в миллисекундах
+ * @return 0 при совпадении, 1 при расхождении
+ */
+static int check_resolve(dns_resolver_t *resolver, const char *host, const char *expected, long long *elapsed) {
+    struct in_addr addr = {0};
+    long long start = now_ms();
+    int status = dns_resolve_wait(resolver, host, &addr);
+    *elapsed = now_ms() - start;
+    char got[INET_ADDRSTRLEN] = "-";
+    if (status == SUCCESS) inet_ntop(AF_INET, &addr, got, sizeof(got));
+    if (expected == NULL ? status != ERROR : status != SUCCESS || strcmp(got, expected) != 0) {
+        fprintf(stderr, "FAIL: %s resolved to %s, expected %s\n", host, got, expected != NULL ? expected : "failure");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Сверяет количество запросов, полученных заглушкой
+ * @param which    Имя
+ * @param expected Ожидаемое количество
+ * @return 0 при совпадении, 1 при расхождении
+ */
+static int check_queries(stub_name_t which, int expected) {
+    int queries = atomic_load(&stub_queries[which]);
+    if (queries != expected) {
+        fprintf(stderr, "FAIL: name server got %d queries for %s, expected %d\n", queries, stub_names[which], expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    proxy_log_set_level(LOG_LEVEL_ERROR);
+    stub_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof(addr);
+    if (stub_fd == ERROR || bind(stub_fd, (struct sockaddr *) &addr, sizeof(addr)) == ERROR ||
+        getsockname(stub_fd, (struct sockaddr *) &addr, &addr_len) == ERROR) {
+        perror("name server");
+        return EXIT_FAILURE;
+    }
+    pthread_t stub;
+    pthread_create(&stub, NULL, stub_routine, NULL);
+    char server[32];
+    snprintf(server, sizeof(server), "127.0.0.1:%d", ntohs(addr.sin_port));
+    dns_resolver_t *resolver = dns_resolver_create(server, NEGATIVE_TTL_MS);
+    if (resolver == NULL) {
+        fprintf(stderr, "FAIL: resolver was not created\n");
+        return EXIT_FAILURE;
+    }
+    int failed = 0;
+    long long elapsed;
+
+    // CNAME: адрес берется из A-записи цели, повторный запрос обслуживает кэш
+    failed |= check_resolve(resolver, "cname.test", CNAME_ADDR, &elapsed);
+    failed |= check_resolve(resolver, "CNAME.test.", CNAME_ADDR, &elapsed);
+    failed |= check_queries(NAME_CNAME, 1);
+
+    // Усеченный ответ без целой A-записи - отказ сразу, без ожидания повторов
+    failed |= check_resolve(resolver, "trunc.test", NULL, &elapsed);
+    if (elapsed >= RETRY_MS) {
+        fprintf(stderr, "FAIL: truncated response took %lld ms, resolver waited for a retry\n", elapsed);
+        failed = 1;
+    }
+    failed |= check_queries(NAME_TRUNC, 1);
+
+    // Усеченный ответ с целой A-записью - адрес из нее
+    failed |= check_resolve(resolver, "partial.test", PARTIAL_ADDR, &elapsed);
+    failed |= check_queries(NAME_PARTIAL, 1);
+
+    // Нет ответа - ATTEMPTS попыток с удвоением таймаута, затем отказ
+    failed |= check_resolve(resolver, "drop.test", NULL, &elapsed);
+    long long expected_ms = (long long) RETRY_MS * ((1 << ATTEMPTS) - 1);
+    if (elapsed < expected_ms - 100) {
+        fprintf(stderr, "FAIL: unanswered query failed after %lld ms, expected about %lld ms\n", elapsed, expected_ms);
+        failed = 1;
+    }
+    failed |= check_queries(NAME_DROP, ATTEMPTS);
+
+    dns_stats_t stats;
+    dns_get_stats(resolver, &stats);
+    if (stats.hits != 1 || stats.misses != 4 || stats.failures != 2) {
+        fprintf(stderr, "FAIL: resolver stats %zu hits, %zu misses, %zu failures, expected 1, 4, 2\n",
+                stats.hits, stats.misses, stats.failures);
+        failed = 1;
+    }
+    dns_resolver_destroy(resolver);
+    close(stub_fd);
+    printf("%s: DNS resolver against a stub name server\n", failed ? "FAIL" : "PASS");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,261 @@
+// Проверка: клиент HTTP/1.0 не получает тело в кодировке chunked.
+//
+// Запускает локальный сервер-источник, который, как настоящие серверы, отвечает
+// на HTTP/1.1 телом chunked, а на HTTP/1.0 - телом с Content-Length, и прокси
+// (путь к исполняемому файлу - первый аргумент, режим - CACHE_PROXY_IO_MODE).
+// Сначала клиент HTTP/1.1 запрашивает ресурс и ответ chunked попадает в кэш,
+// затем тот же ресурс запрашивает клиент HTTP/1.0: он должен получить ответ без
+// chunked и то же тело, а сервер - увидеть запрос HTTP/1.0.
+//
+// Сборка: цель test_http10_chunked (ctest запускает ее во всех режимах обработки соединений)
+//
+// Пример: CACHE_PROXY_IO_MODE=epoll test_http10_chunked ./CACHE_PROXY
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SUCCESS             0
+#define ERROR               (-1)
+
+#define BUFFER_SIZE         65536
+#define IO_TIMEOUT_S        5
+#define START_ATTEMPTS      50
+#define START_DELAY_US      100000
+#define CHUNK_COUNT         8
+
+static const char body_line[] = "chunked body line\n";
+
+static int origin_fd = ERROR;
+static atomic_int http10_requests = 0;  // Запросы HTTP/1.0, полученные сервером
+static atomic_int http11_requests = 0;  // Запросы HTTP/1.1, полученные сервером
+
+/**
+ * @brief Создает слушающий сокет на свободном порту localhost
+ * @param port Указатель для сохранения порта
+ * @return Дескриптор сокета или ERROR
+ */
+static int listen_any(int *port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == ERROR) return ERROR;
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == ERROR || listen(fd, 16) == ERROR ||
+        getsockname(fd, (struct sockaddr *) &addr, &len) == ERROR) {
+        close(fd);
+        return ERROR;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/**
+ * @brief Устанавливает таймауты приема и отправки сокета
+ * @param fd Сокет
+ */
+static void set_timeouts(int fd) {
+    struct timeval tv = {.tv_sec = IO_TIMEOUT_S};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * @brief Обслуживает соединение с прокси: HTTP/1.1 - ответ chunked, HTTP/1.0 - с Content-Length
+ * @param arg Дескриптор соединения
+ * @return NULL
+ */
+static void *origin_connection(void *arg) {
+    int fd = (int) (intptr_t) arg;
+    char request[BUFFER_SIZE];
+    size_t len = 0;
+    set_timeouts(fd);
+    for (;;) {
+        char *end;
+        while ((end = memmem(request, len, "\r\n\r\n", 4)) == NULL) {
+            if (len == sizeof(request)) goto close_conn;
+            ssize_t received = recv(fd, request + len, sizeof(request) - len, 0);
+            if (received <= 0) goto close_conn;
+            len += received;
+        }
+        char *line_end = memmem(request, len, "\r\n", 2);
+        int http10 = line_end - request >= 8 && memcmp(line_end - 8, "HTTP/1.0", 8) == 0;
+        atomic_fetch_add(http10 ? &http10_requests : &http11_requests, 1);
+        char response[BUFFER_SIZE];
+        int n;
+        if (http10) {
+            n = snprintf(response, sizeof(response), "HTTP/1.0 200 OK\r\nCache-Control: max-age=60\r\n"
+                         "Content-Length: %zu\r\n\r\n", (sizeof(body_line) - 1) * CHUNK_COUNT);
+            for (int i = 0; i < CHUNK_COUNT; i++) n += snprintf(response + n, sizeof(response) - n, "%s", body_line);
+        } else {
+            n = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\n"
+                         "Transfer-Encoding: chunked\r\n\r\n");
+            for (int i = 0; i < CHUNK_COUNT; i++) {
+                n += snprintf(response + n, sizeof(response) - n, "%zx\r\n%s\r\n", sizeof(body_line) - 1, body_line);
+            }
+            n += snprintf(response + n, sizeof(response) - n, "0\r\n\r\n");
+        }
+        if (send(fd, response, n, MSG_NOSIGNAL) != n || http10) break;
+        size_t consumed = end + 4 - request;
+        memmove(request, request + consumed, len - consumed);
+        len -= consumed;
+    }
+    close_conn:
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief Принимает соединения сервера-источника
+ * @param arg Не используется
+ * @return NULL
+ */
+static void *origin_routine(__attribute__((unused)) void *arg) {
+    for (;;) {
+        int fd = accept(origin_fd, NULL, NULL);
+        if (fd == ERROR) return NULL;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, origin_connection, (void *) (intptr_t) fd) != 0) close(fd);
+        else pthread_detach(thread);
+    }
+}
+
+/**
+ * @brief Подключается к прокси
+ * @param port Порт прокси
+ * @return Дескриптор сокета или ERROR
+ */
+static int connect_proxy(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == ERROR) return ERROR;
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == ERROR) {
+        close(fd);
+        return ERROR;
+    }
+    set_timeouts(fd);
+    return fd;
+}
+
+/**
+ * @brief Отправляет запрос через прокси и читает ответ до закрытия соединения
+ * @param proxy_port  Порт прокси
+ * @param origin_port Порт сервера-источника
+ * @param version     Версия HTTP запроса ("1.0" или "1.1")
+ * @param response    Буфер ответа (с завершающим нулем)
+ * @param size        Размер буфера
+ * @return Длина ответа или ERROR
+ */
+static ssize_t fetch(int proxy_port, int origin_port, const char *version, char *response, size_t size) {
+    int fd = connect_proxy(proxy_port);
+    if (fd == ERROR) return ERROR;
+    char request[256];
+    int n = snprintf(request, sizeof(request), "GET http://127.0.0.1:%d/resource HTTP/%s\r\nHost: 127.0.0.1:%d\r\n"
+                     "Connection: close\r\n\r\n", origin_port, version, origin_port);
+    size_t len = 0;
+    if (send(fd, request, n, MSG_NOSIGNAL) != n) goto fail;
+    for (;;) {
+        if (len + 1 == size) goto fail;
+        ssize_t received = recv(fd, response + len, size - len - 1, 0);
+        if (received < 0) goto fail;
+        if (received == 0) break;
+        len += received;
+    }
+    close(fd);
+    response[len] = '\0';
+    return (ssize_t) len;
+    fail:
+    close(fd);
+    return ERROR;
+}
+
+/**
+ * @brief Проверяет, указан ли в заголовках ответа Transfer-Encoding: chunked
+ * @param response Ответ с завершающим нулем
+ * @return 1 если указан, 0 если нет
+ */
+static int is_chunked(const char *response) {
+    const char *end = strstr(response, "\r\n\r\n");
+    for (const char *p = response; p != NULL && p < end; p = strstr(p, "\r\n")) {
+        if (*p == '\r') p += 2;
+        const char *chunked = strstr(p, "chunked");
+        if (strncasecmp(p, "transfer-encoding:", 18) == 0 && chunked != NULL && chunked < strstr(p, "\r\n")) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <CACHE_PROXY>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int origin_port, proxy_port;
+    origin_fd = listen_any(&origin_port);
+    int probe = listen_any(&proxy_port); // Свободный порт для прокси
+    if (origin_fd == ERROR || probe == ERROR) {
+        perror("listen");
+        return EXIT_FAILURE;
+    }
+    close(probe);
+    pthread_t origin;
+    pthread_create(&origin, NULL, origin_routine, NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char port[16];
+        snprintf(port, sizeof(port), "%d", proxy_port);
+        setenv("CACHE_PROXY_LOG_LEVEL", "error", 0);
+        execl(argv[1], argv[1], port, (char *) NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < START_ATTEMPTS; i++) { // Ждет, пока прокси начнет принимать соединения
+        int fd = connect_proxy(proxy_port);
+        if (fd != ERROR) {
+            close(fd);
+            break;
+        }
+        usleep(START_DELAY_US);
+    }
+    static char first[BUFFER_SIZE], second[BUFFER_SIZE];
+    int failed = 0;
+    if (fetch(proxy_port, origin_port, "1.1", first, sizeof(first)) == ERROR) {
+        fprintf(stderr, "FAIL: HTTP/1.1 request through proxy failed\n");
+        failed = 1;
+    } else if (!is_chunked(first)) {
+        fprintf(stderr, "FAIL: HTTP/1.1 client did not get the chunked origin response\n");
+        failed = 1;
+    }
+    if (fetch(proxy_port, origin_port, "1.0", second, sizeof(second)) == ERROR) {
+        fprintf(stderr, "FAIL: HTTP/1.0 request through proxy failed\n");
+        failed = 1;
+    } else {
+        const char *body = strstr(second, "\r\n\r\n");
+        size_t body_len = (sizeof(body_line) - 1) * CHUNK_COUNT;
+        if (is_chunked(second)) {
+            fprintf(stderr, "FAIL: HTTP/1.0 client got a chunked response\n");
+            failed = 1;
+        } else if (body == NULL || strlen(body + 4) != body_len || strncmp(body + 4, body_line, sizeof(body_line) - 1) != 0) {
+            fprintf(stderr, "FAIL: HTTP/1.0 client got an unexpected body\n");
+            failed = 1;
+        }
+    }
+    if (atomic_load(&http10_requests) != 1) {
+        fprintf(stderr, "FAIL: origin got %d HTTP/1.0 requests, expected 1\n", atomic_load(&http10_requests));
+        failed = 1;
+    }
+    kill(pid, SIGINT);
+    waitpid(pid, NULL, 0);
+    close(origin_fd);
+    printf("%s: HTTP/1.0 client after cached chunked response\n", failed ? "FAIL" : "PASS");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
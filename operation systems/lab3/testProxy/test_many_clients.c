@@ -0,0 +1,247 @@
+// Проверка: прокси обслуживает больше FD_SETSIZE (1024) одновременных соединений.
+//
+// Поднимает предел открытых файлов, запускает локальный сервер-источник и прокси
+// (путь к исполняемому файлу - первый аргумент, режим - CACHE_PROXY_IO_MODE), открывает
+// CLIENT_COUNT соединений с прокси и только затем отправляет по каждому запрос GET.
+// Номера сокетов прокси при этом превышают 1023, и ожидание на них через select()
+// выходит за границы fd_set (со сборкой -D_FORTIFY_SOURCE=2 прокси аварийно завершается).
+// Каждое соединение должно получить ответ 200 с телом сервера, а прокси - остаться живым.
+// Если предел открытых файлов поднять нельзя, проверка пропускается (код SKIP_CODE).
+//
+// Сборка: цель test_many_clients (ctest запускает ее во всех режимах обработки соединений)
+//
+// Пример: CACHE_PROXY_IO_MODE=threads test_many_clients ./CACHE_PROXY
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SUCCESS             0
+#define ERROR               (-1)
+#define SKIP_CODE           77
+
+#define CLIENT_COUNT        1200
+#define RESOURCE_COUNT      16
+#define FILES_RESERVE       256     // Дескрипторы сверх соединений: сервер-источник, логи, каналы
+#define BUFFER_SIZE         4096
+#define IO_TIMEOUT_S        30
+#define START_ATTEMPTS      50
+#define START_DELAY_US      100000
+
+static const char body[] = "many clients body\n";
+
+static int origin_fd = ERROR;
+
+/**
+ * @brief Поднимает мягкий предел открытых файлов (его унаследует прокси)
+ * @param need Нужное количество дескрипторов
+ * @return SUCCESS или ERROR, если жесткий предел меньше need
+ */
+static int raise_file_limit(rlim_t need) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == ERROR) return ERROR;
+    if (limit.rlim_cur >= need) return SUCCESS;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < need) return ERROR;
+    limit.rlim_cur = need;
+    return setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+/**
+ * @brief Создает слушающий сокет на свободном порту localhost
+ * @param port Указатель для сохранения порта
+ * @return Дескриптор сокета или ERROR
+ */
+static int listen_any(int *port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == ERROR) return ERROR;
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == ERROR || listen(fd, 128) == ERROR ||
+        getsockname(fd, (struct sockaddr *) &addr, &len) == ERROR) {
+        close(fd);
+        return ERROR;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/**
+ * @brief Устанавливает таймауты приема и отправки сокета
+ * @param fd Сокет
+ */
+static void set_timeouts(int fd) {
+    struct timeval tv = {.tv_sec = IO_TIMEOUT_S};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * @brief Обслуживает соединение с прокси: на каждый запрос - кэшируемый ответ с Content-Length
+ * @param arg Дескриптор соединения
+ * @return NULL
+ */
+static void *origin_connection(void *arg) {
+    int fd = (int) (intptr_t) arg;
+    char request[BUFFER_SIZE];
+    size_t len = 0;
+    set_timeouts(fd);
+    for (;;) {
+        char *end;
+        while ((end = memmem(request, len, "\r\n\r\n", 4)) == NULL) {
+            if (len == sizeof(request)) goto close_conn;
+            ssize_t received = recv(fd, request + len, sizeof(request) - len, 0);
+            if (received <= 0) goto close_conn;
+            len += received;
+        }
+        char response[BUFFER_SIZE];
+        int n = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\n"
+                         "Content-Length: %zu\r\n\r\n%s", sizeof(body) - 1, body);
+        if (send(fd, response, n, MSG_NOSIGNAL) != n) break;
+        size_t consumed = end + 4 - request;
+        memmove(request, request + consumed, len - consumed);
+        len -= consumed;
+    }
+    close_conn:
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief Принимает соединения сервера-источника
+ * @param arg Не используется
+ * @return NULL
+ */
+static void *origin_routine(__attribute__((unused)) void *arg) {
+    for (;;) {
+        int fd = accept(origin_fd, NULL, NULL);
+        if (fd == ERROR) return NULL;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, origin_connection, (void *) (intptr_t) fd) != 0) close(fd);
+        else pthread_detach(thread);
+    }
+}
+
+/**
+ * @brief Подключается к прокси
+ * @param port Порт прокси
+ * @return Дескриптор сокета или ERROR
+ */
+static int connect_proxy(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == ERROR) return ERROR;
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == ERROR) {
+        close(fd);
+        return ERROR;
+    }
+    set_timeouts(fd);
+    return fd;
+}
+
+/**
+ * @brief Читает ответ до закрытия соединения и сверяет его
+ * @param fd Сокет клиента
+ * @return SUCCESS если получен ответ 200 с телом сервера, иначе ERROR
+ */
+static int read_response(int fd) {
+    char response[BUFFER_SIZE];
+    size_t len = 0;
+    for (;;) {
+        if (len + 1 == sizeof(response)) return ERROR;
+        ssize_t received = recv(fd, response + len, sizeof(response) - len - 1, 0);
+        if (received < 0) return ERROR;
+        if (received == 0) break;
+        len += received;
+    }
+    response[len] = '\0';
+    const char *end = strstr(response, "\r\n\r\n");
+    if (strncmp(response, "HTTP/1.1 200", 12) != 0 || end == NULL || strcmp(end + 4, body) != 0) return ERROR;
+    return SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <CACHE_PROXY>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (raise_file_limit(2 * CLIENT_COUNT + FILES_RESERVE) == ERROR) {
+        printf("SKIP: open file limit is below %d\n", 2 * CLIENT_COUNT + FILES_RESERVE);
+        return SKIP_CODE;
+    }
+    int origin_port, proxy_port;
+    origin_fd = listen_any(&origin_port);
+    int probe = listen_any(&proxy_port); // Свободный порт для прокси
+    if (origin_fd == ERROR || probe == ERROR) {
+        perror("listen");
+        return EXIT_FAILURE;
+    }
+    close(probe);
+    pthread_t origin;
+    pthread_create(&origin, NULL, origin_routine, NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char port[16];
+        snprintf(port, sizeof(port), "%d", proxy_port);
+        setenv("CACHE_PROXY_LOG_LEVEL", "error", 0);
+        execl(argv[1], argv[1], port, (char *) NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < START_ATTEMPTS; i++) { // Ждет, пока прокси начнет принимать соединения
+        int fd = connect_proxy(proxy_port);
+        if (fd != ERROR) {
+            close(fd);
+            break;
+        }
+        usleep(START_DELAY_US);
+    }
+    static int clients[CLIENT_COUNT];
+    int failed = 0, connected = 0, answered = 0;
+    for (; connected < CLIENT_COUNT; connected++) { // Сначала все соединения, чтобы прокси держал их одновременно
+        clients[connected] = connect_proxy(proxy_port);
+        if (clients[connected] == ERROR) {
+            fprintf(stderr, "FAIL: connection %d to proxy failed: %s\n", connected, strerror(errno));
+            failed = 1;
+            break;
+        }
+    }
+    for (int i = 0; i < connected; i++) {
+        char request[256];
+        int n = snprintf(request, sizeof(request), "GET http://127.0.0.1:%d/resource%d HTTP/1.1\r\n"
+                         "Host: 127.0.0.1:%d\r\nConnection: close\r\n\r\n", origin_port, i % RESOURCE_COUNT, origin_port);
+        if (send(clients[i], request, n, MSG_NOSIGNAL) != n) {
+            fprintf(stderr, "FAIL: request %d was not sent\n", i);
+            failed = 1;
+        }
+    }
+    for (int i = 0; i < connected; i++) {
+        if (read_response(clients[i]) == SUCCESS) answered++;
+        close(clients[i]);
+    }
+    if (answered != CLIENT_COUNT) {
+        fprintf(stderr, "FAIL: %d of %d clients got the response\n", answered, CLIENT_COUNT);
+        failed = 1;
+    }
+    int status;
+    if (waitpid(pid, &status, WNOHANG) != 0) {
+        fprintf(stderr, "FAIL: proxy exited during the test (status %d)\n", status);
+        failed = 1;
+    } else {
+        kill(pid, SIGINT);
+        waitpid(pid, NULL, 0);
+    }
+    close(origin_fd);
+    printf("%s: %d simultaneous clients\n", failed ? "FAIL" : "PASS", CLIENT_COUNT);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}